@@ -22,6 +22,7 @@
 
 bool_t create_awkast(awkast_t *ast) {
   if( ast ) {
+    ast->lineno = 0;
     return create_awkmem(&ast->rom);
   }
   return FALSE;
@@ -36,25 +37,124 @@ bool_t free_awkast(awkast_t *ast) {
 
 bool_t clear_awkast(awkast_t *ast) {
   if( ast ) {
-    sbrk_awkmem(&ast->rom, 0);
+    reset_awkmem(&ast->rom, 0);
     return TRUE;
   }
   return FALSE;
 }
 
+awkast_node_t *get_awkast(awkast_t *ast, awkmem_ptr_t p) {
+  return (ast && (p != AWKMEM_NULL)) ? 
+    (awkast_node_t *)get_awkmem(&ast->rom, p) : NULL;
+}
+
 awkmem_ptr_t mknode_awkast(awkast_t *ast, awkast_node_type_t id,
 			   awkast_variant_t chi, awkast_variant_t sib) {
-  awkmem_ptr_t p = (awkmem_ptr_t)-1;
+  awkmem_ptr_t p = AWKMEM_NULL;
   awkast_node_t *n;
   if( ast ) {
     p = sbrk_awkmem(&ast->rom, sizeof(awkast_node_t));
-    if( p != (awkmem_ptr_t)-1 ) {
+    if( p != AWKMEM_NULL ) {
       n = (awkast_node_t *)(ast->rom.start + p);
       n->id = id;
       n->chi = chi;
       n->sib = sib;
+      n->lineno = ast->lineno;
     }
   }
   return p;
 }
 
+awkmem_ptr_t leaf_awkast(awkast_t *ast, awkast_node_type_t id, awkmem_ptr_t v) {
+  awkast_variant_t chi, sib;
+  chi.ptr = v;
+  sib.ptr = AWKMEM_NULL;
+  return mknode_awkast(ast, id, chi, sib);
+}
+
+awkmem_ptr_t symleaf_awkast(awkast_t *ast, awkast_node_type_t id, symbol_t s) {
+  awkmem_ptr_t p;
+  p = leaf_awkast(ast, id, AWKMEM_NULL);
+  if( p != AWKMEM_NULL ) {
+    get_awkast(ast, p)->chi.sym = s;
+  }
+  return p;
+}
+
+/* the children of a node are chained through their sib pointers */
+static awkmem_ptr_t chain_awkast(awkast_t *ast, awkast_node_type_t id,
+				 awkmem_ptr_t *kids, int n) {
+  int i;
+  for(i = 0; i < n; i++) {
+    if( kids[i] == AWKMEM_NULL ) {
+      kids[i] = leaf_awkast(ast, aNULL, AWKMEM_NULL);
+    }
+  }
+  for(i = 0; i + 1 < n; i++) {
+    get_awkast(ast, kids[i])->sib.ptr = kids[i + 1];
+  }
+  return leaf_awkast(ast, id, (n > 0) ? kids[0] : AWKMEM_NULL);
+}
+
+awkmem_ptr_t op1_awkast(awkast_t *ast, awkast_node_type_t id, awkmem_ptr_t a) {
+  awkmem_ptr_t k[1];
+  k[0] = a;
+  return chain_awkast(ast, id, k, 1);
+}
+
+awkmem_ptr_t op2_awkast(awkast_t *ast, awkast_node_type_t id, 
+			awkmem_ptr_t a, awkmem_ptr_t b) {
+  awkmem_ptr_t k[2];
+  k[0] = a; k[1] = b;
+  return chain_awkast(ast, id, k, 2);
+}
+
+awkmem_ptr_t op3_awkast(awkast_t *ast, awkast_node_type_t id, 
+			awkmem_ptr_t a, awkmem_ptr_t b, awkmem_ptr_t c) {
+  awkmem_ptr_t k[3];
+  k[0] = a; k[1] = b; k[2] = c;
+  return chain_awkast(ast, id, k, 3);
+}
+
+awkmem_ptr_t op4_awkast(awkast_t *ast, awkast_node_type_t id, 
+			awkmem_ptr_t a, awkmem_ptr_t b, 
+			awkmem_ptr_t c, awkmem_ptr_t d) {
+  awkmem_ptr_t k[4];
+  k[0] = a; k[1] = b; k[2] = c; k[3] = d;
+  return chain_awkast(ast, id, k, 4);
+}
+
+/* appends p (and its siblings) at the end of list, returns the list */
+awkmem_ptr_t append_awkast(awkast_t *ast, awkmem_ptr_t list, awkmem_ptr_t p) {
+  awkast_node_t *n;
+  if( list == AWKMEM_NULL ) {
+    return p;
+  }
+  n = get_awkast(ast, list);
+  while( n && (n->sib.ptr != AWKMEM_NULL) ) {
+    n = get_awkast(ast, n->sib.ptr);
+  }
+  if( n ) {
+    n->sib.ptr = p;
+  }
+  return list;
+}
+
+/* the n-th child of p, counting from 0 */
+awkmem_ptr_t child_awkast(awkast_t *ast, awkmem_ptr_t p, int n) {
+  awkast_node_t *x = get_awkast(ast, p);
+  p = x ? x->chi.ptr : AWKMEM_NULL;
+  while( (n-- > 0) && (p != AWKMEM_NULL) ) {
+    p = get_awkast(ast, p)->sib.ptr;
+  }
+  return p;
+}
+
+int count_awkast(awkast_t *ast, awkmem_ptr_t list) {
+  int n = 0;
+  while( list != AWKMEM_NULL ) {
+    n++;
+    list = get_awkast(ast, list)->sib.ptr;
+  }
+  return n;
+}
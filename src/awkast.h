@@ -25,23 +25,49 @@
 #include "awkmem.h"
 #include "symbols.h"
 
+/* The parser builds a tree of awkast_node_t. Each node has a first 
+ * child and a next sibling. Leaves use chi for their value instead:
+ * a constant for aNUMBER, aSTRING, aERE, aXPATH, a symbol for aNAME,
+ * aFUNC, and a builtin code for aBUILTIN. Empty slots in statements
+ * (eg a missing for loop condition) are aNULL leaves.
+ */
 typedef enum {
-  aNULL = 0, aDUMMY
+  aNULL = 0, aDUMMY,
+  /* leaves */
+  aNUMBER, aSTRING, aERE, aXPATH, aNAME, aFUNC, aBUILTIN, aGETLINE,
+  /* expressions */
+  aINDEX, aFIELD, aGROUP,
+  aASSIGN, aADD_ASSIGN, aSUB_ASSIGN, aMUL_ASSIGN, aDIV_ASSIGN, 
+  aMOD_ASSIGN, aPOW_ASSIGN,
+  aPREINC, aPREDEC, aPOSTINC, aPOSTDEC,
+  aADD, aSUB, aMUL, aDIV, aMOD, aPOW, aCAT,
+  aLT, aLE, aNE, aEQ, aGT, aGE, aMATCH, aNOMATCH,
+  aAND, aOR, aNOT, aNEG, aPLUS, aCOND, aIN,
+  aCALL, aBCALL,
+  /* statements */
+  aBLOCK, aPRINT, aPRINTF, aIF, aWHILE, aDO, aFOR, aFORIN,
+  aBREAK, aCONTINUE, aNEXT, aEXIT, aRETURN, aDELETE,
+  aOUT, aAPPEND, aPIPE,
+  /* program items */
+  aBEGIN, aEND, aRANGE, aITEM, aFUNCTION
 } awkast_node_type_t;
 
 typedef union {
   awkmem_ptr_t ptr;
   symbol_t sym;
+  int num;
 } awkast_variant_t;
 
 typedef struct awkast {
   awkast_node_type_t id;
   awkast_variant_t chi; /* child ptr */
   awkast_variant_t sib; /* sibling ptr */
+  int lineno;
 } awkast_node_t;
 
 typedef struct {
   awkmem_t rom;
+  int lineno; /* stamped on new nodes */
 } awkast_t;
 
 bool_t create_awkast(awkast_t *ast);
@@ -49,6 +75,21 @@ bool_t free_awkast(awkast_t *ast);
 bool_t clear_awkast(awkast_t *ast);
 awkmem_ptr_t mknode_awkast(awkast_t *ast, awkast_node_type_t id,
 			   awkast_variant_t chi, awkast_variant_t sib);
+awkast_node_t *get_awkast(awkast_t *ast, awkmem_ptr_t p);
+
+awkmem_ptr_t leaf_awkast(awkast_t *ast, awkast_node_type_t id, awkmem_ptr_t v);
+awkmem_ptr_t symleaf_awkast(awkast_t *ast, awkast_node_type_t id, symbol_t s);
+awkmem_ptr_t op1_awkast(awkast_t *ast, awkast_node_type_t id, awkmem_ptr_t a);
+awkmem_ptr_t op2_awkast(awkast_t *ast, awkast_node_type_t id, 
+			awkmem_ptr_t a, awkmem_ptr_t b);
+awkmem_ptr_t op3_awkast(awkast_t *ast, awkast_node_type_t id, 
+			awkmem_ptr_t a, awkmem_ptr_t b, awkmem_ptr_t c);
+awkmem_ptr_t op4_awkast(awkast_t *ast, awkast_node_type_t id, 
+			awkmem_ptr_t a, awkmem_ptr_t b, 
+			awkmem_ptr_t c, awkmem_ptr_t d);
+awkmem_ptr_t append_awkast(awkast_t *ast, awkmem_ptr_t list, awkmem_ptr_t p);
 
+awkmem_ptr_t child_awkast(awkast_t *ast, awkmem_ptr_t p, int n);
+int count_awkast(awkast_t *ast, awkmem_ptr_t list);
 
 #endif
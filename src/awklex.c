@@ -0,0 +1,452 @@
+/* 
+ * Copyright (C) 2010 Laird Breyer
+ *  
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA.
+ * 
+ * Author:   Laird Breyer <laird@lbreyer.com>
+ */
+
+#include "awkvm.h"
+#include "mem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/* The xml-awk lexer is written by hand because awk tokens depend on 
+ * the parser context: a '/' is a division after an operand and a
+ * regular expression elsewhere, a '>' or '|' at the outer level of a
+ * print statement is an output redirection, and a name followed
+ * immediately by '(' is a function call. 
+ *
+ * To keep the grammar small, newlines which cannot end a statement 
+ * (after '{', '}', ',', ';', &&, ||, do, else, and repeated newlines)
+ * are dropped here, and a ';' is inserted before each '}' which does
+ * not follow a statement terminator.
+ */
+
+extern long inputline;
+
+static struct {
+  awkvm_t *vm;
+  const char *begin;
+  const char *p;
+  const char *end;
+  char *owned; /* a script read from a file */
+  int last; /* previous token, 0 at the start */
+  int pending; /* token to return next */
+  int parens; /* nesting depth of () and [] */
+  int printparens; /* depth of the current print, or -1 */
+  cstring_t tmp;
+} lx;
+
+typedef struct {
+  const char *name;
+  int token;
+  int code;
+} keyword_t;
+
+static const keyword_t keywords[] = {
+  { "BEGIN", Begin, 0 },
+  { "END", End, 0 },
+  { "break", Break, 0 },
+  { "continue", Continue, 0 },
+  { "delete", Delete, 0 },
+  { "do", Do, 0 },
+  { "else", Else, 0 },
+  { "exit", Exit, 0 },
+  { "for", For, 0 },
+  { "func", Function, 0 },
+  { "function", Function, 0 },
+  { "getline", GETLINE, 0 },
+  { "if", If, 0 },
+  { "in", In, 0 },
+  { "next", Next, 0 },
+  { "print", Print, 0 },
+  { "printf", Printf, 0 },
+  { "return", Return, 0 },
+  { "while", While, 0 },
+  { "atan2", BUILTIN_FUNC_NAME, bATAN2 },
+  { "close", BUILTIN_FUNC_NAME, bCLOSE },
+  { "cos", BUILTIN_FUNC_NAME, bCOS },
+  { "exp", BUILTIN_FUNC_NAME, bEXP },
+  { "fflush", BUILTIN_FUNC_NAME, bFFLUSH },
+  { "gsub", BUILTIN_FUNC_NAME, bGSUB },
+  { "index", BUILTIN_FUNC_NAME, bINDEX },
+  { "int", BUILTIN_FUNC_NAME, bINT },
+  { "length", BUILTIN_FUNC_NAME, bLENGTH },
+  { "log", BUILTIN_FUNC_NAME, bLOG },
+  { "match", BUILTIN_FUNC_NAME, bMATCH },
+  { "rand", BUILTIN_FUNC_NAME, bRAND },
+  { "sin", BUILTIN_FUNC_NAME, bSIN },
+  { "split", BUILTIN_FUNC_NAME, bSPLIT },
+  { "sprintf", BUILTIN_FUNC_NAME, bSPRINTF },
+  { "sqrt", BUILTIN_FUNC_NAME, bSQRT },
+  { "srand", BUILTIN_FUNC_NAME, bSRAND },
+  { "sub", BUILTIN_FUNC_NAME, bSUB },
+  { "substr", BUILTIN_FUNC_NAME, bSUBSTR },
+  { "system", BUILTIN_FUNC_NAME, bSYSTEM },
+  { "tolower", BUILTIN_FUNC_NAME, bTOLOWER },
+  { "toupper", BUILTIN_FUNC_NAME, bTOUPPER },
+  { NULL, 0, 0 }
+};
+
+void reset_lexer_awk(awkvm_t *vm) {
+  free_lexer_awk();
+  lx.vm = vm;
+  lx.begin = lx.p = lx.end = NULL;
+  lx.last = 0;
+  lx.pending = 0;
+  lx.parens = 0;
+  lx.printparens = -1;
+  inputline = 1;
+}
+
+void scan_lexer_awk(const char *buf, int len) {
+  lx.begin = lx.p = buf;
+  lx.end = buf + len;
+}
+
+bool_t file_lexer_awk(const char *file) {
+  FILE *f;
+  size_t n, max = 0;
+  f = fopen(file, "r");
+  if( f ) {
+    n = 0;
+    do {
+      if( !grow_mem(&lx.owned, &max, sizeof(char), 4096) ) {
+	errormsg(E_FATAL, "out of memory.\n");
+      }
+      n += fread(lx.owned + n, 1, max - n, f);
+    } while( n == max );
+    fclose(f);
+    scan_lexer_awk(lx.owned, n);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+void free_lexer_awk() {
+  if( lx.owned ) {
+    free(lx.owned);
+    lx.owned = NULL;
+  }
+  if( CSTRINGP(lx.tmp) ) {
+    free_cstring(&lx.tmp);
+  }
+}
+
+/* tokens after which a '/' is a division */
+static bool_t operand_token(int t) {
+  return (t == NAME) || (t == NUMBER) || (t == STRING) || (t == ERE) ||
+    (t == XPATH) || (t == BUILTIN_FUNC_NAME) || (t == INCR) || 
+    (t == DECR) || (t == ')') || (t == ']') || (t == '$');
+}
+
+/* tokens after which a newline is not a statement terminator */
+static bool_t continued_token(int t) {
+  return (t == 0) || (t == NEWLINE) || (t == ';') || (t == '{') || 
+    (t == '}') || (t == ',') || (t == AND) || (t == OR) || 
+    (t == Do) || (t == Else);
+}
+
+static awkmem_ptr_t constant_lexer(const char *begin, const char *end) {
+  awkmem_ptr_t p;
+  p = append_awkconstmgr(&lx.vm->constants, begin, end);
+  if( p == AWKMEM_NULL ) {
+    errormsg(E_FATAL, "out of memory.\n");
+  }
+  return p;
+}
+
+/* converts the escapes in a "string", the quotes are already gone */
+static awkmem_ptr_t string_lexer(const char *begin, const char *end) {
+  char_t *q;
+  int c, n;
+  if( !CSTRINGP(lx.tmp) ) {
+    create_cstring(&lx.tmp, "", 64);
+  }
+  ensure_size_charbuf(&lx.tmp.cb, end - begin + 1);
+  q = lx.tmp.cb.buf;
+  while( begin < end ) {
+    if( (*begin == '\\') && (begin + 1 < end) ) {
+      begin++;
+      switch(*begin) {
+      case 'n': *q++ = '\n'; break;
+      case 't': *q++ = '\t'; break;
+      case 'r': *q++ = '\r'; break;
+      case 'a': *q++ = '\a'; break;
+      case 'b': *q++ = '\b'; break;
+      case 'f': *q++ = '\f'; break;
+      case 'v': *q++ = '\v'; break;
+      case '0': case '1': case '2': case '3': 
+      case '4': case '5': case '6': case '7':
+	for(c = 0, n = 0; (n < 3) && (begin < end) && 
+	      (*begin >= '0') && (*begin <= '7'); n++, begin++) {
+	  c = 8 * c + (*begin - '0');
+	}
+	*q++ = (char_t)c;
+	continue;
+      case '"': case '\\': case '/':
+	*q++ = *begin;
+	break;
+      default:
+	*q++ = '\\';
+	*q++ = *begin;
+	break;
+      }
+      begin++;
+    } else {
+      *q++ = *begin++;
+    }
+  }
+  return constant_lexer(lx.tmp.cb.buf, q);
+}
+
+/* the regular expression is kept as is, except for \/, \" and the
+   control character escapes, which regcomp() does not know about */
+static awkmem_ptr_t ere_lexer(const char *begin, const char *end) {
+  char_t *q;
+  if( !CSTRINGP(lx.tmp) ) {
+    create_cstring(&lx.tmp, "", 64);
+  }
+  ensure_size_charbuf(&lx.tmp.cb, end - begin + 1);
+  q = lx.tmp.cb.buf;
+  while( begin < end ) {
+    if( (begin[0] == '\\') && (begin + 1 < end) ) {
+      switch(begin[1]) {
+      case '/': case '"': *q++ = begin[1]; begin += 2; continue;
+      case 'n': *q++ = '\n'; begin += 2; continue;
+      case 't': *q++ = '\t'; begin += 2; continue;
+      case 'r': *q++ = '\r'; begin += 2; continue;
+      case 'a': *q++ = '\a'; begin += 2; continue;
+      case 'b': *q++ = '\b'; begin += 2; continue;
+      case 'f': *q++ = '\f'; begin += 2; continue;
+      case 'v': *q++ = '\v'; begin += 2; continue;
+      default:
+	*q++ = *begin++;
+	break;
+      }
+    }
+    *q++ = *begin++;
+  }
+  return constant_lexer(lx.tmp.cb.buf, q);
+}
+
+static int scan_token_lexer() {
+  const char *s;
+  const keyword_t *k;
+  int c;
+
+ again:
+  while( (lx.p < lx.end) && ((*lx.p == ' ') || (*lx.p == '\t') || 
+			     (*lx.p == '\r')) ) {
+    lx.p++;
+  }
+  if( (lx.p < lx.end) && (*lx.p == '#') ) {
+    while( (lx.p < lx.end) && (*lx.p != '\n') ) {
+      lx.p++;
+    }
+  }
+  if( (lx.p + 1 < lx.end) && (lx.p[0] == '\\') && (lx.p[1] == '\n') ) {
+    lx.p += 2;
+    inputline++;
+    goto again;
+  }
+  if( lx.p >= lx.end ) {
+    return 0;
+  }
+
+  s = lx.p;
+  c = *lx.p++;
+
+  if( c == '\n' ) {
+    inputline++;
+    return NEWLINE;
+  }
+
+  if( isalpha(c) || (c == '_') ) {
+    while( (lx.p < lx.end) && (isalnum(*lx.p) || (*lx.p == '_')) ) {
+      lx.p++;
+    }
+    for(k = keywords; k->name; k++) {
+      if( (strlen(k->name) == (size_t)(lx.p - s)) && 
+	  (strncmp(k->name, s, lx.p - s) == 0) ) {
+	if( k->token == GETLINE ) {
+	  errormsg(E_FATAL, 
+		   "getline is not supported (line %ld)\n", 
+		   inputline);
+	}
+	yylval.num = k->code;
+	return k->token;
+      }
+    }
+    yylval.sym = getid_awkvm(lx.vm, s, lx.p);
+    putsym_awkvm(lx.vm, yylval.sym);
+    return ((lx.p < lx.end) && (*lx.p == '(')) ? FUNC_NAME : NAME;
+  }
+
+  if( isdigit(c) || ((c == '.') && (lx.p < lx.end) && isdigit(*lx.p)) ) {
+    while( (lx.p < lx.end) && (isdigit(*lx.p) || (*lx.p == '.')) ) {
+      lx.p++;
+    }
+    if( (lx.p < lx.end) && ((*lx.p == 'e') || (*lx.p == 'E')) ) {
+      if( (lx.p + 1 < lx.end) && isdigit(lx.p[1]) ) {
+	lx.p++;
+      } else if( (lx.p + 2 < lx.end) && 
+		 ((lx.p[1] == '+') || (lx.p[1] == '-')) && 
+		 isdigit(lx.p[2]) ) {
+	lx.p += 2;
+      }
+      while( (lx.p < lx.end) && isdigit(*lx.p) ) {
+	lx.p++;
+      }
+    }
+    yylval.ptr = constant_lexer(s, lx.p);
+    return NUMBER;
+  }
+
+  switch(c) {
+  case '"':
+    while( (lx.p < lx.end) && (*lx.p != '"') && (*lx.p != '\n') ) {
+      lx.p += ((*lx.p == '\\') && (lx.p + 1 < lx.end)) ? 2 : 1;
+    }
+    if( (lx.p >= lx.end) || (*lx.p != '"') ) {
+      errormsg(E_FATAL, "unterminated string at line %ld\n",
+	       inputline);
+    }
+    yylval.ptr = string_lexer(s + 1, lx.p);
+    lx.p++;
+    return STRING;
+  case '/':
+    if( operand_token(lx.last) ) {
+      if( (lx.p < lx.end) && (*lx.p == '=') ) {
+	lx.p++;
+	return DIV_ASSIGN;
+      }
+      return '/';
+    }
+    while( (lx.p < lx.end) && (*lx.p != '/') && (*lx.p != '\n') ) {
+      lx.p += ((*lx.p == '\\') && (lx.p + 1 < lx.end)) ? 2 : 1;
+    }
+    if( (lx.p >= lx.end) || (*lx.p != '/') ) {
+      errormsg(E_FATAL, "unterminated regular expression at line %ld\n",
+	       inputline);
+    }
+    yylval.ptr = ere_lexer(s + 1, lx.p);
+    lx.p++;
+    return ERE;
+  case ':':
+    if( (lx.p < lx.end) && (*lx.p == '/') ) {
+      while( (lx.p < lx.end) && 
+	     (isalnum(*lx.p) || strchr("_/*@.-[]", *lx.p)) ) {
+	lx.p++;
+      }
+      yylval.ptr = constant_lexer(s + 1, lx.p);
+      return XPATH;
+    }
+    return ':';
+  case '(': case '[':
+    lx.parens++;
+    return c;
+  case ')': case ']':
+    lx.parens--;
+    return c;
+  case '>':
+    if( (lx.p < lx.end) && (*lx.p == '=') ) {
+      lx.p++;
+      return GE;
+    }
+    if( (lx.p < lx.end) && (*lx.p == '>') ) {
+      lx.p++;
+      return APPEND;
+    }
+    return (lx.printparens == lx.parens) ? OUT_REDIR : '>';
+  case '|':
+    if( (lx.p < lx.end) && (*lx.p == '|') ) {
+      lx.p++;
+      return OR;
+    }
+    return (lx.printparens == lx.parens) ? PIPE_OUT : '|';
+  }
+
+  if( lx.p < lx.end ) {
+    switch( (c << 8) | *lx.p ) {
+    case ('+' << 8) | '=': lx.p++; return ADD_ASSIGN;
+    case ('-' << 8) | '=': lx.p++; return SUB_ASSIGN;
+    case ('*' << 8) | '=': lx.p++; return MUL_ASSIGN;
+    case ('%' << 8) | '=': lx.p++; return MOD_ASSIGN;
+    case ('^' << 8) | '=': lx.p++; return POW_ASSIGN;
+    case ('*' << 8) | '*': 
+      lx.p++; 
+      if( (lx.p < lx.end) && (*lx.p == '=') ) {
+	lx.p++;
+	return POW_ASSIGN;
+      }
+      return '^';
+    case ('&' << 8) | '&': lx.p++; return AND;
+    case ('!' << 8) | '~': lx.p++; return NO_MATCH;
+    case ('=' << 8) | '=': lx.p++; return EQ;
+    case ('<' << 8) | '=': lx.p++; return LE;
+    case ('!' << 8) | '=': lx.p++; return NE;
+    case ('+' << 8) | '+': lx.p++; return INCR;
+    case ('-' << 8) | '-': lx.p++; return DECR;
+    }
+  }
+
+  if( strchr("{};,+-*%^!<~?=$", c) ) {
+    return c;
+  }
+  errormsg(E_FATAL, "unexpected character '%c' at line %ld\n",
+	   c, inputline);
+  return 0;
+}
+
+int yylex(void) {
+  int t;
+
+  if( lx.pending ) {
+    t = lx.pending;
+    lx.pending = 0;
+  } else {
+    do {
+      t = scan_token_lexer();
+    } while( (t == NEWLINE) && continued_token(lx.last) );
+
+    if( (t == '}') && !continued_token(lx.last) ) {
+      lx.pending = t;
+      t = ';';
+    } else if( (t == 0) && !continued_token(lx.last) ) {
+      t = NEWLINE; /* the last statement needs a terminator */
+    }
+  }
+
+  switch(t) {
+  case Print:
+  case Printf:
+    lx.printparens = lx.parens;
+    break;
+  case NEWLINE:
+  case ';':
+  case '{':
+  case '}':
+    lx.printparens = -1;
+    break;
+  }
+  lx.vm->ast.lineno = inputline;
+  lx.last = t;
+  return t;
+}
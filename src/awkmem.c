@@ -20,9 +20,14 @@
 
 #include "awkmem.h"
 #include "mem.h"
-#include "math.h"
+#include "myerror.h"
 
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <stddef.h>
 
 bool_t create_awkmem(awkmem_t *am) {
   if( am ) {
@@ -52,23 +57,28 @@ awkmem_ptr_t sbrk_awkmem(awkmem_t *am, size_t numbytes) {
   if( am ) {
     if( numbytes == 0 ) {
       return am->brk;
-    } else if( ensure_bytes_mem(numbytes + am->brk, 
-				&am->start, &am->size, sizeof(byte_t)) ) {
+    } 
+    numbytes = (numbytes + AWKMEM_ALIGN - 1) & ~(AWKMEM_ALIGN - 1);
+    if( ensure_bytes_mem(numbytes + am->brk, 
+			 &am->start, &am->size, sizeof(byte_t)) ) {
       am->brk += numbytes * sizeof(byte_t);
       return (am->brk - numbytes * sizeof(byte_t));
     }
   }
-  return (awkmem_ptr_t)(-1);
+  return AWKMEM_NULL;
 }
 
 void *get_awkmem(awkmem_t *am, awkmem_ptr_t p) {
-  return (am && (p >= 0) && (p <= am->brk)) ? (am + p) : NULL;
+  return (am && (p < am->brk)) ? (am->start + p) : NULL;
 }
 
 /***/
 
 bool_t create_awkconstmgr(awkconstmgr_t *ac) {
   if( ac ) {
+    ac->ntab = 0;
+    ac->maxtab = 0;
+    ac->tab = NULL;
     return create_awkmem(&ac->rom);
   }
   return FALSE;
@@ -76,32 +86,88 @@ bool_t create_awkconstmgr(awkconstmgr_t *ac) {
 
 bool_t free_awkconstmgr(awkconstmgr_t *ac) {
   if( ac ) {
+    if( ac->tab ) {
+      free(ac->tab);
+      ac->tab = NULL;
+    }
     return free_awkmem(&ac->rom);
   }
   return FALSE;
 }
 
+awkconst_t *get_awkconstmgr(awkconstmgr_t *ac, awkmem_ptr_t p) {
+  return ac ? (awkconst_t *)get_awkmem(&ac->rom, p) : NULL;
+}
+
 awkstring_t get_string_awkconstmgr(awkconstmgr_t *ac, awkmem_ptr_t p) {
-  awkconst_t *c = (awkconst_t *)get_awkmem(&ac->rom, p);
-  return c ? &c->strval : NULL;
+  awkconst_t *c = get_awkconstmgr(ac, p);
+  return c ? c->strval : NULL;
 }
 
 awknum_t get_number_awkconstmgr(awkconstmgr_t *ac, awkmem_ptr_t p) {
-  awkconst_t *c = (awkconst_t *)get_awkmem(&ac->rom, p);
+  awkconst_t *c = get_awkconstmgr(ac, p);
   return c ? c->numval : NAN;
 }
 
-/* insert both a string and its floating point value into as->rom */
+static bool_t rehash_awkconstmgr(awkconstmgr_t *ac) {
+  awkmem_ptr_t *tab;
+  awkconst_t *c;
+  size_t i, j, max;
+  max = (ac->maxtab > 0) ? 2 * ac->maxtab : 64;
+  tab = (awkmem_ptr_t *)malloc(max * sizeof(awkmem_ptr_t));
+  if( !tab ) {
+    return FALSE;
+  }
+  for(i = 0; i < max; i++) {
+    tab[i] = AWKMEM_NULL;
+  }
+  for(i = 0; i < ac->maxtab; i++) {
+    if( ac->tab[i] != AWKMEM_NULL ) {
+      c = get_awkconstmgr(ac, ac->tab[i]);
+      j = hash((unsigned char *)c->strval, c->len, 0) & (max - 1);
+      while( tab[j] != AWKMEM_NULL ) {
+	j = (j + 1) & (max - 1);
+      }
+      tab[j] = ac->tab[i];
+    }
+  }
+  if( ac->tab ) {
+    free(ac->tab);
+  }
+  ac->tab = tab;
+  ac->maxtab = max;
+  return TRUE;
+}
+
+/* insert both a string and its floating point value into ac->rom,
+   unless the string is already there */
 awkmem_ptr_t append_awkconstmgr(awkconstmgr_t *ac, const char_t *begin, const char_t *end) {
-  awkmem_ptr_t p = (awkmem_ptr_t)(-1);
+  awkmem_ptr_t p = AWKMEM_NULL;
   awkconst_t *c;
+  size_t len, j;
   if( ac && begin && (end >= begin) ) {
-    p = sbrk_awkmem(&ac->rom, end - begin + sizeof(awkconst_t));
-    if( p != (awkmem_ptr_t)(-1) ) {
-      c = (awkconst_t *)(ac->rom.start + p);
-      memcpy(&c->strval, begin, end - begin);
-      ac->rom.start[p + end - begin + sizeof(awkconst_t)] = '\0';
-      c->numval = atof(&c->strval);
+    len = end - begin;
+    if( (2 * (ac->ntab + 1) > ac->maxtab) && !rehash_awkconstmgr(ac) ) {
+      return AWKMEM_NULL;
+    }
+    j = hash((unsigned char *)begin, len, 0) & (ac->maxtab - 1);
+    while( ac->tab[j] != AWKMEM_NULL ) {
+      c = get_awkconstmgr(ac, ac->tab[j]);
+      if( (c->len == len) && (memcmp(c->strval, begin, len) == 0) ) {
+	return ac->tab[j];
+      }
+      j = (j + 1) & (ac->maxtab - 1);
+    }
+
+    p = sbrk_awkmem(&ac->rom, offsetof(awkconst_t, strval) + len + 1);
+    if( p != AWKMEM_NULL ) {
+      c = get_awkconstmgr(ac, p);
+      memcpy(c->strval, begin, len);
+      c->strval[len] = '\0';
+      c->len = len;
+      c->numval = strtonum_awk(c->strval);
+      ac->tab[j] = p;
+      ac->ntab++;
     }
   }
   return p;
@@ -109,17 +175,462 @@ awkmem_ptr_t append_awkconstmgr(awkconstmgr_t *ac, const char_t *begin, const ch
 
 /***/
 
+/* awk converts integral values exactly, others with CONVFMT or OFMT */
+size_t numtostr_awk(char_t *buf, size_t size, awknum_t x, const char *fmt) {
+  int n;
+  if( (x == floor(x)) && (fabs(x) < 1e16) ) {
+    n = snprintf((char *)buf, size, "%lld", (long long)x);
+  } else if( isnan(x) ) {
+    n = snprintf((char *)buf, size, "%snan", signbit(x) ? "-" : "+");
+  } else if( isinf(x) ) {
+    n = snprintf((char *)buf, size, "%sinf", (x < 0) ? "-" : "+");
+  } else {
+    n = snprintf((char *)buf, size, fmt, x);
+  }
+  return (n < 0) ? 0 : (size_t)n;
+}
+
+/* the value of the longest numeric prefix, like atof() but without
+   hexadecimal numbers, infinities and the like */
+awknum_t strtonum_awk(const char_t *s) {
+  const char_t *p = s;
+  while( isspace(*p) ) { 
+    p++; 
+  }
+  if( (*p == '+') || (*p == '-') ) { 
+    p++; 
+  }
+  if( isdigit(*p) || ((*p == '.') && isdigit(p[1])) ) {
+    if( (p[0] == '0') && ((p[1] == 'x') || (p[1] == 'X')) ) {
+      return 0.0;
+    }
+    return strtod((const char *)s, NULL);
+  }
+  return 0.0;
+}
+
+/* true if the whole string (up to surrounding spaces) is a number */
+bool_t looks_numeric_awk(const char_t *s) {
+  const char_t *p = s;
+  char *q;
+  while( isspace(*p) ) { 
+    p++; 
+  }
+  if( (*p == '+') || (*p == '-') ) { 
+    p++; 
+  }
+  if( !(isdigit(*p) || ((*p == '.') && isdigit(p[1]))) ||
+      ((p[0] == '0') && ((p[1] == 'x') || (p[1] == 'X'))) ) {
+    return FALSE;
+  }
+  strtod((const char *)s, &q);
+  while( isspace(*q) ) { 
+    q++; 
+  }
+  return (*q == '\0');
+}
+
+/***/
+
 bool_t create_awkvar(awkvar_t *v) {
   if( v ) {
     memset(v, 0, sizeof(awkvar_t));
+    v->string = "";
+    return TRUE;
   }
   return FALSE;
 }
 
+static void release_obj_awkvar(awkvar_t *v) {
+  if( v->obj ) {
+    if( !checkflag(v->type,AWKVAR_REF) ) {
+      if( checkflag(v->type,AWKVAR_ARRAY) ) {
+	free_awkarray((awkarray_t *)v->obj);
+      } else if( checkflag(v->type,AWKVAR_ITER) ) {
+	free_awkiter((awkiter_t *)v->obj);
+      }
+      free(v->obj);
+    }
+    v->obj = NULL;
+  }
+}
+
 bool_t free_awkvar(awkvar_t *v) {
   if( v ) {
+    release_obj_awkvar(v);
+    if( v->buf ) {
+      free_mem(&v->buf, &v->maxbuf);
+    }
     memset(v, 0, sizeof(awkvar_t));
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* keeps the buffer for later */
+bool_t clear_awkvar(awkvar_t *v) {
+  if( v ) {
+    release_obj_awkvar(v);
+    v->type = AWKVAR_UNDEF;
+    v->number = 0.0;
+    v->string = "";
+    v->len = 0;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* room for a string of len chars in buf. The string is left alone */
+char_t *reserve_awkvar(awkvar_t *v, size_t len) {
+  size_t off;
+  bool_t inbuf;
+  inbuf = v->buf && (v->string >= v->buf) && (v->string < v->buf + v->maxbuf);
+  off = inbuf ? (v->string - v->buf) : 0;
+  while( len + 1 > v->maxbuf ) {
+    if( !grow_mem(&v->buf, &v->maxbuf, sizeof(char_t), 16) ) {
+      errormsg(E_FATAL, "out of memory.\n");
+    }
+  }
+  if( inbuf ) {
+    v->string = v->buf + off;
+  }
+  return v->buf;
+}
+
+bool_t setnum_awkvar(awkvar_t *v, awknum_t x) {
+  if( v ) {
+    release_obj_awkvar(v);
+    v->type = AWKVAR_NUMBER;
+    v->number = x;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* s may point inside v->buf */
+bool_t setstr_awkvar(awkvar_t *v, const char_t *s, size_t len) {
+  size_t off;
+  if( v && s ) {
+    release_obj_awkvar(v);
+    if( v->buf && (s >= v->buf) && (s < v->buf + v->maxbuf) ) {
+      off = s - v->buf;
+      reserve_awkvar(v, len);
+      memmove(v->buf, v->buf + off, len);
+    } else {
+      reserve_awkvar(v, len);
+      memcpy(v->buf, s, len);
+    }
+    v->buf[len] = '\0';
+    v->string = v->buf;
+    v->len = len;
+    v->type = AWKVAR_STRING;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* s must stay valid and unchanged for as long as v uses it */
+bool_t setkeep_awkvar(awkvar_t *v, const char_t *s, size_t len) {
+  if( v && s ) {
+    release_obj_awkvar(v);
+    v->string = s;
+    v->len = len;
+    v->type = AWKVAR_STRING|AWKVAR_KEEP;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* input data: s must stay valid until the next record */
+bool_t setfield_awkvar(awkvar_t *v, const char_t *s, size_t len) {
+  if( v && s ) {
+    release_obj_awkvar(v);
+    v->string = s;
+    v->len = len;
+    v->type = AWKVAR_STRING;
+    if( looks_numeric_awk(s) ) {
+      setflag(&v->type,AWKVAR_STRNUM);
+    }
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t copy_awkvar(awkvar_t *dst, const awkvar_t *src) {
+  flag_t t;
+  if( dst && src && (dst != src) ) {
+    release_obj_awkvar(dst);
+    t = src->type & (AWKVAR_VALUE|AWKVAR_STRNUM|AWKVAR_NUMOK|AWKVAR_KEEP);
+    if( checkflag(src->type,AWKVAR_STRING) ) {
+      if( checkflag(src->type,AWKVAR_KEEP) ) {
+	dst->string = src->string;
+	dst->len = src->len;
+      } else {
+	setstr_awkvar(dst, src->string, src->len);
+      }
+    } else if( checkflag(src->type,AWKVAR_NUMBER) ) {
+      /* the cached string is not copied */
+      t &= ~AWKVAR_KEEP;
+    }
+    dst->number = src->number;
+    dst->type = t;
+    return TRUE;
   }
   return FALSE;
 }
 
+awknum_t num_awkvar(awkvar_t *v) {
+  if( checkflag(v->type,AWKVAR_NUMBER|AWKVAR_NUMOK) ) {
+    return v->number;
+  } else if( checkflag(v->type,AWKVAR_STRING) ) {
+    v->number = strtonum_awk(v->string);
+    setflag(&v->type,AWKVAR_NUMOK);
+    return v->number;
+  }
+  return 0.0;
+}
+
+const char_t *str_awkvar(awkvar_t *v, const char *convfmt) {
+  char_t tmp[64];
+  size_t n;
+  if( checkflag(v->type,AWKVAR_STRING|AWKVAR_STROK) ) {
+    return v->string;
+  } else if( checkflag(v->type,AWKVAR_NUMBER) ) {
+    n = numtostr_awk(tmp, sizeof(tmp), v->number, convfmt);
+    if( n >= sizeof(tmp) ) {
+      n = sizeof(tmp) - 1;
+    }
+    reserve_awkvar(v, n);
+    memcpy(v->buf, tmp, n + 1);
+    v->string = v->buf;
+    v->len = n;
+    setflag(&v->type,AWKVAR_STROK);
+    return v->string;
+  }
+  v->string = "";
+  v->len = 0;
+  return v->string;
+}
+
+bool_t true_awkvar(awkvar_t *v) {
+  if( checkflag(v->type,AWKVAR_NUMBER) ) {
+    return (v->number != 0.0);
+  } else if( checkflag(v->type,AWKVAR_STRNUM) ) {
+    return (num_awkvar(v) != 0.0);
+  } else if( checkflag(v->type,AWKVAR_STRING) ) {
+    return (v->len > 0);
+  }
+  return FALSE;
+}
+
+/* numbers compare as numbers, unless one of them is a real string */
+int compare_awkvar(awkvar_t *a, awkvar_t *b, const char *convfmt) {
+  awknum_t x, y;
+  size_t n;
+  int c;
+  if( (!checkflag(a->type,AWKVAR_STRING) || 
+       checkflag(a->type,AWKVAR_STRNUM)) &&
+      (!checkflag(b->type,AWKVAR_STRING) || 
+       checkflag(b->type,AWKVAR_STRNUM)) ) {
+    x = num_awkvar(a);
+    y = num_awkvar(b);
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+  }
+  str_awkvar(a, convfmt);
+  str_awkvar(b, convfmt);
+  n = (a->len < b->len) ? a->len : b->len;
+  c = memcmp(a->string, b->string, n);
+  if( c == 0 ) {
+    return (a->len < b->len) ? -1 : ((a->len > b->len) ? 1 : 0);
+  }
+  return c;
+}
+
+/***/
+
+bool_t create_awkarray(awkarray_t *a) {
+  if( a ) {
+    memset(a, 0, sizeof(awkarray_t));
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t clear_awkarray(awkarray_t *a) {
+  size_t i;
+  if( a ) {
+    for(i = 0; i < a->maxcells; i++) {
+      if( a->cells[i].key ) {
+	free(a->cells[i].key);
+	free_awkvar(&a->cells[i].val);
+      }
+    }
+    if( a->cells ) {
+      memset(a->cells, 0, a->maxcells * sizeof(awkcell_t));
+    }
+    a->ncells = 0;
+    a->nused = 0;
+    a->last = 0;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t free_awkarray(awkarray_t *a) {
+  if( a ) {
+    clear_awkarray(a);
+    if( a->cells ) {
+      free(a->cells);
+    }
+    memset(a, 0, sizeof(awkarray_t));
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* deleted cells are dropped, so the table may also shrink */
+static bool_t rehash_awkarray(awkarray_t *a) {
+  awkcell_t *cells;
+  size_t i, j, max;
+  max = 16;
+  while( max < 4 * (a->ncells + 1) ) {
+    max *= 2;
+  }
+  cells = (awkcell_t *)calloc(max, sizeof(awkcell_t));
+  if( !cells ) {
+    errormsg(E_FATAL, "out of memory.\n");
+  }
+  for(i = 0; i < a->maxcells; i++) {
+    if( a->cells[i].live ) {
+      j = a->cells[i].h & (max - 1);
+      while( cells[j].key ) {
+	j = (j + 1) & (max - 1);
+      }
+      cells[j] = a->cells[i];
+    } else if( a->cells[i].key ) {
+      free(a->cells[i].key);
+      free_awkvar(&a->cells[i].val);
+    }
+  }
+  if( a->cells ) {
+    free(a->cells);
+  }
+  a->cells = cells;
+  a->maxcells = max;
+  a->nused = a->ncells;
+  a->last = 0;
+  return TRUE;
+}
+
+awkvar_t *find_awkarray(awkarray_t *a, const char_t *key, size_t klen, bool_t create) {
+  unsigned long int h;
+  awkcell_t *c;
+  size_t j;
+
+  if( !a || !key ) {
+    return NULL;
+  }
+  /* a[k] += x looks up the same key twice in a row */
+  if( a->maxcells > 0 ) {
+    c = &a->cells[a->last];
+    if( c->live && (c->klen == klen) && (memcmp(c->key, key, klen) == 0) ) {
+      return &c->val;
+    }
+  }
+
+  h = hash((unsigned char *)key, klen, 0);
+  if( a->maxcells > 0 ) {
+    j = h & (a->maxcells - 1);
+    while( a->cells[j].key ) {
+      c = &a->cells[j];
+      if( c->live && (c->h == h) && (c->klen == klen) && 
+	  (memcmp(c->key, key, klen) == 0) ) {
+	a->last = j;
+	return &c->val;
+      }
+      j = (j + 1) & (a->maxcells - 1);
+    }
+  }
+  if( !create ) {
+    return NULL;
+  }
+
+  if( 2 * (a->nused + 1) > a->maxcells ) {
+    rehash_awkarray(a);
+  }
+  j = h & (a->maxcells - 1);
+  while( a->cells[j].key ) {
+    j = (j + 1) & (a->maxcells - 1);
+  }
+  c = &a->cells[j];
+  c->key = dup_string(key, key + klen);
+  if( !c->key ) {
+    errormsg(E_FATAL, "out of memory.\n");
+  }
+  c->klen = klen;
+  c->h = h;
+  c->live = TRUE;
+  create_awkvar(&c->val);
+  a->ncells++;
+  a->nused++;
+  a->last = j;
+  return &c->val;
+}
+
+/* the cell stays as a tombstone until the next rehash */
+bool_t delete_awkarray(awkarray_t *a, const char_t *key, size_t klen) {
+  awkcell_t *c;
+  if( find_awkarray(a, key, klen, FALSE) ) {
+    c = &a->cells[a->last];
+    c->live = FALSE;
+    free_awkvar(&c->val);
+    a->ncells--;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/***/
+
+bool_t create_awkiter(awkiter_t *it, const awkarray_t *a) {
+  size_t i;
+  if( it && a ) {
+    memset(it, 0, sizeof(awkiter_t));
+    for(i = 0; i < a->maxcells; i++) {
+      if( a->cells[i].live ) {
+	while( it->len + a->cells[i].klen + 1 > it->maxlen ) {
+	  if( !grow_mem(&it->keys, &it->maxlen, sizeof(char_t), 256) ) {
+	    errormsg(E_FATAL, "out of memory.\n");
+	  }
+	}
+	memcpy(it->keys + it->len, a->cells[i].key, a->cells[i].klen + 1);
+	it->len += a->cells[i].klen + 1;
+      }
+    }
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t free_awkiter(awkiter_t *it) {
+  if( it ) {
+    if( it->keys ) {
+      free_mem(&it->keys, &it->maxlen);
+    }
+    memset(it, 0, sizeof(awkiter_t));
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* keys containing a null char are cut short */
+const char_t *next_awkiter(awkiter_t *it, size_t *klen) {
+  const char_t *k;
+  if( it && (it->pos < it->len) ) {
+    k = it->keys + it->pos;
+    *klen = strlen(k);
+    it->pos += *klen + 1;
+    return k;
+  }
+  return NULL;
+}
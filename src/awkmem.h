@@ -27,6 +27,10 @@
 
 /* can't use real pointers if the memory is resizable */
 typedef size_t awkmem_ptr_t;
+#define AWKMEM_NULL ((awkmem_ptr_t)(-1))
+
+/* every sbrk_awkmem() block starts at a multiple of this */
+#define AWKMEM_ALIGN sizeof(double)
 
 typedef struct {
   byte_t *start;
@@ -44,39 +48,113 @@ typedef double awknum_t;
 typedef const char_t *awkstring_t;
 typedef struct {
   awknum_t numval;
-  char_t strval; /* must be last */
+  size_t len;
+  char_t strval[1]; /* must be last, really len + 1 chars */
 } awkconst_t;
 
-/* storage for constants */
+/* storage for constants. Each distinct string is stored only once,
+   and the strings never move once the program is compiled. */
 typedef struct {
   awkmem_t rom;
+  awkmem_ptr_t *tab; /* open addressing */
+  size_t ntab, maxtab;
 } awkconstmgr_t;
 
 bool_t create_awkconstmgr(awkconstmgr_t *ac);
 bool_t free_awkconstmgr(awkconstmgr_t *ac);
 awkmem_ptr_t append_awkconstmgr(awkconstmgr_t *ac, const char_t *begin, const char_t *end);
 
-awkstring_t get_string_awkconstrmgr(awkconstmgr_t *ac, awkmem_ptr_t p);
-awknum_t get_number_awkstrings(awkconstmgr_t *ac, awkmem_ptr_t p);
+awkconst_t *get_awkconstmgr(awkconstmgr_t *ac, awkmem_ptr_t p);
+awkstring_t get_string_awkconstmgr(awkconstmgr_t *ac, awkmem_ptr_t p);
+awknum_t get_number_awkconstmgr(awkconstmgr_t *ac, awkmem_ptr_t p);
 
-typedef enum { symUNDEF = 0, symVARIABLE, symFUNCTION } symtype_t;
+typedef enum { symUNDEF = 0, symVARIABLE, symARRAY, symFUNCTION } symtype_t;
 typedef struct {
   symtype_t type;
+  int index; /* function number */
 } symrec_t;
 
-#define AWKVAR_UNDEF    0
-#define AWKVAR_STRING   1
-#define AWKVAR_NUMBER   2
+/* An awkvar_t holds an unboxed number, or a string, or both when one
+ * was converted to the other. Strings are always null terminated, and
+ * either live in buf, or in storage which outlives the variable
+ * (AWKVAR_KEEP, eg a constant), or in storage which is only valid 
+ * for the current record (eg a field). Copying a variable copies the
+ * string unless it is kept.
+ */
+#define AWKVAR_UNDEF    0x00
+#define AWKVAR_STRING   0x01 /* the value is a string */
+#define AWKVAR_NUMBER   0x02 /* the value is a number */
+#define AWKVAR_STRNUM   0x04 /* input string which looks like a number */
+#define AWKVAR_NUMOK    0x08 /* number caches the string's value */
+#define AWKVAR_STROK    0x10 /* string caches the number's value */
+#define AWKVAR_KEEP     0x20 /* string needs no copying */
+#define AWKVAR_ARRAY    0x40 /* obj is an awkarray_t */
+#define AWKVAR_REF      0x80 /* obj belongs to another variable */
+#define AWKVAR_ITER     0x100 /* obj is an awkiter_t */
+
+#define AWKVAR_VALUE    (AWKVAR_STRING|AWKVAR_NUMBER)
 
 typedef struct {
-  int type;
-  union {
-    awknum_t number;
-    awkstring_t string;
-  } t;
+  flag_t type;
+  awknum_t number;
+  const char_t *string;
+  size_t len;
+  char_t *buf;
+  size_t maxbuf;
+  void *obj;
 } awkvar_t;
 
 bool_t create_awkvar(awkvar_t *v);
 bool_t free_awkvar(awkvar_t *v);
+bool_t clear_awkvar(awkvar_t *v);
+bool_t setnum_awkvar(awkvar_t *v, awknum_t x);
+bool_t setstr_awkvar(awkvar_t *v, const char_t *s, size_t len);
+bool_t setkeep_awkvar(awkvar_t *v, const char_t *s, size_t len);
+bool_t setfield_awkvar(awkvar_t *v, const char_t *s, size_t len);
+bool_t copy_awkvar(awkvar_t *dst, const awkvar_t *src);
+char_t *reserve_awkvar(awkvar_t *v, size_t len);
+
+awknum_t num_awkvar(awkvar_t *v);
+const char_t *str_awkvar(awkvar_t *v, const char *convfmt);
+bool_t true_awkvar(awkvar_t *v);
+int compare_awkvar(awkvar_t *a, awkvar_t *b, const char *convfmt);
+
+size_t numtostr_awk(char_t *buf, size_t size, awknum_t x, const char *fmt);
+awknum_t strtonum_awk(const char_t *s);
+bool_t looks_numeric_awk(const char_t *s);
+
+/* associative arrays, open addressing */
+typedef struct {
+  char_t *key; /* null terminated, NULL if never used */
+  size_t klen;
+  unsigned long int h;
+  bool_t live;
+  awkvar_t val;
+} awkcell_t;
+
+typedef struct {
+  awkcell_t *cells;
+  size_t ncells; /* live cells */
+  size_t nused; /* live and deleted cells */
+  size_t maxcells; /* a power of two */
+  size_t last; /* most recently found cell */
+} awkarray_t;
+
+bool_t create_awkarray(awkarray_t *a);
+bool_t free_awkarray(awkarray_t *a);
+bool_t clear_awkarray(awkarray_t *a);
+awkvar_t *find_awkarray(awkarray_t *a, const char_t *key, size_t klen, bool_t create);
+bool_t delete_awkarray(awkarray_t *a, const char_t *key, size_t klen);
+
+/* for (k in a) iterates over a copy of the keys */
+typedef struct {
+  char_t *keys; /* null separated */
+  size_t len, maxlen;
+  size_t pos;
+} awkiter_t;
+
+bool_t create_awkiter(awkiter_t *it, const awkarray_t *a);
+bool_t free_awkiter(awkiter_t *it);
+const char_t *next_awkiter(awkiter_t *it, size_t *klen);
 
 #endif
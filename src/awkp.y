@@ -26,6 +26,11 @@
  * in IEEE Std 1003.1 (2004). HOWEVER, xml-awk IS NOT A CONFORMING 
  * IMPLEMENTATION, AND SIGNIFICANT DEPARTURES FROM THE STANDARD ARE
  * EXPECTED EVENTUALLY (WHERE THIS MAKES SENSE FOR XML INPUTS).
+ *
+ * The lexer (awklex.c) drops the optional newlines and inserts the
+ * terminators in front of '}', so the rules below only see newlines 
+ * where they end a statement. The actions build an awkast_t tree,
+ * which is compiled by awkvm.c.
  */
 
 static awkvm_t *avm = NULL; /* local copy of the VM which receives the code */
@@ -35,26 +40,32 @@ static awkvm_t *avm = NULL; /* local copy of the VM which receives the code */
 extern char *inputfile;
 extern long inputline;
 
-extern FILE *yyin;
-extern char *yytext;
 extern int yylex(void);
 
-/* defined in awk-lexer.l */
+/* defined here */
+int yyerror(const char *s);
 
-  /* defined here */
-  int yyerror(char *s);
-
-  %}
+#define AST (&avm->ast)
+#define NIL AWKMEM_NULL
+#define OP1(id,a) op1_awkast(AST, id, a)
+#define OP2(id,a,b) op2_awkast(AST, id, a, b)
+#define OP3(id,a,b,c) op3_awkast(AST, id, a, b, c)
+#define OP4(id,a,b,c,d) op4_awkast(AST, id, a, b, c, d)
+#define LEAF(id,v) leaf_awkast(AST, id, v)
+#define SYM(id,s) symleaf_awkast(AST, id, s)
+#define LIST(l,p) append_awkast(AST, l, p)
 
+%}
 
 %union {
-  int  num;
-  char *str;
+  int num;
+  awkmem_ptr_t ptr;
+  symbol_t sym;
 }
 
-%token NAME NUMBER STRING ERE XPATH
-%token FUNC_NAME   /* Name followed by '(' without white space. */
-
+%token <sym> NAME
+%token <sym> FUNC_NAME   /* Name followed by '(' without white space. */
+%token <ptr> NUMBER STRING ERE XPATH
 
 /* Keywords  */
 %token       Begin   End
@@ -70,367 +81,345 @@ extern int yylex(void);
 /*          'next' 'print' 'printf' 'return' 'while' */
 
 /* Reserved function names */
-%token BUILTIN_FUNC_NAME
+%token <num> BUILTIN_FUNC_NAME
               /* One token for the following:
                * atan2 cos sin exp log sqrt int rand srand
                * gsub index length match split sprintf sub
-               * substr tolower toupper close system
+               * substr tolower toupper close system fflush
                */
 %token GETLINE
-              /* Syntactically different from other built-ins. */
+              /* Not supported, the lexer rejects it. */
 
 /* Two-character tokens. */
 %token ADD_ASSIGN SUB_ASSIGN MUL_ASSIGN DIV_ASSIGN MOD_ASSIGN POW_ASSIGN
 /*     '+='       '-='       '*='       '/='       '%='       '^=' */
 
 %token OR   AND  NO_MATCH   EQ   LE   GE   NE   INCR  DECR  APPEND
-/*     '||' '&&' '! ' '==' '<=' '>=' '!=' '++'  '--'  '>>'   */
+/*     '||' '&&' '!~'       '==' '<=' '>=' '!=' '++'  '--'  '>>'   */
+
+/* Output redirections, '>' and '|' at the outer level of a print */
+%token OUT_REDIR PIPE_OUT
 
-/* One-character tokens. */
-%token '{' '}' '(' ')' '[' ']' ',' ';' NEWLINE
-%token '+' '-' '*' '%' '^' '!' '>' '<' '|' '?' ':' ' ' '$' '='
+%token NEWLINE
+
+%type <ptr> item_list item action stmts stmt simple_stmt
+%type <ptr> expr opt_expr term lvalue fieldarg call
+%type <ptr> expr_list opt_expr_list multiple_expr_list
+%type <ptr> prlist opt_prlist opt_redir opt_param_list param_list
+%type <sym> funcname
 
 %start program
 
-%right ASSIGN 
+%nonassoc LOWER_THAN_ELSE
+%nonassoc Else
+%right '=' ADD_ASSIGN SUB_ASSIGN MUL_ASSIGN DIV_ASSIGN MOD_ASSIGN POW_ASSIGN
 %right '?' ':'
 %left OR
 %left AND
-%left GETLINE
-%left STRING NUMBER
+%nonassoc In
+%nonassoc '~' NO_MATCH
+%nonassoc '<' LE NE EQ '>' GE
+%left CAT
 %left '+' '-'
 %left '*' '/' '%'
+%right '!' UMINUS
 %right '^'
-%left INCR DECR
-%left '$'
-%left '(' ')'
+%nonassoc INCR DECR
 
-%%
+/* All the conflicts are between ending an expression and starting a
+ * term which is concatenated to it, eg "a < b c". Shifting is right
+ * since concatenation binds tighter than everything on the expr level.
+ */
+%expect 170
 
+%%
 
   program          : item_list
-                   | actionless_item_list
+                       { avm->program = $1; }
                    ;
 
 
-  item_list        : newline_opt
-                   | actionless_item_list item terminator
-                   | item_list            item terminator
-                   | item_list          action terminator
+  item_list        : /* empty */
+                       { $$ = NIL; }
+                   | item_list item
+                       { $$ = LIST($1, $2); }
                    ;
 
 
-  actionless_item_list : item_list            pattern terminator
-                   | actionless_item_list pattern terminator
+  item             : sep
+                       { $$ = NIL; }
+                   | action
+                       { $$ = OP2(aITEM, NIL, $1); }
+                   | expr action
+                       { $$ = OP2(aITEM, $1, $2); }
+                   | expr sep
+                       { $$ = OP2(aITEM, $1, NIL); }
+                   | expr ',' expr action
+                       { $$ = OP2(aITEM, OP2(aRANGE, $1, $3), $4); }
+                   | expr ',' expr sep
+                       { $$ = OP2(aITEM, OP2(aRANGE, $1, $3), NIL); }
+                   | Begin action
+                       { $$ = OP1(aBEGIN, $2); }
+                   | End action
+                       { $$ = OP1(aEND, $2); }
+                   | Function funcname '(' opt_param_list rparen action
+                       { $$ = OP3(aFUNCTION, SYM(aFUNC, $2), $6, $4); }
                    ;
 
 
-  item             : pattern action
-                   | Function NAME      '(' param_list_opt ')'
-                         newline_opt action
-                   | Function FUNC_NAME '(' param_list_opt ')'
-                         newline_opt action
+  funcname         : NAME
+                   | FUNC_NAME
                    ;
 
 
-  param_list_opt   : /* empty */
+  opt_param_list   : /* empty */
+                       { $$ = NIL; }
                    | param_list
                    ;
 
 
   param_list       : NAME
+                       { $$ = SYM(aNAME, $1); }
                    | param_list ',' NAME
+                       { $$ = LIST($1, SYM(aNAME, $3)); }
                    ;
 
 
-  pattern          : Begin
-                   | End
-                   | expr
-                   | expr ',' newline_opt expr
+  sep              : NEWLINE
+                   | ';'
                    ;
 
 
-  action           : '{' newline_opt                             '}'
-                   | '{' newline_opt terminated_statement_list   '}'
-                   | '{' newline_opt unterminated_statement_list '}'
+  rparen           : ')'
+                   | rparen NEWLINE
                    ;
 
 
-  terminator       : terminator ';'
-                   | terminator NEWLINE
-                   |            ';'
-                   |            NEWLINE
+  action           : '{' stmts '}'
+                       { $$ = OP1(aBLOCK, $2); }
                    ;
 
 
-  terminated_statement_list : terminated_statement
-                   | terminated_statement_list terminated_statement
+  stmts            : /* empty */
+                       { $$ = NIL; }
+                   | stmts stmt
+                       { $$ = LIST($1, $2); }
                    ;
 
 
-  unterminated_statement_list : unterminated_statement
-                   | terminated_statement_list unterminated_statement
+  stmt             : simple_stmt sep
+                       { $$ = $1; }
+                   | ';'
+                       { $$ = NIL; }
+                   | action
+                   | If '(' expr rparen stmt %prec LOWER_THAN_ELSE
+                       { $$ = OP3(aIF, $3, $5, NIL); }
+                   | If '(' expr rparen stmt Else stmt
+                       { $$ = OP3(aIF, $3, $5, $7); }
+                   | While '(' expr rparen stmt
+                       { $$ = OP2(aWHILE, $3, $5); }
+                   | Do stmt While '(' expr ')' sep
+                       { $$ = OP2(aDO, $2, $5); }
+                   | For '(' opt_expr ';' opt_expr ';' opt_expr rparen stmt
+                       { $$ = OP4(aFOR, $3, $5, $7, $9); }
+                   | For '(' NAME In NAME rparen stmt
+                       { $$ = OP3(aFORIN, SYM(aNAME, $3), SYM(aNAME, $5), $7); }
+                   | Break sep
+                       { $$ = LEAF(aBREAK, NIL); }
+                   | Continue sep
+                       { $$ = LEAF(aCONTINUE, NIL); }
+                   | Next sep
+                       { $$ = LEAF(aNEXT, NIL); }
+                   | Exit opt_expr sep
+                       { $$ = OP1(aEXIT, $2); }
+                   | Return opt_expr sep
+                       { $$ = OP1(aRETURN, $2); }
+                   | Delete NAME '[' expr_list ']' sep
+                       { $$ = OP2(aDELETE, SYM(aNAME, $2), $4); }
+                   | Delete NAME sep
+                       { $$ = OP2(aDELETE, SYM(aNAME, $2), NIL); }
                    ;
 
 
-  terminated_statement : action newline_opt
-                   | If '(' expr ')' newline_opt terminated_statement
-                   | If '(' expr ')' newline_opt terminated_statement
-                         Else newline_opt terminated_statement
-                   | While '(' expr ')' newline_opt terminated_statement
-                   | For '(' simple_statement_opt ';'
-                        expr_opt ';' simple_statement_opt ')' newline_opt
-                        terminated_statement
-                   | For '(' NAME In NAME ')' newline_opt
-                        terminated_statement
-                   | ';' newline_opt
-                   | terminatable_statement NEWLINE newline_opt
-                   | terminatable_statement ';'     newline_opt
+  simple_stmt      : expr
+                   | Print opt_prlist opt_redir
+                       { $$ = OP2(aPRINT, $3, $2); }
+                   | Printf prlist opt_redir
+                       { $$ = OP2(aPRINTF, $3, $2); }
                    ;
 
 
-  unterminated_statement : terminatable_statement
-                   | If '(' expr ')' newline_opt unterminated_statement
-                   | If '(' expr ')' newline_opt terminated_statement
-                        Else newline_opt unterminated_statement
-                   | While '(' expr ')' newline_opt unterminated_statement
-                   | For '(' simple_statement_opt ';'
-                    expr_opt ';' simple_statement_opt ')' newline_opt
-                        unterminated_statement
-                   | For '(' NAME In NAME ')' newline_opt
-                        unterminated_statement
+  opt_prlist       : /* empty */
+                       { $$ = NIL; }
+                   | prlist
                    ;
 
 
-  terminatable_statement : simple_statement
-                   | Break
-                   | Continue
-                   | Next
-                   | Exit expr_opt
-                   | Return expr_opt
-                   | Do newline_opt terminated_statement While '(' expr ')'
+  prlist           : expr_list
+                   | '(' multiple_expr_list ')'
+                       { $$ = $2; }
                    ;
 
 
-  simple_statement_opt : /* empty */
-                   | simple_statement
+  opt_redir        : /* empty */
+                       { $$ = NIL; }
+                   | OUT_REDIR term
+                       { $$ = OP1(aOUT, $2); }
+                   | APPEND term
+                       { $$ = OP1(aAPPEND, $2); }
+                   | PIPE_OUT term
+                       { $$ = OP1(aPIPE, $2); }
                    ;
 
 
-  simple_statement : Delete NAME '[' expr_list ']'
+  opt_expr         : /* empty */
+                       { $$ = NIL; }
                    | expr
-                   | print_statement
-                   ;
-
-
-  print_statement  : simple_print_statement
-                   | simple_print_statement output_redirection
                    ;
 
 
-  simple_print_statement : Print  print_expr_list_opt
-                   | Print  '(' multiple_expr_list ')'
-                   | Printf print_expr_list
-                   | Printf '(' multiple_expr_list ')'
-                   ;
-
-
-  output_redirection : '>'    expr
-                   | APPEND expr
-                   | '|'    expr
-                   ;
-
-
-  expr_list_opt    : /* empty */
+  opt_expr_list    : /* empty */
+                       { $$ = NIL; }
                    | expr_list
                    ;
 
 
   expr_list        : expr
-                   | multiple_expr_list
+                   | expr_list ',' expr
+                       { $$ = LIST($1, $3); }
                    ;
 
 
-  multiple_expr_list : expr ',' newline_opt expr
-                   | multiple_expr_list ',' newline_opt expr
+  multiple_expr_list : expr ',' expr
+                       { $$ = LIST($1, $3); }
+                   | multiple_expr_list ',' expr
+                       { $$ = LIST($1, $3); }
                    ;
 
 
-  expr_opt         : /* empty */
-                   | expr
-                   ;
-
-
-  expr             : unary_expr
-                   | non_unary_expr
-                   ;
-
-
-  unary_expr       : '+' expr
-                   | '-' expr
-                   | unary_expr '^'      expr
-                   | unary_expr '*'      expr
-                   | unary_expr '/'      expr
-                   | unary_expr '%'      expr
-                   | unary_expr '+'      expr
-                   | unary_expr '-'      expr
-                   | unary_expr          non_unary_expr
-                   | unary_expr '<'      expr
-                   | unary_expr LE       expr
-                   | unary_expr NE       expr
-                   | unary_expr EQ       expr
-                   | unary_expr '>'      expr
-                   | unary_expr GE       expr
-                   | unary_expr ' '      expr
-                   | unary_expr NO_MATCH expr
-                   | unary_expr In NAME
-                   | unary_expr AND newline_opt expr
-                   | unary_expr OR  newline_opt expr
-                   | unary_expr '?' expr ':' expr
-                   | unary_input_function
-                   ;
-
-
-  non_unary_expr   : '(' expr ')'
-                   | '!' expr
-                   | non_unary_expr '^'      expr
-                   | non_unary_expr '*'      expr
-                   | non_unary_expr '/'      expr
-                   | non_unary_expr '%'      expr
-                   | non_unary_expr '+'      expr
-                   | non_unary_expr '-'      expr
-                   | non_unary_expr          non_unary_expr
-                   | non_unary_expr '<'      expr
-                   | non_unary_expr LE       expr
-                   | non_unary_expr NE       expr
-                   | non_unary_expr EQ       expr
-                   | non_unary_expr '>'      expr
-                   | non_unary_expr GE       expr
-                   | non_unary_expr ' '      expr
-                   | non_unary_expr NO_MATCH expr
-                   | non_unary_expr In NAME
+  expr             : lvalue '=' expr
+                       { $$ = OP2(aASSIGN, $1, $3); }
+                   | lvalue ADD_ASSIGN expr
+                       { $$ = OP2(aADD_ASSIGN, $1, $3); }
+                   | lvalue SUB_ASSIGN expr
+                       { $$ = OP2(aSUB_ASSIGN, $1, $3); }
+                   | lvalue MUL_ASSIGN expr
+                       { $$ = OP2(aMUL_ASSIGN, $1, $3); }
+                   | lvalue DIV_ASSIGN expr
+                       { $$ = OP2(aDIV_ASSIGN, $1, $3); }
+                   | lvalue MOD_ASSIGN expr
+                       { $$ = OP2(aMOD_ASSIGN, $1, $3); }
+                   | lvalue POW_ASSIGN expr
+                       { $$ = OP2(aPOW_ASSIGN, $1, $3); }
+                   | expr '?' expr ':' expr
+                       { $$ = OP3(aCOND, $1, $3, $5); }
+                   | expr OR expr
+                       { $$ = OP2(aOR, $1, $3); }
+                   | expr AND expr
+                       { $$ = OP2(aAND, $1, $3); }
+                   | expr In NAME
+                       { $$ = OP2(aIN, SYM(aNAME, $3), $1); }
                    | '(' multiple_expr_list ')' In NAME
-                   | non_unary_expr AND newline_opt expr
-                   | non_unary_expr OR  newline_opt expr
-                   | non_unary_expr '?' expr ':' expr
+                       { $$ = OP2(aIN, SYM(aNAME, $5), $2); }
+                   | expr '~' expr
+                       { $$ = OP2(aMATCH, $1, $3); }
+                   | expr NO_MATCH expr
+                       { $$ = OP2(aNOMATCH, $1, $3); }
+                   | expr '<' expr
+                       { $$ = OP2(aLT, $1, $3); }
+                   | expr LE expr
+                       { $$ = OP2(aLE, $1, $3); }
+                   | expr NE expr
+                       { $$ = OP2(aNE, $1, $3); }
+                   | expr EQ expr
+                       { $$ = OP2(aEQ, $1, $3); }
+                   | expr '>' expr
+                       { $$ = OP2(aGT, $1, $3); }
+                   | expr GE expr
+                       { $$ = OP2(aGE, $1, $3); }
+                   | expr term %prec CAT
+                       { $$ = OP2(aCAT, $1, $2); }
+                   | term
+                   ;
+
+
+  term             : term '+' term
+                       { $$ = OP2(aADD, $1, $3); }
+                   | term '-' term
+                       { $$ = OP2(aSUB, $1, $3); }
+                   | term '*' term
+                       { $$ = OP2(aMUL, $1, $3); }
+                   | term '/' term
+                       { $$ = OP2(aDIV, $1, $3); }
+                   | term '%' term
+                       { $$ = OP2(aMOD, $1, $3); }
+                   | term '^' term
+                       { $$ = OP2(aPOW, $1, $3); }
+                   | '-' term %prec UMINUS
+                       { $$ = OP1(aNEG, $2); }
+                   | '+' term %prec UMINUS
+                       { $$ = OP1(aPLUS, $2); }
+                   | '!' term %prec UMINUS
+                       { $$ = OP1(aNOT, $2); }
+                   | '(' expr ')'
+                       { $$ = $2; }
                    | NUMBER
+                       { $$ = LEAF(aNUMBER, $1); }
                    | STRING
-                   | lvalue
+                       { $$ = LEAF(aSTRING, $1); }
                    | ERE
+                       { $$ = LEAF(aERE, $1); }
                    | XPATH
-                   | lvalue INCR
-                   | lvalue DECR
+                       { $$ = LEAF(aXPATH, $1); }
+                   | lvalue
                    | INCR lvalue
+                       { $$ = OP1(aPREINC, $2); }
                    | DECR lvalue
-                   | lvalue POW_ASSIGN expr
-                   | lvalue MOD_ASSIGN expr
-                   | lvalue MUL_ASSIGN expr
-                   | lvalue DIV_ASSIGN expr
-                   | lvalue ADD_ASSIGN expr
-                   | lvalue SUB_ASSIGN expr
-                   | lvalue '=' expr
-                   | FUNC_NAME '(' expr_list_opt ')'
-                        /* no white space allowed before '(' */
-                   | BUILTIN_FUNC_NAME '(' expr_list_opt ')'
-                   | BUILTIN_FUNC_NAME
-                   | non_unary_input_function
-                   ;
-
-
-  print_expr_list_opt : /* empty */
-                   | print_expr_list
-                   ;
-
-
-  print_expr_list  : print_expr
-                   | print_expr_list ',' newline_opt print_expr
-                   ;
-
-
-  print_expr       : unary_print_expr
-                   | non_unary_print_expr
-                   ;
-
-
-  unary_print_expr : '+' print_expr
-                   | '-' print_expr
-                   | unary_print_expr '^'      print_expr
-                   | unary_print_expr '*'      print_expr
-                   | unary_print_expr '/'      print_expr
-                   | unary_print_expr '%'      print_expr
-                   | unary_print_expr '+'      print_expr
-                   | unary_print_expr '-'      print_expr
-                   | unary_print_expr          non_unary_print_expr
-                   | unary_print_expr ' '      print_expr
-                   | unary_print_expr NO_MATCH print_expr
-                   | unary_print_expr In NAME
-                   | unary_print_expr AND newline_opt print_expr
-                   | unary_print_expr OR  newline_opt print_expr
-                   | unary_print_expr '?' print_expr ':' print_expr
+                       { $$ = OP1(aPREDEC, $2); }
+                   | lvalue INCR
+                       { $$ = OP1(aPOSTINC, $1); }
+                   | lvalue DECR
+                       { $$ = OP1(aPOSTDEC, $1); }
+                   | call
                    ;
 
 
-  non_unary_print_expr : '(' expr ')'
-                   | '!' print_expr
-                   | non_unary_print_expr '^'      print_expr
-                   | non_unary_print_expr '*'      print_expr
-                   | non_unary_print_expr '/'      print_expr
-                   | non_unary_print_expr '%'      print_expr
-                   | non_unary_print_expr '+'      print_expr
-                   | non_unary_print_expr '-'      print_expr
-                   | non_unary_print_expr          non_unary_print_expr
-                   | non_unary_print_expr ' '      print_expr
-                   | non_unary_print_expr NO_MATCH print_expr
-                   | non_unary_print_expr In NAME
-                   | '(' multiple_expr_list ')' In NAME
-                   | non_unary_print_expr AND newline_opt print_expr
-                   | non_unary_print_expr OR  newline_opt print_expr
-                   | non_unary_print_expr '?' print_expr ':' print_expr
-                   | NUMBER
-                   | STRING
-                   | lvalue
-                   | ERE
-                   | lvalue INCR
-                   | lvalue DECR
-                   | INCR lvalue
-                   | DECR lvalue
-                   | lvalue POW_ASSIGN print_expr
-                   | lvalue MOD_ASSIGN print_expr
-                   | lvalue MUL_ASSIGN print_expr
-                   | lvalue DIV_ASSIGN print_expr
-                   | lvalue ADD_ASSIGN print_expr
-                   | lvalue SUB_ASSIGN print_expr
-                   | lvalue '=' print_expr
-                   | FUNC_NAME '(' expr_list_opt ')'
-                       /* no white space allowed before '(' */
-                   | BUILTIN_FUNC_NAME '(' expr_list_opt ')'
+  call             : FUNC_NAME '(' opt_expr_list ')'
+                       { $$ = OP2(aCALL, SYM(aFUNC, $1), $3); }
+                   | BUILTIN_FUNC_NAME '(' opt_expr_list ')'
+                       { $$ = OP2(aBCALL, LEAF(aBUILTIN, $1), $3); }
                    | BUILTIN_FUNC_NAME
+                       { $$ = OP2(aBCALL, LEAF(aBUILTIN, $1), NIL); }
                    ;
 
 
   lvalue           : NAME
+                       { $$ = SYM(aNAME, $1); }
                    | NAME '[' expr_list ']'
-                   | '$' expr
+                       { $$ = OP2(aINDEX, SYM(aNAME, $1), $3); }
+                   | '$' fieldarg
+                       { $$ = OP1(aFIELD, $2); }
                    ;
 
 
-  non_unary_input_function : simple_get
-                   | simple_get '<' expr
-                   | non_unary_expr '|' simple_get
-                   ;
-
-
-  unary_input_function : unary_expr '|' simple_get
-                   ;
-
-
-  simple_get       : GETLINE
-                   | GETLINE lvalue
-                   ;
-
-
-  newline_opt      : /* empty */
-                   | newline_opt NEWLINE
+  /* so that $i++ and $NF-1 mean ($i)++ and ($NF)-1 */
+  fieldarg         : NUMBER
+                       { $$ = LEAF(aNUMBER, $1); }
+                   | NAME
+                       { $$ = SYM(aNAME, $1); }
+                   | NAME '[' expr_list ']'
+                       { $$ = OP2(aINDEX, SYM(aNAME, $1), $3); }
+                   | '$' fieldarg
+                       { $$ = OP1(aFIELD, $2); }
+                   | '(' expr ')'
+                       { $$ = $2; }
+                   | '-' fieldarg
+                       { $$ = OP1(aNEG, $2); }
+                   | INCR lvalue
+                       { $$ = OP1(aPREINC, $2); }
+                   | DECR lvalue
+                       { $$ = OP1(aPREDEC, $2); }
+                   | call
                    ;
 
 %%
@@ -443,8 +432,8 @@ bool_t parse_string_awkvm(awkvm_t *vm, const char_t *begin, const char_t *end) {
 
   avm = vm;
 
-  reset_lexer_awk();
-  scan_lexer_awk((char *)begin, end - begin);
+  reset_lexer_awk(vm);
+  scan_lexer_awk(begin, end - begin);
   ok = yyparse();
   free_lexer_awk();
 
@@ -458,30 +447,24 @@ bool_t parse_file_awkvm(awkvm_t *vm, const char *file) {
 #if YYDEBUG
   yydebug = 1;
 #endif
-  yyin = fopen(file, "r");
-  if( yyin ) {
-
-    avm = vm;
 
-    reset_lexer_awk();
-    ok = yyparse();
-    free_lexer_awk();
-    fclose(yyin);
-    yyin = NULL;
+  avm = vm;
 
+  reset_lexer_awk(vm);
+  if( !file_lexer_awk(file) ) {
     avm = NULL;
-
-    return (ok == 0);
+    return FALSE;
   }
-  return FALSE;
+  ok = yyparse();
+  free_lexer_awk();
+
+  avm = NULL;
+
+  return (ok == 0);
 }
 
-int yyerror(char *s)
+int yyerror(const char *s)
 { 
-  errormsg(E_FATAL, "%s: parse error at line %ld before '%s'\n", 
-	   inputfile, inputline, yytext); 
+  errormsg(E_FATAL, "%s at line %ld\n", s, inputline); 
   return 0;
 }
-
-/* we never parse multiple files */
-int yywrap() { return 1; }
@@ -18,8 +18,36 @@
  * Author:   Laird Breyer <laird@lbreyer.com>
  */
 
+
 #include "awkvm.h"
+#include "mem.h"
+#include "xpath.h"
+#include "stdout.h"
+
 #include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+static const char *specials[] = {
+  "NR", "NF", "FNR", "FS", "OFS", "ORS", "SUBSEP", "CONVFMT", "OFMT",
+  "FILENAME", "RSTART", "RLENGTH", "ENVIRON", "ATTR", "PATH", NULL
+};
+
+#define NOREG 0x7fffffff
+
+#define AWKLOOP_MAX 64
+
+/* what a codeblock returns */
+#define AWKRUN_OK    0
+#define AWKRUN_NEXT  1
+#define AWKRUN_EXIT  2
+
+#define AWKCALL_MAX  10000
 
 bool_t create_codeblock(codeblock_t *bl) {
   if( bl ) {
@@ -31,39 +59,76 @@ bool_t create_codeblock(codeblock_t *bl) {
 
 bool_t free_codeblock(codeblock_t *bl) {
   if( bl ) {
+    if( bl->arrays ) {
+      free(bl->arrays);
+      bl->arrays = NULL;
+    }
     return TRUE;
   }
   return FALSE;
 }
 
-bool_t set_pattern_codeblock(codeblock_t *bl, const char *pattern) {
-  if( bl ) {
-    return (pattern != NULL);
-  }
-  return FALSE;
-}
-
-
 bool_t create_awkvm(awkvm_t *vm) {
   bool_t ok = TRUE;
+  int i;
   if( vm ) {
     memset(vm, 0, sizeof(awkvm_t));
     ok &= create_symbols(&vm->sym);
     ok &= create_objstack(&vm->symtable, sizeof(symrec_t));
     ok &= create_awkconstmgr(&vm->constants);
     ok &= create_objstack(&vm->codeblocks, sizeof(codeblock_t));
+    ok &= create_awkast(&vm->ast);
+    ok &= create_awkmem(&vm->code);
+    ok &= create_awkvar(&vm->retval);
+    vm->program = AWKMEM_NULL;
+    vm->cbbegin = vm->cbmain = vm->cbend = -1;
+    for(i = 0; ok && specials[i]; i++) {
+      ok &= putsym_awkvm(vm, getid_awkvm(vm, specials[i], 
+					 specials[i] + strlen(specials[i])));
+    }
     return ok;
   }
   return FALSE;
 }
 
+static void free_vars_awkvm(awkvar_t *v, size_t n) {
+  size_t i;
+  if( v ) {
+    for(i = 0; i < n; i++) {
+      free_awkvar(&v[i]);
+    }
+    free(v);
+  }
+}
 
 bool_t free_awkvm(awkvm_t *vm) {
+  int i;
   if( vm ) {
+    for(i = 0; i < vm->codeblocks.top; i++) {
+      free_codeblock(get_objstack(&vm->codeblocks, i, sizeof(codeblock_t)));
+    }
     free_objstack(&vm->codeblocks);
     free_awkconstmgr(&vm->constants);
     free_objstack(&vm->symtable);
     free_symbols(&vm->sym);
+    free_awkast(&vm->ast);
+    free_awkmem(&vm->code);
+
+    free_vars_awkvm(vm->globals, vm->nglobals);
+    free_vars_awkvm(vm->stack, vm->maxstack);
+    free_vars_awkvm(vm->fields, vm->maxfields);
+    free_awkvar(&vm->retval);
+
+    for(i = 0; i < (int)vm->nregex; i++) {
+      free(vm->regex[i].pattern);
+      regfree(&vm->regex[i].re);
+    }
+    free_mem(&vm->regex, &vm->maxregex);
+    free_mem(&vm->outputs, &vm->maxoutputs);
+    free_mem(&vm->scratch, &vm->maxscratch);
+    free_mem(&vm->fbuf, &vm->maxfbuf);
+    free_mem(&vm->spans, &vm->maxspans);
+    memset(vm, 0, sizeof(awkvm_t));
   }
   return FALSE;
 }
@@ -73,7 +138,7 @@ symbol_t getid_awkvm(awkvm_t *vm,  const char_t *begin, const char_t *end) {
 }
 
 bool_t putsym_awkvm(awkvm_t *vm, symbol_t id) {
-  if( vm && (id == vm->sym.last) ) {
+  if( vm && (id == vm->sym.last) && (id == vm->symtable.top) ) {
     return push_objstack(&vm->symtable, NULL, sizeof(symrec_t));
   }
   return FALSE;
@@ -82,3 +147,2215 @@ bool_t putsym_awkvm(awkvm_t *vm, symbol_t id) {
 symrec_t *getsym_awkvm(awkvm_t *vm, symbol_t id) {
   return vm ? get_objstack(&vm->symtable, id, sizeof(symrec_t)) : NULL;
 }
+
+static codeblock_t *getblock_awkvm(awkvm_t *vm, int n) {
+  return (codeblock_t *)get_objstack(&vm->codeblocks, n, sizeof(codeblock_t));
+}
+
+/*
+ * The compiler. Expressions are compiled by compile_expr(), which
+ * returns the register holding the value. Temporaries are allocated
+ * in the frame like a stack, and released at the end of each
+ * statement. Jumps which are not yet resolved are chained through
+ * their d field, see patch().
+ */
+
+typedef struct {
+  awkvm_t *vm;
+  int ntmp, maxtmp;
+  codeblock_t *fun; /* when compiling a function */
+  awkmem_ptr_t params;
+  int nloops;
+  int brk[AWKLOOP_MAX];
+  int cont[AWKLOOP_MAX];
+  int lineno;
+} awkcomp_t;
+
+#define LV_VAR   0
+#define LV_ELEM  1
+#define LV_FIELD 2
+
+typedef struct {
+  int kind;
+  int reg; /* LV_VAR: the variable, LV_ELEM: the array */
+  int key; /* LV_ELEM: the subscript, LV_FIELD: the field number */
+} awklval_t;
+
+#define NODE(cs,p) get_awkast(&(cs)->vm->ast, p)
+#define CHILD(cs,p,n) child_awkast(&(cs)->vm->ast, p, n)
+#define INSN(vm,i) (((awkinsn_t *)(vm)->code.start) + (i))
+
+static int compile_expr(awkcomp_t *cs, awkmem_ptr_t p);
+static void compile_stmt(awkcomp_t *cs, awkmem_ptr_t p);
+
+static void fail_compile(awkcomp_t *cs, const char *what) {
+  errormsg(E_FATAL, "%s at line %d\n", what, cs->lineno);
+}
+
+static bool_t empty_node(awkcomp_t *cs, awkmem_ptr_t p) {
+  return (p == AWKMEM_NULL) || (NODE(cs, p)->id == aNULL);
+}
+
+static int emit(awkcomp_t *cs, int op, int a, int b, int c, int d) {
+  awkinsn_t *i;
+  if( sbrk_awkmem(&cs->vm->code, sizeof(awkinsn_t)) == AWKMEM_NULL ) {
+    errormsg(E_FATAL, "out of memory.\n");
+  }
+  i = INSN(cs->vm, cs->vm->ic);
+  i->op = op;
+  i->a = a;
+  i->b = b;
+  i->c = c;
+  i->d = d;
+  i->lineno = cs->lineno;
+  return cs->vm->ic++;
+}
+
+/* adds a jump to the list, to be patched later */
+static void jump(awkcomp_t *cs, int op, int reg, int *list) {
+  int i = emit(cs, op, reg, 0, 0, *list);
+  *list = i;
+}
+
+static void patch(awkcomp_t *cs, int list, int target) {
+  int next;
+  while( list >= 0 ) {
+    next = INSN(cs->vm, list)->d;
+    INSN(cs->vm, list)->d = target;
+    list = next;
+  }
+}
+
+static int tmp(awkcomp_t *cs) {
+  int r = cs->ntmp++;
+  if( cs->ntmp > cs->maxtmp ) {
+    cs->maxtmp = cs->ntmp;
+  }
+  return -1 - r;
+}
+
+/* the slot of a temporary register */
+#define SLOT(r) (-1 - (r))
+
+static int varreg(awkcomp_t *cs, symbol_t s) {
+  awkmem_ptr_t q;
+  symrec_t *sr;
+  int n;
+  if( cs->fun ) {
+    for(q = cs->params, n = 0; q != AWKMEM_NULL; 
+	q = NODE(cs, q)->sib.ptr, n++) {
+      if( (NODE(cs, q)->id == aNAME) && (NODE(cs, q)->chi.sym == s) ) {
+	return -1 - n;
+      }
+    }
+  }
+  sr = getsym_awkvm(cs->vm, s);
+  if( sr && (sr->type == symFUNCTION) ) {
+    fail_compile(cs, "function name used as a variable");
+  }
+  return s;
+}
+
+/* the index of a parameter of the current function, or -1 */
+static int varreg_param(awkcomp_t *cs, symbol_t s) {
+  int r;
+  if( cs->fun ) {
+    r = varreg(cs, s);
+    return (r < 0) ? SLOT(r) : -1;
+  }
+  return -1;
+}
+
+static int arrayreg(awkcomp_t *cs, awkmem_ptr_t p) {
+  symrec_t *sr;
+  int r;
+  if( NODE(cs, p)->id != aNAME ) {
+    fail_compile(cs, "array name expected");
+  }
+  r = varreg(cs, NODE(cs, p)->chi.sym);
+  if( r >= 0 ) {
+    sr = getsym_awkvm(cs->vm, r);
+    sr->type = symARRAY;
+  }
+  return r;
+}
+
+static int load_const(awkcomp_t *cs, int op, awkmem_ptr_t k) {
+  int t = tmp(cs);
+  emit(cs, op, t, (int)k, 0, 0);
+  return t;
+}
+
+static void expr_to(awkcomp_t *cs, awkmem_ptr_t p, int dst) {
+  int r = compile_expr(cs, p);
+  if( r != dst ) {
+    emit(cs, oMOVE, dst, r, 0, 0);
+  }
+}
+
+/* the subscript list becomes a single key, joined by SUBSEP */
+static int subscript(awkcomp_t *cs, awkmem_ptr_t list) {
+  int k, r, t;
+  k = compile_expr(cs, list);
+  list = NODE(cs, list)->sib.ptr;
+  if( list != AWKMEM_NULL ) {
+    t = tmp(cs);
+    for( ; list != AWKMEM_NULL; list = NODE(cs, list)->sib.ptr) {
+      r = compile_expr(cs, list);
+      emit(cs, oJOIN, t, k, r, 0);
+      k = t;
+    }
+  }
+  return k;
+}
+
+static void prepare_lvalue(awkcomp_t *cs, awkmem_ptr_t p, awklval_t *lv) {
+  awkast_node_t *n = NODE(cs, p);
+  switch(n->id) {
+  case aNAME:
+    lv->kind = LV_VAR;
+    lv->reg = varreg(cs, n->chi.sym);
+    break;
+  case aINDEX:
+    lv->kind = LV_ELEM;
+    lv->reg = arrayreg(cs, CHILD(cs, p, 0));
+    lv->key = subscript(cs, CHILD(cs, p, 1));
+    break;
+  case aFIELD:
+    lv->kind = LV_FIELD;
+    lv->key = compile_expr(cs, CHILD(cs, p, 0));
+    break;
+  default:
+    fail_compile(cs, "assignment to a non variable");
+  }
+}
+
+/* the register holding the current value */
+static int load_lvalue(awkcomp_t *cs, awklval_t *lv) {
+  int t;
+  switch(lv->kind) {
+  case LV_VAR:
+    if( lv->reg == vNF ) {
+      emit(cs, oNF, 0, 0, 0, 0);
+    }
+    return lv->reg;
+  case LV_ELEM:
+    t = tmp(cs);
+    emit(cs, oAGET, t, lv->reg, lv->key, 0);
+    return t;
+  default:
+    t = tmp(cs);
+    emit(cs, oGETF, t, lv->key, 0, 0);
+    return t;
+  }
+}
+
+static void store_lvalue(awkcomp_t *cs, awklval_t *lv, int r) {
+  switch(lv->kind) {
+  case LV_VAR:
+    if( lv->reg == vNF ) {
+      emit(cs, oNF, 0, 0, 0, 0);
+    }
+    if( r != lv->reg ) {
+      emit(cs, oMOVE, lv->reg, r, 0, 0);
+    }
+    if( lv->reg == vNF ) {
+      emit(cs, oSETNF, 0, 0, 0, 0);
+    }
+    break;
+  case LV_ELEM:
+    emit(cs, oASET, lv->reg, lv->key, r, 0);
+    break;
+  default:
+    emit(cs, oSETF, lv->key, r, 0, 0);
+    break;
+  }
+}
+
+/* emits jumps to the list, taken when the truth value of p is sense */
+static void compile_cond(awkcomp_t *cs, awkmem_ptr_t p, bool_t sense, int *list) {
+  int skip = -1;
+  switch(NODE(cs, p)->id) {
+  case aNOT:
+    compile_cond(cs, CHILD(cs, p, 0), !sense, list);
+    break;
+  case aAND:
+    if( sense ) {
+      compile_cond(cs, CHILD(cs, p, 0), FALSE, &skip);
+      compile_cond(cs, CHILD(cs, p, 1), TRUE, list);
+      patch(cs, skip, cs->vm->ic);
+    } else {
+      compile_cond(cs, CHILD(cs, p, 0), FALSE, list);
+      compile_cond(cs, CHILD(cs, p, 1), FALSE, list);
+    }
+    break;
+  case aOR:
+    if( sense ) {
+      compile_cond(cs, CHILD(cs, p, 0), TRUE, list);
+      compile_cond(cs, CHILD(cs, p, 1), TRUE, list);
+    } else {
+      compile_cond(cs, CHILD(cs, p, 0), TRUE, &skip);
+      compile_cond(cs, CHILD(cs, p, 1), FALSE, list);
+      patch(cs, skip, cs->vm->ic);
+    }
+    break;
+  default:
+    jump(cs, sense ? oJT : oJF, compile_expr(cs, p), list);
+    break;
+  }
+}
+
+static int add_regex_awkvm(awkvm_t *vm, const char_t *pattern);
+
+static int compile_binary(awkcomp_t *cs, int op, awkmem_ptr_t p) {
+  int a, b, t, save = cs->ntmp;
+  a = compile_expr(cs, CHILD(cs, p, 0));
+  b = compile_expr(cs, CHILD(cs, p, 1));
+  cs->ntmp = save;
+  t = tmp(cs);
+  emit(cs, op, t, a, b, 0);
+  return t;
+}
+
+static int compile_assign(awkcomp_t *cs, awkmem_ptr_t p) {
+  static const int ops[] = { 
+    oNOP, oADD, oSUB, oMUL, oDIV, oMOD, oPOW 
+  };
+  awklval_t lv;
+  int r, v, op;
+  op = ops[NODE(cs, p)->id - aASSIGN];
+  prepare_lvalue(cs, CHILD(cs, p, 0), &lv);
+  if( op == oNOP ) {
+    v = compile_expr(cs, CHILD(cs, p, 1));
+    store_lvalue(cs, &lv, v);
+    return (lv.kind == LV_VAR) ? lv.reg : v;
+  } else if( (op == oADD) && (lv.kind == LV_ELEM) ) {
+    v = compile_expr(cs, CHILD(cs, p, 1));
+    r = tmp(cs);
+    emit(cs, oAADD, r, lv.reg, lv.key, v);
+    return r;
+  }
+  r = load_lvalue(cs, &lv);
+  v = compile_expr(cs, CHILD(cs, p, 1));
+  emit(cs, op, r, r, v, 0);
+  if( (lv.kind != LV_VAR) || (lv.reg == vNF) ) {
+    store_lvalue(cs, &lv, r);
+  }
+  return r;
+}
+
+static int compile_incr(awkcomp_t *cs, awkmem_ptr_t p, int delta, bool_t post) {
+  awklval_t lv;
+  int r, t, one;
+  prepare_lvalue(cs, CHILD(cs, p, 0), &lv);
+  if( lv.kind == LV_ELEM ) {
+    t = NOREG;
+    if( post ) {
+      t = tmp(cs);
+      emit(cs, oAGET, t, lv.reg, lv.key, 0);
+      emit(cs, oPLUS, t, t, 0, 0);
+    }
+    one = tmp(cs);
+    emit(cs, oLOADI, one, delta, 0, 0);
+    emit(cs, oAADD, one, lv.reg, lv.key, one);
+    return post ? t : one;
+  }
+  r = load_lvalue(cs, &lv);
+  t = NOREG;
+  if( post ) {
+    t = tmp(cs);
+    emit(cs, oPLUS, t, r, 0, 0);
+  }
+  emit(cs, oADDI, r, r, delta, 0);
+  if( (lv.kind != LV_VAR) || (lv.reg == vNF) ) {
+    store_lvalue(cs, &lv, r);
+  }
+  return post ? t : r;
+}
+
+static bool_t regex_arg(int code, int n) {
+  return ((code == bSPLIT) && (n == 2)) ||
+    (((code == bSUB) || (code == bGSUB)) && (n == 0)) ||
+    ((code == bMATCH) && (n == 1));
+}
+
+static int compile_builtin(awkcomp_t *cs, awkmem_ptr_t p) {
+  awkmem_ptr_t q, args;
+  awklval_t lv;
+  int code, n, first, t, skip;
+
+  code = (int)NODE(cs, CHILD(cs, p, 0))->chi.ptr;
+  args = CHILD(cs, p, 1);
+  if( NODE(cs, args)->id == aNULL ) {
+    args = AWKMEM_NULL;
+  }
+  n = count_awkast(&cs->vm->ast, args);
+
+  switch(code) {
+  case bSPLIT:
+    if( (n < 2) || (n > 3) ) {
+      fail_compile(cs, "split() needs two or three arguments");
+    }
+    first = tmp(cs);
+    expr_to(cs, args, first);
+    cs->ntmp = SLOT(first) + 1;
+    t = arrayreg(cs, CHILD(cs, p, 2));
+    skip = NOREG;
+    if( n == 3 ) {
+      q = CHILD(cs, p, 3);
+      skip = (NODE(cs, q)->id == aERE) ? 
+	load_const(cs, oLOADSTR, NODE(cs, q)->chi.ptr) : compile_expr(cs, q);
+    }
+    emit(cs, oSPLIT, first, t, skip, (n == 3));
+    return first;
+  case bSUB:
+  case bGSUB:
+    if( (n < 2) || (n > 3) ) {
+      fail_compile(cs, "sub() and gsub() need two or three arguments");
+    }
+    if( n == 3 ) {
+      prepare_lvalue(cs, CHILD(cs, p, 3), &lv);
+    } else {
+      lv.kind = LV_FIELD;
+      lv.key = tmp(cs);
+      emit(cs, oLOADI, lv.key, 0, 0, 0);
+    }
+    break;
+  case bLENGTH:
+    if( n == 0 ) {
+      t = tmp(cs);
+      emit(cs, oGETFI, t, 0, 0, 0);
+      emit(cs, oBUILTIN, t, code, 1, 0);
+      return t;
+    }
+    break;
+  }
+
+  first = cs->ntmp;
+  for(q = args, n = 0; q != AWKMEM_NULL; q = NODE(cs, q)->sib.ptr, n++) {
+    if( ((code == bSUB) || (code == bGSUB)) && (n == 2) ) {
+      break;
+    }
+    t = tmp(cs);
+    if( regex_arg(code, n) && (NODE(cs, q)->id == aERE) ) {
+      emit(cs, oLOADSTR, t, (int)NODE(cs, q)->chi.ptr, 0, 0);
+    } else if( (code == bLENGTH) && (NODE(cs, q)->id == aNAME) ) {
+      /* length(a) also counts array elements */
+      emit(cs, oMOVE, t, varreg(cs, NODE(cs, q)->chi.sym), 1, 0);
+    } else {
+      expr_to(cs, q, t);
+    }
+    cs->ntmp = SLOT(t) + 1;
+  }
+
+  if( (code == bSUB) || (code == bGSUB) ) {
+    t = tmp(cs);
+    emit(cs, oMOVE, t, load_lvalue(cs, &lv), 0, 0);
+    cs->ntmp = SLOT(t) + 1;
+    emit(cs, oBUILTIN, -1 - first, code, 3, 0);
+    skip = -1;
+    jump(cs, oJF, -1 - first, &skip);
+    store_lvalue(cs, &lv, t);
+    patch(cs, skip, cs->vm->ic);
+    return -1 - first;
+  }
+
+  if( n == 0 ) {
+    t = tmp(cs);
+    emit(cs, oBUILTIN, t, code, 0, 0);
+    return t;
+  }
+  emit(cs, oBUILTIN, -1 - first, code, n, 0);
+  return -1 - first;
+}
+
+static int compile_call(awkcomp_t *cs, awkmem_ptr_t p) {
+  awkmem_ptr_t q, args;
+  symrec_t *sr;
+  codeblock_t *cb;
+  int n, first, t;
+
+  sr = getsym_awkvm(cs->vm, NODE(cs, CHILD(cs, p, 0))->chi.sym);
+  if( !sr || (sr->type != symFUNCTION) ) {
+    fail_compile(cs, "call to an undefined function");
+  }
+  cb = getblock_awkvm(cs->vm, sr->index);
+  args = CHILD(cs, p, 1);
+  if( NODE(cs, args)->id == aNULL ) {
+    args = AWKMEM_NULL;
+  }
+  first = cs->ntmp;
+  for(q = args, n = 0; q != AWKMEM_NULL; q = NODE(cs, q)->sib.ptr, n++) {
+    if( n >= cb->nparams ) {
+      fail_compile(cs, "too many arguments in function call");
+    }
+    t = tmp(cs);
+    if( cb->arrays[n] && (NODE(cs, q)->id == aNAME) ) {
+      emit(cs, oAREF, t, arrayreg(cs, q), 0, 0);
+    } else {
+      expr_to(cs, q, t);
+    }
+    cs->ntmp = SLOT(t) + 1;
+  }
+  cs->ntmp = first;
+  t = tmp(cs);
+  emit(cs, oCALL, t, sr->index, -1 - first, n);
+  return t;
+}
+
+static int compile_expr(awkcomp_t *cs, awkmem_ptr_t p) {
+  awkast_node_t *n;
+  awkmem_ptr_t q;
+  int a, b, t, skip, end;
+
+  n = NODE(cs, p);
+  cs->lineno = n->lineno;
+  switch(n->id) {
+  case aNUMBER:
+    return load_const(cs, oLOADNUM, n->chi.ptr);
+  case aSTRING:
+    return load_const(cs, oLOADSTR, n->chi.ptr);
+  case aERE:
+    t = tmp(cs);
+    emit(cs, oMATCH0, t, 0, 
+	 add_regex_awkvm(cs->vm, get_string_awkconstmgr(&cs->vm->constants, 
+							n->chi.ptr)), 0);
+    return t;
+  case aXPATH:
+    return load_const(cs, oXPATH, n->chi.ptr);
+  case aNAME:
+    a = varreg(cs, n->chi.sym);
+    if( a == vNF ) {
+      emit(cs, oNF, 0, 0, 0, 0);
+    }
+    return a;
+  case aINDEX:
+    a = arrayreg(cs, CHILD(cs, p, 0));
+    b = subscript(cs, CHILD(cs, p, 1));
+    t = tmp(cs);
+    emit(cs, oAGET, t, a, b, 0);
+    return t;
+  case aFIELD:
+    q = CHILD(cs, p, 0);
+    t = tmp(cs);
+    if( NODE(cs, q)->id == aNUMBER ) {
+      emit(cs, oGETFI, t, 
+	   (int)get_number_awkconstmgr(&cs->vm->constants, NODE(cs, q)->chi.ptr), 
+	   0, 0);
+    } else {
+      emit(cs, oGETF, t, compile_expr(cs, q), 0, 0);
+    }
+    return t;
+  case aASSIGN: case aADD_ASSIGN: case aSUB_ASSIGN: case aMUL_ASSIGN: 
+  case aDIV_ASSIGN: case aMOD_ASSIGN: case aPOW_ASSIGN:
+    return compile_assign(cs, p);
+  case aPREINC:
+    return compile_incr(cs, p, 1, FALSE);
+  case aPREDEC:
+    return compile_incr(cs, p, -1, FALSE);
+  case aPOSTINC:
+    return compile_incr(cs, p, 1, TRUE);
+  case aPOSTDEC:
+    return compile_incr(cs, p, -1, TRUE);
+  case aADD: return compile_binary(cs, oADD, p);
+  case aSUB: return compile_binary(cs, oSUB, p);
+  case aMUL: return compile_binary(cs, oMUL, p);
+  case aDIV: return compile_binary(cs, oDIV, p);
+  case aMOD: return compile_binary(cs, oMOD, p);
+  case aPOW: return compile_binary(cs, oPOW, p);
+  case aCAT: return compile_binary(cs, oCAT, p);
+  case aLT: return compile_binary(cs, oLT, p);
+  case aLE: return compile_binary(cs, oLE, p);
+  case aNE: return compile_binary(cs, oNE, p);
+  case aEQ: return compile_binary(cs, oEQ, p);
+  case aGT: return compile_binary(cs, oGT, p);
+  case aGE: return compile_binary(cs, oGE, p);
+  case aMATCH:
+  case aNOMATCH:
+    q = CHILD(cs, p, 1);
+    a = compile_expr(cs, CHILD(cs, p, 0));
+    if( NODE(cs, q)->id == aERE ) {
+      b = add_regex_awkvm(cs->vm, get_string_awkconstmgr(&cs->vm->constants,
+							 NODE(cs, q)->chi.ptr));
+      t = tmp(cs);
+      emit(cs, oMATCH, t, a, b, (n->id == aNOMATCH));
+    } else {
+      b = compile_expr(cs, q);
+      t = tmp(cs);
+      emit(cs, oMATCHD, t, a, b, (n->id == aNOMATCH));
+    }
+    return t;
+  case aNOT:
+    a = compile_expr(cs, CHILD(cs, p, 0));
+    t = tmp(cs);
+    emit(cs, oNOT, t, a, 0, 0);
+    return t;
+  case aNEG:
+  case aPLUS:
+    a = compile_expr(cs, CHILD(cs, p, 0));
+    t = tmp(cs);
+    emit(cs, (n->id == aNEG) ? oNEG : oPLUS, t, a, 0, 0);
+    return t;
+  case aAND:
+  case aOR:
+    t = tmp(cs);
+    skip = end = -1;
+    compile_cond(cs, p, FALSE, &skip);
+    emit(cs, oLOADI, t, 1, 0, 0);
+    jump(cs, oJMP, 0, &end);
+    patch(cs, skip, cs->vm->ic);
+    emit(cs, oLOADI, t, 0, 0, 0);
+    patch(cs, end, cs->vm->ic);
+    return t;
+  case aCOND:
+    t = tmp(cs);
+    skip = end = -1;
+    compile_cond(cs, CHILD(cs, p, 0), FALSE, &skip);
+    expr_to(cs, CHILD(cs, p, 1), t);
+    jump(cs, oJMP, 0, &end);
+    patch(cs, skip, cs->vm->ic);
+    expr_to(cs, CHILD(cs, p, 2), t);
+    patch(cs, end, cs->vm->ic);
+    return t;
+  case aIN:
+    a = arrayreg(cs, CHILD(cs, p, 0));
+    b = subscript(cs, CHILD(cs, p, 1));
+    t = tmp(cs);
+    emit(cs, oAIN, t, a, b, 0);
+    return t;
+  case aCALL:
+    return compile_call(cs, p);
+  case aBCALL:
+    return compile_builtin(cs, p);
+  case aGROUP:
+    return compile_expr(cs, CHILD(cs, p, 0));
+  default:
+    fail_compile(cs, "bad expression");
+  }
+  return NOREG;
+}
+
+static void compile_print(awkcomp_t *cs, awkmem_ptr_t p, int op) {
+  awkmem_ptr_t q, args, redir;
+  int n, first, t, mode, target;
+
+  redir = CHILD(cs, p, 0);
+  mode = 0;
+  target = 0;
+  switch(NODE(cs, redir)->id) {
+  case aOUT: mode = 1; break;
+  case aAPPEND: mode = 2; break;
+  case aPIPE: mode = 3; break;
+  default: break;
+  }
+  if( mode ) {
+    target = compile_expr(cs, CHILD(cs, redir, 0));
+  }
+
+  args = CHILD(cs, p, 1);
+  if( NODE(cs, args)->id == aNULL ) {
+    args = AWKMEM_NULL;
+  }
+  n = count_awkast(&cs->vm->ast, args);
+  if( n == 1 ) {
+    first = compile_expr(cs, args);
+  } else {
+    first = -1 - cs->ntmp;
+    for(q = args; q != AWKMEM_NULL; q = NODE(cs, q)->sib.ptr) {
+      t = tmp(cs);
+      expr_to(cs, q, t);
+      cs->ntmp = SLOT(t) + 1;
+    }
+  }
+  emit(cs, op, first, n, mode, target);
+}
+
+static void push_loop(awkcomp_t *cs) {
+  if( cs->nloops >= AWKLOOP_MAX ) {
+    fail_compile(cs, "loops nested too deeply");
+  }
+  cs->brk[cs->nloops] = -1;
+  cs->cont[cs->nloops] = -1;
+  cs->nloops++;
+}
+
+static void pop_loop(awkcomp_t *cs, int brk, int cont) {
+  cs->nloops--;
+  patch(cs, cs->brk[cs->nloops], brk);
+  patch(cs, cs->cont[cs->nloops], cont);
+}
+
+static void compile_stmt(awkcomp_t *cs, awkmem_ptr_t p) {
+  awkast_node_t *n;
+  awkmem_ptr_t q;
+  int save, top, cont, it, a, b, skip, end;
+
+  if( empty_node(cs, p) ) {
+    return;
+  }
+  n = NODE(cs, p);
+  cs->lineno = n->lineno;
+  save = cs->ntmp;
+  skip = end = -1;
+  switch(n->id) {
+  case aBLOCK:
+    for(q = n->chi.ptr; q != AWKMEM_NULL; q = NODE(cs, q)->sib.ptr) {
+      compile_stmt(cs, q);
+    }
+    break;
+  case aPRINT:
+    compile_print(cs, p, oPRINT);
+    break;
+  case aPRINTF:
+    compile_print(cs, p, oPRINTF);
+    break;
+  case aIF:
+    compile_cond(cs, CHILD(cs, p, 0), FALSE, &skip);
+    cs->ntmp = save;
+    compile_stmt(cs, CHILD(cs, p, 1));
+    if( !empty_node(cs, CHILD(cs, p, 2)) ) {
+      jump(cs, oJMP, 0, &end);
+      patch(cs, skip, cs->vm->ic);
+      compile_stmt(cs, CHILD(cs, p, 2));
+      patch(cs, end, cs->vm->ic);
+    } else {
+      patch(cs, skip, cs->vm->ic);
+    }
+    break;
+  case aWHILE:
+    push_loop(cs);
+    top = cs->vm->ic;
+    compile_cond(cs, CHILD(cs, p, 0), FALSE, &skip);
+    cs->ntmp = save;
+    compile_stmt(cs, CHILD(cs, p, 1));
+    emit(cs, oJMP, 0, 0, 0, top);
+    patch(cs, skip, cs->vm->ic);
+    pop_loop(cs, cs->vm->ic, top);
+    break;
+  case aDO:
+    push_loop(cs);
+    top = cs->vm->ic;
+    compile_stmt(cs, CHILD(cs, p, 0));
+    cont = cs->vm->ic;
+    compile_cond(cs, CHILD(cs, p, 1), TRUE, &skip);
+    patch(cs, skip, top);
+    pop_loop(cs, cs->vm->ic, cont);
+    break;
+  case aFOR:
+    compile_stmt(cs, CHILD(cs, p, 0));
+    push_loop(cs);
+    top = cs->vm->ic;
+    if( !empty_node(cs, CHILD(cs, p, 1)) ) {
+      compile_cond(cs, CHILD(cs, p, 1), FALSE, &skip);
+      cs->ntmp = save;
+    }
+    compile_stmt(cs, CHILD(cs, p, 3));
+    cont = cs->vm->ic;
+    compile_stmt(cs, CHILD(cs, p, 2));
+    emit(cs, oJMP, 0, 0, 0, top);
+    patch(cs, skip, cs->vm->ic);
+    pop_loop(cs, cs->vm->ic, cont);
+    break;
+  case aFORIN:
+    a = varreg(cs, NODE(cs, CHILD(cs, p, 0))->chi.sym);
+    b = arrayreg(cs, CHILD(cs, p, 1));
+    it = tmp(cs);
+    emit(cs, oITERINIT, it, b, 0, 0);
+    push_loop(cs);
+    top = cs->vm->ic;
+    jump(cs, oITERNEXT, it, &skip);
+    INSN(cs->vm, skip)->b = a;
+    compile_stmt(cs, CHILD(cs, p, 2));
+    emit(cs, oJMP, 0, 0, 0, top);
+    patch(cs, skip, cs->vm->ic);
+    pop_loop(cs, cs->vm->ic, top);
+    emit(cs, oCLEAR, it, 0, 0, 0);
+    break;
+  case aBREAK:
+  case aCONTINUE:
+    if( cs->nloops == 0 ) {
+      fail_compile(cs, "break or continue outside a loop");
+    }
+    jump(cs, oJMP, 0, (n->id == aBREAK) ? 
+	 &cs->brk[cs->nloops - 1] : &cs->cont[cs->nloops - 1]);
+    break;
+  case aNEXT:
+    emit(cs, oNEXT, 0, 0, 0, 0);
+    break;
+  case aEXIT:
+    q = CHILD(cs, p, 0);
+    if( empty_node(cs, q) ) {
+      emit(cs, oEXIT, 0, 0, 0, 0);
+    } else {
+      emit(cs, oEXIT, compile_expr(cs, q), 1, 0, 0);
+    }
+    break;
+  case aRETURN:
+    if( !cs->fun ) {
+      fail_compile(cs, "return outside a function");
+    }
+    q = CHILD(cs, p, 0);
+    if( empty_node(cs, q) ) {
+      emit(cs, oRET, 0, 0, 0, 0);
+    } else {
+      emit(cs, oRET, compile_expr(cs, q), 1, 0, 0);
+    }
+    break;
+  case aDELETE:
+    a = arrayreg(cs, CHILD(cs, p, 0));
+    q = CHILD(cs, p, 1);
+    if( empty_node(cs, q) ) {
+      emit(cs, oACLEAR, a, 0, 0, 0);
+    } else {
+      emit(cs, oADEL, a, subscript(cs, q), 0, 0);
+    }
+    break;
+  case aPOSTINC:
+    compile_incr(cs, p, 1, FALSE);
+    break;
+  case aPOSTDEC:
+    compile_incr(cs, p, -1, FALSE);
+    break;
+  default:
+    compile_expr(cs, p);
+    break;
+  }
+  cs->ntmp = save;
+}
+
+static void compile_item(awkcomp_t *cs, awkmem_ptr_t p) {
+  awkmem_ptr_t pat, act;
+  int skip = -1, in = -1, s;
+
+  pat = CHILD(cs, p, 0);
+  act = CHILD(cs, p, 1);
+  cs->lineno = NODE(cs, p)->lineno;
+  if( NODE(cs, pat)->id == aRANGE ) {
+    /* the range state is kept in a hidden global */
+    s = cs->vm->nglobals++;
+    jump(cs, oJT, s, &in);
+    compile_cond(cs, CHILD(cs, pat, 0), FALSE, &skip);
+    emit(cs, oLOADI, s, 1, 0, 0);
+    patch(cs, in, cs->vm->ic);
+    in = -1;
+    compile_cond(cs, CHILD(cs, pat, 1), FALSE, &in);
+    emit(cs, oLOADI, s, 0, 0, 0);
+    patch(cs, in, cs->vm->ic);
+  } else if( !empty_node(cs, pat) ) {
+    compile_cond(cs, pat, FALSE, &skip);
+  }
+  cs->ntmp = 0;
+  if( empty_node(cs, act) ) {
+    emit(cs, oPRINT, 0, 0, 0, 0);
+  } else {
+    compile_stmt(cs, act);
+  }
+  patch(cs, skip, cs->vm->ic);
+}
+
+static int new_block(awkvm_t *vm) {
+  codeblock_t cb;
+  create_codeblock(&cb);
+  cb.codestart = vm->ic;
+  if( !push_objstack(&vm->codeblocks, (byte_t *)&cb, sizeof(codeblock_t)) ) {
+    errormsg(E_FATAL, "out of memory.\n");
+  }
+  return vm->codeblocks.top - 1;
+}
+
+static void end_block(awkcomp_t *cs, int b) {
+  codeblock_t *cb;
+  emit(cs, oRET, 0, 0, 0, 0);
+  cb = getblock_awkvm(cs->vm, b);
+  cb->nregs = cs->maxtmp;
+  cs->ntmp = cs->maxtmp = 0;
+}
+
+/* which function parameters are arrays: those used as arrays in the
+   body, or passed on to array parameters */
+static bool_t scan_arrays(awkcomp_t *cs, awkmem_ptr_t p) {
+  awkast_node_t *n;
+  awkmem_ptr_t q, arr = AWKMEM_NULL;
+  symrec_t *sr;
+  codeblock_t *cb;
+  bool_t changed = FALSE;
+  int i, k;
+
+  if( empty_node(cs, p) ) {
+    return FALSE;
+  }
+  n = NODE(cs, p);
+  switch(n->id) {
+  case aINDEX:
+  case aIN:
+  case aDELETE:
+    arr = CHILD(cs, p, 0);
+    break;
+  case aFORIN:
+    arr = CHILD(cs, p, 1);
+    break;
+  case aBCALL:
+    if( (int)NODE(cs, CHILD(cs, p, 0))->chi.ptr == bSPLIT ) {
+      arr = CHILD(cs, p, 2);
+    }
+    break;
+  case aCALL:
+    sr = getsym_awkvm(cs->vm, NODE(cs, CHILD(cs, p, 0))->chi.sym);
+    if( sr && (sr->type == symFUNCTION) ) {
+      cb = getblock_awkvm(cs->vm, sr->index);
+      for(q = CHILD(cs, p, 1), i = 0; (q != AWKMEM_NULL) && (i < cb->nparams);
+	  q = NODE(cs, q)->sib.ptr, i++) {
+	if( cb->arrays[i] && (NODE(cs, q)->id == aNAME) ) {
+	  k = varreg_param(cs, NODE(cs, q)->chi.sym);
+	  if( (k >= 0) && !cs->fun->arrays[k] ) {
+	    cs->fun->arrays[k] = TRUE;
+	    changed = TRUE;
+	  }
+	}
+      }
+    }
+    break;
+  default:
+    break;
+  }
+  if( (arr != AWKMEM_NULL) && (NODE(cs, arr)->id == aNAME) ) {
+    i = varreg_param(cs, NODE(cs, arr)->chi.sym);
+    if( (i >= 0) && !cs->fun->arrays[i] ) {
+      cs->fun->arrays[i] = TRUE;
+      changed = TRUE;
+    }
+  }
+  if( n->id > aGETLINE ) {
+    for(q = n->chi.ptr; q != AWKMEM_NULL; q = NODE(cs, q)->sib.ptr) {
+      changed |= scan_arrays(cs, q);
+    }
+  }
+  return changed;
+}
+
+static void default_globals(awkvm_t *vm) {
+  awkvar_t *g = vm->globals;
+  setkeep_awkvar(&g[vFS], " ", 1);
+  setkeep_awkvar(&g[vOFS], " ", 1);
+  setkeep_awkvar(&g[vORS], "\n", 1);
+  setkeep_awkvar(&g[vSUBSEP], "\034", 1);
+  setkeep_awkvar(&g[vCONVFMT], "%.6g", 4);
+  setkeep_awkvar(&g[vOFMT], "%.6g", 4);
+  setkeep_awkvar(&g[vFILENAME], "", 0);
+  setkeep_awkvar(&g[vPATH], "", 0);
+  setnum_awkvar(&g[vNR], 0);
+  setnum_awkvar(&g[vNF], 0);
+  setnum_awkvar(&g[vFNR], 0);
+  setnum_awkvar(&g[vRSTART], 0);
+  setnum_awkvar(&g[vRLENGTH], -1);
+}
+
+static awkvar_t *alloc_vars_awkvm(size_t n) {
+  awkvar_t *v;
+  size_t i;
+  v = (awkvar_t *)malloc(n * sizeof(awkvar_t));
+  if( !v ) {
+    errormsg(E_FATAL, "out of memory.\n");
+  }
+  for(i = 0; i < n; i++) {
+    create_awkvar(&v[i]);
+  }
+  return v;
+}
+
+bool_t compile_awkvm(awkvm_t *vm) {
+  awkcomp_t cs;
+  awkmem_ptr_t p, q;
+  awkast_node_t *n;
+  symrec_t *sr;
+  codeblock_t *cb;
+  bool_t changed;
+  int b;
+
+  if( !vm ) {
+    return FALSE;
+  }
+  memset(&cs, 0, sizeof(awkcomp_t));
+  cs.vm = vm;
+  vm->nsyms = vm->nglobals = vm->sym.last + 1;
+
+  /* functions first, so that calls can be resolved */
+  for(p = vm->program; p != AWKMEM_NULL; p = NODE(&cs, p)->sib.ptr) {
+    n = NODE(&cs, p);
+    if( n->id == aFUNCTION ) {
+      cs.lineno = n->lineno;
+      sr = getsym_awkvm(vm, NODE(&cs, CHILD(&cs, p, 0))->chi.sym);
+      if( sr->type != symUNDEF ) {
+	fail_compile(&cs, "function name already in use");
+      }
+      b = new_block(vm);
+      sr->type = symFUNCTION;
+      sr->index = b;
+      cb = getblock_awkvm(vm, b);
+      q = CHILD(&cs, p, 2);
+      cb->nparams = empty_node(&cs, q) ? 0 : count_awkast(&vm->ast, q);
+      cb->arrays = (char_t *)calloc(cb->nparams + 1, sizeof(char_t));
+      if( !cb->arrays ) {
+	errormsg(E_FATAL, "out of memory.\n");
+      }
+    }
+  }
+  do {
+    changed = FALSE;
+    for(p = vm->program; p != AWKMEM_NULL; p = NODE(&cs, p)->sib.ptr) {
+      if( NODE(&cs, p)->id == aFUNCTION ) {
+	sr = getsym_awkvm(vm, NODE(&cs, CHILD(&cs, p, 0))->chi.sym);
+	cs.fun = getblock_awkvm(vm, sr->index);
+	cs.params = empty_node(&cs, CHILD(&cs, p, 2)) ? 
+	  AWKMEM_NULL : CHILD(&cs, p, 2);
+	changed |= scan_arrays(&cs, CHILD(&cs, p, 1));
+      }
+    }
+  } while( changed );
+  cs.fun = NULL;
+  cs.params = AWKMEM_NULL;
+
+  vm->cbbegin = new_block(vm);
+  for(p = vm->program; p != AWKMEM_NULL; p = NODE(&cs, p)->sib.ptr) {
+    if( NODE(&cs, p)->id == aBEGIN ) {
+      compile_stmt(&cs, CHILD(&cs, p, 0));
+    }
+  }
+  end_block(&cs, vm->cbbegin);
+
+  vm->cbmain = new_block(vm);
+  for(p = vm->program; p != AWKMEM_NULL; p = NODE(&cs, p)->sib.ptr) {
+    if( NODE(&cs, p)->id == aITEM ) {
+      compile_item(&cs, p);
+      vm->nitems++;
+    }
+  }
+  end_block(&cs, vm->cbmain);
+
+  vm->cbend = new_block(vm);
+  for(p = vm->program; p != AWKMEM_NULL; p = NODE(&cs, p)->sib.ptr) {
+    if( NODE(&cs, p)->id == aEND ) {
+      compile_stmt(&cs, CHILD(&cs, p, 0));
+      vm->nend++;
+    }
+  }
+  end_block(&cs, vm->cbend);
+
+  for(p = vm->program; p != AWKMEM_NULL; p = NODE(&cs, p)->sib.ptr) {
+    if( NODE(&cs, p)->id == aFUNCTION ) {
+      sr = getsym_awkvm(vm, NODE(&cs, CHILD(&cs, p, 0))->chi.sym);
+      b = sr->index;
+      cs.fun = getblock_awkvm(vm, b);
+      cs.fun->codestart = vm->ic;
+      cs.params = empty_node(&cs, CHILD(&cs, p, 2)) ? 
+	AWKMEM_NULL : CHILD(&cs, p, 2);
+      cs.ntmp = cs.maxtmp = cs.fun->nparams;
+      compile_stmt(&cs, CHILD(&cs, p, 1));
+      end_block(&cs, b);
+    }
+  }
+  cs.fun = NULL;
+
+  vm->nstatic = vm->nregex;
+  vm->globals = alloc_vars_awkvm(vm->nglobals);
+  default_globals(vm);
+  return TRUE;
+}
+
+/*
+ * The run time.
+ */
+
+#define REG(r) (((r) >= 0) ? &vm->globals[r] : &vm->stack[vm->fp + SLOT(r)])
+#define CONVFMT (str_awkvar(&vm->globals[vCONVFMT], "%.6g"))
+
+static awkvar_t nofield = { AWKVAR_UNDEF, 0.0, "", 0, NULL, 0, NULL };
+
+static void fail_run(awkinsn_t *i, const char *what) {
+  errormsg(E_FATAL, "%s (program line %d)\n", what, i ? i->lineno : 0);
+}
+
+static char_t *scratch_awkvm(awkvm_t *vm, size_t n) {
+  while( n + 1 > vm->maxscratch ) {
+    if( !grow_mem(&vm->scratch, &vm->maxscratch, sizeof(char_t), 256) ) {
+      errormsg(E_FATAL, "out of memory.\n");
+    }
+  }
+  return vm->scratch;
+}
+
+static void ensure_vars_awkvm(awkvar_t **v, size_t *max, size_t n) {
+  size_t i, old;
+  while( n > *max ) {
+    old = *max;
+    if( !grow_mem(v, max, sizeof(awkvar_t), 16) ) {
+      errormsg(E_FATAL, "out of memory.\n");
+    }
+    for(i = (*v && (old > 0)) ? old : 0; i < *max; i++) {
+      create_awkvar(&(*v)[i]);
+    }
+  }
+}
+
+static int append_regex_awkvm(awkvm_t *vm, const char_t *pattern) {
+  awkregex_t *r;
+  char_t buf[128];
+  int e;
+  if( vm->nregex >= vm->maxregex ) {
+    if( !grow_mem(&vm->regex, &vm->maxregex, sizeof(awkregex_t), 16) ) {
+      errormsg(E_FATAL, "out of memory.\n");
+    }
+  }
+  r = &vm->regex[vm->nregex];
+  e = regcomp(&r->re, pattern, REG_EXTENDED);
+  if( e != 0 ) {
+    regerror(e, &r->re, buf, sizeof(buf));
+    errormsg(E_FATAL, "bad regular expression /%s/: %s\n", pattern, buf);
+  }
+  r->pattern = dup_string(pattern, pattern + strlen(pattern));
+  return vm->nregex++;
+}
+
+static int add_regex_awkvm(awkvm_t *vm, const char_t *pattern) {
+  size_t i;
+  for(i = 0; i < vm->nregex; i++) {
+    if( strcmp(vm->regex[i].pattern, pattern) == 0 ) {
+      return i;
+    }
+  }
+  return append_regex_awkvm(vm, pattern);
+}
+
+/* dynamic regexes are cached, up to AWKVM_MAXREGEX at a time */
+static regex_t *find_regex_awkvm(awkvm_t *vm, const char_t *pattern) {
+  size_t i;
+  int k;
+  for(i = vm->nregex; i-- > 0; ) {
+    if( strcmp(vm->regex[i].pattern, pattern) == 0 ) {
+      return &vm->regex[i].re;
+    }
+  }
+  if( vm->nregex - vm->nstatic >= AWKVM_MAXREGEX ) {
+    while( vm->nregex > vm->nstatic ) {
+      vm->nregex--;
+      free(vm->regex[vm->nregex].pattern);
+      regfree(&vm->regex[vm->nregex].re);
+    }
+  }
+  k = append_regex_awkvm(vm, pattern);
+  return &vm->regex[k].re;
+}
+
+static awkarray_t *getarray_awkvm(awkinsn_t *i, awkvar_t *v) {
+  awkarray_t *a;
+  if( checkflag(v->type,AWKVAR_ARRAY) ) {
+    return (awkarray_t *)v->obj;
+  } else if( !checkflag(v->type,AWKVAR_VALUE) ) {
+    clear_awkvar(v);
+    a = (awkarray_t *)malloc(sizeof(awkarray_t));
+    if( !a || !create_awkarray(a) ) {
+      errormsg(E_FATAL, "out of memory.\n");
+    }
+    v->type = AWKVAR_ARRAY;
+    v->obj = a;
+    return a;
+  }
+  fail_run(i, "scalar used as an array");
+  return NULL;
+}
+
+static void push_span_awkvm(awkvm_t *vm, size_t *n, size_t b, size_t e) {
+  if( 2 * (*n + 1) > vm->maxspans ) {
+    if( !grow_mem(&vm->spans, &vm->maxspans, sizeof(size_t), 64) ) {
+      errormsg(E_FATAL, "out of memory.\n");
+    }
+  }
+  vm->spans[2 * *n] = b;
+  vm->spans[2 * *n + 1] = e;
+  (*n)++;
+}
+
+/* cuts s into fields according to fs, see vm->spans */
+static size_t split_awkvm(awkvm_t *vm, const char_t *s, size_t len, 
+			  awkvar_t *fs) {
+  const char_t *f;
+  regex_t *re;
+  regmatch_t m;
+  size_t n = 0, pos, b;
+  f = str_awkvar(fs, CONVFMT);
+  if( len == 0 ) {
+    return 0;
+  } else if( fs->len == 0 ) {
+    for(pos = 0; pos < len; pos++) {
+      push_span_awkvm(vm, &n, pos, pos + 1);
+    }
+  } else if( (fs->len == 1) && (*f == ' ') ) {
+    pos = 0;
+    for(;;) {
+      while( (pos < len) && isspace(s[pos]) ) {
+	pos++;
+      }
+      if( pos >= len ) {
+	break;
+      }
+      b = pos;
+      while( (pos < len) && !isspace(s[pos]) ) {
+	pos++;
+      }
+      push_span_awkvm(vm, &n, b, pos);
+    }
+  } else if( fs->len == 1 ) {
+    for(b = pos = 0; pos < len; pos++) {
+      if( s[pos] == *f ) {
+	push_span_awkvm(vm, &n, b, pos);
+	b = pos + 1;
+      }
+    }
+    push_span_awkvm(vm, &n, b, len);
+  } else {
+    re = find_regex_awkvm(vm, f);
+    pos = 0;
+    while( (regexec(re, s + pos, 1, &m, (pos > 0) ? REG_NOTBOL : 0) == 0) &&
+	   (m.rm_eo > m.rm_so) ) {
+      push_span_awkvm(vm, &n, pos, pos + m.rm_so);
+      pos += m.rm_eo;
+    }
+    push_span_awkvm(vm, &n, pos, len);
+  }
+  return n;
+}
+
+static void split_record_awkvm(awkvm_t *vm) {
+  const char_t *s;
+  size_t len, n, i, b, e;
+  if( !checkflag(vm->flags,AWKVM_FIELDS) ) {
+    s = str_awkvar(&vm->fields[0], CONVFMT);
+    len = vm->fields[0].len;
+    n = split_awkvm(vm, s, len, &vm->globals[vFS]);
+    while( len + 1 > vm->maxfbuf ) {
+      if( !grow_mem(&vm->fbuf, &vm->maxfbuf, sizeof(char_t), 256) ) {
+	errormsg(E_FATAL, "out of memory.\n");
+      }
+    }
+    memcpy(vm->fbuf, s, len);
+    ensure_vars_awkvm(&vm->fields, &vm->maxfields, n + 1);
+    for(i = 0; i < n; i++) {
+      b = vm->spans[2 * i];
+      e = vm->spans[2 * i + 1];
+      vm->fbuf[e] = '\0';
+      setfield_awkvar(&vm->fields[i + 1], vm->fbuf + b, e - b);
+    }
+    vm->nf = n;
+    setnum_awkvar(&vm->globals[vNF], n);
+    setflag(&vm->flags,AWKVM_FIELDS);
+  }
+}
+
+static awkvar_t *get_field_awkvm(awkvm_t *vm, awkinsn_t *i, int n) {
+  if( n == 0 ) {
+    return &vm->fields[0];
+  } else if( n < 0 ) {
+    fail_run(i, "negative field number");
+  }
+  split_record_awkvm(vm);
+  return (n <= vm->nf) ? &vm->fields[n] : &nofield;
+}
+
+/* $0 is rebuilt from the fields with OFS */
+static void rebuild_record_awkvm(awkvm_t *vm) {
+  awkvar_t *ofs = &vm->globals[vOFS];
+  size_t len = 0;
+  char_t *p;
+  int k;
+  str_awkvar(ofs, CONVFMT);
+  for(k = 1; k <= vm->nf; k++) {
+    str_awkvar(&vm->fields[k], CONVFMT);
+    len += vm->fields[k].len + ((k > 1) ? ofs->len : 0);
+  }
+  p = scratch_awkvm(vm, len);
+  for(k = 1; k <= vm->nf; k++) {
+    if( k > 1 ) {
+      memcpy(p, ofs->string, ofs->len);
+      p += ofs->len;
+    }
+    memcpy(p, vm->fields[k].string, vm->fields[k].len);
+    p += vm->fields[k].len;
+  }
+  setstr_awkvar(&vm->fields[0], vm->scratch, len);
+}
+
+static void extend_fields_awkvm(awkvm_t *vm, int n) {
+  ensure_vars_awkvm(&vm->fields, &vm->maxfields, n + 1);
+  while( vm->nf < n ) {
+    vm->nf++;
+    clear_awkvar(&vm->fields[vm->nf]);
+  }
+  vm->nf = n;
+  setnum_awkvar(&vm->globals[vNF], n);
+}
+
+static void set_field_awkvm(awkvm_t *vm, awkinsn_t *i, int n, awkvar_t *v) {
+  const char_t *s;
+  if( n == 0 ) {
+    if( v != &vm->fields[0] ) {
+      s = str_awkvar(v, CONVFMT);
+      setstr_awkvar(&vm->fields[0], s, v->len);
+    }
+    clearflag(&vm->flags,AWKVM_FIELDS);
+  } else if( n < 0 ) {
+    fail_run(i, "negative field number");
+  } else {
+    split_record_awkvm(vm);
+    if( n > vm->nf ) {
+      extend_fields_awkvm(vm, n);
+    }
+    copy_awkvar(&vm->fields[n], v);
+    rebuild_record_awkvm(vm);
+  }
+}
+
+static void setnf_awkvm(awkvm_t *vm, awkinsn_t *i) {
+  int n = (int)num_awkvar(&vm->globals[vNF]);
+  if( n < 0 ) {
+    fail_run(i, "negative field number");
+  }
+  split_record_awkvm(vm);
+  extend_fields_awkvm(vm, n);
+  rebuild_record_awkvm(vm);
+}
+
+static FILE *output_awkvm(awkvm_t *vm, awkinsn_t *i, int mode, awkvar_t *target) {
+  const char_t *name;
+  awkoutput_t *o;
+  FILE *fp;
+  size_t k;
+  name = str_awkvar(target, CONVFMT);
+  for(k = 0; k < vm->noutputs; k++) {
+    if( strcmp(vm->outputs[k].name, name) == 0 ) {
+      return vm->outputs[k].fp;
+    }
+  }
+  if( (strcmp(name, "/dev/stdout") == 0) || (strcmp(name, "-") == 0) ) {
+    return NULL;
+  } else if( strcmp(name, "/dev/stderr") == 0 ) {
+    return stderr;
+  }
+  flush_stdout();
+  fp = (mode == 3) ? popen(name, "w") : fopen(name, (mode == 2) ? "a" : "w");
+  if( !fp ) {
+    errormsg(E_FATAL, "cannot open \"%s\" for output (program line %d)\n", 
+	     name, i->lineno);
+  }
+  if( vm->noutputs >= vm->maxoutputs ) {
+    if( !grow_mem(&vm->outputs, &vm->maxoutputs, sizeof(awkoutput_t), 4) ) {
+      errormsg(E_FATAL, "out of memory.\n");
+    }
+  }
+  o = &vm->outputs[vm->noutputs++];
+  o->name = dup_string(name, name + strlen(name));
+  o->fp = fp;
+  o->pipe = (mode == 3);
+  return fp;
+}
+
+static int close_output_awkvm(awkvm_t *vm, size_t k) {
+  int status;
+  awkoutput_t *o = &vm->outputs[k];
+  if( o->pipe ) {
+    status = pclose(o->fp);
+    status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  } else {
+    status = fclose(o->fp);
+  }
+  free(o->name);
+  *o = vm->outputs[--vm->noutputs];
+  return status;
+}
+
+static void write_awkvm(FILE *fp, const char_t *buf, size_t len) {
+  if( fp ) {
+    fwrite(buf, sizeof(char_t), len, fp);
+  } else {
+    write_stdout((const byte_t *)buf, len);
+  }
+}
+
+static void print_value_awkvm(awkvm_t *vm, FILE *fp, awkvar_t *v) {
+  char_t buf[64];
+  size_t n;
+  if( checkflag(v->type,AWKVAR_NUMBER) && !checkflag(v->type,AWKVAR_STRING) ) {
+    n = numtostr_awk(buf, sizeof(buf), v->number, 
+		     str_awkvar(&vm->globals[vOFMT], "%.6g"));
+    write_awkvm(fp, buf, MIN(n, sizeof(buf) - 1));
+  } else {
+    str_awkvar(v, CONVFMT);
+    write_awkvm(fp, v->string, v->len);
+  }
+}
+
+/* printf style formatting into vm->scratch, returns the length */
+static size_t format_awkvm(awkvm_t *vm, int first, int n) {
+  awkvar_t *fmt, *v;
+  const char_t *f, *fend, *s;
+  char spec[64], *q;
+  size_t len = 0;
+  int k = 1, m;
+  char_t conv;
+
+  fmt = REG(first);
+  f = str_awkvar(fmt, CONVFMT);
+  fend = f + fmt->len;
+  scratch_awkvm(vm, fmt->len);
+  while( f < fend ) {
+    if( (*f != '%') || (f + 1 >= fend) ) {
+      scratch_awkvm(vm, len + 1);
+      vm->scratch[len++] = *f++;
+      continue;
+    } else if( f[1] == '%' ) {
+      scratch_awkvm(vm, len + 1);
+      vm->scratch[len++] = '%';
+      f += 2;
+      continue;
+    }
+    q = spec;
+    *q++ = *f++;
+    while( (f < fend) && strchr("-+ #0", *f) && (q < spec + 8) ) {
+      *q++ = *f++;
+    }
+    if( (f < fend) && (*f == '*') ) {
+      v = (k < n) ? REG(first - k) : &nofield;
+      k++;
+      q += sprintf(q, "%d", (int)num_awkvar(v));
+      f++;
+    }
+    while( (f < fend) && isdigit(*f) && (q < spec + 24) ) {
+      *q++ = *f++;
+    }
+    if( (f < fend) && (*f == '.') ) {
+      *q++ = *f++;
+      if( (f < fend) && (*f == '*') ) {
+	v = (k < n) ? REG(first - k) : &nofield;
+	k++;
+	q += sprintf(q, "%d", (int)num_awkvar(v));
+	f++;
+      }
+      while( (f < fend) && isdigit(*f) && (q < spec + 48) ) {
+	*q++ = *f++;
+      }
+    }
+    while( (f < fend) && strchr("hlLqjzt", *f) ) {
+      f++;
+    }
+    if( f >= fend ) {
+      break;
+    }
+    conv = *f++;
+    v = (k < n) ? REG(first - k) : &nofield;
+    k++;
+    switch(conv) {
+    case 'd': case 'i':
+      strcpy(q, "lld");
+      m = snprintf(NULL, 0, spec, (long long)num_awkvar(v));
+      scratch_awkvm(vm, len + m);
+      snprintf(vm->scratch + len, m + 1, spec, (long long)num_awkvar(v));
+      break;
+    case 'o': case 'u': case 'x': case 'X':
+      q[0] = 'l'; q[1] = 'l'; q[2] = conv; q[3] = '\0';
+      m = snprintf(NULL, 0, spec, 
+		   (unsigned long long)(long long)num_awkvar(v));
+      scratch_awkvm(vm, len + m);
+      snprintf(vm->scratch + len, m + 1, spec, 
+	       (unsigned long long)(long long)num_awkvar(v));
+      break;
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': 
+    case 'a': case 'A':
+      q[0] = conv; q[1] = '\0';
+      m = snprintf(NULL, 0, spec, (double)num_awkvar(v));
+      scratch_awkvm(vm, len + m);
+      snprintf(vm->scratch + len, m + 1, spec, (double)num_awkvar(v));
+      break;
+    case 'c':
+      q[0] = 'c'; q[1] = '\0';
+      if( checkflag(v->type,AWKVAR_NUMBER) && 
+	  !checkflag(v->type,AWKVAR_STRING) ) {
+	m = (int)num_awkvar(v);
+      } else {
+	s = str_awkvar(v, CONVFMT);
+	m = (unsigned char)*s;
+      }
+      conv = (char_t)m;
+      m = snprintf(NULL, 0, spec, conv);
+      scratch_awkvm(vm, len + m);
+      snprintf(vm->scratch + len, m + 1, spec, conv);
+      break;
+    case 's':
+      q[0] = 's'; q[1] = '\0';
+      s = str_awkvar(v, CONVFMT);
+      m = snprintf(NULL, 0, spec, s);
+      scratch_awkvm(vm, len + m);
+      snprintf(vm->scratch + len, m + 1, spec, s);
+      break;
+    default:
+      k--;
+      *q = '\0';
+      m = strlen(spec);
+      scratch_awkvm(vm, len + m + 1);
+      memcpy(vm->scratch + len, spec, m);
+      vm->scratch[len + m] = conv;
+      m++;
+      break;
+    }
+    len += (m > 0) ? m : 0;
+  }
+  scratch_awkvm(vm, len);
+  vm->scratch[len] = '\0';
+  return len;
+}
+
+static regex_t *regex_arg_awkvm(awkvm_t *vm, awkvar_t *v) {
+  return find_regex_awkvm(vm, str_awkvar(v, CONVFMT));
+}
+
+static awknum_t round_awk(awknum_t x) {
+  return floor(x + 0.5);
+}
+
+/* sub() and gsub(), the result is left in vm->scratch */
+static int substitute_awkvm(awkvm_t *vm, regex_t *re, awkvar_t *repl, 
+			    const char_t *t, size_t tlen, bool_t global, 
+			    size_t *outlen) {
+  const char_t *r;
+  regmatch_t m;
+  size_t pos = 0, len = 0, so, eo, lastend = (size_t)-1, k;
+  int count = 0;
+
+  r = str_awkvar(repl, CONVFMT);
+  scratch_awkvm(vm, tlen);
+  while( pos <= tlen ) {
+    if( regexec(re, t + pos, 1, &m, (pos > 0) ? REG_NOTBOL : 0) != 0 ) {
+      break;
+    }
+    so = pos + m.rm_so;
+    eo = pos + m.rm_eo;
+    scratch_awkvm(vm, len + (so - pos));
+    memcpy(vm->scratch + len, t + pos, so - pos);
+    len += so - pos;
+    if( (eo > so) || (so != lastend) ) {
+      /* an empty match right after a match is not replaced */
+      for(k = 0; k < repl->len; k++) {
+	if( (r[k] == '\\') && (k + 1 < repl->len) && 
+	    ((r[k + 1] == '&') || (r[k + 1] == '\\')) ) {
+	  scratch_awkvm(vm, len + 1);
+	  vm->scratch[len++] = r[++k];
+	} else if( r[k] == '&' ) {
+	  scratch_awkvm(vm, len + (eo - so));
+	  memcpy(vm->scratch + len, t + so, eo - so);
+	  len += eo - so;
+	} else {
+	  scratch_awkvm(vm, len + 1);
+	  vm->scratch[len++] = r[k];
+	}
+      }
+      count++;
+    }
+    lastend = eo;
+    if( eo == so ) {
+      if( so < tlen ) {
+	scratch_awkvm(vm, len + 1);
+	vm->scratch[len++] = t[so];
+      }
+      pos = so + 1;
+    } else {
+      pos = eo;
+    }
+    if( !global ) {
+      break;
+    }
+  }
+  if( pos < tlen ) {
+    scratch_awkvm(vm, len + (tlen - pos));
+    memcpy(vm->scratch + len, t + pos, tlen - pos);
+    len += tlen - pos;
+  }
+  *outlen = len;
+  return count;
+}
+
+static void flush_outputs_awkvm(awkvm_t *vm) {
+  size_t k;
+  flush_stdout();
+  for(k = 0; k < vm->noutputs; k++) {
+    fflush(vm->outputs[k].fp);
+  }
+}
+
+/* the arguments are in registers a, a-1, ..., the result goes in a */
+static void builtin_awkvm(awkvm_t *vm, awkinsn_t *i) {
+  awkvar_t *r, *arg[3];
+  const char_t *s, *t;
+  regex_t *re;
+  regmatch_t m;
+  awknum_t x, y;
+  size_t len, k;
+  int n;
+
+  r = REG(i->a);
+  for(n = 0; n < 3; n++) {
+    arg[n] = (n < i->c) ? REG(i->a - n) : &nofield;
+  }
+  switch(i->b) {
+  case bLENGTH:
+    if( checkflag(r->type,AWKVAR_ARRAY) ) {
+      x = ((awkarray_t *)r->obj)->ncells;
+    } else {
+      str_awkvar(r, CONVFMT);
+      x = r->len;
+    }
+    setnum_awkvar(r, x);
+    break;
+  case bSUBSTR:
+    s = str_awkvar(arg[0], CONVFMT);
+    len = arg[0]->len;
+    x = round_awk(num_awkvar(arg[1]));
+    y = (i->c > 2) ? x + round_awk(num_awkvar(arg[2])) : (awknum_t)len + 1;
+    x = (x < 1) ? 1 : x;
+    y = (y > len + 1) ? len + 1 : y;
+    if( y > x ) {
+      setstr_awkvar(r, s + (size_t)x - 1, (size_t)(y - x));
+    } else {
+      setstr_awkvar(r, "", 0);
+    }
+    break;
+  case bINDEX:
+    s = str_awkvar(arg[0], CONVFMT);
+    t = strstr(s, str_awkvar(arg[1], CONVFMT));
+    setnum_awkvar(r, t ? (t - s + 1) : 0);
+    break;
+  case bSUB:
+  case bGSUB:
+    re = regex_arg_awkvm(vm, arg[0]);
+    s = str_awkvar(arg[2], CONVFMT);
+    n = substitute_awkvm(vm, re, arg[1], s, arg[2]->len, 
+			 (i->b == bGSUB), &len);
+    if( n > 0 ) {
+      setstr_awkvar(arg[2], vm->scratch, len);
+    }
+    setnum_awkvar(r, n);
+    break;
+  case bMATCH:
+    re = regex_arg_awkvm(vm, arg[1]);
+    s = str_awkvar(arg[0], CONVFMT);
+    if( regexec(re, s, 1, &m, 0) == 0 ) {
+      setnum_awkvar(&vm->globals[vRSTART], m.rm_so + 1);
+      setnum_awkvar(&vm->globals[vRLENGTH], m.rm_eo - m.rm_so);
+    } else {
+      setnum_awkvar(&vm->globals[vRSTART], 0);
+      setnum_awkvar(&vm->globals[vRLENGTH], -1);
+    }
+    copy_awkvar(r, &vm->globals[vRSTART]);
+    break;
+  case bSPRINTF:
+    len = format_awkvm(vm, i->a, i->c);
+    setstr_awkvar(r, vm->scratch, len);
+    break;
+  case bSIN:
+    setnum_awkvar(r, sin(num_awkvar(arg[0])));
+    break;
+  case bCOS:
+    setnum_awkvar(r, cos(num_awkvar(arg[0])));
+    break;
+  case bATAN2:
+    setnum_awkvar(r, atan2(num_awkvar(arg[0]), num_awkvar(arg[1])));
+    break;
+  case bEXP:
+    setnum_awkvar(r, exp(num_awkvar(arg[0])));
+    break;
+  case bLOG:
+    setnum_awkvar(r, log(num_awkvar(arg[0])));
+    break;
+  case bSQRT:
+    setnum_awkvar(r, sqrt(num_awkvar(arg[0])));
+    break;
+  case bINT:
+    x = num_awkvar(arg[0]);
+    setnum_awkvar(r, (x < 0) ? ceil(x) : floor(x));
+    break;
+  case bRAND:
+    setnum_awkvar(r, random() / ((awknum_t)RAND_MAX + 1.0));
+    break;
+  case bSRAND:
+    x = vm->seed;
+    vm->seed = (i->c > 0) ? num_awkvar(arg[0]) : (awknum_t)time(NULL);
+    srandom((unsigned int)vm->seed);
+    setnum_awkvar(r, x);
+    break;
+  case bTOLOWER:
+  case bTOUPPER:
+    s = str_awkvar(arg[0], CONVFMT);
+    len = arg[0]->len;
+    scratch_awkvm(vm, len);
+    for(k = 0; k < len; k++) {
+      vm->scratch[k] = (i->b == bTOLOWER) ? 
+	tolower((unsigned char)s[k]) : toupper((unsigned char)s[k]);
+    }
+    setstr_awkvar(r, vm->scratch, len);
+    break;
+  case bCLOSE:
+    s = str_awkvar(arg[0], CONVFMT);
+    n = -1;
+    for(k = 0; k < vm->noutputs; k++) {
+      if( strcmp(vm->outputs[k].name, s) == 0 ) {
+	n = close_output_awkvm(vm, k);
+	break;
+      }
+    }
+    setnum_awkvar(r, n);
+    break;
+  case bSYSTEM:
+    flush_outputs_awkvm(vm);
+    n = system(str_awkvar(arg[0], CONVFMT));
+    setnum_awkvar(r, (n == -1) ? -1 : 
+		  (WIFEXITED(n) ? WEXITSTATUS(n) : 256 + WTERMSIG(n)));
+    break;
+  case bFFLUSH:
+    flush_outputs_awkvm(vm);
+    setnum_awkvar(r, 0);
+    break;
+  default:
+    fail_run(i, "unknown builtin function");
+  }
+}
+
+/* split(s, a, fs) */
+static void split_builtin_awkvm(awkvm_t *vm, awkinsn_t *i) {
+  awkvar_t *r, *v, *fs;
+  awkarray_t *a;
+  const char_t *s;
+  char_t key[32];
+  size_t n, k, len, b, e;
+
+  r = REG(i->a);
+  a = getarray_awkvm(i, REG(i->b));
+  fs = i->d ? REG(i->c) : &vm->globals[vFS];
+  s = str_awkvar(r, CONVFMT);
+  len = r->len;
+  /* the array may own the string */
+  memcpy(scratch_awkvm(vm, len), s, len);
+  vm->scratch[len] = '\0';
+  clear_awkarray(a);
+  n = split_awkvm(vm, vm->scratch, len, fs);
+  for(k = 0; k < n; k++) {
+    b = vm->spans[2 * k];
+    e = vm->spans[2 * k + 1];
+    v = find_awkarray(a, key, sprintf(key, "%d", (int)(k + 1)), TRUE);
+    setstr_awkvar(v, vm->scratch + b, e - b);
+    if( looks_numeric_awk(v->string) ) {
+      setflag(&v->type,AWKVAR_STRNUM);
+    }
+  }
+  setnum_awkvar(REG(i->a), n);
+}
+
+static void ensure_stack_awkvm(awkvm_t *vm, size_t n) {
+  ensure_vars_awkvm(&vm->stack, &vm->maxstack, n);
+}
+
+static int run_awkvm(awkvm_t *vm, int pc);
+
+static void call_awkvm(awkvm_t *vm, awkinsn_t *i) {
+  codeblock_t *cb;
+  awkvar_t *arg, *p;
+  int k, savefp, savenregs, newfp;
+
+  if( ++vm->depth > AWKCALL_MAX ) {
+    fail_run(i, "function calls nested too deeply");
+  }
+  cb = getblock_awkvm(vm, i->b);
+  newfp = vm->fp + vm->nregs;
+  ensure_stack_awkvm(vm, newfp + cb->nregs);
+  for(k = 0; k < cb->nregs; k++) {
+    p = &vm->stack[newfp + k];
+    clear_awkvar(p);
+    if( k < i->d ) {
+      arg = REG(i->c - k);
+      if( checkflag(arg->type,AWKVAR_ARRAY) ) {
+	p->type = AWKVAR_ARRAY|AWKVAR_REF;
+	p->obj = arg->obj;
+      } else {
+	copy_awkvar(p, arg);
+      }
+    }
+  }
+  savefp = vm->fp;
+  savenregs = vm->nregs;
+  vm->fp = newfp;
+  vm->nregs = cb->nregs;
+  clear_awkvar(&vm->retval);
+  if( run_awkvm(vm, cb->codestart) == AWKRUN_NEXT ) {
+    fail_run(i, "next called from a function");
+  }
+  for(k = 0; k < cb->nregs; k++) {
+    clear_awkvar(&vm->stack[newfp + k]);
+  }
+  vm->fp = savefp;
+  vm->nregs = savenregs;
+  vm->depth--;
+  copy_awkvar(REG(i->a), &vm->retval);
+}
+
+static bool_t xpath_awkvm(awkvm_t *vm, const char_t *pattern) {
+  const char_t *path = str_awkvar(&vm->globals[vPATH], CONVFMT);
+  return (match_no_att_no_pred_xpath(pattern, NULL, path) == 0);
+}
+
+static const char_t *key_awkvm(awkvm_t *vm, int r, size_t *klen) {
+  awkvar_t *k = REG(r);
+  const char_t *s = str_awkvar(k, CONVFMT);
+  *klen = k->len;
+  return s;
+}
+
+/* the interpreter, returns one of AWKRUN_OK, AWKRUN_NEXT, AWKRUN_EXIT */
+static int run_awkvm(awkvm_t *vm, int pc) {
+  awkinsn_t *i;
+  awkvar_t *r, *a, *b;
+  awkarray_t *arr;
+  awkiter_t *it;
+  awkconst_t *c;
+  const char_t *s;
+  size_t len, klen;
+  awknum_t x, y;
+  FILE *fp;
+  int k;
+
+  for(;;) {
+    i = INSN(vm, pc++);
+    switch(i->op) {
+    case oNOP:
+      break;
+    case oLOADNUM:
+      setnum_awkvar(REG(i->a), 
+		    get_number_awkconstmgr(&vm->constants, i->b));
+      break;
+    case oLOADSTR:
+      c = get_awkconstmgr(&vm->constants, i->b);
+      setkeep_awkvar(REG(i->a), c->strval, c->len);
+      break;
+    case oLOADI:
+      setnum_awkvar(REG(i->a), i->b);
+      break;
+    case oMOVE:
+      b = REG(i->b);
+      r = REG(i->a);
+      if( checkflag(b->type,AWKVAR_ARRAY) ) {
+	if( !i->c ) {
+	  fail_run(i, "array used as a scalar");
+	}
+	clear_awkvar(r);
+	r->type = AWKVAR_ARRAY|AWKVAR_REF;
+	r->obj = b->obj;
+	break;
+      }
+      if( checkflag(r->type,AWKVAR_ARRAY) ) {
+	fail_run(i, "array used as a scalar");
+      }
+      copy_awkvar(r, b);
+      break;
+    case oCLEAR:
+      clear_awkvar(REG(i->a));
+      break;
+    case oADD:
+      setnum_awkvar(REG(i->a), num_awkvar(REG(i->b)) + num_awkvar(REG(i->c)));
+      break;
+    case oSUB:
+      setnum_awkvar(REG(i->a), num_awkvar(REG(i->b)) - num_awkvar(REG(i->c)));
+      break;
+    case oMUL:
+      setnum_awkvar(REG(i->a), num_awkvar(REG(i->b)) * num_awkvar(REG(i->c)));
+      break;
+    case oDIV:
+      y = num_awkvar(REG(i->c));
+      if( y == 0.0 ) {
+	fail_run(i, "division by zero");
+      }
+      setnum_awkvar(REG(i->a), num_awkvar(REG(i->b)) / y);
+      break;
+    case oMOD:
+      y = num_awkvar(REG(i->c));
+      if( y == 0.0 ) {
+	fail_run(i, "division by zero in %");
+      }
+      setnum_awkvar(REG(i->a), fmod(num_awkvar(REG(i->b)), y));
+      break;
+    case oPOW:
+      setnum_awkvar(REG(i->a), 
+		    pow(num_awkvar(REG(i->b)), num_awkvar(REG(i->c))));
+      break;
+    case oNEG:
+      setnum_awkvar(REG(i->a), -num_awkvar(REG(i->b)));
+      break;
+    case oPLUS:
+      setnum_awkvar(REG(i->a), num_awkvar(REG(i->b)));
+      break;
+    case oNOT:
+      setnum_awkvar(REG(i->a), !true_awkvar(REG(i->b)));
+      break;
+    case oADDI:
+      setnum_awkvar(REG(i->a), num_awkvar(REG(i->b)) + i->c);
+      break;
+    case oCAT:
+      a = REG(i->b);
+      b = REG(i->c);
+      str_awkvar(a, CONVFMT);
+      str_awkvar(b, CONVFMT);
+      len = a->len + b->len;
+      scratch_awkvm(vm, len);
+      memcpy(vm->scratch, a->string, a->len);
+      memcpy(vm->scratch + a->len, b->string, b->len);
+      setstr_awkvar(REG(i->a), vm->scratch, len);
+      break;
+    case oLT: case oLE: case oNE: case oEQ: case oGT: case oGE:
+      k = compare_awkvar(REG(i->b), REG(i->c), CONVFMT);
+      switch(i->op) {
+      case oLT: k = (k < 0); break;
+      case oLE: k = (k <= 0); break;
+      case oNE: k = (k != 0); break;
+      case oEQ: k = (k == 0); break;
+      case oGT: k = (k > 0); break;
+      default: k = (k >= 0); break;
+      }
+      setnum_awkvar(REG(i->a), k);
+      break;
+    case oMATCH:
+      s = str_awkvar(REG(i->b), CONVFMT);
+      k = (regexec(&vm->regex[i->c].re, s, 0, NULL, 0) == 0);
+      setnum_awkvar(REG(i->a), i->d ? !k : k);
+      break;
+    case oMATCHD:
+      s = str_awkvar(REG(i->b), CONVFMT);
+      k = (regexec(regex_arg_awkvm(vm, REG(i->c)), s, 0, NULL, 0) == 0);
+      setnum_awkvar(REG(i->a), i->d ? !k : k);
+      break;
+    case oMATCH0:
+      s = str_awkvar(&vm->fields[0], CONVFMT);
+      k = (regexec(&vm->regex[i->c].re, s, 0, NULL, 0) == 0);
+      setnum_awkvar(REG(i->a), k);
+      break;
+    case oXPATH:
+      s = get_string_awkconstmgr(&vm->constants, i->b);
+      setnum_awkvar(REG(i->a), xpath_awkvm(vm, s));
+      break;
+    case oGETF:
+      x = num_awkvar(REG(i->b));
+      copy_awkvar(REG(i->a), get_field_awkvm(vm, i, (int)x));
+      break;
+    case oGETFI:
+      copy_awkvar(REG(i->a), get_field_awkvm(vm, i, i->b));
+      break;
+    case oSETF:
+      x = num_awkvar(REG(i->a));
+      set_field_awkvm(vm, i, (int)x, REG(i->b));
+      break;
+    case oNF:
+      split_record_awkvm(vm);
+      break;
+    case oSETNF:
+      setnf_awkvm(vm, i);
+      break;
+    case oAGET:
+      s = key_awkvm(vm, i->c, &klen);
+      arr = getarray_awkvm(i, REG(i->b));
+      copy_awkvar(REG(i->a), find_awkarray(arr, s, klen, TRUE));
+      break;
+    case oASET:
+      s = key_awkvm(vm, i->b, &klen);
+      arr = getarray_awkvm(i, REG(i->a));
+      copy_awkvar(find_awkarray(arr, s, klen, TRUE), REG(i->c));
+      break;
+    case oAADD:
+      s = key_awkvm(vm, i->c, &klen);
+      arr = getarray_awkvm(i, REG(i->b));
+      a = find_awkarray(arr, s, klen, TRUE);
+      setnum_awkvar(a, num_awkvar(a) + num_awkvar(REG(i->d)));
+      setnum_awkvar(REG(i->a), a->number);
+      break;
+    case oAIN:
+      s = key_awkvm(vm, i->c, &klen);
+      arr = getarray_awkvm(i, REG(i->b));
+      setnum_awkvar(REG(i->a), find_awkarray(arr, s, klen, FALSE) != NULL);
+      break;
+    case oADEL:
+      s = key_awkvm(vm, i->b, &klen);
+      delete_awkarray(getarray_awkvm(i, REG(i->a)), s, klen);
+      break;
+    case oACLEAR:
+      clear_awkarray(getarray_awkvm(i, REG(i->a)));
+      break;
+    case oAREF:
+      arr = getarray_awkvm(i, REG(i->b));
+      r = REG(i->a);
+      clear_awkvar(r);
+      r->type = AWKVAR_ARRAY|AWKVAR_REF;
+      r->obj = arr;
+      break;
+    case oJOIN:
+      a = REG(i->b);
+      b = REG(i->c);
+      r = &vm->globals[vSUBSEP];
+      str_awkvar(a, CONVFMT);
+      str_awkvar(b, CONVFMT);
+      str_awkvar(r, CONVFMT);
+      len = a->len + r->len + b->len;
+      scratch_awkvm(vm, len);
+      memcpy(vm->scratch, a->string, a->len);
+      memcpy(vm->scratch + a->len, r->string, r->len);
+      memcpy(vm->scratch + a->len + r->len, b->string, b->len);
+      setstr_awkvar(REG(i->a), vm->scratch, len);
+      break;
+    case oITERINIT:
+      arr = getarray_awkvm(i, REG(i->b));
+      it = (awkiter_t *)malloc(sizeof(awkiter_t));
+      if( !it || !create_awkiter(it, arr) ) {
+	errormsg(E_FATAL, "out of memory.\n");
+      }
+      r = REG(i->a);
+      clear_awkvar(r);
+      r->type = AWKVAR_ITER;
+      r->obj = it;
+      break;
+    case oITERNEXT:
+      it = (awkiter_t *)REG(i->a)->obj;
+      s = next_awkiter(it, &klen);
+      if( !s ) {
+	pc = i->d;
+      } else {
+	r = REG(i->b);
+	setstr_awkvar(r, s, klen);
+	if( looks_numeric_awk(r->string) ) {
+	  setflag(&r->type,AWKVAR_STRNUM);
+	}
+      }
+      break;
+    case oJMP:
+      pc = i->d;
+      break;
+    case oJT:
+      if( true_awkvar(REG(i->a)) ) {
+	pc = i->d;
+      }
+      break;
+    case oJF:
+      if( !true_awkvar(REG(i->a)) ) {
+	pc = i->d;
+      }
+      break;
+    case oPRINT:
+      fp = i->c ? output_awkvm(vm, i, i->c, REG(i->d)) : NULL;
+      if( i->b == 0 ) {
+	print_value_awkvm(vm, fp, &vm->fields[0]);
+      } else {
+	for(k = 0; k < i->b; k++) {
+	  if( k > 0 ) {
+	    r = &vm->globals[vOFS];
+	    write_awkvm(fp, str_awkvar(r, CONVFMT), r->len);
+	  }
+	  print_value_awkvm(vm, fp, REG(i->a - k));
+	}
+      }
+      r = &vm->globals[vORS];
+      write_awkvm(fp, str_awkvar(r, CONVFMT), r->len);
+      break;
+    case oPRINTF:
+      fp = i->c ? output_awkvm(vm, i, i->c, REG(i->d)) : NULL;
+      if( i->b == 0 ) {
+	fail_run(i, "printf needs a format");
+      }
+      len = format_awkvm(vm, i->a, i->b);
+      write_awkvm(fp, vm->scratch, len);
+      break;
+    case oBUILTIN:
+      builtin_awkvm(vm, i);
+      break;
+    case oSPLIT:
+      split_builtin_awkvm(vm, i);
+      break;
+    case oCALL:
+      call_awkvm(vm, i);
+      if( checkflag(vm->flags,AWKVM_EXIT) ) {
+	return AWKRUN_EXIT;
+      }
+      break;
+    case oRET:
+      if( i->b ) {
+	copy_awkvar(&vm->retval, REG(i->a));
+      }
+      return AWKRUN_OK;
+    case oNEXT:
+      if( checkflag(vm->flags,AWKVM_END) || (vm->depth > 0) ) {
+	fail_run(i, "next used outside a pattern action");
+      }
+      return AWKRUN_NEXT;
+    case oEXIT:
+      if( i->b ) {
+	vm->exitcode = (int)num_awkvar(REG(i->a));
+      }
+      setflag(&vm->flags,AWKVM_EXIT);
+      return AWKRUN_EXIT;
+    default:
+      fail_run(i, "bad instruction");
+    }
+  }
+  return AWKRUN_OK;
+}
+
+static int run_block_awkvm(awkvm_t *vm, int b) {
+  codeblock_t *cb = getblock_awkvm(vm, b);
+  int k, status;
+  vm->fp = 0;
+  vm->nregs = cb->nregs;
+  ensure_stack_awkvm(vm, cb->nregs);
+  status = run_awkvm(vm, cb->codestart);
+  for(k = 0; k < cb->nregs; k++) {
+    if( vm->stack[k].obj ) {
+      clear_awkvar(&vm->stack[k]);
+    }
+  }
+  return status;
+}
+
+bool_t needinput_awkvm(awkvm_t *vm) {
+  return vm && ((vm->nitems > 0) || (vm->nend > 0));
+}
+
+bool_t assign_awkvm(awkvm_t *vm, const char *assignment) {
+  const char *eq;
+  symbol_t s;
+  size_t len;
+  char_t *q;
+  awkvar_t *v;
+  if( vm && assignment && vm->globals ) {
+    eq = strchr(assignment, '=');
+    if( !eq || (eq == assignment) ) {
+      return FALSE;
+    }
+    s = getvalue_symbols(&vm->sym, FALSE, assignment, eq);
+    if( (s < 0) || (s >= vm->nsyms) ) {
+      return TRUE; /* not used by the program */
+    }
+    if( (getsym_awkvm(vm, s)->type == symARRAY) ||
+	(getsym_awkvm(vm, s)->type == symFUNCTION) ) {
+      errormsg(E_FATAL, "cannot assign to %.*s\n", 
+	       (int)(eq - assignment), assignment);
+    }
+    eq++;
+    len = strlen(eq);
+    q = scratch_awkvm(vm, len);
+    while( *eq ) {
+      if( (*eq == '\\') && eq[1] ) {
+	eq++;
+	switch(*eq) {
+	case 'n': *q++ = '\n'; break;
+	case 't': *q++ = '\t'; break;
+	case 'r': *q++ = '\r'; break;
+	case '\\': *q++ = '\\'; break;
+	case '"': *q++ = '"'; break;
+	case '/': *q++ = '/'; break;
+	default: *q++ = '\\'; *q++ = *eq; break;
+	}
+	eq++;
+      } else {
+	*q++ = *eq++;
+      }
+    }
+    *q = '\0';
+    v = &vm->globals[s];
+    setstr_awkvar(v, vm->scratch, q - vm->scratch);
+    if( looks_numeric_awk(v->string) ) {
+      setflag(&v->type,AWKVAR_STRNUM);
+    }
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t begin_awkvm(awkvm_t *vm) {
+  awkarray_t *env;
+  awkvar_t *v;
+  char **e;
+  char *eq;
+  if( vm && vm->globals ) {
+    env = getarray_awkvm(NULL, &vm->globals[vENVIRON]);
+    for(e = environ; e && *e; e++) {
+      eq = strchr(*e, '=');
+      if( eq ) {
+	v = find_awkarray(env, *e, eq - *e, TRUE);
+	setstr_awkvar(v, eq + 1, strlen(eq + 1));
+	if( looks_numeric_awk(v->string) ) {
+	  setflag(&v->type,AWKVAR_STRNUM);
+	}
+      }
+    }
+    vm->seed = 0;
+    srandom(0);
+    ensure_vars_awkvm(&vm->fields, &vm->maxfields, 16);
+    setkeep_awkvar(&vm->fields[0], "", 0);
+    if( run_block_awkvm(vm, vm->cbbegin) == AWKRUN_EXIT ) {
+      return FALSE;
+    }
+    return !checkflag(vm->flags,AWKVM_EXIT);
+  }
+  return FALSE;
+}
+
+bool_t file_awkvm(awkvm_t *vm, const char_t *file) {
+  if( vm && vm->globals && !checkflag(vm->flags,AWKVM_EXIT) ) {
+    setstr_awkvar(&vm->globals[vFILENAME], file, strlen(file));
+    setnum_awkvar(&vm->globals[vFNR], 0);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t record_awkvm(awkvm_t *vm, const char_t *text, size_t len,
+		    const char_t *path, const char_t **att) {
+  awkarray_t *a;
+  awkvar_t *v;
+  if( vm && vm->globals && !checkflag(vm->flags,AWKVM_EXIT) ) {
+    v = &vm->globals[vNR];
+    setnum_awkvar(v, num_awkvar(v) + 1);
+    v = &vm->globals[vFNR];
+    setnum_awkvar(v, num_awkvar(v) + 1);
+    setfield_awkvar(&vm->fields[0], text, len);
+    clearflag(&vm->flags,AWKVM_FIELDS);
+    setstr_awkvar(&vm->globals[vPATH], path ? path : "", 
+		  path ? strlen(path) : 0);
+    if( checkflag(vm->globals[vATTR].type,AWKVAR_ARRAY) || att ) {
+      a = getarray_awkvm(NULL, &vm->globals[vATTR]);
+      clear_awkarray(a);
+      for( ; att && att[0]; att += 2) {
+	v = find_awkarray(a, att[0], strlen(att[0]), TRUE);
+	setstr_awkvar(v, att[1], strlen(att[1]));
+	if( looks_numeric_awk(v->string) ) {
+	  setflag(&v->type,AWKVAR_STRNUM);
+	}
+      }
+    }
+    run_block_awkvm(vm, vm->cbmain);
+    return !checkflag(vm->flags,AWKVM_EXIT);
+  }
+  return FALSE;
+}
+
+bool_t end_awkvm(awkvm_t *vm) {
+  if( vm && vm->globals ) {
+    clearflag(&vm->flags,AWKVM_EXIT);
+    setflag(&vm->flags,AWKVM_END);
+    run_block_awkvm(vm, vm->cbend);
+    flush_stdout();
+    while( vm->noutputs > 0 ) {
+      close_output_awkvm(vm, vm->noutputs - 1);
+    }
+    return TRUE;
+  }
+  return FALSE;
+}
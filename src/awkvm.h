@@ -18,6 +18,7 @@
  * Author:   Laird Breyer <laird@lbreyer.com>
  */
 
+
 #ifndef AWKPARSER_H
 #define AWKPARSER_H
 
@@ -27,27 +28,125 @@
 #include "symbols.h"
 
 #include "awkmem.h"
+#include "awkast.h"
+
+#include <stdio.h>
+#include <regex.h>
+
+/* The parser (awkp.y) builds an awkast_t, which compile_awkvm() lowers 
+ * to a register based bytecode in vm->code. Every instruction names
+ * its operands as registers: register r >= 0 is global variable r
+ * (the symbol id), and register r < 0 is slot -1-r of the current
+ * frame, which holds temporaries and function parameters.
+ *
+ * There is one codeblock_t for all the BEGIN actions, one for all the
+ * pattern/action items, one for all the END actions, and one for
+ * each function. The main codeblock is run once per record.
+ */
+
+typedef enum {
+  oNOP = 0,
+  oLOADNUM, oLOADSTR, oLOADI, oMOVE, oCLEAR,
+  oADD, oSUB, oMUL, oDIV, oMOD, oPOW, oNEG, oPLUS, oNOT, oADDI,
+  oCAT, oLT, oLE, oNE, oEQ, oGT, oGE,
+  oMATCH, oMATCH0, oMATCHD, oXPATH,
+  oGETF, oGETFI, oSETF, oNF, oSETNF,
+  oAGET, oASET, oAADD, oAIN, oADEL, oACLEAR, oAREF, oJOIN,
+  oITERINIT, oITERNEXT,
+  oJMP, oJT, oJF,
+  oPRINT, oPRINTF, oBUILTIN, oSPLIT, oCALL, oRET, oNEXT, oEXIT
+} awkop_t;
 
 typedef struct {
-  const char_t *pattern;
-  int codestart;
+  int op;
+  int a, b, c, d;
+  int lineno;
+} awkinsn_t;
+
+/* builtin functions, see BUILTIN_FUNC_NAME in awkp.y */
+typedef enum {
+  bLENGTH = 0, bSUBSTR, bINDEX, bSPLIT, bSUB, bGSUB, bMATCH, bSPRINTF, 
+  bSIN, bCOS, bATAN2, bEXP, bLOG, bSQRT, bINT, bRAND, bSRAND, 
+  bTOLOWER, bTOUPPER, bCLOSE, bSYSTEM, bFFLUSH
+} awkbuiltin_t;
+
+/* special variables, their symbols are created first */
+typedef enum {
+  vNR = 0, vNF, vFNR, vFS, vOFS, vORS, vSUBSEP, vCONVFMT, vOFMT, 
+  vFILENAME, vRSTART, vRLENGTH, vENVIRON, vATTR, vPATH, vSPECIALS
+} awkspecial_t;
+
+typedef struct {
+  int codestart; /* first instruction */
+  int nregs; /* frame size */
+  int nparams;
+  char_t *arrays; /* nparams flags, TRUE if the parameter is an array */
 } codeblock_t;
 
 bool_t create_codeblock(codeblock_t *bl);
 bool_t free_codeblock(codeblock_t *bl);
-bool_t set_pattern_codeblock(codeblock_t *bl, const char *pattern);
 
+typedef struct {
+  char_t *pattern;
+  regex_t re;
+} awkregex_t;
+
+typedef struct {
+  char_t *name;
+  FILE *fp;
+  bool_t pipe;
+} awkoutput_t;
+
+#define AWKVM_EXIT      0x01 /* exit was called */
+#define AWKVM_FIELDS    0x02 /* $0 is split into fields */
+#define AWKVM_END       0x04 /* running the END actions */
+
+#define AWKVM_MAXREGEX  64 /* dynamic regexes cached at most */
 
 typedef struct {
   int ic; /* instruction counter */
   flag_t flags;
   
-  /* awkast_t *ast; */
+  awkast_t ast;
+  awkmem_ptr_t program; /* list of items */
   symbols_t sym;
   objstack_t symtable;
 
   awkconstmgr_t constants;
   objstack_t codeblocks;
+  int cbbegin, cbmain, cbend;
+
+  awkmem_t code;
+  int nglobals;
+  awkvar_t *globals;
+  awkvar_t *stack;
+  size_t maxstack;
+  int fp; /* current frame is stack[fp..] */
+  int nregs; /* current frame size */
+  awkvar_t retval;
+
+  awkvar_t *fields; /* fields[0] is $0 */
+  size_t maxfields;
+  int nf;
+  char_t *fbuf; /* a copy of $0, cut into null terminated fields */
+  size_t maxfbuf;
+  size_t *spans; /* begin/end offsets of the fields */
+  size_t maxspans;
+
+  awkregex_t *regex;
+  size_t nregex, maxregex, nstatic;
+
+  awkoutput_t *outputs;
+  size_t noutputs, maxoutputs;
+
+  char_t *scratch; /* for building strings */
+  size_t maxscratch;
+
+  int nsyms; /* symbols seen by the compiler */
+  int nitems, nend;
+  int depth; /* of function calls */
+  awknum_t seed;
+  int exitcode;
 } awkvm_t;
 
 bool_t create_awkvm(awkvm_t *vm);
@@ -61,11 +160,22 @@ symrec_t *getsym_awkvm(awkvm_t *vm, symbol_t id);
 bool_t parse_string_awkvm(awkvm_t *vm, const char_t *begin, const char_t *end);
 bool_t parse_file_awkvm(awkvm_t *vm, const char *file);
 
-/* see awkl.l */
-void reset_lexer_awk();
-void scan_lexer_awk(char *buf, int len);
+/* see awklex.c */
+void reset_lexer_awk(awkvm_t *vm);
+void scan_lexer_awk(const char *buf, int len);
+bool_t file_lexer_awk(const char *file);
 void free_lexer_awk();
 
+/* after parsing, before running */
+bool_t compile_awkvm(awkvm_t *vm);
+bool_t assign_awkvm(awkvm_t *vm, const char *assignment);
+bool_t needinput_awkvm(awkvm_t *vm);
+
+bool_t begin_awkvm(awkvm_t *vm);
+bool_t file_awkvm(awkvm_t *vm, const char_t *file);
+bool_t record_awkvm(awkvm_t *vm, const char_t *text, size_t len,
+		    const char_t *path, const char_t **att);
+bool_t end_awkvm(awkvm_t *vm);
 
 #include "awkp.h" /* bison generates this */
 
@@ -41,6 +41,7 @@ bool_t create_blockmanager(blockmanager_t *bm, size_t blocksize, size_t maxblock
 bool_t reset_blockmanager(blockmanager_t *bm) {
   if( bm ) {
     memset(bm->blocks, 0, sizeof(block_t) * bm->numblocks);
+    bm->root = NULL;
     bm->count = 0;
     return TRUE;
   }
@@ -63,6 +63,7 @@ typedef const char **cstringlst_t;
 #define CMD_QUIT     0x01
 #define CMD_ALRM     0x02
 #define CMD_CHLD     0x04
+#define CMD_INFO     0x08
 
 /* not safe: can eval x, y twice */
 #define MIN(x,y) ( (x) < (y) ? (x) : (y) )
@@ -50,9 +50,8 @@ static unsigned char specials[256] = {
 };
 
 const char_t *find_next_special(const char_t *begin, const char_t *end) {
-  while( begin ) {
-    if( specials[(int)*begin] != 0 ||
-	(begin == end) ) {
+  while( begin && (begin < end) ) {
+    if( specials[(byte_t)*begin] != 0 ) {
       return begin;
     }
     begin++;
@@ -61,7 +60,7 @@ const char_t *find_next_special(const char_t *begin, const char_t *end) {
 }
 
 const char_t *get_entity(char_t c) {
-  return entities[(int)specials[(int)c]];
+  return entities[(int)specials[(byte_t)c]];
 }
 
 const char_t *skip_xml_whitespace(const char_t *begin, const char_t *end) {
@@ -73,8 +72,29 @@ bool_t is_xml_space(const char_t *begin, const char_t *end) {
   return (skip_xml_whitespace(begin, end) == end);
 }
 
+/* All XML whitespace chars are below 0x21, so we can skip a whole word
+ * at a time while no byte in it is that small (see "haszero" in the
+ * bit twiddling hacks). The word test is exact, control chars merely
+ * send us down the slow path for one byte.
+ */
+#define WORD_ONES (~0UL / 0xFF)
+#define WORD_HASLESS(x,n) (((x) - WORD_ONES * (n)) & ~(x) & (WORD_ONES * 0x80))
+
 const char_t *find_xml_whitespace(const char_t *begin, const char_t *end) {
-  while( (begin < end) && !xml_whitespace(*begin) ) { begin++; }
+  unsigned long w;
+  while( begin < end ) {
+    if( end - begin >= sizeof(w) ) {
+      memcpy(&w, begin, sizeof(w));
+      if( !WORD_HASLESS(w, 0x21) ) {
+	begin += sizeof(w);
+	continue;
+      }
+    }
+    if( xml_whitespace(*begin) ) {
+      break;
+    }
+    begin++;
+  }
   return begin;
 }
 
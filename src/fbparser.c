@@ -326,9 +326,33 @@ bool_t parse_first_fileblockparser(fbparser_t *fbp, const cursor_t *cursor, fbca
   return parse_just_cursor_fileblockparser(fbp, cursor, callbacks, pos, FALSE);
 }
 
+/* Like skip_byte(begin, end, '>'), but a '>' inside a quoted attribute
+ * value doesn't end a start tag. The markup may continue in the next
+ * block, so seen is the number of its bytes in earlier blocks, and
+ * *state is kept between calls: 0 in comments, PIs and declarations,
+ * 'T' in a tag, or the open quote character.
+ */
+static const byte_t *skip_markup(const byte_t *begin, const byte_t *end,
+				 long seen, byte_t *state) {
+  const byte_t *p;
+  for(p = begin; p < end; p++) {
+    if( (seen + (p - begin) == 1) && ((*p == '!') || (*p == '?')) ) {
+      *state = 0;
+    }
+    if( (*state == '"') || (*state == '\'') ) {
+      *state = (*p == *state) ? 'T' : *state;
+    } else if( *p == '>' ) {
+      break;
+    } else if( (*state == 'T') && ((*p == '"') || (*p == '\'')) ) {
+      *state = *p;
+    }
+  }
+  return p;
+}
+
 bool_t parse_next_fileblockparser(fbparser_t *fbp, position_t *pos) {
   size_t len;
-  byte_t lookfor;
+  byte_t lookfor, state;
   bool_t retval = FALSE;
   byte_t *begin, *end;
   const byte_t *e;
@@ -338,9 +362,12 @@ bool_t parse_next_fileblockparser(fbparser_t *fbp, position_t *pos) {
     pos->status = ps_ok;
     if( read_fileblockreader(&fbp->reader, fbp->info.offset, &begin, &end) ) {
       lookfor = (*begin == '<') ? '>' : '<';
+      state = 'T';
 
       do {
-	e = skip_byte(begin, end, lookfor);
+	e = (lookfor == '>') ?
+	  skip_markup(begin, end, fbp->info.offset - pos->offset, &state) :
+	  skip_byte(begin, end, lookfor);
 	if( e < end ) {
 	  fbp->info.noderep = 
 	    (*e == '>') ? ((*begin == '<') ? full : endfrag) :
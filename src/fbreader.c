@@ -23,6 +23,7 @@
 #include "mem.h"
 #include "fbreader.h"
 #include "myerror.h"
+#include "stats.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -47,6 +48,7 @@ bool_t open_fileblockreader(fbreader_t *fbr, const char *path, size_t maxblocks)
       default:
 	fbr->size = statbuf.st_size;
 	fbr->blksize = statbuf.st_blksize;
+	fbr->mtime = statbuf.st_mtime;
 	break;
       }
       return create_blockmanager(&fbr->bm, fbr->blksize, maxblocks);
@@ -71,6 +73,7 @@ bool_t read_fileblockreader(fbreader_t *fbr, off_t offset, byte_t **begin, byte_
   block_t *block;
   byte_t *buf;
   size_t buflen;
+  double t = 0.0;
   if( fbr && begin && end && (offset >= 0) && (offset < fbr->size) ) {
     blockid = offset / fbr->blksize;
     if( !find_block_blockmanager(&fbr->bm, blockid, &block) ) {
@@ -87,10 +90,14 @@ bool_t read_fileblockreader(fbreader_t *fbr, off_t offset, byte_t **begin, byte_
       }
       block->blockid = blockid;
       block->touch = 1;
+      STATS_BEGIN(t);
       block->bytecount = read(fbr->fd, buf, buflen);
+      STATS_END(input_time, t);
+      STATS_ADD(reads, 1);
       if( block->bytecount == -1 ) {
 	return FALSE;
       }
+      STATS_ADD(bytesread, block->bytecount);
       if( !insert_block_blockmanager(&fbr->bm, block) ) {
 	return FALSE;
       }
@@ -122,7 +129,8 @@ bool_t refresh_fileblockreader(fbreader_t *fbr) {
   struct stat statbuf;
   if( fbr ) {
     fstat(fbr->fd, &statbuf);
-    if(fbr->mtime < statbuf.st_mtime) {
+    /* a file can grow several times within one mtime tick */
+    if( (fbr->mtime < statbuf.st_mtime) || (fbr->size != statbuf.st_size) ) {
       fbr->mtime = statbuf.st_mtime;
       fbr->size = statbuf.st_size;
       reset_blockmanager(&fbr->bm);
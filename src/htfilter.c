@@ -62,14 +62,9 @@ static const char_t *html_lazy_tag[] = {
 
 bool_t reset_htfilter(htfilter_t *f);
 
-bool_t is_special_tag(const char_t *name, const char_t *list[]) {
-  const char_t **p;
-  if( name ) {
-    for(p = list; *p; p++) {
-      if( strcasecmp(name, *p) == 0 ) { return TRUE; }
-    }
-  }
-  return FALSE;
+/* HTML tag names are case insensitive, id must be folded */
+bool_t is_special_tag(nameid_t id, const nameset_t *set) {
+  return member_nameset(set, id);
 }
 
 /* DUMB FILTER CALLBACKS 
@@ -108,19 +103,21 @@ result_t dumb_dfault(void *user, const char_t *data, size_t buflen) {
 result_t html_start_tag(void *user, const char_t *name, const char_t **att) {
   filter_data_t *filter = (filter_data_t *)user;
   const char_t *tag;
+  nameid_t id;
   if( filter ) {
+    id = fold_intern(filter->cur->tag);
     filter->depth++;
     if( filter->depth == 1 ) {
-      if( strcasecmp(name, "html") != 0 ) {
+      if( id != filter->html ) {
     	write_start_tag_stdout("html", NULL, FALSE);
     	push_tag_xpath(&filter->xpath, "html");
 	return html_start_tag(user, name, att);
       }
     }
     if( filter->depth == 2 ) {
-      if( strcasecmp(name, "head") == 0 ) {
+      if( id == filter->headid ) {
 	filter->section = "head";
-      } else if( strcasecmp(name, "body") == 0 ) {
+      } else if( id == filter->body ) {
 	filter->section = "body";
       } else {
     	filter->section = (filter->section == NULL) ? "head" : "body";
@@ -131,7 +128,7 @@ result_t html_start_tag(void *user, const char_t *name, const char_t **att) {
     }
     if( filter->depth == 3 ) {
       if( (strcmp(filter->section, "head") == 0) && 
-	  !is_special_tag(name, html_head_tag) ) {
+	  !is_special_tag(id, &filter->head) ) {
 	write_end_tag_stdout(filter->section);
 	pop_xpath(&filter->xpath);
 	filter->depth--;
@@ -144,15 +141,16 @@ result_t html_start_tag(void *user, const char_t *name, const char_t **att) {
 
 
     if( filter->depth > 2 ) {
-      if( is_special_tag(name, html_empty_tag) ) {
+      if( is_special_tag(id, &filter->empty) ) {
     	write_start_tag_stdout(name, att, TRUE);
 	filter->depth--;
 	/* printf("SPECIALTAG[%s][%s]\n", name, string_xpath(&filter->xpath)); */
     	return PARSER_OK;
       }
       tag = get_last_xpath(&filter->xpath);
-      if( tag && is_special_tag(tag, html_lazy_tag) &&
-	  is_special_tag(name, html_selfish_tag) ) {
+      if( tag && 
+	  is_special_tag(fold_intern(lookup_intern(tag)), &filter->lazy) &&
+	  is_special_tag(id, &filter->selfish) ) {
 	write_end_tag_stdout(tag);
 	pop_xpath(&filter->xpath);
       }
@@ -199,6 +197,15 @@ bool_t create_htfilter(htfilter_t *f, flag_t flags) {
     f->buflen = 4096;
 
     create_xpath(&f->filter.xpath);
+    init_intern(256);
+    create_nameset(&f->filter.empty, html_empty_tag);
+    create_nameset(&f->filter.head, html_head_tag);
+    create_nameset(&f->filter.selfish, html_selfish_tag);
+    create_nameset(&f->filter.lazy, html_lazy_tag);
+    f->filter.html = intern("html");
+    f->filter.headid = intern("head");
+    f->filter.body = intern("body");
+    f->filter.cur = &f->parser.cur;
     if( create_parser(&f->parser, &f->filter) ) {
 
       if( checkflag(f->flags, HTFILTER_DUMB) ) {
@@ -223,6 +230,10 @@ bool_t free_htfilter(htfilter_t *f) {
     flush_htfilter(f);
     free_parser(&f->parser);
     free_xpath(&f->filter.xpath);
+    free_nameset(&f->filter.empty);
+    free_nameset(&f->filter.head);
+    free_nameset(&f->filter.selfish);
+    free_nameset(&f->filter.lazy);
     return TRUE;
   }
   return FALSE;
@@ -24,6 +24,7 @@
 #include "common.h"
 #include "parser.h"
 #include "xpath.h"
+#include "intern.h"
 
 #define HTFILTER_DUMB   0x01
 #define HTFILTER_HTML   0x02
@@ -33,6 +34,9 @@ typedef struct {
   xpath_t xpath;
   int depth;
   const char_t *section;
+  const status_t *cur; /* parser status, for the interned tag name */
+  nameset_t empty, head, selfish, lazy;
+  nameid_t html, headid, body;
 } filter_data_t;
 
 typedef struct {
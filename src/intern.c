@@ -0,0 +1,268 @@
+/* 
+ * Copyright (C) 2010 Laird Breyer
+ *  
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA.
+ * 
+ * Author:   Laird Breyer <laird@lbreyer.com>
+ */
+
+#include "common.h"
+#include "intern.h"
+#include "mem.h"
+#include "myerror.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+typedef struct {
+  uint64_t h;
+  size_t off, len; /* offsets into pool, names can move */
+  nameid_t fold;
+} nameentry_t;
+
+static struct {
+  bool_t active;
+  nameid_t *slots; /* open addressing, power of 2 */
+  size_t maxslots;
+  nameentry_t *names; /* indexed by id, names[0] is unused */
+  size_t nnames, maxnames;
+  char_t *pool;
+  size_t npool, maxpool;
+} itab;
+
+#define INTERN_MUL1 0x9e3779b97f4a7c15ULL
+#define INTERN_MUL2 0xbf58476d1ce4e5b9ULL
+
+/* a multiply-xorshift hash which reads eight bytes at a time */
+static uint64_t hash_intern(const char_t *p, size_t len) {
+  uint64_t h = len * INTERN_MUL1;
+  uint64_t w;
+  while( len >= 8 ) {
+    memcpy(&w, p, 8);
+    h = (h ^ w) * INTERN_MUL2;
+    h ^= h >> 29;
+    p += 8;
+    len -= 8;
+  }
+  if( len > 0 ) {
+    w = 0;
+    memcpy(&w, p, len);
+    h = (h ^ w) * INTERN_MUL2;
+    h ^= h >> 29;
+  }
+  h *= INTERN_MUL1;
+  return h ^ (h >> 32);
+}
+
+bool_t init_intern(size_t hint) {
+  size_t n = 256;
+  if( !itab.active ) {
+    while( n < 2 * hint ) {
+      n *= 2;
+    }
+    memset(&itab, 0, sizeof(itab));
+    itab.slots = (nameid_t *)calloc(n, sizeof(nameid_t));
+    if( !itab.slots ||
+	!create_mem(&itab.names, &itab.maxnames, sizeof(nameentry_t), n/2) ||
+	!create_mem(&itab.pool, &itab.maxpool, sizeof(char_t), 8 * n) ) {
+      errormsg(E_FATAL, "out of memory.\n");
+    }
+    itab.maxslots = n;
+    itab.nnames = 1;
+    itab.active = TRUE;
+  }
+  return TRUE;
+}
+
+bool_t exit_intern() {
+  if( itab.active ) {
+    free(itab.slots);
+    free_mem(&itab.names, &itab.maxnames);
+    free_mem(&itab.pool, &itab.maxpool);
+    memset(&itab, 0, sizeof(itab));
+  }
+  return TRUE;
+}
+
+bool_t active_intern() {
+  return itab.active;
+}
+
+static size_t find_slot_intern(uint64_t h, const char_t *name, size_t len) {
+  size_t j;
+  nameentry_t *e;
+  j = h & (itab.maxslots - 1);
+  while( itab.slots[j] != NAMEID_NONE ) {
+    e = &itab.names[itab.slots[j]];
+    if( (e->h == h) && (e->len == len) && 
+	(memcmp(itab.pool + e->off, name, len) == 0) ) {
+      break;
+    }
+    j = (j + 1) & (itab.maxslots - 1);
+  }
+  return j;
+}
+
+static bool_t grow_slots_intern() {
+  nameid_t *old = itab.slots;
+  size_t i, j, n = itab.maxslots;
+  itab.slots = (nameid_t *)calloc(2 * n, sizeof(nameid_t));
+  if( !itab.slots ) {
+    itab.slots = old;
+    return FALSE;
+  }
+  itab.maxslots = 2 * n;
+  for(i = 0; i < n; i++) {
+    if( old[i] != NAMEID_NONE ) {
+      j = itab.names[old[i]].h & (itab.maxslots - 1);
+      while( itab.slots[j] != NAMEID_NONE ) {
+	j = (j + 1) & (itab.maxslots - 1);
+      }
+      itab.slots[j] = old[i];
+    }
+  }
+  free(old);
+  return TRUE;
+}
+
+static nameid_t add_intern(uint64_t h, size_t j, const char_t *name, size_t len) {
+  nameentry_t *e;
+  nameid_t id;
+  while( itab.npool + len + 1 > itab.maxpool ) {
+    if( !grow_mem(&itab.pool, &itab.maxpool, sizeof(char_t), 1024) ) {
+      return NAMEID_NONE;
+    }
+  }
+  if( (itab.nnames >= itab.maxnames) &&
+      !grow_mem(&itab.names, &itab.maxnames, sizeof(nameentry_t), 256) ) {
+    return NAMEID_NONE;
+  }
+  id = itab.nnames++;
+  e = &itab.names[id];
+  e->h = h;
+  e->off = itab.npool;
+  e->len = len;
+  e->fold = id;
+  memcpy(itab.pool + itab.npool, name, len);
+  itab.pool[itab.npool + len] = '\0';
+  itab.npool += len + 1;
+  itab.slots[j] = id;
+  return id;
+}
+
+/* lowercase ASCII names fold to themselves */
+static nameid_t add_fold_intern(nameid_t id) {
+  char_t buf[64];
+  const char_t *p;
+  size_t i, len;
+  nameid_t f;
+  if( id == NAMEID_NONE ) {
+    return id;
+  }
+  len = itab.names[id].len;
+  p = itab.pool + itab.names[id].off;
+  for(i = 0; (i < len) && !(('A' <= p[i]) && (p[i] <= 'Z')); i++);
+  if( (i < len) && (len < sizeof(buf)) ) {
+    for(i = 0; i < len; i++) {
+      buf[i] = (('A' <= p[i]) && (p[i] <= 'Z')) ? p[i] - 'A' + 'a' : p[i];
+    }
+    f = intern2(buf, buf + len);
+    if( f != NAMEID_NONE ) {
+      itab.names[id].fold = f;
+    }
+  }
+  return id;
+}
+
+nameid_t intern2(const char_t *begin, const char_t *end) {
+  uint64_t h;
+  size_t j, len;
+  if( itab.active && begin && (begin <= end) ) {
+    if( (2 * itab.nnames > itab.maxslots) && !grow_slots_intern() ) {
+      return NAMEID_NONE;
+    }
+    len = end - begin;
+    h = hash_intern(begin, len);
+    j = find_slot_intern(h, begin, len);
+    if( itab.slots[j] != NAMEID_NONE ) {
+      return itab.slots[j];
+    }
+    return add_fold_intern(add_intern(h, j, begin, len));
+  }
+  return NAMEID_NONE;
+}
+
+nameid_t intern(const char_t *name) {
+  return name ? intern2(name, name + strlen(name)) : NAMEID_NONE;
+}
+
+nameid_t lookup_intern(const char_t *name) {
+  uint64_t h;
+  size_t len;
+  if( itab.active && name ) {
+    len = strlen(name);
+    h = hash_intern(name, len);
+    return itab.slots[find_slot_intern(h, name, len)];
+  }
+  return NAMEID_NONE;
+}
+
+nameid_t fold_intern(nameid_t id) {
+  return ((id > 0) && (id < itab.nnames)) ? itab.names[id].fold : NAMEID_NONE;
+}
+
+const char_t *name_intern(nameid_t id) {
+  return ((id > 0) && (id < itab.nnames)) ? 
+    itab.pool + itab.names[id].off : NULL;
+}
+
+bool_t create_nameset(nameset_t *ns, const char_t **list) {
+  nameid_t id;
+  size_t n;
+  if( ns && list ) {
+    memset(ns, 0, sizeof(nameset_t));
+    init_intern(0);
+    for(; *list; list++) {
+      id = intern(*list);
+      if( id == NAMEID_NONE ) {
+	return FALSE;
+      }
+      while( id >= 8 * ns->maxbits ) {
+	n = ns->maxbits;
+	if( !grow_mem(&ns->bits, &ns->maxbits, sizeof(byte_t), 16) ) {
+	  return FALSE;
+	}
+	memset(ns->bits + n, 0, ns->maxbits - n);
+      }
+      ns->bits[id / 8] |= (1 << (id % 8));
+    }
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t free_nameset(nameset_t *ns) {
+  if( ns ) {
+    free_mem(&ns->bits, &ns->maxbits);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t member_nameset(const nameset_t *ns, nameid_t id) {
+  return ns && (id > 0) && (id < 8 * ns->maxbits) &&
+    (ns->bits[id / 8] & (1 << (id % 8)));
+}
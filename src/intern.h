@@ -0,0 +1,61 @@
+/* 
+ * Copyright (C) 2010 Laird Breyer
+ *  
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA.
+ * 
+ * Author:   Laird Breyer <laird@lbreyer.com>
+ */
+
+#ifndef INTERN_H
+#define INTERN_H
+
+#include "common.h"
+
+/* A process wide table of interned names. Each distinct name gets a
+ * small positive id the first time it is seen, so tag names can
+ * afterwards be compared as integers. The table uses open addressing
+ * with a fast 64 bit hash, and each name also remembers the id of its
+ * lowercase form, for case insensitive (HTML) comparisons.
+ *
+ * Once init_intern() has been called, every parser_t interns the name
+ * of each start and end tag, see parser->cur.tag.
+ */
+
+typedef int nameid_t;
+#define NAMEID_NONE 0
+
+bool_t init_intern(size_t hint);
+bool_t exit_intern();
+bool_t active_intern();
+
+nameid_t intern(const char_t *name);
+nameid_t intern2(const char_t *begin, const char_t *end);
+/* like intern(), but never adds the name */
+nameid_t lookup_intern(const char_t *name);
+/* the id of the lowercase form of the name */
+nameid_t fold_intern(nameid_t id);
+const char_t *name_intern(nameid_t id);
+
+/* a fixed set of names, such as a list of HTML tags */
+typedef struct {
+  byte_t *bits;
+  size_t maxbits;
+} nameset_t;
+
+bool_t create_nameset(nameset_t *ns, const char_t **list);
+bool_t free_nameset(nameset_t *ns);
+bool_t member_nameset(const nameset_t *ns, nameid_t id);
+
+#endif
@@ -20,16 +20,25 @@
 
 #include "common.h"
 #include "interval.h"
+#include "mem.h"
+
+#include <stdlib.h>
+#include <string.h>
 
 bool_t create_intervalmgr(intervalmgr_t *im) {
   if( im ) {
-    return create_objstack(&im->iset, sizeof(interval_t));
+    im->dirty = FALSE;
+    im->nsorted = 0;
+    memset(im->bitmap, 0, sizeof(im->bitmap));
+    return create_objstack(&im->iset, sizeof(interval_t)) &&
+      create_mem(&im->sorted, &im->maxsorted, sizeof(interval_t), 16);
   }
   return FALSE;
 }
 
 bool_t free_intervalmgr(intervalmgr_t *im) {
   if( im ) {
+    free_mem(&im->sorted, &im->maxsorted);
     return free_objstack(&im->iset);
   }
   return FALSE;
@@ -40,6 +49,7 @@ bool_t push_intervalmgr(intervalmgr_t *im, int a, int b) {
   if( im ) {
     i.a = a;
     i.b = b;
+    im->dirty = TRUE;
     return push_objstack(&im->iset, (byte_t *)&i, sizeof(interval_t));
   }
   return FALSE;
@@ -47,6 +57,7 @@ bool_t push_intervalmgr(intervalmgr_t *im, int a, int b) {
 
 bool_t pop_intervalmgr(intervalmgr_t *im) {
   if( im ) {
+    im->dirty = TRUE;
     return pop_objstack(&im->iset, sizeof(interval_t)); 
   } 
   return FALSE;
@@ -64,15 +75,102 @@ bool_t peek_intervalmgr(intervalmgr_t *im, int *a, int *b) {
   return FALSE;
 }
 
-bool_t memberof_intervalmgr(intervalmgr_t *im, int x) {
-  int i;
+static int cmp_interval(const void *x, const void *y) {
+  const interval_t *i = (const interval_t *)x;
+  const interval_t *j = (const interval_t *)y;
+  return (i->a < j->a) ? -1 : (i->a > j->a);
+}
+
+static void set_bitmap_intervalmgr(intervalmgr_t *im, int a, int b) {
+  a = MAX(a, 0);
+  b = MIN(b, INTERVAL_BITMAP - 1);
+  for(; (a <= b) && (a % 8); a++) {
+    im->bitmap[a / 8] |= (1 << (a % 8));
+  }
+  if( a + 7 <= b ) {
+    memset(im->bitmap + a / 8, 0xff, (b + 1 - a) / 8);
+    a += ((b + 1 - a) / 8) * 8;
+  }
+  for(; a <= b; a++) {
+    im->bitmap[a / 8] |= (1 << (a % 8));
+  }
+}
+
+/* rebuilds the sorted interval list and the bitmap */
+static bool_t normalize_intervalmgr(intervalmgr_t *im) {
   interval_t *ilist;
+  size_t i, n;
+  ilist = (interval_t *)im->iset.stack;
+  while( im->maxsorted < im->iset.top ) {
+    if( !grow_mem(&im->sorted, &im->maxsorted, sizeof(interval_t), 16) ) {
+      return FALSE;
+    }
+  }
+  n = 0;
+  for(i = 0; i < im->iset.top; i++) {
+    if( ilist[i].a <= ilist[i].b ) {
+      im->sorted[n++] = ilist[i];
+    }
+  }
+  qsort(im->sorted, n, sizeof(interval_t), cmp_interval);
+  im->nsorted = 0;
+  for(i = 0; i < n; i++) {
+    if( (im->nsorted > 0) && 
+	(im->sorted[i].a - 1 <= im->sorted[im->nsorted - 1].b) ) {
+      im->sorted[im->nsorted - 1].b = 
+	MAX(im->sorted[im->nsorted - 1].b, im->sorted[i].b);
+    } else {
+      im->sorted[im->nsorted++] = im->sorted[i];
+    }
+  }
+  memset(im->bitmap, 0, sizeof(im->bitmap));
+  for(i = 0; i < im->nsorted; i++) {
+    set_bitmap_intervalmgr(im, im->sorted[i].a, im->sorted[i].b);
+  }
+  im->dirty = FALSE;
+  return TRUE;
+}
+
+/* index of the first interval which ends at or after x, or nsorted */
+static size_t search_intervalmgr(intervalmgr_t *im, int x) {
+  size_t lo = 0, hi = im->nsorted, mid;
+  while( lo < hi ) {
+    mid = lo + (hi - lo) / 2;
+    if( im->sorted[mid].b < x ) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+bool_t memberof_intervalmgr(intervalmgr_t *im, int x) {
+  size_t i;
   if( im ) {
-    ilist = (interval_t *)im->iset.stack;
-    for(i = 0; i < im->iset.top; i++) {
-      if( (ilist[i].a <= x) && (x <= ilist[i].b) ) {
-	return TRUE;
-      }
+    if( im->dirty && !normalize_intervalmgr(im) ) {
+      return FALSE;
+    }
+    if( (x >= 0) && (x < INTERVAL_BITMAP) ) {
+      return (im->bitmap[x / 8] & (1 << (x % 8))) != 0;
+    }
+    i = search_intervalmgr(im, x);
+    return (i < im->nsorted) && (im->sorted[i].a <= x);
+  }
+  return FALSE;
+}
+
+bool_t next_intervalmgr(intervalmgr_t *im, int x, int *a, int *b) {
+  size_t i;
+  if( im && a && b ) {
+    if( im->dirty && !normalize_intervalmgr(im) ) {
+      return FALSE;
+    }
+    i = search_intervalmgr(im, x);
+    if( i < im->nsorted ) {
+      *a = im->sorted[i].a;
+      *b = im->sorted[i].b;
+      return TRUE;
     }
   }
   return FALSE;
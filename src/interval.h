@@ -30,8 +30,19 @@ typedef struct {
   int a, b;
 } interval_t;
 
+/* The intervals are kept on a stack in the order they were pushed. 
+ * Before the first query after a push or pop, a sorted copy is made
+ * with overlapping and adjacent intervals merged. Small indices are
+ * then looked up in a bitmap, larger ones by binary search. 
+ */
+#define INTERVAL_BITMAP 4096
+
 typedef struct {
   objstack_t iset;
+  interval_t *sorted; /* merged, in increasing order */
+  size_t nsorted, maxsorted;
+  byte_t bitmap[INTERVAL_BITMAP/8];
+  bool_t dirty;
 } intervalmgr_t;
 
 bool_t create_intervalmgr(intervalmgr_t *im);
@@ -41,5 +52,8 @@ bool_t pop_intervalmgr(intervalmgr_t *im);
 bool_t peek_intervalmgr(intervalmgr_t *im, int *a, int *b);
 bool_t memberof_intervalmgr(intervalmgr_t *im, int x);
 bool_t is_empty_intervalmgr(intervalmgr_t *im);
+/* finds the first (merged) interval [a, b] with x <= b, so the
+   next member >= x is max(a, x). Returns FALSE if there is none. */
+bool_t next_intervalmgr(intervalmgr_t *im, int x, int *a, int *b);
 
 #endif
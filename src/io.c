@@ -26,6 +26,7 @@
 #include "wrap.h"
 #include "mem.h"
 #include "cstring.h"
+#include "stats.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -38,6 +39,11 @@
 #include <limits.h>
 #include <errno.h>
 
+#if defined HAVE_POSIX_SPAWNP
+#include <spawn.h>
+extern char **environ;
+#endif
+
 
 extern volatile flag_t cmd;
 extern char *progname;
@@ -146,11 +152,15 @@ bool_t seekbuf_stream(stream_t *strm, long numbytes) {
 }
 
 bool_t read_file_stream(stream_t *strm, byte_t *buf, size_t buflen) {
+  double t = 0.0;
   /* we never free an existing buffer, as we don't own it */
   strm->buflen = 0;
   strm->buf = buf;
   if( strm->buf ) {
+    STATS_BEGIN(t);
     strm->buflen = read(strm->fd, strm->buf, buflen);
+    STATS_END(input_time, t);
+    STATS_ADD(reads, 1);
     if( strm->buflen == -1 ) {
       switch(errno) {
       case EAGAIN:
@@ -169,6 +179,7 @@ bool_t read_file_stream(stream_t *strm, byte_t *buf, size_t buflen) {
     }
     strm->pos = strm->buf;
     strm->bytesread += strm->buflen;
+    STATS_ADD(bytesread, strm->buflen);
     return (strm->buflen > 0);
   }
   return FALSE;
@@ -200,14 +211,21 @@ bool_t read_stream(stream_t *strm, byte_t *buf, size_t buflen) {
 
 bool_t write_file(int fd, const byte_t *buf, size_t buflen) {
   ssize_t n, written;
+  double t = 0.0;
   
   written = 0;
   while( (written < buflen) && !checkflag(cmd,CMD_QUIT) ) {
+    STATS_BEGIN(t);
     n = write(fd, buf + written, buflen - written);
-    if( n == -1 ) {
-      errormsg(E_ERROR, 
-	       "couldn't write data to file descriptor %d (%lu bytes)\n", 
-	       fd, (unsigned long)(buflen - written));
+    STATS_END(output_time, t);
+    if( (n == -1) && (errno == EINTR) ) {
+      continue; /* eg the --progress timer */
+    } else if( n == -1 ) {
+      if( errno != EPIPE ) { /* the reader is gone, SIGPIPE reports it */
+	errormsg(E_ERROR, 
+		 "couldn't write data to file descriptor %d (%lu bytes)\n", 
+		 fd, (unsigned long)(buflen - written));
+      }
       return FALSE;
     } 
     written += n;
@@ -215,35 +233,92 @@ bool_t write_file(int fd, const byte_t *buf, size_t buflen) {
   return TRUE;
 }
 
-/* return TRUE on zero status */
-bool_t exec_cmdline(const char *filename, const char **argv) {
-  pid_t pid, wpid;
-  int status;
+/* start filename in the background and return its pid, or -1. If
+ * infd != NULL, the child reads its stdin from a pipe, and the write
+ * end of the pipe is returned in *infd. 
+ * posix_spawn() doesn't copy our address space like fork(), which
+ * matters when a big process starts many small commands.
+ */
+pid_t spawn_cmdline(const char *filename, const char **argv, int *infd) {
+  pid_t pid = -1;
+  int p[2];
+#if defined HAVE_POSIX_SPAWNP
+  posix_spawn_file_actions_t fa;
+  int e;
+#endif
+
+  if( infd ) {
+    if( pipe(p) == -1 ) {
+      errormsg(E_WARNING, "failed to create pipe: %s\n", strerror(errno));
+      return -1;
+    }
+    /* only the child's stdin stays open across exec */
+    fcntl(p[0], F_SETFD, FD_CLOEXEC);
+    fcntl(p[1], F_SETFD, FD_CLOEXEC);
+  }
 
+#if defined HAVE_POSIX_SPAWNP
+  posix_spawn_file_actions_init(&fa);
+  if( infd ) {
+    posix_spawn_file_actions_adddup2(&fa, p[0], STDIN_FILENO);
+  }
+  e = posix_spawnp(&pid, filename, &fa, NULL, (char * const *)argv, environ);
+  posix_spawn_file_actions_destroy(&fa);
+  if( e != 0 ) {
+    errormsg(E_WARNING, "failed to exec %s: %s\n", filename, strerror(e));
+    pid = -1;
+  }
+#else
   pid = fork();
   if( pid == -1 ) {
     errormsg(E_WARNING, "failed to fork\n"); 
-    return FALSE;
-  } else if( (pid == 0) && (-1 == execvp(filename, (char **)argv)) ) {
-    errormsg(E_WARNING, "failed to exec %s: %s\n", 
-	     filename, strerror(errno));
-    _exit(EXIT_FAILURE);
+  } else if( pid == 0 ) {
+    if( infd ) {
+      dup2(p[0], STDIN_FILENO);
+    }
+    if( -1 == execvp(filename, (char **)argv) ) {
+      errormsg(E_WARNING, "failed to exec %s: %s\n", 
+	       filename, strerror(errno));
+      _exit(EXIT_FAILURE);
+    }
   }
+#endif
+
+  if( infd ) {
+    close(p[0]);
+    if( pid == -1 ) {
+      close(p[1]);
+    } else {
+      *infd = p[1];
+    }
+  }
+  return pid;
+}
+
+/* return TRUE on zero status */
+bool_t wait_cmdline(pid_t pid, const char *filename) {
+  pid_t wpid;
+  int status;
 
   /* IMPORTANT: do not handle SIGCHLD during the wait */
-  wpid = waitpid(pid, &status, 0);
+  do {
+    wpid = waitpid(pid, &status, 0);
+  } while( (wpid == -1) && (errno == EINTR) );
   if( wpid == pid ) {
-    return TRUE;
-  }
-  if( (wpid == 0) || 
-      ((wpid == pid) && (WIFEXITED(status) && (WEXITSTATUS(status) == 0))) ) {
-    return TRUE;
+    return WIFEXITED(status) && (WEXITSTATUS(status) == 0);
   }
   errormsg(E_WARNING, 
-	     "during exec %s: %s\n", filename, strerror(errno));
+	   "during exec %s: %s\n", filename, strerror(errno));
   return FALSE;
 }
 
+/* return TRUE on zero status */
+bool_t exec_cmdline(const char *filename, const char **argv) {
+  pid_t pid;
+  pid = spawn_cmdline(filename, argv, NULL);
+  return (pid != -1) && wait_cmdline(pid, filename);
+}
+
 
 
 bool_t reaper(pid_t pid) {
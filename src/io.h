@@ -55,6 +55,8 @@ bool_t read_stream(stream_t *strm, byte_t *buf, size_t buflen);
 bool_t write_file(int fd, const byte_t *buf, size_t buflen);
 
 bool_t exec_cmdline(const char *filename, const char **argv);
+pid_t spawn_cmdline(const char *filename, const char **argv, int *infd);
+bool_t wait_cmdline(pid_t pid, const char *filename);
 bool_t reaper(pid_t pid);
 
 #endif
@@ -24,6 +24,7 @@
 #include "filelist.h"
 #include "leafparse.h"
 #include "entities.h"
+#include "stats.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -57,6 +58,16 @@ result_t lf_chardata(void *user, const char_t *buf, size_t buflen) {
 	ok &= write_unecho(&pinfo->ue, &pinfo->cp,(byte_t *)"\\q", 2);
       }
 
+      if( checkflag(pinfo->setup.flags,LFP_RAW_CHARDATA) && (buflen > 0) ) {
+	if( checkflag(pinfo->reserved,LFP_R_CDATA) ) {
+	  ok &= puts_tempcollect(&pinfo->raw, "<![CDATA[");
+	  ok &= write_tempcollect(&pinfo->raw, (byte_t *)buf, buflen);
+	  ok &= puts_tempcollect(&pinfo->raw, "]]>");
+	} else {
+	  ok &= write_coded_entities_tempcollect(&pinfo->raw, buf, buflen);
+	}
+      }
+
     }
 
     if( !ok ) {
@@ -97,6 +108,7 @@ result_t lf_start_tag(void *user, const char_t *name, const char_t **att) {
       pinfo->setup.cb.leaf_node(user, &pinfo->ue) : PARSER_OK;
 
     clearflag(&pinfo->reserved,LFP_R_CHARDATA);
+    reset_tempcollect(&pinfo->raw);
 
     /* post tag below */
 
@@ -107,6 +119,9 @@ result_t lf_start_tag(void *user, const char_t *name, const char_t **att) {
 
     activate_node_stdselect(&pinfo->sel, pinfo->depth, &pinfo->cp);
     pinfo->line.selected = pinfo->sel.active;
+    if( pinfo->sel.active ) {
+      STATS_ADD(selected, 1);
+    }
     if( checkflag(pinfo->setup.flags,LFP_ATTRIBUTES) ) {
       push_attributes_values_xpath(&pinfo->cp, att);
     }
@@ -143,6 +158,7 @@ result_t lf_end_tag(void *user, const char_t *name) {
       pinfo->setup.cb.leaf_node(user, &pinfo->ue) : PARSER_OK;
 
     clearflag(&pinfo->reserved,LFP_R_CHARDATA);
+    reset_tempcollect(&pinfo->raw);
 
     /* post tag below */
 
@@ -222,6 +238,7 @@ bool_t create_leafparserinfo(leafparserinfo_t *pinfo) {
     ok &= create_xpath(&pinfo->cp);
     ok &= create_unecho(&pinfo->ue, 0);
     ok &= create_tempcollect(&pinfo->tc, "wrap", MINVARSIZE, MAXVARSIZE);
+    ok &= create_tempcollect(&pinfo->raw, "raw", MINVARSIZE, MAXVARSIZE);
     ok &= create_stdselect(&pinfo->sel);
     return ok;
   }
@@ -243,6 +260,7 @@ bool_t reset_leafparserinfo(leafparserinfo_t *pinfo) {
     reset_unecho(&pinfo->ue, ue_flags);
 
     reset_tempcollect(&pinfo->tc);
+    reset_tempcollect(&pinfo->raw);
 
     reset_stdselect(&pinfo->sel);
 
@@ -256,6 +274,7 @@ bool_t free_leafparserinfo(leafparserinfo_t *pinfo) {
     free_xpath(&pinfo->cp);
     free_unecho(&pinfo->ue);
     free_tempcollect(&pinfo->tc);
+    free_tempcollect(&pinfo->raw);
     free_stdselect(&pinfo->sel);
     /* zero memory so people don't try to use its (now invalid) contents */
     memset(pinfo, 0, sizeof(leafparserinfo_t));
@@ -295,6 +314,8 @@ bool_t leafparse(const char *file, cstringlst_t xpaths, leafparserinfo_t *pinfo)
 
 	  if( inputfile && open_file_stream(&strm, inputfile) ) {
 
+	    begin_progress(strm.fd);
+
 	    while( !checkflag(cmd,CMD_QUIT) && 
 		   read_stream(&strm, getbuf_parser(&parser, strm.blksize), 
 			       strm.blksize) ) {
@@ -63,6 +63,7 @@
 #define LFP_SKIP_EMPTY        0x040 /* skip whitespace chardata */
 #define LFP_ATTRIBUTES        0x080 /* incl. attributes in paths */
 #define LFP_ALWAYS_CHARDATA   0x100 /* always call chardata fun */
+#define LFP_RAW_CHARDATA      0x200 /* also keep leaf chardata as XML */
 
 
 typedef enum {lt_first = 0, lt_middle, lt_last} linetype_t;
@@ -110,6 +111,7 @@ typedef struct {
   xpath_t cp; /* current path */
   unecho_t ue; /* current unecho'd leafnode */
   tempcollect_t tc; /* original head or footwrap */
+  tempcollect_t raw; /* leaf chardata as XML, valid in PRE_ callbacks */
   flag_t reserved; /* not for users */
   stdselect_t sel; /* user selection (XPath) */
   struct {
@@ -22,7 +22,7 @@
 #include "myerror.h"
 
 #include <string.h>
-#include <sys/wait.h>
+#include <sys/time.h>
 
 typedef struct {
   const char *tempfile;
@@ -31,6 +31,7 @@ typedef struct {
 flag_t cmd = 0;
 
 int sa_signal = 0;
+unsigned int progress_interval = 0;
 signal_cleanup_t cleanup = { NULL };
 
 #if defined HAVE_SIGACTION
@@ -64,6 +65,7 @@ void init_signal_handling(flag_t flags) {
   sigaddset(&act.sa_mask,SIGTERM);
   sigaddset(&act.sa_mask,SIGPIPE);
   sigaddset(&act.sa_mask,SIGALRM);
+  sigaddset(&act.sa_mask,SIGUSR1);
   if( !checkflag(flags,SIGNALS_NOCHLD) ) {
     sigaddset(&act.sa_mask,SIGCHLD);
   }
@@ -79,15 +81,34 @@ void init_signal_handling(flag_t flags) {
     sigaction(SIGCHLD, &act, NULL);
   }
 
+  /* a progress request shouldn't make a blocking read or write fail */
+  act.sa_flags = SA_RESTART;
+  sigaction(SIGUSR1, &act, NULL);
+  act.sa_flags = 0;
+
   act.sa_handler = sigsegv;
   sigemptyset(&act.sa_mask);
   sigaddset(&act.sa_mask,SIGSEGV);
   act.sa_flags = 0;
   sigaction(SIGSEGV, &act, NULL);
 
+  if( progress_interval > 0 ) {
+    struct itimerval it;
+    it.it_interval.tv_sec = progress_interval;
+    it.it_interval.tv_usec = 0;
+    it.it_value = it.it_interval;
+    setitimer(ITIMER_REAL, &it, NULL);
+  }
+
 #endif
 }
 
+/* with seconds > 0, init_signal_handling() starts a timer which
+   raises CMD_INFO periodically, as well as CMD_ALRM */
+void set_progress_signal(unsigned int seconds) {
+  progress_interval = seconds;
+}
+
 void exit_signal_handling() {
   /* nothing - this is just to mess with your head ;-) */
 }
@@ -118,11 +139,18 @@ void process_pending_signal() {
 	       "caught termination request, ignoring further input.\n");
       break;
     case SIGCHLD:
-      waitpid(-1, NULL, WNOHANG);
+      /* the owner reaps its children, eg see reap_procpool() */
       setflag(&cmd,CMD_CHLD);
       break;
     case SIGALRM:
       setflag(&cmd,CMD_ALRM);
+      if( progress_interval > 0 ) {
+	setflag(&cmd,CMD_INFO);
+      }
+      break;
+    case SIGUSR1:
+      /* the parser prints the progress report, see audit_parser() */
+      setflag(&cmd,CMD_INFO);
       break;
     default:
       /* nothing */
@@ -35,6 +35,7 @@ typedef int sig_atomic_t; /* too bad, but the show must go on... */
 #define SIGNALS_NOCHLD   0x01
 
 void init_signal_handling(flag_t flags);
+void set_progress_signal(unsigned int seconds);
 void process_pending_signal();
 void exit_signal_handling();
 
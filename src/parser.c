@@ -22,9 +22,12 @@
 #include "mysignal.h"
 #include "myerror.h"
 #include "parser.h"
+#include "stats.h"
 #include <string.h>
+#include <strings.h>
 
 extern char *inputfile;
+extern volatile flag_t cmd;
 
 bool_t create_parser(parser_t *parser, void *ud) {
   if( parser ) {
@@ -37,6 +40,7 @@ bool_t create_parser(parser_t *parser, void *ud) {
     memset(&parser->callbacks, 0, sizeof(callback_t));
     XML_SetUserData(parser->p, parser); /* no need to free this later */
     parser->user = ud; /* user data, we don't free this either */
+    parser->offset = 0;
     parser->cur.rstatus = XML_STATUS_OK;
     return TRUE;
   }
@@ -46,6 +50,7 @@ bool_t create_parser(parser_t *parser, void *ud) {
 bool_t reset_parser(parser_t *parser) {
   if( parser && parser->p ) {
     parser->cur.rstatus = XML_ParserReset(parser->p, NULL);
+    parser->offset = 0;
     XML_SetUserData(parser->p, parser); /* no need to free this later */
     reset_handlers_parser(parser);
     return (bool_t)(parser->cur.rstatus == XML_STATUS_OK);
@@ -63,8 +68,11 @@ bool_t stop_parser(parser_t *parser, bool_t abort) {
 }
 
 bool_t restart_parser(parser_t *parser) {
+  double t = 0.0;
   if( parser ) {
+    STATS_BEGIN(t);
     parser->cur.rstatus = XML_ResumeParser(parser->p);
+    STATS_END(parse_time, t);
     return (bool_t)(parser->cur.rstatus == XML_STATUS_OK);
   }
   return FALSE;
@@ -92,52 +100,72 @@ void exec_result(result_t r, parser_t *parser) {
   }
 }
 
+/* calls back the user, and with --stats, counts the event and the time 
+   spent outside of expat. Use STATS_NUMEVENTS for events not counted. */
+#define DISPATCH(parser, event, call) \
+  do { \
+    if( STATS_UNLIKELY(tstats != NULL) ) { \
+      double t = now_stats(); \
+      if( (event) < STATS_NUMEVENTS ) { tstats->events[event]++; } \
+      exec_result( call, parser ); \
+      tstats->callback_time += now_stats() - t; \
+    } else { \
+      exec_result( call, parser ); \
+    } \
+  } while(0)
+
 void XMLCALL xml_startelementhandler(void *userdata, const XML_Char *name, const XML_Char **atts) {
   parser_t *parser = (parser_t *)userdata;
   if( parser && parser->callbacks.start_tag ) {
-    exec_result( parser->callbacks.start_tag(parser->user, name, atts), parser );
+    if( active_intern() ) {
+      parser->cur.tag = intern(name);
+    }
+    DISPATCH(parser, STATS_START_TAG, parser->callbacks.start_tag(parser->user, name, atts));
   }
 }
 
 void XMLCALL xml_endelementhandler(void *userdata, const XML_Char *name) {
   parser_t *parser = (parser_t *)userdata;
   if( parser && parser->callbacks.end_tag ) {
-    exec_result( parser->callbacks.end_tag(parser->user, name), parser );
+    if( active_intern() ) {
+      parser->cur.tag = intern(name);
+    }
+    DISPATCH(parser, STATS_END_TAG, parser->callbacks.end_tag(parser->user, name));
   }
 }
 
 void XMLCALL xml_characterdatahandler(void *userdata, const XML_Char *s, int len) {
   parser_t *parser = (parser_t *)userdata;
   if( parser && parser->callbacks.chardata ) {
-    exec_result( parser->callbacks.chardata(parser->user, s, (size_t)len), parser );
+    DISPATCH(parser, STATS_CHARDATA, parser->callbacks.chardata(parser->user, s, (size_t)len));
   }
 }
 
 void XMLCALL xml_processinginstructionhandler(void *userdata, const XML_Char *target, const XML_Char *data) {
   parser_t *parser = (parser_t *)userdata;
   if( parser && parser->callbacks.pidata ) {
-    exec_result( parser->callbacks.pidata(parser->user, target, data), parser );
+    DISPATCH(parser, STATS_PIDATA, parser->callbacks.pidata(parser->user, target, data));
   }
 }
 
 void XMLCALL xml_commenthandler(void *userdata, const XML_Char *data) {
   parser_t *parser = (parser_t *)userdata;
   if( parser && parser->callbacks.comment ) {
-    exec_result( parser->callbacks.comment(parser->user, data), parser );
+    DISPATCH(parser, STATS_COMMENT, parser->callbacks.comment(parser->user, data));
   }
 }
 
 void XMLCALL xml_startcdatahandler(void *userdata) {
   parser_t *parser = (parser_t *)userdata;
   if( parser && parser->callbacks.start_cdata ) {
-    exec_result( parser->callbacks.start_cdata(parser->user), parser );
+    DISPATCH(parser, STATS_CDATA, parser->callbacks.start_cdata(parser->user));
   }
 }
 
 void XMLCALL xml_endcdatahandler(void *userdata) {
   parser_t *parser = (parser_t *)userdata;
   if( parser && parser->callbacks.end_cdata ) {
-    exec_result( parser->callbacks.end_cdata(parser->user), parser );
+    DISPATCH(parser, STATS_NUMEVENTS, parser->callbacks.end_cdata(parser->user));
   }
 }
 
@@ -148,14 +176,14 @@ void XMLCALL xml_startdoctypedeclhandler(void *userdata,
 					 int has_internal_subset) {
   parser_t *parser = (parser_t *)userdata;
   if( parser && parser->callbacks.start_doctypedecl ) {
-    exec_result( parser->callbacks.start_doctypedecl(parser->user, doctypeName, sysid, pubid, has_internal_subset), parser );
+    DISPATCH(parser, STATS_DOCTYPE, parser->callbacks.start_doctypedecl(parser->user, doctypeName, sysid, pubid, has_internal_subset));
   }
 }
 
 void XMLCALL xml_enddoctypedeclhandler(void *userdata) {
   parser_t *parser = (parser_t *)userdata;
   if( parser && parser->callbacks.end_doctypedecl ) {
-    exec_result( parser->callbacks.end_doctypedecl(parser->user), parser );
+    DISPATCH(parser, STATS_NUMEVENTS, parser->callbacks.end_doctypedecl(parser->user));
   }
 }
 
@@ -170,7 +198,7 @@ void XMLCALL xml_entitydeclhandler(void *userdata,
 				   const XML_Char *notationName) {
   parser_t *parser = (parser_t *)userdata;
   if( parser && parser->callbacks.entitydecl ) {
-    exec_result( parser->callbacks.entitydecl(parser->user, entityName, is_parameter_entity, value, value_length, base, systemId, publicId, notationName), parser );
+    DISPATCH(parser, STATS_NUMEVENTS, parser->callbacks.entitydecl(parser->user, entityName, is_parameter_entity, value, value_length, base, systemId, publicId, notationName));
   }
 }
 
@@ -201,7 +229,7 @@ int XMLCALL xml_externalentityrefhandler(XML_Parser dummy,
 void XMLCALL xml_defaulthandler(void *userdata, const XML_Char *s, int len) {
   parser_t *parser = (parser_t *)userdata;
   if( parser && parser->callbacks.dfault ) {
-    exec_result( parser->callbacks.dfault(parser->user, s, (size_t)len), parser );
+    DISPATCH(parser, STATS_DEFAULT, parser->callbacks.dfault(parser->user, s, (size_t)len));
   }
 }
 
@@ -306,25 +334,83 @@ bool_t audit_parser(parser_t *parser) {
     parser->cur.colno = XML_GetCurrentColumnNumber(parser->p);
     parser->cur.length = XML_GetCurrentByteCount(parser->p);
     parser->cur.byteno = XML_GetCurrentByteIndex(parser->p);
+    if( parser->cur.byteno >= 0 ) {
+      parser->cur.byteno += parser->offset;
+    }
+    if( STATS_UNLIKELY(true_and_clearflag((flag_t *)&cmd,CMD_INFO)) ) {
+      print_progress(inputfile, parser->cur.byteno);
+    }
     return (bool_t)(parser->cur.rstatus == XML_STATUS_OK);
   }
   return FALSE;
 }
 
+/* byte offsets [begin, end) of the event being reported, valid inside
+   a callback only. The end tag of an empty element has begin == end. */
+bool_t range_parser(parser_t *parser, long *begin, long *end) {
+  if( parser && begin && end ) {
+    *begin = XML_GetCurrentByteIndex(parser->p);
+    if( *begin < 0 ) {
+      return FALSE;
+    }
+    *begin += parser->offset;
+    *end = *begin + XML_GetCurrentByteCount(parser->p);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* true if buf lies in the parser's input buffer, where it stays until
+   the next call to do_parser(). Some callback data does not, eg a
+   normalized newline. */
+bool_t inbuf_parser(parser_t *parser, const char_t *buf, size_t buflen) {
+  const char *ctx;
+  int offset, size;
+  if( parser ) {
+    ctx = XML_GetInputContext(parser->p, &offset, &size);
+    return ctx && ((const char *)buf >= ctx) && 
+      ((const char *)buf + buflen <= ctx + size);
+  }
+  return FALSE;
+}
+
+/* the input after the current event, which the parser hasn't looked
+   at yet. Valid inside a callback only. The bytes belong to the parser's
+   own buffer (see getbuf_parser()), and the caller may change them. */
+byte_t *ahead_parser(parser_t *parser, size_t *n) {
+  const char *ctx;
+  int offset, size, count;
+  if( parser && n ) {
+    ctx = XML_GetInputContext(parser->p, &offset, &size);
+    count = XML_GetCurrentByteCount(parser->p);
+    if( ctx && (count > 0) && (offset + count <= size) ) {
+      *n = size - (offset + count);
+      return (byte_t *)ctx + offset + count;
+    }
+  }
+  return NULL;
+}
+
 bool_t do_parser(parser_t *parser, size_t nbytes) {
   int n, fin;
+  double t = 0.0;
   if( parser ) {
     n = (nbytes < 0) ? 0 : nbytes;
     fin = (nbytes < 0);
+    STATS_BEGIN(t);
     parser->cur.rstatus = XML_ParseBuffer(parser->p, n, fin);
+    STATS_END(parse_time, t);
     return audit_parser(parser);
   }
   return FALSE;
 }
 
 bool_t do_parser2(parser_t *parser, const byte_t *buf, size_t nbytes) {
+  double t = 0.0;
   if( parser && buf && (nbytes >= 0)) {
+    STATS_BEGIN(t);
     parser->cur.rstatus = XML_Parse(parser->p, (char *)buf, (int)nbytes, 0);
+    STATS_END(parse_time, t);
     return audit_parser(parser);
   }
   return FALSE;
@@ -360,3 +446,45 @@ void freebuf_parser(parser_t *parser, byte_t *buf) {
   }
 }
 
+/* Expat converts everything to UTF-8, but copying input bytes directly
+ * is only safe if they are UTF-8 already. We look at the byte order mark
+ * and the XML declaration, which must come first in the document.
+ * Anything unclear, such as a truncated declaration, counts as FALSE.
+ */
+bool_t utf8_prefix_parser(const byte_t *buf, size_t buflen) {
+  const char *p, *e, *q;
+  size_t n;
+  if( (buflen >= 3) && (memcmp(buf, "\xef\xbb\xbf", 3) == 0) ) {
+    buf += 3;
+    buflen -= 3;
+  }
+  if( (buflen < 2) || (buf[0] == '\0') || (buf[1] == '\0') ||
+      (buf[0] == 0xfe) || (buf[0] == 0xff) ) {
+    return FALSE; /* UTF-16, UTF-32, or too short to tell */
+  }
+  if( (buflen >= 5) && (memcmp(buf, "<?xml", 5) != 0) ) {
+    return TRUE; /* no declaration */
+  } else if( (buflen < 5) && (memcmp(buf, "<?xml", buflen) != 0) ) {
+    return TRUE;
+  }
+  p = (const char *)buf;
+  e = p + buflen;
+  for(q = p; (q + 1 < e) && !((q[0] == '?') && (q[1] == '>')); q++) { }
+  if( q + 1 >= e ) {
+    return FALSE;
+  }
+  e = q;
+  for(q = p; (q + 8 < e) && (strncmp(q, "encoding", 8) != 0); q++) { }
+  if( q + 8 >= e ) {
+    return TRUE; /* UTF-8 is the default */
+  }
+  for(q += 8; (q < e) && (*q != '"') && (*q != '\''); q++) { }
+  if( q >= e ) {
+    return FALSE;
+  }
+  for(p = ++q; (q < e) && (*q != p[-1]); q++) { }
+  n = q - p;
+  return ((n == 5) && (strncasecmp(p, "UTF-8", 5) == 0)) ||
+    ((n == 8) && (strncasecmp(p, "US-ASCII", 8) == 0)) ||
+    ((n == 5) && (strncasecmp(p, "ASCII", 5) == 0));
+}
@@ -26,6 +26,7 @@
 #endif
 
 #include <expat.h>
+#include "intern.h"
 
 typedef struct {
   enum XML_Status rstatus;
@@ -34,6 +35,7 @@ typedef struct {
   int colno;
   int length;
   long byteno;
+  nameid_t tag; /* current tag name, if active_intern() */
 } status_t;
 
 typedef int result_t;
@@ -85,6 +87,7 @@ typedef struct {
   status_t cur;
   callback_t callbacks;
   void *user;
+  long offset; /* input bytes never given to expat, see skip_stdparse() */
 } parser_t;
 
 bool_t create_parser(parser_t *parser, void *ud);
@@ -103,9 +106,16 @@ bool_t aborted_parser(parser_t *parser);
 
 bool_t setup_parser(parser_t *parser, callback_t *callbacks);
 bool_t audit_parser(parser_t *parser);
+bool_t range_parser(parser_t *parser, long *begin, long *end);
+bool_t inbuf_parser(parser_t *parser, const char_t *buf, size_t buflen);
+byte_t *ahead_parser(parser_t *parser, size_t *n);
 bool_t do_parser(parser_t *parser, size_t nbytes);
 bool_t do_parser2(parser_t *parser, const byte_t *buf, size_t nbytes);
 
 const char_t *error_message_parser(parser_t *parser);
 
+/* TRUE if a document starting with these bytes is UTF-8 (or US-ASCII),
+   so that its raw bytes can be mixed with our UTF-8 output */
+bool_t utf8_prefix_parser(const byte_t *buf, size_t buflen);
+
 #endif
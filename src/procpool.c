@@ -0,0 +1,144 @@
+/* 
+ * Copyright (C) 2006 Laird Breyer
+ *  
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA.
+ * 
+ * Author:   Laird Breyer <laird@lbreyer.com>
+ */
+
+#include "common.h"
+#include "myerror.h"
+#include "mem.h"
+#include "io.h"
+#include "mysignal.h"
+#include "procpool.h"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <string.h>
+#include <errno.h>
+
+extern volatile flag_t cmd;
+
+bool_t create_procpool(procpool_t *pp, int maxprocs) {
+  if( pp ) {
+    memset(pp, 0, sizeof(procpool_t));
+    pp->maxprocs = MAX(maxprocs, 1);
+    return create_mem(&pp->running, &pp->maxrunning, sizeof(proc_t), 16) &&
+      create_mem(&pp->done, &pp->maxdone, sizeof(proc_t), 16);
+  }
+  return FALSE;
+}
+
+bool_t free_procpool(procpool_t *pp) {
+  if( pp ) {
+    free_mem(&pp->running, &pp->maxrunning);
+    free_mem(&pp->done, &pp->maxdone);
+    pp->nrunning = pp->ndone = pp->head = 0;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t finish_procpool(procpool_t *pp, pid_t pid, int status) {
+  proc_t *p;
+  int i;
+  for(i = 0; i < pp->nrunning; i++) {
+    if( pp->running[i].pid == pid ) {
+      if( pp->head == pp->ndone ) {
+	pp->head = pp->ndone = 0;
+      }
+      if( (pp->ndone >= pp->maxdone) &&
+	  !grow_mem(&pp->done, &pp->maxdone, sizeof(proc_t), 16) ) {
+	errormsg(E_FATAL, "out of memory\n");
+      }
+      p = &pp->done[pp->ndone++];
+      *p = pp->running[i];
+      p->status = status;
+      pp->running[i] = pp->running[--pp->nrunning];
+      return TRUE;
+    }
+  }
+  return FALSE; /* not ours */
+}
+
+/* collect the children which have exited, and wait until fewer than
+ * n are still running.
+ */
+bool_t reap_procpool(procpool_t *pp, int n) {
+  pid_t pid;
+  int status;
+  if( pp ) {
+    while( pp->nrunning > 0 ) {
+      pid = waitpid(-1, &status, (pp->nrunning >= n) ? 0 : WNOHANG);
+      if( pid > 0 ) {
+	finish_procpool(pp, pid, status);
+      } else if( pid == 0 ) {
+	break;
+      } else if( errno == EINTR ) {
+	process_pending_signal();
+      } else {
+	/* somebody else reaped them */
+	while( pp->nrunning > 0 ) {
+	  finish_procpool(pp, pp->running[0].pid, -1);
+	}
+      }
+    }
+    clearflag((flag_t *)&cmd,CMD_CHLD);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* start a command, after waiting for a free slot. If infd != NULL,
+ * the command reads its stdin from *infd, see spawn_cmdline().
+ */
+pid_t run_procpool(procpool_t *pp, const char *filename, const char **argv,
+		   int *infd, void *user) {
+  proc_t *p;
+  pid_t pid;
+  if( pp && filename && argv ) {
+    if( checkflag(cmd,CMD_CHLD) || (pp->nrunning >= pp->maxprocs) ) {
+      reap_procpool(pp, pp->maxprocs);
+    }
+    pid = spawn_cmdline(filename, argv, infd);
+    if( pid != -1 ) {
+      if( (pp->nrunning >= pp->maxrunning) &&
+	  !grow_mem(&pp->running, &pp->maxrunning, sizeof(proc_t), 16) ) {
+	errormsg(E_FATAL, "out of memory\n");
+      }
+      p = &pp->running[pp->nrunning++];
+      p->pid = pid;
+      p->status = -1;
+      p->user = user;
+    }
+    return pid;
+  }
+  return -1;
+}
+
+/* pop the next finished child, if any */
+bool_t get_done_procpool(procpool_t *pp, proc_t *p) {
+  if( pp && p && (pp->head < pp->ndone) ) {
+    *p = pp->done[pp->head++];
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t success_proc(const proc_t *p) {
+  return p && (p->status != -1) && 
+    WIFEXITED(p->status) && (WEXITSTATUS(p->status) == 0);
+}
@@ -0,0 +1,60 @@
+/* 
+ * Copyright (C) 2009 Laird Breyer
+ *  
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA.
+ * 
+ * Author:   Laird Breyer <laird@lbreyer.com>
+ */
+#ifndef PROCPOOL_H
+#define PROCPOOL_H
+
+#include "common.h"
+#include <sys/types.h>
+
+/* A procpool_t runs external commands in the background, at most
+ * maxprocs at a time. Children which have exited are collected with
+ * reap_procpool(), usually after CMD_CHLD is raised, and are queued
+ * until the caller picks them up with get_done_procpool().
+ * The pool assumes that it owns every child of the process while
+ * it is in use. NOT THREAD SAFE.
+ */
+
+typedef struct {
+  pid_t pid;
+  int status; /* as given by waitpid(), or -1 if unknown */
+  void *user;
+} proc_t;
+
+typedef struct {
+  proc_t *running;
+  int nrunning;
+  size_t maxrunning;
+  proc_t *done; /* queue, done[head..ndone) */
+  int head, ndone;
+  size_t maxdone;
+  int maxprocs;
+} procpool_t;
+
+bool_t create_procpool(procpool_t *pp, int maxprocs);
+bool_t free_procpool(procpool_t *pp);
+
+pid_t run_procpool(procpool_t *pp, const char *filename, const char **argv,
+		   int *infd, void *user);
+bool_t reap_procpool(procpool_t *pp, int n);
+bool_t get_done_procpool(procpool_t *pp, proc_t *p);
+
+bool_t success_proc(const proc_t *p);
+
+#endif
@@ -0,0 +1,592 @@
+/* 
+ * Copyright (C) 2009 Laird Breyer
+ *  
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA.
+ * 
+ * Author:   Laird Breyer <laird@lbreyer.com>
+ */
+
+#include "common.h"
+#include "rawscan.h"
+#include "mem.h"
+#include "myerror.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define RAWSCAN_SIMD 1
+#endif
+
+/* scanner states */
+#define RS_TEXT      0
+#define RS_LT        1
+#define RS_STAG      2
+#define RS_ETAG      3
+#define RS_QUOTE     4
+#define RS_BANG      5
+#define RS_BANG2     6
+#define RS_COMMENT   7
+#define RS_CDHEAD    8
+#define RS_CDATA     9
+#define RS_PI       10
+#define RS_DECL     11
+#define RS_SUBSET   12
+#define RS_SUBLT    13
+#define RS_SUBBANG  14
+#define RS_SUBBANG2 15
+
+#define RAWSCAN_PENDING 0x01 /* nonblank text since the last tag */
+#define RAWSCAN_LEAD    0x02 /* nonblank text before the first tag */
+#define RAWSCAN_TAGS    0x04 /* some tag was seen */
+#define RAWSCAN_SLASH   0x08 /* last byte seen in a start tag was '/' */
+#define RAWSCAN_CR      0x10 /* last byte of text was '\r' */
+
+#define TEXT_NONBLANK 0x01
+#define TEXT_AMP      0x02
+#define TEXT_CR       0x04
+
+bool_t create_rawscan(rawscan_t *rs) {
+  if( rs ) {
+    memset(rs, 0, sizeof(rawscan_t));
+    return create_mem(&rs->pos, &rs->maxpos, sizeof(rawlevel_t), 16);
+  }
+  return FALSE;
+}
+
+bool_t free_rawscan(rawscan_t *rs) {
+  if( rs ) {
+    if( rs->pos ) {
+      free_mem(&rs->pos, &rs->maxpos);
+    }
+    if( rs->neg ) {
+      free_mem(&rs->neg, &rs->maxneg);
+    }
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t reset_rawscan(rawscan_t *rs) {
+  if( rs ) {
+    if( rs->pos ) {
+      memset(rs->pos, 0, rs->maxpos * sizeof(rawlevel_t));
+    }
+    if( rs->neg ) {
+      memset(rs->neg, 0, rs->maxneg * sizeof(rawlevel_t));
+    }
+    rs->depth = rs->mindepth = rs->maxdepth = 0;
+    rs->state = RS_TEXT;
+    rs->back = RS_TEXT;
+    rs->run = 0;
+    rs->entlen = 0;
+    rs->flags = 0;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+static rawlevel_t *level(rawscan_t *rs, int depth) {
+  rawlevel_t **v;
+  size_t *max, i, old;
+  if( depth >= 0 ) {
+    v = &rs->pos;
+    max = &rs->maxpos;
+    i = depth;
+  } else {
+    v = &rs->neg;
+    max = &rs->maxneg;
+    i = -depth - 1;
+  }
+  while( i >= *max ) {
+    old = *max;
+    if( !grow_mem(v, max, sizeof(rawlevel_t), 16) ) {
+      errormsg(E_FATAL, "out of memory.\n");
+    }
+    memset(*v + old, 0, (*max - old) * sizeof(rawlevel_t));
+  }
+  return *v + i;
+}
+
+const rawlevel_t *level_rawscan(const rawscan_t *rs, int depth) {
+  if( rs && (depth >= 0) && ((size_t)depth < rs->maxpos) ) {
+    return rs->pos + depth;
+  } else if( rs && (depth < 0) && ((size_t)(-depth - 1) < rs->maxneg) ) {
+    return rs->neg + (-depth - 1);
+  }
+  return NULL;
+}
+
+bool_t unfinished_rawscan(const rawscan_t *rs) {
+  return rs && ((rs->state != RS_TEXT) || (rs->entlen > 0));
+}
+
+bool_t pending_rawscan(const rawscan_t *rs) {
+  return rs && checkflag(rs->flags, RAWSCAN_PENDING);
+}
+
+bool_t resumable_rawscan(rawscan_t *rs) {
+  return rs && !unfinished_rawscan(rs);
+}
+
+/* first of four special bytes, or e */
+static const byte_t *find_rawscan(const byte_t *p, const byte_t *e,
+				  byte_t a, byte_t b, byte_t c, byte_t d) {
+#if RAWSCAN_SIMD
+  const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+  const __m128i vc = _mm_set1_epi8(c), vd = _mm_set1_epi8(d);
+  __m128i x;
+  int m;
+  for(; e - p >= 16; p += 16) {
+    x = _mm_loadu_si128((const __m128i *)p);
+    m = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, va),
+						    _mm_cmpeq_epi8(x, vb)),
+				       _mm_or_si128(_mm_cmpeq_epi8(x, vc),
+						    _mm_cmpeq_epi8(x, vd))));
+    if( m ) {
+      return p + __builtin_ctz(m);
+    }
+  }
+#endif
+  for(; p < e; p++) {
+    if( (*p == a) || (*p == b) || (*p == c) || (*p == d) ) {
+      return p;
+    }
+  }
+  return e;
+}
+
+/* count the UTF-8 continuation bytes, and look for the bytes which
+   need a closer look */
+static int classify_text(const byte_t *p, const byte_t *e, long *conts) {
+  long n = 0;
+  int f = 0;
+#if RAWSCAN_SIMD
+  const __m128i top = _mm_set1_epi8(-64);
+  const __m128i sp = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+  const __m128i nl = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+  const __m128i amp = _mm_set1_epi8('&');
+  __m128i x, r, b;
+  for(; e - p >= 16; p += 16) {
+    x = _mm_loadu_si128((const __m128i *)p);
+    n += __builtin_popcount(_mm_movemask_epi8(_mm_cmplt_epi8(x, top)));
+    r = _mm_cmpeq_epi8(x, cr);
+    b = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, sp),
+				  _mm_cmpeq_epi8(x, tab)),
+		     _mm_or_si128(_mm_cmpeq_epi8(x, nl), r));
+    if( _mm_movemask_epi8(b) != 0xffff ) {
+      f |= TEXT_NONBLANK;
+    }
+    if( _mm_movemask_epi8(r) ) {
+      f |= TEXT_CR;
+    }
+    if( _mm_movemask_epi8(_mm_cmpeq_epi8(x, amp)) ) {
+      f |= TEXT_AMP;
+    }
+  }
+#endif
+  for(; p < e; p++) {
+    switch(*p) {
+    case ' ':
+    case '\t':
+    case '\n':
+      break;
+    case '\r':
+      f |= TEXT_CR;
+      break;
+    case '&':
+      f |= (TEXT_AMP|TEXT_NONBLANK);
+      break;
+    default:
+      f |= TEXT_NONBLANK;
+      n += ((*p & 0xc0) == 0x80);
+      break;
+    }
+  }
+  *conts = n;
+  return f;
+}
+
+static int utf8len(long code) {
+  return (code < 0x80) ? 1 : (code < 0x800) ? 2 : (code < 0x10000) ? 3 : 4;
+}
+
+/* references shrink to what they stand for, and \r\n becomes \n */
+static void fix_text_rawscan(rawscan_t *rs, const byte_t *p, const byte_t *e,
+			     bool_t refs, long *bytes, long *chars) {
+  int d;
+  for(; p < e; p++) {
+    if( true_and_clearflag(&rs->flags, RAWSCAN_CR) && (*p == '\n') ) {
+      (*bytes)--;
+      (*chars)--;
+    }
+    if( rs->entlen > 0 ) {
+      rs->entlen++;
+      if( *p == ';' ) {
+	d = (rs->entbase > 0) ? utf8len(rs->entcode) : 1;
+	*bytes -= rs->entlen - d;
+	*chars -= rs->entlen - 1;
+	rs->entlen = 0;
+      } else if( (rs->entlen == 2) && (*p == '#') ) {
+	rs->entbase = 10;
+      } else if( (rs->entlen == 3) && (rs->entbase == 10) && (*p == 'x') ) {
+	rs->entbase = 16;
+      } else if( rs->entbase > 0 ) {
+	d = (*p <= '9') ? (*p - '0') : ((*p | 0x20) - 'a' + 10);
+	rs->entcode = MIN(rs->entcode * rs->entbase + d, 0x110000);
+      } else if( rs->entlen > 64 ) {
+	rs->entlen = 0; /* not a reference after all */
+      }
+    } else if( refs && (*p == '&') ) {
+      rs->entlen = 1;
+      rs->entbase = 0;
+      rs->entcode = 0;
+    } else if( *p == '\r' ) {
+      setflag(&rs->flags, RAWSCAN_CR);
+    }
+  }
+}
+
+static void text_rawscan(rawscan_t *rs, const byte_t *p, const byte_t *e,
+			 bool_t refs) {
+  rawlevel_t *l;
+  long conts, bytes, chars;
+  int f;
+  if( p < e ) {
+    f = classify_text(p, e, &conts);
+    bytes = e - p;
+    chars = bytes - conts;
+    if( (f & (TEXT_AMP|TEXT_CR)) || (rs->entlen > 0) ||
+	checkflag(rs->flags, RAWSCAN_CR) ) {
+      fix_text_rawscan(rs, p, e, refs, &bytes, &chars);
+    }
+    l = level(rs, rs->depth);
+    l->bytes += bytes;
+    l->chars += chars;
+    if( f & TEXT_NONBLANK ) {
+      setflag(&rs->flags, RAWSCAN_PENDING);
+    }
+  }
+}
+
+/* a tag ends the current text run */
+static void close_text_rawscan(rawscan_t *rs) {
+  clearflag(&rs->flags, RAWSCAN_CR);
+  if( !checkflag(rs->flags, RAWSCAN_TAGS) ) {
+    setflag(&rs->flags, RAWSCAN_TAGS);
+    if( checkflag(rs->flags, RAWSCAN_PENDING) ) {
+      setflag(&rs->flags, RAWSCAN_LEAD);
+    }
+  }
+  if( true_and_clearflag(&rs->flags, RAWSCAN_PENDING) ) {
+    level(rs, rs->depth)->texts++;
+  }
+}
+
+/* number of c just before e, and more before p if it's all c */
+static int trailing(const byte_t *p, const byte_t *e, byte_t c, int more) {
+  const byte_t *q = e;
+  while( (q > p) && (q[-1] == c) ) {
+    q--;
+  }
+  return (e - q) + ((q == p) ? more : 0);
+}
+
+bool_t scan_rawscan(rawscan_t *rs, const byte_t *buf, size_t buflen) {
+  const byte_t *p, *q, *e;
+  long n;
+  if( !rs || !buf ) {
+    return FALSE;
+  }
+  p = buf;
+  e = buf + buflen;
+  while( p < e ) {
+    switch(rs->state) {
+    case RS_TEXT:
+      q = memchr(p, '<', e - p);
+      if( !q ) {
+	text_rawscan(rs, p, e, TRUE);
+	p = e;
+      } else {
+	text_rawscan(rs, p, q, TRUE);
+	rs->state = RS_LT;
+	p = q + 1;
+      }
+      break;
+    case RS_LT:
+      switch(*p) {
+      case '/':
+	close_text_rawscan(rs);
+	rs->depth--;
+	rs->mindepth = MIN(rs->mindepth, rs->depth);
+	rs->state = RS_ETAG;
+	p++;
+	break;
+      case '!':
+	rs->state = RS_BANG;
+	p++;
+	break;
+      case '?':
+	rs->state = RS_PI;
+	rs->back = RS_TEXT;
+	rs->run = 0;
+	p++;
+	break;
+      default:
+	close_text_rawscan(rs);
+	rs->depth++;
+	rs->maxdepth = MAX(rs->maxdepth, rs->depth);
+	level(rs, rs->depth)->elements++;
+	clearflag(&rs->flags, RAWSCAN_SLASH);
+	rs->state = RS_STAG;
+	break;
+      }
+      break;
+    case RS_STAG:
+      q = find_rawscan(p, e, '>', '=', '"', '\'');
+      if( q == e ) {
+	flipflag(&rs->flags, RAWSCAN_SLASH, (e[-1] == '/'));
+	p = e;
+	break;
+      }
+      switch(*q) {
+      case '>':
+	if( (q > p) ? (q[-1] == '/') : checkflag(rs->flags, RAWSCAN_SLASH) ) {
+	  rs->depth--; /* empty element */
+	}
+	rs->state = RS_TEXT;
+	break;
+      case '=':
+	level(rs, rs->depth)->attributes++;
+	break;
+      default:
+	rs->quote = *q;
+	rs->back = RS_STAG;
+	rs->state = RS_QUOTE;
+	break;
+      }
+      clearflag(&rs->flags, RAWSCAN_SLASH);
+      p = q + 1;
+      break;
+    case RS_ETAG:
+      q = memchr(p, '>', e - p);
+      if( !q ) {
+	p = e;
+      } else {
+	rs->state = RS_TEXT;
+	p = q + 1;
+      }
+      break;
+    case RS_QUOTE:
+      q = memchr(p, rs->quote, e - p);
+      if( !q ) {
+	p = e;
+      } else {
+	rs->state = rs->back;
+	p = q + 1;
+      }
+      break;
+    case RS_BANG:
+      rs->run = 0;
+      rs->state = (*p == '-') ? RS_BANG2 : (*p == '[') ? RS_CDHEAD : RS_DECL;
+      p++;
+      break;
+    case RS_BANG2:
+      level(rs, rs->depth)->comments++;
+      rs->state = RS_COMMENT;
+      rs->back = RS_TEXT;
+      rs->run = 0;
+      p++;
+      break;
+    case RS_COMMENT:
+      /* ends with --> */
+      q = memchr(p, '>', e - p);
+      if( !q ) {
+	rs->run = trailing(p, e, '-', rs->run);
+	p = e;
+      } else {
+	if( trailing(p, q, '-', rs->run) >= 2 ) {
+	  rs->state = rs->back;
+	}
+	rs->run = 0;
+	p = q + 1;
+      }
+      break;
+    case RS_CDHEAD:
+      /* skip CDATA[ */
+      n = MIN(e - p, 6 - rs->run);
+      rs->run += n;
+      p += n;
+      if( rs->run == 6 ) {
+	rs->state = RS_CDATA;
+	rs->run = 0;
+      }
+      break;
+    case RS_CDATA:
+      /* ends with ]]>, and the brackets may be in the previous buffer */
+      q = memchr(p, '>', e - p);
+      if( !q ) {
+	text_rawscan(rs, p, e, FALSE);
+	rs->run = trailing(p, e, ']', rs->run);
+	p = e;
+      } else if( trailing(p, q, ']', rs->run) >= 2 ) {
+	n = MIN(trailing(p, q, ']', 0), 2);
+	text_rawscan(rs, p, q - n, FALSE);
+	if( n < 2 ) {
+	  level(rs, rs->depth)->bytes -= 2 - n;
+	  level(rs, rs->depth)->chars -= 2 - n;
+	}
+	clearflag(&rs->flags, RAWSCAN_CR);
+	rs->state = RS_TEXT;
+	rs->run = 0;
+	p = q + 1;
+      } else {
+	text_rawscan(rs, p, q + 1, FALSE);
+	rs->run = 0;
+	p = q + 1;
+      }
+      break;
+    case RS_PI:
+      /* ends with ?> */
+      q = memchr(p, '>', e - p);
+      if( !q ) {
+	rs->run = (e[-1] == '?');
+	p = e;
+      } else {
+	if( (q > p) ? (q[-1] == '?') : rs->run ) {
+	  rs->state = rs->back;
+	}
+	rs->run = 0;
+	p = q + 1;
+      }
+      break;
+    case RS_DECL:
+      q = find_rawscan(p, e, '>', '[', '"', '\'');
+      if( q < e ) {
+	switch(*q) {
+	case '>':
+	  rs->state = RS_TEXT;
+	  break;
+	case '[':
+	  rs->state = RS_SUBSET;
+	  break;
+	default:
+	  rs->quote = *q;
+	  rs->back = RS_DECL;
+	  rs->state = RS_QUOTE;
+	  break;
+	}
+	q++;
+      }
+      p = q;
+      break;
+    case RS_SUBSET:
+      /* the internal DTD subset: declarations, comments and PIs */
+      q = find_rawscan(p, e, ']', '<', '"', '\'');
+      if( q < e ) {
+	switch(*q) {
+	case ']':
+	  rs->state = RS_DECL;
+	  break;
+	case '<':
+	  rs->state = RS_SUBLT;
+	  break;
+	default:
+	  rs->quote = *q;
+	  rs->back = RS_SUBSET;
+	  rs->state = RS_QUOTE;
+	  break;
+	}
+	q++;
+      }
+      p = q;
+      break;
+    case RS_SUBLT:
+      rs->back = RS_SUBSET;
+      rs->run = 0;
+      rs->state = (*p == '!') ? RS_SUBBANG : (*p == '?') ? RS_PI : RS_SUBSET;
+      p++;
+      break;
+    case RS_SUBBANG:
+      rs->state = (*p == '-') ? RS_SUBBANG2 : RS_SUBSET;
+      p++;
+      break;
+    case RS_SUBBANG2:
+      rs->back = RS_SUBSET;
+      rs->state = RS_COMMENT;
+      rs->run = 0;
+      p++;
+      break;
+    }
+  }
+  return TRUE;
+}
+
+static void add_level(rawlevel_t *l, const rawlevel_t *m) {
+  l->elements += m->elements;
+  l->attributes += m->attributes;
+  l->texts += m->texts;
+  l->comments += m->comments;
+  l->bytes += m->bytes;
+  l->chars += m->chars;
+}
+
+bool_t reduce_rawscan(rawscan_t *rs, const rawscan_t *next) {
+  int base;
+  size_t i;
+  flag_t f;
+  if( rs && next ) {
+    base = rs->depth;
+    for(i = 0; i < next->maxpos; i++) {
+      add_level(level(rs, base + (int)i), next->pos + i);
+    }
+    for(i = 0; i < next->maxneg; i++) {
+      add_level(level(rs, base - 1 - (int)i), next->neg + i);
+    }
+
+    /* a text run can straddle the cut */
+    f = rs->flags & (RAWSCAN_LEAD|RAWSCAN_TAGS);
+    if( checkflag(next->flags, RAWSCAN_TAGS) ) {
+      if( checkflag(rs->flags, RAWSCAN_PENDING) &&
+	  !checkflag(next->flags, RAWSCAN_LEAD) ) {
+	level(rs, base)->texts++;
+      }
+      if( !checkflag(rs->flags, RAWSCAN_TAGS) &&
+	  (checkflag(rs->flags, RAWSCAN_PENDING) ||
+	   checkflag(next->flags, RAWSCAN_LEAD)) ) {
+	setflag(&f, RAWSCAN_LEAD);
+      }
+      f |= next->flags & RAWSCAN_PENDING;
+    } else {
+      f |= (rs->flags | next->flags) & RAWSCAN_PENDING;
+    }
+    f |= next->flags & (RAWSCAN_TAGS|RAWSCAN_SLASH|RAWSCAN_CR);
+    rs->flags = f;
+
+    rs->mindepth = MIN(rs->mindepth, base + next->mindepth);
+    rs->maxdepth = MAX(rs->maxdepth, base + next->maxdepth);
+    rs->depth = base + next->depth;
+    rs->state = next->state;
+    rs->back = next->back;
+    rs->run = next->run;
+    rs->quote = next->quote;
+    rs->entlen = next->entlen;
+    rs->entbase = next->entbase;
+    rs->entcode = next->entcode;
+    return TRUE;
+  }
+  return FALSE;
+}
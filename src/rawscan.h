@@ -0,0 +1,81 @@
+/* 
+ * Copyright (C) 2009 Laird Breyer
+ *  
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA.
+ * 
+ * Author:   Laird Breyer <laird@lbreyer.com>
+ */
+
+#ifndef RAWSCAN_H
+#define RAWSCAN_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/*
+ * The rawscan_t counts the nodes of an XML document without parsing it.
+ * It only looks for the characters which delimit markup (< > / ? ! and
+ * quotes), so it is much faster than expat, but it checks nothing: a
+ * broken document simply gives meaningless counts. Entities declared
+ * in a DTD aren't expanded, they count as a single character.
+ *
+ * The input can be passed in pieces of any size. A document can also be
+ * cut into chunks which are scanned separately, each as if it started
+ * at depth 0 outside of any markup, and the results are then put back
+ * together in order with reduce_rawscan(). This is only correct if the
+ * earlier part really ends outside of markup, see resumable_rawscan().
+ * Otherwise, scan the chunk again, continuing the earlier part.
+ *
+ * Depths are counted like stdparse does: the root element has depth 1.
+ */
+
+typedef struct {
+  long elements; /* start tags */
+  long attributes;
+  long texts; /* nonblank runs of character data between tags */
+  long comments;
+  long bytes; /* character data, in bytes */
+  long chars; /* character data, in UTF-8 characters */
+} rawlevel_t;
+
+typedef struct {
+  rawlevel_t *pos, *neg; /* counts at depths >= 0 and < 0 */
+  size_t maxpos, maxneg;
+  int depth; /* current depth, relative to the start */
+  int mindepth, maxdepth;
+  int state, back, run;
+  byte_t quote;
+  int entlen, entbase; /* unfinished entity reference */
+  long entcode;
+  flag_t flags;
+} rawscan_t;
+
+bool_t create_rawscan(rawscan_t *rs);
+bool_t free_rawscan(rawscan_t *rs);
+bool_t reset_rawscan(rawscan_t *rs);
+
+bool_t scan_rawscan(rawscan_t *rs, const byte_t *buf, size_t buflen);
+bool_t resumable_rawscan(rawscan_t *rs);
+bool_t reduce_rawscan(rawscan_t *rs, const rawscan_t *next);
+
+/* counts at a depth relative to the start, or NULL if none */
+const rawlevel_t *level_rawscan(const rawscan_t *rs, int depth);
+/* TRUE if the input ended in the middle of some markup */
+bool_t unfinished_rawscan(const rawscan_t *rs);
+/* TRUE if a text run after the last tag has nonblank characters */
+bool_t pending_rawscan(const rawscan_t *rs);
+
+#endif
@@ -31,13 +31,31 @@
 #include "wrap.h"
 
 #include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+
+extern volatile flag_t cmd;
+extern char *inputfile;
+
+/* bytes read to check the encoding of a file before splicing it */
+#define RCM_SPLICE_HEAD 1024
+/* a bigger insert is read back from its tempcollect for each target */
+#define RCM_PAYLOAD_MAX (4L * 1048576)
 
 bool_t create_rcm(rcm_t *rcm) {
   if( rcm ) {
     memset(rcm, 0, sizeof(rcm_t));
     create_stringlist(&rcm->sl);
     create_cstring(&rcm->av, "", 64);
-    return TRUE;
+    create_cstring(&rcm->payload, "", 64);
+    create_cstring(&rcm->tag, "", 64);
+    rcm->infd = -1;
+    return create_splice(&rcm->edits);
   }
   return FALSE;
 }
@@ -46,6 +64,9 @@ bool_t free_rcm(rcm_t *rcm) {
   if( rcm ) {
     free_stringlist(&rcm->sl);
     free_cstring(&rcm->av);
+    free_cstring(&rcm->payload);
+    free_cstring(&rcm->tag);
+    free_splice(&rcm->edits);
     return TRUE;
   }
   return FALSE;
@@ -56,31 +77,59 @@ bool_t reset_rcm(rcm_t *rcm) {
     rcm->fd = -1;
     clearflag(&rcm->flags,RCM_SELECT);
     clearflag(&rcm->flags,RCM_CP_OKINSERT);
+    clearflag(&rcm->flags,RCM_RM_RETAG);
     rcm->depth = 0;
     reset_stringlist(&rcm->sl);
     truncate_cstring(&rcm->av, 0);
+    reset_splice(&rcm->edits);
   }
   return TRUE;
 }
 
+typedef struct {
+  parser_t parser;
+  cstring_t *cs;
+  const char_t *p;
+} check_insert_fun_t;
+
+/* validates and keeps a copy of the insert in a single pass */
 bool_t check_insert_fun(void *user, byte_t *buf, size_t buflen) {
-  parser_t *parser = (parser_t *)user;
-  return do_parser2(parser, buf, buflen);
+  check_insert_fun_t *cif = (check_insert_fun_t *)user;
+  if( cif->p && 
+      ((size_t)(cif->p - begin_cstring(cif->cs)) + buflen > RCM_PAYLOAD_MAX) ) {
+    truncate_cstring(cif->cs, 0);
+    cif->p = NULL;
+  }
+  if( cif->p ) {
+    cif->p = write_cstring(cif->cs, cif->p, (char_t *)buf, buflen);
+  }
+  return do_parser2(&cif->parser, buf, buflen);
 }
 
+/* The insert is checked once, and if it is not bigger than
+ * RCM_PAYLOAD_MAX it is kept in memory for all the targets. 
+ */
 bool_t insert_rcm(rcm_t *rcm, tempcollect_t *ins) {
-  parser_t parser;
+  check_insert_fun_t cif;
   tempcollect_adapter_t ad = { check_insert_fun, NULL};
   if( rcm && ins ) {
     rcm->insert = ins;
+    if( checkflag(rcm->flags,RCM_CP_REPLACE) ) {
+      setflag(&rcm->flags,RCM_CP_EACH);
+    }
     if( is_empty_tempcollect(ins) ) {
       errormsg(E_WARNING, "source data is empty! (check paths?)\n");
-    } else if( create_parser(&parser, NULL) ) {
-      ad.user = &parser;
+    } else if( create_parser(&cif.parser, NULL) ) {
+      ad.user = &cif;
+      cif.cs = &rcm->payload;
+      cif.p = truncate_cstring(&rcm->payload, 0);
       if( write_adapter_tempcollect(ins, &ad) ) {
 	setflag(&rcm->flags,RCM_CP_WFXML);
       }
-      free_parser(&parser);
+      if( cif.p ) {
+	setflag(&rcm->flags,RCM_CP_PAYLOAD);
+      }
+      free_parser(&cif.parser);
     }
     return TRUE;
   }
@@ -110,15 +159,84 @@ const char_t **filter_rcm(rcm_t *rcm, stdparserinfo_t *sp, const char_t **att, b
 }
 
 
+/* With RCM_RM_EDITS, the rm_*() functions print nothing. Instead,
+ * they record the byte ranges of the events which would not have been
+ * printed, and the file is rebuilt from the original by rm_end_file_rcm().
+ * Everything else is kept byte for byte.
+ */
+static bool_t drop_event_rcm(rcm_t *rcm, stdparserinfo_t *sp) {
+  long b = -1, e;
+  if( !range_stdparse(sp, &b, &e) || !delete_splice(&rcm->edits, b, e) ) {
+    errormsg(E_FATAL, "%s: cannot splice out byte %ld\n", inputfile, b);
+  }
+  return TRUE;
+}
+
+/* a start tag which lost some attributes is written out again */
+static bool_t retag_event_rcm(rcm_t *rcm, stdparserinfo_t *sp,
+			      const char_t *name, const char_t **att) {
+  const char_t *p;
+  long b = -1, e;
+  p = truncate_cstring(&rcm->tag, 0);
+  p = vputs_cstring(&rcm->tag, p, "<", name, NULL);
+  while( p && att && *att ) {
+    p = vputs_cstring(&rcm->tag, p, " ", att[0], "=\"", NULL);
+    p = write_coded_entities_cstring(&rcm->tag, p, att[1], strlen(att[1]));
+    p = puts_cstring(&rcm->tag, p, "\"");
+    att += 2;
+  }
+  p = puts_cstring(&rcm->tag, p, ">");
+  if( !p || !range_stdparse(sp, &b, &e) ||
+      !replace_splice(&rcm->edits, b, e, (byte_t *)begin_cstring(&rcm->tag),
+		      strlen_cstring(&rcm->tag)) ) {
+    errormsg(E_FATAL, "%s: cannot splice in byte %ld\n", inputfile, b);
+  }
+  setflag(&rcm->flags,RCM_RM_RETAG);
+  return TRUE;
+}
+
+/* the end tag of an empty element has no bytes, so if its start
+   tag was rewritten, it must be added explicitly */
+static bool_t untag_event_rcm(rcm_t *rcm, stdparserinfo_t *sp,
+			      const char_t *name) {
+  const char_t *p;
+  long b = -1, e;
+  if( range_stdparse(sp, &b, &e) && (b == e) ) {
+    p = vputs_cstring(&rcm->tag, truncate_cstring(&rcm->tag, 0), 
+		      "</", name, ">", NULL);
+    if( !p || !insert_splice(&rcm->edits, b, (byte_t *)begin_cstring(&rcm->tag),
+			     strlen_cstring(&rcm->tag)) ) {
+      errormsg(E_FATAL, "%s: cannot splice in byte %ld\n", inputfile, b);
+    }
+  }
+  return TRUE;
+}
+
+static size_t count_att_rcm(const char_t **att) {
+  size_t n = 0;
+  while( att && att[n] ) {
+    n += 2;
+  }
+  return n;
+}
+
 bool_t rm_start_tag_rcm(rcm_t *rcm, stdparserinfo_t *sp,
 			const char_t *name, const char_t **att) {
   const char_t **fatt;
   if( rcm ) {
+    clearflag(&rcm->flags,RCM_RM_RETAG);
     if( (sp->depth == 1) || !sp->sel.active ) {
       if( checkflag(rcm->flags,RCM_RM_OUTPUT) ) {
 	fatt = filter_rcm(rcm, sp, att, FALSE);
 	write_start_tag_stdout(name, fatt, FALSE);
+      } else if( checkflag(rcm->flags,RCM_RM_EDITS) && sp->sel.attrib ) {
+	fatt = filter_rcm(rcm, sp, att, FALSE);
+	if( count_att_rcm(fatt) != count_att_rcm(att) ) {
+	  retag_event_rcm(rcm, sp, name, fatt);
+	}
       }
+    } else if( checkflag(rcm->flags,RCM_RM_EDITS) ) {
+      drop_event_rcm(rcm, sp);
     }
     return TRUE;
   }
@@ -131,8 +249,13 @@ bool_t rm_end_tag_rcm(rcm_t *rcm, stdparserinfo_t *sp,
     if( (sp->depth == 1) || !sp->sel.active ) {
       if( checkflag(rcm->flags,RCM_RM_OUTPUT) ) {
 	write_end_tag_stdout(name);
+      } else if( true_and_clearflag(&rcm->flags,RCM_RM_RETAG) ) {
+	untag_event_rcm(rcm, sp, name);
       }
+    } else if( checkflag(rcm->flags,RCM_RM_EDITS) ) {
+      drop_event_rcm(rcm, sp);
     }
+    clearflag(&rcm->flags,RCM_RM_RETAG);
     return TRUE;
   }
   return FALSE;
@@ -149,6 +272,7 @@ bool_t rm_attribute_rcm(rcm_t *rcm, stdparserinfo_t *sp,
 bool_t rm_chardata_rcm(rcm_t *rcm, stdparserinfo_t *sp,
 		       const char_t *buf, size_t buflen) {
   if( rcm ) {
+    clearflag(&rcm->flags,RCM_RM_RETAG);
     if( sp->depth == 0 ) {
       if( checkflag(rcm->flags,RCM_RM_OUTPUT) ) {
 	write_coded_entities_stdout(buf, buflen);
@@ -158,6 +282,8 @@ bool_t rm_chardata_rcm(rcm_t *rcm, stdparserinfo_t *sp,
 	if( checkflag(rcm->flags,RCM_RM_OUTPUT) ) {
 	  write_coded_entities_stdout(buf, buflen);
 	}
+      } else if( checkflag(rcm->flags,RCM_RM_EDITS) && (buflen > 0) ) {
+	drop_event_rcm(rcm, sp);
       }
     }
     return TRUE;
@@ -168,6 +294,7 @@ bool_t rm_chardata_rcm(rcm_t *rcm, stdparserinfo_t *sp,
 bool_t rm_dfault_rcm(rcm_t *rcm, stdparserinfo_t *sp,
 		     const char_t *data, size_t buflen) {
   if( rcm ) {
+    clearflag(&rcm->flags,RCM_RM_RETAG);
     if( sp->depth == 0 ) {
       if( checkflag(rcm->flags,RCM_RM_OUTPUT) ) {
 	write_stdout((byte_t *)data, buflen);
@@ -177,6 +304,8 @@ bool_t rm_dfault_rcm(rcm_t *rcm, stdparserinfo_t *sp,
 	if( checkflag(rcm->flags,RCM_RM_OUTPUT) ) {
 	  write_stdout((byte_t *)data, buflen);
 	}
+      } else if( checkflag(rcm->flags,RCM_RM_EDITS) && (buflen > 0) ) {
+	drop_event_rcm(rcm, sp);
       }
     }
     return TRUE;
@@ -184,6 +313,30 @@ bool_t rm_dfault_rcm(rcm_t *rcm, stdparserinfo_t *sp,
   return FALSE;
 }
 
+/* splicing needs the original as a regular file, which is opened now
+   so that it cannot be swapped under us while we parse it. The kept
+   bytes sit next to rewritten UTF-8 tags, so the file must be UTF-8. */
+static bool_t open_splice_rcm(rcm_t *rcm, const char_t *file) {
+  struct stat st;
+  byte_t head[RCM_SPLICE_HEAD];
+  ssize_t n;
+  if( checkflag(rcm->flags, RCM_RM_SPLICE) && 
+      (strcmp(file, "stdout") != 0) ) {
+    rcm->infd = open(file, O_RDONLY);
+    if( rcm->infd != -1 ) {
+      if( (fstat(rcm->infd, &st) == 0) && S_ISREG(st.st_mode) ) {
+	n = pread(rcm->infd, head, sizeof(head), 0);
+	if( (n > 0) && utf8_prefix_parser(head, n) ) {
+	  return TRUE;
+	}
+      }
+      close(rcm->infd);
+      rcm->infd = -1;
+    }
+  }
+  return FALSE;
+}
+
 bool_t rm_start_file_rcm(rcm_t *rcm, const char_t *file) {
   if( rcm ) {
     reset_rcm(rcm);
@@ -193,11 +346,15 @@ bool_t rm_start_file_rcm(rcm_t *rcm, const char_t *file) {
       rcm->fd = (strcmp(file, "stdout") == 0) ? STDOUT_FILENO :
 	open_file_with_rollback(file);
       
-      if( rcm->fd != -1 ) {
+      if( rcm->fd == -1 ) {
+	errormsg(E_FATAL, "unable to safely write file %s\n", file);
+      } else if( open_splice_rcm(rcm, file) ) {
+	clearflag(&rcm->flags, RCM_RM_OUTPUT);
+	setflag(&rcm->flags, RCM_RM_EDITS);
+	return TRUE;
+      } else {
 	/* NB: close stdout before closing file */
 	open_redirect_stdout(rcm->fd); 
-      } else {
-	errormsg(E_FATAL, "unable to safely write file %s\n", file);
       }
 
       setflag(&rcm->flags, RCM_RM_OUTPUT);
@@ -218,6 +375,15 @@ bool_t rm_end_file_rcm(rcm_t *rcm, const char_t *file) {
 
     close_stdout();
 
+    if( true_and_clearflag(&rcm->flags, RCM_RM_EDITS) ) {
+      if( !write_splice(&rcm->edits, rcm->infd, rcm->fd) ) {
+	errormsg(E_FATAL, "unable to splice file %s\n", file);
+      }
+      close(rcm->infd);
+      rcm->infd = -1;
+      setflag(&rcm->flags, RCM_RM_OUTPUT);
+    }
+
     if( (rcm->fd != -1) && (rcm->fd != STDOUT_FILENO) ) {
       commit_file_with_rollback(rcm->fd);
       close_file_with_rollback(rcm->fd);
@@ -258,6 +424,18 @@ bool_t dump_cstring_tempcollect(cstring_t *cs, tempcollect_t *tc) {
   return FALSE;
 }
 
+/* the insert with coded entities, in rcm->av */
+bool_t dump_payload_rcm(rcm_t *rcm) {
+  if( checkflag(rcm->flags,RCM_CP_PAYLOAD) ) {
+    truncate_cstring(&rcm->av, 0);
+    return (NULL != 
+	    write_coded_entities_cstring(&rcm->av, begin_cstring(&rcm->av),
+					 begin_cstring(&rcm->payload),
+					 strlen_cstring(&rcm->payload)));
+  }
+  return dump_cstring_tempcollect(&rcm->av, rcm->insert);
+}
+
 const char_t **try_write_attribute(rcm_t *rcm, stdparserinfo_t *sp,
 				   const char_t **att) {
   const char_t *path, *q;
@@ -271,7 +449,7 @@ const char_t **try_write_attribute(rcm_t *rcm, stdparserinfo_t *sp,
       if( xa->begin &&
 	  (0 == match_no_att_no_pred_xpath(xa->path, xa->begin, path)) ) {
 	if( false_and_setflag(&rcm->flags,RCM_CP_OKINSERT) ) {
-	  if( dump_cstring_tempcollect(&rcm->av, rcm->insert) ) {
+	  if( dump_payload_rcm(rcm) ) {
 	    q = dup_string(xa->begin + 1, xa->end);
 	    add_stringlist(&rcm->sl, q, STRINGLIST_FREE);
 	    q = dup_string(begin_cstring(&rcm->av), end_cstring(&rcm->av));
@@ -304,7 +482,12 @@ const char_t **try_write_attribute(rcm_t *rcm, stdparserinfo_t *sp,
 void try_write(rcm_t *rcm) {
   if( rcm && rcm->insert ) {
     if( false_and_setflag(&rcm->flags,RCM_CP_OKINSERT) ) {
-      write_stdout_tempcollect(rcm->insert);
+      if( checkflag(rcm->flags,RCM_CP_PAYLOAD) ) {
+	write_stdout((byte_t *)begin_cstring(&rcm->payload),
+		     strlen_cstring(&rcm->payload));
+      } else {
+	write_stdout_tempcollect(rcm->insert);
+      }
       if( checkflag(rcm->flags,RCM_CP_MULTI) ) {
 	clearflag(&rcm->flags,RCM_CP_OKINSERT);
       }
@@ -373,6 +556,12 @@ bool_t cp_end_tag_rcm(rcm_t *rcm, stdparserinfo_t *sp,
       if( eos && !checkflag(rcm->flags,RCM_CP_MULTI) ) {
       	clearflag(&rcm->flags,RCM_CP_REPLACE);
       }
+
+      /* after a single insertion, nothing else can change */
+      if( checkflag(rcm->flags,RCM_CP_OKINSERT) &&
+	  !checkflag(rcm->flags,RCM_CP_MULTI|RCM_CP_REPLACE|RCM_SELECT) ) {
+	setflag(&rcm->flags,RCM_CP_TAIL);
+      }
     }
     rcm->depth -= (sp->sel.active ? 1 : 0);
     return TRUE;
@@ -437,6 +626,10 @@ bool_t cp_dfault_rcm(rcm_t *rcm, stdparserinfo_t *sp,
 bool_t cp_start_target_rcm(rcm_t *rcm, const char_t *file) {
   if( rcm ) {
     reset_rcm(rcm);
+    clearflag(&rcm->flags,RCM_CP_TAIL);
+    if( checkflag(rcm->flags,RCM_CP_EACH) ) {
+      setflag(&rcm->flags,RCM_CP_REPLACE);
+    }
 
     if( checkflag(rcm->flags, RCM_WRITE_FILES) ) {
 
@@ -478,3 +671,103 @@ bool_t cp_end_target_rcm(rcm_t *rcm, const char_t *file) {
   }
   return FALSE;
 }
+
+/* parses files in jobs worker processes, each with its own copy of the
+ * parser, the rcm_t state and the rollback table. Workers only prepare
+ * their files, and send the list back to us. The files are renamed
+ * together once every worker has succeeded, otherwise none are.
+ * This is only useful with RCM_WRITE_FILES, when each file is
+ * independent of the others.
+ */
+bool_t parallel_stdparse2_rcm(int jobs, int n, cstringlst_t files, 
+			      cstringlst_t *xpaths, stdparserinfo_t *pinfo) {
+  cstringlst_t wfiles = NULL;
+  cstringlst_t *wxpaths = NULL;
+  pid_t *pids = NULL;
+  int *fds = NULL;
+  int w, f, k, p[2], status;
+  bool_t ok = TRUE;
+
+  if( (jobs <= 1) || (n <= 1) ) {
+    return stdparse2(n, files, xpaths, pinfo);
+  }
+  jobs = (jobs > n) ? n : jobs;
+
+  pids = (pid_t *)malloc(jobs * sizeof(pid_t));
+  fds = (int *)malloc(jobs * sizeof(int));
+  wfiles = (cstringlst_t)malloc((n / jobs + 1) * sizeof(char *));
+  wxpaths = (cstringlst_t *)malloc((n / jobs + 1) * sizeof(cstringlst_t));
+  if( !pids || !fds || !wfiles || !wxpaths ) {
+    errormsg(E_FATAL, "out of memory.\n");
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+  defer_commit_with_rollback(TRUE);
+
+  for(w = 0; w < jobs; w++) {
+    pids[w] = -1;
+    fds[w] = -1;
+    if( pipe(p) == -1 ) {
+      errormsg(E_ERROR, "couldn't create pipe.\n");
+      ok = FALSE;
+      break;
+    }
+    pids[w] = fork();
+    if( pids[w] == 0 ) {
+      /* worker: every jobs-th file, starting from w */
+      close(p[0]);
+      for(f = 0; f < w; f++) {
+	close(fds[f]);
+      }
+      for(k = 0, f = w; f < n; f += jobs, k++) {
+	wfiles[k] = files[f];
+	wxpaths[k] = xpaths ? xpaths[f] : NULL;
+      }
+      stdparse2(k, wfiles, wxpaths, pinfo);
+      if( checkflag(cmd,CMD_QUIT) || !write_pending_with_rollback(p[1]) ) {
+	exit(EXIT_FAILURE); /* deletes our temporary files */
+      }
+      close(p[1]);
+      _exit(EXIT_SUCCESS); /* our temporary files now belong to the parent */
+    }
+    close(p[1]);
+    if( pids[w] == -1 ) {
+      errormsg(E_ERROR, "couldn't start worker process.\n");
+      close(p[0]);
+      ok = FALSE;
+      break;
+    }
+    fds[w] = p[0];
+  }
+
+  for(k = 0; k < w; k++) {
+    ok &= read_pending_with_rollback(fds[k]);
+    close(fds[k]);
+  }
+  for(k = 0; k < w; k++) {
+    while( waitpid(pids[k], &status, 0) == -1 ) {
+      if( errno != EINTR ) {
+	status = -1;
+	break;
+      }
+    }
+    ok &= (WIFEXITED(status) && (WEXITSTATUS(status) == EXIT_SUCCESS));
+  }
+
+  defer_commit_with_rollback(FALSE);
+  if( ok && !checkflag(cmd,CMD_QUIT) ) {
+    ok = commit_pending_with_rollback();
+  } else {
+    abort_pending_with_rollback();
+    errormsg(E_ERROR, "some files could not be processed, "
+	     "no files were changed.\n");
+    ok = FALSE;
+  }
+
+  free(pids);
+  free(fds);
+  free(wfiles);
+  free(wxpaths);
+  return ok;
+}
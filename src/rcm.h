@@ -28,6 +28,7 @@
 #include "stdparse.h"
 #include "tempcollect.h"
 #include "stringlist.h"
+#include "splice.h"
 #include <stdio.h>
 
 typedef struct {
@@ -37,6 +38,10 @@ typedef struct {
   int depth;
   stringlist_t sl;
   cstring_t av;
+  cstring_t payload; /* copy of insert, if RCM_CP_PAYLOAD */
+  int infd; /* the original file, if RCM_RM_EDITS */
+  splice_t edits; /* removed byte ranges, if RCM_RM_EDITS */
+  cstring_t tag; /* rewritten start tag, if RCM_RM_EDITS */
 } rcm_t;
 
 #define RCM_SELECT       0x001 /* true if we are within a selection */
@@ -53,6 +58,13 @@ typedef struct {
 #define RCM_CP_MULTI     0x100 /* if set, want to copy data multiple times */
 
 #define RCM_CP_WFXML     0x200 /* if set, rcm->insert is well formed xml */
+#define RCM_CP_PAYLOAD   0x400 /* if set, rcm->payload holds rcm->insert */
+#define RCM_CP_EACH      0x800 /* if set, RCM_CP_REPLACE is reset per target */
+#define RCM_CP_TAIL     0x1000 /* if set, the rest of the target is unchanged */
+
+#define RCM_RM_SPLICE   0x2000 /* if set, rm files in place by splicing */
+#define RCM_RM_EDITS    0x4000 /* true if rm_*() record edits, not output */
+#define RCM_RM_RETAG    0x8000 /* true if rm_*() rewrote the last start tag */
 
 bool_t create_rcm(rcm_t *rcm);
 bool_t free_rcm(rcm_t *rcm);
@@ -75,4 +87,7 @@ bool_t cp_dfault_rcm(rcm_t *rcm, stdparserinfo_t *sp, const char_t *data, size_t
 bool_t cp_start_target_rcm(rcm_t *rcm, const char_t *file);
 bool_t cp_end_target_rcm(rcm_t *rcm, const char_t *file);
 
+bool_t parallel_stdparse2_rcm(int jobs, int n, cstringlst_t files, 
+			      cstringlst_t *xpaths, stdparserinfo_t *pinfo);
+
 #endif
@@ -34,16 +34,139 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <stdio.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#if !defined HAVE_FDATASYNC
+#define fdatasync fsync
+#endif
 
 extern char *progname;
 
 static rollbackmgr_t RBM = { 0 };
 static const char_t *TEMPLATE = ".XXXXXX";
+static int durability = ROLLBACK_DURABLE_NONE;
+static rollbackstats_t stats = { 0 };
+
+/* a batch of committed files is still renamed at exit, but files
+ * deferred for another process are deleted */
+static void cleanup_rollback() {
+  if( checkflag(RBM.flags, RBM_FLAG_DEFER) ) {
+    abort_pending_with_rollback();
+  } else {
+    commit_pending_with_rollback();
+  }
+}
+
+static double now_rollback() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void sync_dir_rollback(const char *path) {
+  const char *p;
+  cstring_t dir;
+  int fd;
+  p = strrchr(path, '/');
+  if( !p ) {
+    create_cstring(&dir, ".", 2);
+  } else {
+    create_cstring(&dir, path, (p - path) + 2);
+    truncate_cstring(&dir, (p == path) ? 1 : (p - path));
+  }
+  fd = open(p_cstring(&dir), O_RDONLY);
+  if( fd != -1 ) {
+    if( fsync(fd) == -1 ) {
+      errormsg(E_WARNING, "failed to sync directory %s\n", p_cstring(&dir));
+    }
+    close(fd);
+  }
+  stats.dirs++;
+  free_cstring(&dir);
+}
+
+/* length of the directory part of path, including the last slash */
+static size_t dirlen_rollback(const char *path) {
+  const char *p = strrchr(path, '/');
+  return p ? (p - path) + 1 : 0;
+}
+
+static int cmp_dir_rollback(const void *a, const void *b) {
+  const char *p = *(const char **)a;
+  const char *q = *(const char **)b;
+  size_t m = dirlen_rollback(p);
+  size_t n = dirlen_rollback(q);
+  int r = strncmp(p, q, (m < n) ? m : n);
+  return (r != 0) ? r : ((m < n) ? -1 : (m > n));
+}
+
+/* one fsync per directory containing a renamed file */
+static void sync_pending_dirs_rollback() {
+  const char **dirs;
+  int i, n;
+  n = RBM.pending.num / 2;
+  dirs = (const char **)malloc(n * sizeof(char *));
+  if( !dirs ) {
+    for(i = 1; i < RBM.pending.num; i += 2) {
+      sync_dir_rollback(RBM.pending.list[i]);
+    }
+    return;
+  }
+  for(i = 0; i < n; i++) {
+    dirs[i] = RBM.pending.list[2 * i + 1];
+  }
+  /* files in the same directory become adjacent */
+  qsort(dirs, n, sizeof(char *), cmp_dir_rollback);
+  for(i = 0; i < n; i++) {
+    if( (i == 0) || (cmp_dir_rollback(&dirs[i - 1], &dirs[i]) != 0) ) {
+      sync_dir_rollback(dirs[i]);
+    }
+  }
+  free(dirs);
+}
+
+/* flush the data of the pending files, using one syncfs() per 
+ * filesystem if we can */
+static void sync_pending_rollback() {
+  int i, fd;
+#if defined HAVE_SYNCFS
+  struct stat st;
+  dev_t dev = 0;
+  bool_t havedev = FALSE;
+  for(i = 0; i < RBM.pending.num; i += 2) {
+    if( (stat(RBM.pending.list[i], &st) == 0) && 
+	(!havedev || (st.st_dev != dev)) ) {
+      fd = open(RBM.pending.list[i], O_RDONLY);
+      if( fd != -1 ) {
+	if( syncfs(fd) == 0 ) {
+	  dev = st.st_dev;
+	  havedev = TRUE;
+	} else if( fdatasync(fd) == -1 ) {
+	  errormsg(E_WARNING, "failed to sync %s\n", RBM.pending.list[i]);
+	}
+	close(fd);
+      }
+    }
+  }
+#else
+  for(i = 0; i < RBM.pending.num; i += 2) {
+    fd = open(RBM.pending.list[i], O_RDONLY);
+    if( fd != -1 ) {
+      if( fdatasync(fd) == -1 ) {
+	errormsg(E_WARNING, "failed to sync %s\n", RBM.pending.list[i]);
+      }
+      close(fd);
+    }
+  }
+#endif
+}
 
 void init_rollback_handling() {
   if( !create_mgr_with_rollback(&RBM) ) {
     errormsg(E_FATAL, "failed to initialize file rollbacks.\n");
   }
+  atexit(cleanup_rollback);
 }
 
 void exit_rollback_handling() {
@@ -56,7 +179,9 @@ bool_t create_mgr_with_rollback(rollbackmgr_t *rbm) {
   if( rbm ) {
     rbm->files = NULL;
     rbm->maxfiles = 0;
-    ok = create_mem(&rbm->files, &rbm->maxfiles, sizeof(rollback_t), 8);
+    rbm->flags = 0;
+    ok = create_stringlist(&rbm->pending);
+    ok &= create_mem(&rbm->files, &rbm->maxfiles, sizeof(rollback_t), 8);
     if( ok ) {
       memset(rbm->files, 0, sizeof(rollback_t) * rbm->maxfiles);
       for(f = 0; f < rbm->maxfiles; f++) {
@@ -71,6 +196,10 @@ bool_t create_mgr_with_rollback(rollbackmgr_t *rbm) {
 bool_t free_mgr_with_rollback(rollbackmgr_t *rbm) {
   if( rbm ) {
     clear_mgr_with_rollback(rbm);
+    if( rbm == &RBM ) {
+      cleanup_rollback();
+    }
+    free_stringlist(&rbm->pending);
     free_mem(&rbm->files, &rbm->maxfiles);
     rbm->files = NULL;
     rbm->maxfiles = 0;
@@ -83,57 +212,78 @@ bool_t clear_mgr_with_rollback(rollbackmgr_t *rbm) {
   unsigned int f;
   if( rbm && rbm->files ) {
     for(f = 0; f < rbm->maxfiles; f++) {
-      close_file_with_rollback(rbm->files[f].fd);
+      if( rbm->files[f].fd > -1 ) {
+	close_file_with_rollback(rbm->files[f].fd);
+      }
     }
     return TRUE;
   }
   return FALSE;
 }
 
-/* fd = -1 searches for a free rollback_t, fd >= 0 searches for
-   an existing rollback_t */
+/* the table is indexed by file descriptor, so there's no search, and
+   thousands of open files cost nothing */
 rollback_t *find_mgr_with_rollback(rollbackmgr_t *rbm, int fd) {
+  if( rbm && (fd > -1) && (fd < rbm->maxfiles) &&
+      (rbm->files[fd].fd == fd) ) {
+    return &(rbm->files[fd]);
+  }
+  return NULL;
+}
+
+/* make room for the (new) file descriptor fd */
+rollback_t *grow_mgr_with_rollback(rollbackmgr_t *rbm, int fd) {
   unsigned int f, g;
-  if( rbm ) {
-    for(f = 0; f < rbm->maxfiles; f++) {
-      if( rbm->files[f].fd == fd ) {
-	return &(rbm->files[f]);
-      }
-    }
-    /* nothing available */
-    if( fd == -1 ) {
+  if( rbm && (fd > -1) ) {
+    while( fd >= rbm->maxfiles ) {
       f = rbm->maxfiles;
-      if( grow_mem(&rbm->files, &rbm->maxfiles, sizeof(rollback_t), 8) ) {
-	/* initialize */
-	memset(rbm->files + f, 0, sizeof(rollback_t) * (rbm->maxfiles - f));
-	for(g = f; g < rbm->maxfiles; g++) {
-	  rbm->files[g].fd = -1;
-	}
-	return &(rbm->files[f]);
+      if( !grow_mem(&rbm->files, &rbm->maxfiles, sizeof(rollback_t), 8) ) {
+	return NULL;
+      }
+      /* initialize */
+      memset(rbm->files + f, 0, sizeof(rollback_t) * (rbm->maxfiles - f));
+      for(g = f; g < rbm->maxfiles; g++) {
+	rbm->files[g].fd = -1;
       }
     }
+    return &(rbm->files[fd]);
   }
-  return FALSE;
+  return NULL;
 }
 
 int open_file_with_rollback(const char_t *path) {
   rollback_t *rb;
-  int n;
-  rb = find_mgr_with_rollback(&RBM, -1);
-  if( rb ) {
-    n = strlen(path) + strlen(progname) + sizeof(TEMPLATE) + 2;
-    if( n >  (PATH_MAX + 1) ) {
-      return -1;
+  cstring_t tmp;
+  int n, fd;
+  if( !checkflag(RBM.flags, RBM_FLAG_DEFER) ) {
+    /* path is about to be read again, so its rename can't wait */
+    for(n = 1; n < RBM.pending.num; n += 2) {
+      if( strcmp(RBM.pending.list[n], path) == 0 ) {
+	commit_pending_with_rollback();
+	break;
+      }
     }
-    create_cstring(&rb->path, path, n);
-    vstrcat_cstring(&rb->path, ".", progname, TEMPLATE, NULLPTR);
-    rb->fd = open_tempfile(p_cstring(&rb->path));
-    if( rb->fd != -1 ) {
-      return rb->fd;
+  }
+  n = strlen(path) + strlen(progname) + sizeof(TEMPLATE) + 2;
+  if( n >  (PATH_MAX + 1) ) {
+    return -1;
+  }
+  create_cstring(&tmp, path, n);
+  vstrcat_cstring(&tmp, ".", progname, TEMPLATE, NULLPTR);
+  fd = open_tempfile(p_cstring(&tmp));
+  if( fd != -1 ) {
+    rb = grow_mgr_with_rollback(&RBM, fd);
+    if( rb ) {
+      rb->fd = fd;
+      rb->path = tmp;
+      rb->flags = 0;
+      return fd;
     }
-    /* failed */
-    free_cstring(&rb->path);
+    close(fd);
+    remove_tempfile(p_cstring(&tmp));
   }
+  /* failed */
+  free_cstring(&tmp);
   return -1;
 }
 
@@ -150,9 +300,18 @@ void close_file_with_rollback(int fd) {
   cstring_t oldpath;
   const char_t *p, *q;
   int n = 0;
+  double t;
   if( fd > -1 ) {
     rb = find_mgr_with_rollback(&RBM, fd);
     if( rb ) {
+      if( checkflag(rb->flags, RBM_FLAG_COMMIT) &&
+	  (durability == ROLLBACK_DURABLE_STRICT) ) {
+	t = now_rollback();
+	if( fdatasync(rb->fd) == -1 ) {
+	  errormsg(E_WARNING, "failed to sync %s\n", p_cstring(&rb->path));
+	}
+	stats.sync_time += now_rollback() - t;
+      }
       close(rb->fd);
       q = p_cstring(&rb->path);
       if( checkflag(rb->flags, RBM_FLAG_COMMIT) ) {
@@ -160,10 +319,24 @@ void close_file_with_rollback(int fd) {
 	if( p ) {
 	  n = strlen_cstring(&oldpath) - strlen(TEMPLATE) - strlen(progname) - 1;
 	  truncate_cstring(&oldpath, n);
-	  n = rename(q, p);
-	  if( n != 0 ) {
-	    errormsg(E_WARNING, "failed to update %s\n", p);
-	  } 
+	  if( checkflag(RBM.flags, RBM_FLAG_DEFER) || 
+	      (durability == ROLLBACK_DURABLE_BATCH) ) {
+	    n = add_pending_with_rollback(q, p) ? 0 : -1;
+	  } else {
+	    t = now_rollback();
+	    n = rename(q, p);
+	    stats.rename_time += now_rollback() - t;
+	    if( n != 0 ) {
+	      errormsg(E_WARNING, "failed to update %s\n", p);
+	    } else {
+	      stats.files++;
+	      if( durability == ROLLBACK_DURABLE_STRICT ) {
+		t = now_rollback();
+		sync_dir_rollback(p);
+		stats.dirsync_time += now_rollback() - t;
+	      }
+	    }
+	  }
 	  free_cstring(&oldpath);
 	}
       }
@@ -173,7 +346,164 @@ void close_file_with_rollback(int fd) {
       free_cstring(&rb->path);
       rb->fd = -1;
       rb->flags = 0;
+
+      if( !checkflag(RBM.flags, RBM_FLAG_DEFER) &&
+	  (RBM.pending.num >= 2 * ROLLBACK_BATCH) ) {
+	commit_pending_with_rollback();
+      }
+    }
+  }
+}
+
+void defer_commit_with_rollback(bool_t defer) {
+  if( defer ) {
+    setflag(&RBM.flags, RBM_FLAG_DEFER);
+  } else {
+    clearflag(&RBM.flags, RBM_FLAG_DEFER);
+  }
+}
+
+bool_t add_pending_with_rollback(const char *tmp, const char *path) {
+  if( tmp && path ) {
+    if( add_stringlist(&RBM.pending, tmp, STRINGLIST_STRDUP) ) {
+      if( add_stringlist(&RBM.pending, path, STRINGLIST_STRDUP) ) {
+	return TRUE;
+      }
+      unlink(tmp);
+      RBM.pending.num--;
+      free((void *)RBM.pending.list[RBM.pending.num]);
+    }
+  }
+  return FALSE;
+}
+
+/* renames all pending files, and returns FALSE if any failed. The
+ * data is flushed before any file is renamed, and the directories
+ * after, so a crash leaves either the old or the new file. 
+ */
+bool_t commit_pending_with_rollback() {
+  bool_t ok = TRUE;
+  const char *q, *p;
+  int i;
+  double t;
+  if( RBM.pending.num == 0 ) {
+    return TRUE;
+  }
+  if( durability == ROLLBACK_DURABLE_BATCH ) {
+    t = now_rollback();
+    sync_pending_rollback();
+    stats.sync_time += now_rollback() - t;
+  }
+  t = now_rollback();
+  for(i = 0; i + 1 < RBM.pending.num; i += 2) {
+    q = RBM.pending.list[i];
+    p = RBM.pending.list[i + 1];
+    if( rename(q, p) != 0 ) {
+      errormsg(E_WARNING, "failed to update %s\n", p);
+      unlink(q);
+      ok = FALSE;
+    } else {
+      stats.files++;
     }
   }
+  stats.rename_time += now_rollback() - t;
+  if( durability != ROLLBACK_DURABLE_NONE ) {
+    t = now_rollback();
+    sync_pending_dirs_rollback();
+    stats.dirsync_time += now_rollback() - t;
+  }
+  stats.batches++;
+  reset_stringlist(&RBM.pending);
+  return ok;
 }
 
+void abort_pending_with_rollback() {
+  int i;
+  for(i = 0; i + 1 < RBM.pending.num; i += 2) {
+    unlink(RBM.pending.list[i]);
+  }
+  reset_stringlist(&RBM.pending);
+}
+
+/* sends the pending list through fd, as NUL terminated names */
+bool_t write_pending_with_rollback(int fd) {
+  bool_t ok = TRUE;
+  int i;
+  for(i = 0; ok && (i < RBM.pending.num); i++) {
+    ok = write_file(fd, (byte_t *)RBM.pending.list[i], 
+		    strlen(RBM.pending.list[i]) + 1);
+  }
+  return ok;
+}
+
+/* adds the pending list written by write_pending_with_rollback() */
+bool_t read_pending_with_rollback(int fd) {
+  bool_t ok = TRUE;
+  byte_t *buf = NULL;
+  size_t n = 0, maxbuf = 0;
+  ssize_t r;
+  char *p, *q, *e;
+
+  if( !create_mem(&buf, &maxbuf, sizeof(byte_t), 4096) ) {
+    return FALSE;
+  }
+  while( ok ) {
+    if( n >= maxbuf ) {
+      ok = grow_mem(&buf, &maxbuf, sizeof(byte_t), 4096);
+      continue;
+    }
+    r = read(fd, buf + n, maxbuf - n);
+    if( r == -1 ) {
+      ok = (errno == EINTR);
+    } else if( r == 0 ) {
+      break;
+    } else {
+      n += r;
+    }
+  }
+  if( ok && (n == maxbuf) ) {
+    ok = grow_mem(&buf, &maxbuf, sizeof(byte_t), 4096);
+  }
+  if( ok ) {
+    buf[n] = '\0'; /* in case the writer died halfway */
+    e = (char *)buf + n;
+    for(p = (char *)buf; ok && (p < e); p = q + strlen(q) + 1) {
+      q = p + strlen(p) + 1;
+      ok = (q < e) && add_pending_with_rollback(p, q);
+    }
+  }
+  free_mem(&buf, &maxbuf);
+  return ok;
+}
+
+bool_t set_durability_with_rollback(const char *level) {
+  if( level ) {
+    if( strcmp(level, "none") == 0 ) {
+      durability = ROLLBACK_DURABLE_NONE;
+    } else if( strcmp(level, "batch") == 0 ) {
+      durability = ROLLBACK_DURABLE_BATCH;
+    } else if( strcmp(level, "strict") == 0 ) {
+      durability = ROLLBACK_DURABLE_STRICT;
+    } else {
+      return FALSE;
+    }
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* called from the --stats summary, see set_stats_report() */
+void print_stats_with_rollback(FILE *out, bool_t json) {
+  if( json ) {
+    fprintf(out, "\"committed_files\":%lu,\"batches\":%lu,\"synced_dirs\":%lu,",
+	    stats.files, stats.batches, stats.dirs);
+    fprintf(out, "\"sync_time\":%.6f,\"rename_time\":%.6f,"
+	    "\"dirsync_time\":%.6f,",
+	    stats.sync_time, stats.rename_time, stats.dirsync_time);
+    return;
+  }
+  fprintf(out, "%s: committed %lu files in %lu batches, synced %lu directories\n",
+	  progname, stats.files, stats.batches, stats.dirs);
+  fprintf(out, "%s: sync %.3fs, rename %.3fs, directory sync %.3fs\n",
+	  progname, stats.sync_time, stats.rename_time, stats.dirsync_time);
+}
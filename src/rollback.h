@@ -23,6 +23,8 @@
 
 #include "common.h"
 #include "cstring.h"
+#include "stringlist.h"
+#include <stdio.h>
 
 typedef struct {
   int fd;
@@ -31,12 +33,31 @@ typedef struct {
 } rollback_t;
 
 #define RBM_FLAG_COMMIT   0x01
+#define RBM_FLAG_DEFER    0x02
 
 typedef struct {
-  rollback_t *files;
+  rollback_t *files; /* indexed by fd */
   size_t maxfiles;
+  stringlist_t pending; /* pairs of temporary file and path */
+  flag_t flags;
 } rollbackmgr_t;
 
+/* how hard we try to make committed files survive a crash */
+#define ROLLBACK_DURABLE_NONE    0 /* rename only */
+#define ROLLBACK_DURABLE_BATCH   1 /* sync and rename files in batches */
+#define ROLLBACK_DURABLE_STRICT  2 /* sync each file before its rename */
+
+#define ROLLBACK_BATCH  1024 /* files per batch */
+
+typedef struct {
+  unsigned long int files;
+  unsigned long int batches;
+  unsigned long int dirs;
+  double sync_time; /* seconds */
+  double rename_time;
+  double dirsync_time;
+} rollbackstats_t;
+
 /* _with_rollback() functions:
  * open a temporary file to write into, and upon closing decide if it
  * should be renamed as path or deleted. The file is automatically
@@ -50,11 +71,29 @@ int open_file_with_rollback(const char *path);
 void commit_file_with_rollback(int fd);
 void close_file_with_rollback(int fd);
 
+/* deferred commits: committed files are closed but not renamed until
+ * commit_pending_with_rollback() is called, and are deleted by
+ * abort_pending_with_rollback() or at exit. This lets several processes
+ * prepare their files independently, then have a single process
+ * rename them all together.
+ */
+void defer_commit_with_rollback(bool_t defer);
+bool_t add_pending_with_rollback(const char *tmp, const char *path);
+bool_t commit_pending_with_rollback();
+void abort_pending_with_rollback();
+bool_t write_pending_with_rollback(int fd);
+bool_t read_pending_with_rollback(int fd);
+
+/* level is one of "none", "batch" or "strict" */
+bool_t set_durability_with_rollback(const char *level);
+void print_stats_with_rollback(FILE *out, bool_t json);
+
 /* not for users */
 bool_t create_mgr_with_rollback(rollbackmgr_t *rbm);
 bool_t free_mgr_with_rollback(rollbackmgr_t *rbm);
 bool_t clear_mgr_with_rollback(rollbackmgr_t *rbm);
 rollback_t *find_mgr_with_rollback(rollbackmgr_t *rbm, int fd);
+rollback_t *grow_mgr_with_rollback(rollbackmgr_t *rbm, int fd);
 
 
 #endif
@@ -0,0 +1,235 @@
+/* 
+ * Copyright (C) 2009 Laird Breyer
+ *  
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA.
+ * 
+ * Author:   Laird Breyer <laird@lbreyer.com>
+ */
+
+#include "common.h"
+#include "splice.h"
+#include "mem.h"
+#include "myerror.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#if defined HAVE_LINUX_FS_H
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+extern volatile flag_t cmd;
+
+bool_t create_splice(splice_t *sp) {
+  if( sp ) {
+    memset(sp, 0, sizeof(splice_t));
+    return create_mem(&sp->edits, &sp->maxedits, sizeof(spliceedit_t), 16) &&
+      create_mem(&sp->data, &sp->maxdata, sizeof(byte_t), 256);
+  }
+  return FALSE;
+}
+
+bool_t free_splice(splice_t *sp) {
+  if( sp ) {
+    free_mem(&sp->edits, &sp->maxedits);
+    free_mem(&sp->data, &sp->maxdata);
+    sp->nedits = 0;
+    sp->ndata = 0;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t reset_splice(splice_t *sp) {
+  if( sp ) {
+    sp->nedits = 0;
+    sp->ndata = 0;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* edits must be added in file order. An edit which touches the
+   previous one is merged with it. */
+bool_t replace_splice(splice_t *sp, off_t begin, off_t end, 
+		      const byte_t *buf, size_t buflen) {
+  spliceedit_t *e;
+  if( sp && (0 <= begin) && (begin <= end) ) {
+    e = (sp->nedits > 0) ? &sp->edits[sp->nedits - 1] : NULL;
+    if( e && (begin < e->end) ) {
+      return FALSE; /* out of order */
+    }
+    if( buflen > 0 ) {
+      while( sp->ndata + buflen > sp->maxdata ) {
+	if( !grow_mem(&sp->data, &sp->maxdata, sizeof(byte_t), 256) ) {
+	  return FALSE;
+	}
+      }
+      memcpy(sp->data + sp->ndata, buf, buflen);
+    }
+    if( e && (begin == e->end) ) {
+      /* the data of the last edit is always at the end */
+      e->end = end;
+      e->len += buflen;
+    } else {
+      if( (sp->nedits >= sp->maxedits) &&
+	  !grow_mem(&sp->edits, &sp->maxedits, sizeof(spliceedit_t), 16) ) {
+	return FALSE;
+      }
+      e = &sp->edits[sp->nedits++];
+      e->begin = begin;
+      e->end = end;
+      e->off = sp->ndata;
+      e->len = buflen;
+    }
+    sp->ndata += buflen;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t delete_splice(splice_t *sp, off_t begin, off_t end) {
+  return (begin == end) || replace_splice(sp, begin, end, NULL, 0);
+}
+
+bool_t insert_splice(splice_t *sp, off_t pos, const byte_t *buf, size_t buflen) {
+  return (buflen == 0) || replace_splice(sp, pos, pos, buf, buflen);
+}
+
+static bool_t pwrite_splice(int fd, const byte_t *buf, size_t buflen, 
+			    off_t *pos) {
+  ssize_t n;
+  while( buflen > 0 ) {
+    n = pwrite(fd, buf, buflen, *pos);
+    if( n == -1 ) {
+      if( errno == EINTR ) {
+	continue;
+      }
+      return FALSE;
+    }
+    buf += n;
+    buflen -= n;
+    *pos += n;
+  }
+  return TRUE;
+}
+
+/* plain copy through a buffer, the last resort */
+static bool_t rw_copy_splice(int infd, off_t *inpos, int outfd, off_t *outpos,
+			     off_t len) {
+  byte_t buf[65536];
+  ssize_t n;
+  while( (len > 0) && !checkflag(cmd,CMD_QUIT) ) {
+    n = pread(infd, buf, (len < sizeof(buf)) ? len : sizeof(buf), *inpos);
+    if( n == -1 ) {
+      if( errno == EINTR ) {
+	continue;
+      }
+      return FALSE;
+    } else if( n == 0 ) {
+      return FALSE; /* file shrank */
+    }
+    *inpos += n;
+    len -= n;
+    if( !pwrite_splice(outfd, buf, n, outpos) ) {
+      return FALSE;
+    }
+  }
+  return (len == 0);
+}
+
+static bool_t kernel_copy_splice(int infd, off_t *inpos, int outfd, 
+				 off_t *outpos, off_t len) {
+#if defined HAVE_COPY_FILE_RANGE
+  ssize_t n;
+  while( (len > 0) && !checkflag(cmd,CMD_QUIT) ) {
+    n = copy_file_range(infd, inpos, outfd, outpos, len, 0);
+    if( n == -1 ) {
+      if( errno == EINTR ) {
+	continue;
+      }
+      /* not supported here, eg across filesystems */
+      return rw_copy_splice(infd, inpos, outfd, outpos, len);
+    } else if( n == 0 ) {
+      return FALSE; /* file shrank */
+    }
+    len -= n;
+  }
+  return (len == 0);
+#else
+  return rw_copy_splice(infd, inpos, outfd, outpos, len);
+#endif
+}
+
+/* copies len bytes of infd at *inpos to outfd at *outpos. When both 
+ * offsets have the same alignment, the whole blocks in the middle are
+ * cloned, so they share storage with the input. 
+ */
+static bool_t copy_splice(int infd, off_t *inpos, int outfd, off_t *outpos,
+			  off_t len, off_t blksize) {
+#if defined HAVE_LINUX_FS_H && defined FICLONERANGE
+  struct file_clone_range fcr;
+  off_t head, mid;
+  if( (blksize > 0) && ((*inpos % blksize) == (*outpos % blksize)) ) {
+    head = (blksize - (*inpos % blksize)) % blksize;
+    if( head + blksize <= len ) {
+      mid = ((len - head) / blksize) * blksize;
+      if( !kernel_copy_splice(infd, inpos, outfd, outpos, head) ) {
+	return FALSE;
+      }
+      len -= head;
+      fcr.src_fd = infd;
+      fcr.src_offset = *inpos;
+      fcr.src_length = mid;
+      fcr.dest_offset = *outpos;
+      if( ioctl(outfd, FICLONERANGE, &fcr) == 0 ) {
+	*inpos += mid;
+	*outpos += mid;
+	len -= mid;
+      }
+    }
+  }
+#endif
+  return kernel_copy_splice(infd, inpos, outfd, outpos, len);
+}
+
+bool_t write_splice(splice_t *sp, int infd, int outfd) {
+  struct stat st;
+  off_t inpos = 0, outpos = 0;
+  spliceedit_t *e;
+  size_t i;
+
+  if( sp && (fstat(infd, &st) == 0) ) {
+    for(i = 0; i < sp->nedits; i++) {
+      e = &sp->edits[i];
+      if( (e->end > st.st_size) ||
+	  !copy_splice(infd, &inpos, outfd, &outpos, 
+		       e->begin - inpos, st.st_blksize) ||
+	  !pwrite_splice(outfd, sp->data + e->off, e->len, &outpos) ) {
+	return FALSE;
+      }
+      inpos = e->end;
+    }
+    if( copy_splice(infd, &inpos, outfd, &outpos, 
+		    st.st_size - inpos, st.st_blksize) ) {
+      /* leave the file offset at the end, like a plain write would */
+      return (lseek(outfd, outpos, SEEK_SET) == outpos);
+    }
+  }
+  return FALSE;
+}
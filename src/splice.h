@@ -0,0 +1,58 @@
+/* 
+ * Copyright (C) 2009 Laird Breyer
+ *  
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA.
+ * 
+ * Author:   Laird Breyer <laird@lbreyer.com>
+ */
+
+#ifndef SPLICE_H
+#define SPLICE_H
+
+#include "common.h"
+#include <sys/types.h>
+
+/* A splice_t is a list of edits to an input file, recorded in file
+ * order: each edit replaces the input bytes [begin, end) with some new
+ * data (possibly empty). write_splice() then builds the edited file 
+ * by copying the unchanged extents inside the kernel, sharing the
+ * disk blocks with the input where the filesystem allows it, so the 
+ * cost depends on the size of the edits rather than the file.
+ */
+
+typedef struct {
+  off_t begin, end; /* input bytes [begin, end) are replaced */
+  size_t off, len; /* by data[off, off + len) */
+} spliceedit_t;
+
+typedef struct {
+  spliceedit_t *edits;
+  size_t nedits, maxedits;
+  byte_t *data;
+  size_t ndata, maxdata;
+} splice_t;
+
+bool_t create_splice(splice_t *sp);
+bool_t free_splice(splice_t *sp);
+bool_t reset_splice(splice_t *sp);
+
+bool_t replace_splice(splice_t *sp, off_t begin, off_t end, 
+		      const byte_t *buf, size_t buflen);
+bool_t delete_splice(splice_t *sp, off_t begin, off_t end);
+bool_t insert_splice(splice_t *sp, off_t pos, const byte_t *buf, size_t buflen);
+
+bool_t write_splice(splice_t *sp, int infd, int outfd);
+
+#endif
@@ -0,0 +1,265 @@
+/* 
+ * Copyright (C) 2009 Laird Breyer
+ *  
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA.
+ * 
+ * Author:   Laird Breyer <laird@lbreyer.com>
+ */
+
+#include "common.h"
+#include "stats.h"
+#include "myerror.h"
+#include "mysignal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#if HAVE_PTHREAD_H && HAVE_LIBPTHREAD
+#include <pthread.h>
+static pthread_mutex_t statslock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+extern char *progname;
+
+STATS_THREAD stats_t *tstats = NULL;
+
+static int statsmode = 0;
+static bool_t counting = FALSE;
+static stats_t *allstats = NULL; /* one for each thread */
+static stats_report_fun *extrareport = NULL;
+
+typedef struct {
+  double start;
+  long size; /* -1 if unknown */
+  unsigned long int events; /* counted before the file was opened */
+} progress_t;
+
+static progress_t progress = { 0.0, -1, 0 };
+
+static const char *eventnames[STATS_NUMEVENTS] = {
+  "start_tag", "end_tag", "chardata", "pidata", 
+  "comment", "cdata", "doctype", "default"
+};
+
+double now_stats() {
+#if defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+#endif
+}
+
+stats_t *enter_stats_thread() {
+  stats_t *s;
+  if( counting && !tstats ) {
+    s = (stats_t *)calloc(1, sizeof(stats_t));
+    if( s ) {
+#if HAVE_PTHREAD_H && HAVE_LIBPTHREAD
+      pthread_mutex_lock(&statslock);
+#endif
+      s->next = allstats;
+      allstats = s;
+#if HAVE_PTHREAD_H && HAVE_LIBPTHREAD
+      pthread_mutex_unlock(&statslock);
+#endif
+      tstats = s;
+    }
+  }
+  return tstats;
+}
+
+static void sum_stats(stats_t *sum) {
+  stats_t *s;
+  int i;
+  memset(sum, 0, sizeof(stats_t));
+#if HAVE_PTHREAD_H && HAVE_LIBPTHREAD
+  pthread_mutex_lock(&statslock);
+#endif
+  for(s = allstats; s; s = s->next) {
+    sum->bytesread += s->bytesread;
+    sum->reads += s->reads;
+    sum->input_time += s->input_time;
+    sum->output_time += s->output_time;
+    sum->parse_time += s->parse_time;
+    sum->callback_time += s->callback_time;
+    for(i = 0; i < STATS_NUMEVENTS; i++) {
+      sum->events[i] += s->events[i];
+    }
+    sum->selected += s->selected;
+    sum->byteswritten += s->byteswritten;
+    sum->flushes += s->flushes;
+    sum->spills += s->spills;
+    sum->bytesspilled += s->bytesspilled;
+  }
+#if HAVE_PTHREAD_H && HAVE_LIBPTHREAD
+  pthread_mutex_unlock(&statslock);
+#endif
+}
+
+/* peak resident set size in kilobytes, 0 if unknown */
+static long peak_rss_stats() {
+  struct rusage ru;
+  if( getrusage(RUSAGE_SELF, &ru) == 0 ) {
+    return ru.ru_maxrss;
+  }
+  return 0;
+}
+
+static void print_text_stats(FILE *out, stats_t *s) {
+  int i;
+  if( extrareport ) {
+    (*extrareport)(out, FALSE);
+  }
+  fprintf(out, "%s: read %lu bytes in %lu calls, blocked %.3fs\n",
+	  progname, s->bytesread, s->reads, s->input_time);
+  fprintf(out, "%s: wrote %lu bytes in %lu flushes, blocked %.3fs\n",
+	  progname, s->byteswritten, s->flushes, s->output_time);
+  fprintf(out, "%s: parsed for %.3fs, expat %.3fs, callbacks %.3fs\n",
+	  progname, s->parse_time, 
+	  MAX(s->parse_time - s->callback_time, 0.0), s->callback_time);
+  fprintf(out, "%s: events", progname);
+  for(i = 0; i < STATS_NUMEVENTS; i++) {
+    fprintf(out, " %s %lu", eventnames[i], s->events[i]);
+  }
+  fprintf(out, ", selected %lu\n", s->selected);
+  fprintf(out, "%s: spilled %lu buffers, %lu bytes\n",
+	  progname, s->spills, s->bytesspilled);
+  fprintf(out, "%s: peak RSS %ldKB\n", progname, peak_rss_stats());
+}
+
+static void print_json_stats(FILE *out, stats_t *s) {
+  int i;
+  fprintf(out, "{\"program\":\"%s\",", progname);
+  fprintf(out, "\"bytes_read\":%lu,\"reads\":%lu,\"input_wait\":%.6f,",
+	  s->bytesread, s->reads, s->input_time);
+  fprintf(out, "\"bytes_written\":%lu,\"flushes\":%lu,\"output_wait\":%.6f,",
+	  s->byteswritten, s->flushes, s->output_time);
+  fprintf(out, "\"parse_time\":%.6f,\"expat_time\":%.6f,"
+	  "\"callback_time\":%.6f,", s->parse_time, 
+	  MAX(s->parse_time - s->callback_time, 0.0), s->callback_time);
+  fprintf(out, "\"events\":{");
+  for(i = 0; i < STATS_NUMEVENTS; i++) {
+    fprintf(out, "%s\"%s\":%lu", (i > 0) ? "," : "", 
+	    eventnames[i], s->events[i]);
+  }
+  fprintf(out, "},\"selected\":%lu,", s->selected);
+  fprintf(out, "\"spills\":%lu,\"bytes_spilled\":%lu,",
+	  s->spills, s->bytesspilled);
+  if( extrareport ) {
+    (*extrareport)(out, TRUE);
+  }
+  fprintf(out, "\"peak_rss_kb\":%ld}\n", peak_rss_stats());
+}
+
+static void print_stats() {
+  stats_t sum;
+  sum_stats(&sum);
+  if( statsmode == STATS_JSON ) {
+    print_json_stats(stderr, &sum);
+  } else {
+    print_text_stats(stderr, &sum);
+  }
+}
+
+/* optarg is NULL for plain --stats */
+bool_t set_stats(const char *optarg) {
+  if( optarg && (strcmp(optarg, "json") != 0) ) {
+    errormsg(E_FATAL, "unknown statistics format %s (try --help).\n", optarg);
+  }
+  if( !statsmode ) {
+    statsmode = optarg ? STATS_JSON : STATS_TEXT;
+    counting = TRUE;
+    enter_stats_thread();
+    atexit(print_stats);
+  } else {
+    statsmode = optarg ? STATS_JSON : STATS_TEXT;
+  }
+  return TRUE;
+}
+
+/* report is called from print_stats() at exit */
+void set_stats_report(stats_report_fun *report) {
+  extrareport = report;
+}
+
+static unsigned long int events_stats(const stats_t *s) {
+  unsigned long int n = 0;
+  int i;
+  for(i = 0; i < STATS_NUMEVENTS; i++) {
+    n += s->events[i];
+  }
+  return n;
+}
+
+/* optarg is the number of seconds between reports, or NULL */
+bool_t set_progress(const char *optarg) {
+  int n = optarg ? atoi(optarg) : PROGRESS_INTERVAL;
+  if( n < 1 ) {
+    errormsg(E_FATAL, "bad progress interval %s\n", optarg);
+  }
+  counting = TRUE;
+  enter_stats_thread();
+  set_progress_signal((unsigned int)n);
+  return TRUE;
+}
+
+/* called whenever an input file is opened */
+void begin_progress(int fd) {
+  struct stat st;
+  progress.start = now_stats();
+  progress.size = ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode)) ?
+    (long)st.st_size : -1;
+  progress.events = tstats ? events_stats(tstats) : 0;
+}
+
+static void print_hms(FILE *out, double secs) {
+  long s = (long)secs;
+  fprintf(out, "%ld:%02ld:%02ld", s / 3600, (s / 60) % 60, s % 60);
+}
+
+/* byteno is the offset in the current file, or -1 if unknown */
+void print_progress(const char *file, long byteno) {
+  double elapsed, rate;
+  elapsed = now_stats() - progress.start;
+  byteno = MAX(byteno, 0);
+  rate = (elapsed > 0.0) ? byteno / elapsed : 0.0;
+  fprintf(stderr, "%s: %s: %ld", progname, 
+	  (file && *file) ? file : "stdin", byteno);
+  if( (progress.size > 0) && (byteno <= progress.size) ) {
+    fprintf(stderr, "/%ld bytes (%.0f%%)", 
+	    progress.size, 100.0 * byteno / progress.size);
+  } else {
+    fprintf(stderr, " bytes");
+  }
+  fprintf(stderr, ", %.1fs, %.1f MB/s", elapsed, rate / 1000000.0);
+  if( tstats && (elapsed > 0.0) ) {
+    fprintf(stderr, ", %.0f events/s", 
+	    (events_stats(tstats) - progress.events) / elapsed);
+  }
+  if( (progress.size > 0) && (byteno <= progress.size) && (rate > 0.0) ) {
+    fprintf(stderr, ", ETA ");
+    print_hms(stderr, (progress.size - byteno) / rate);
+  }
+  fprintf(stderr, "\n");
+}
@@ -0,0 +1,118 @@
+/* 
+ * Copyright (C) 2009 Laird Breyer
+ *  
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA.
+ * 
+ * Author:   Laird Breyer <laird@lbreyer.com>
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "common.h"
+#include <stdio.h>
+
+/*
+ * With --stats, every command counts where its input came from, where
+ * its output went and what it spent its time on, and prints a summary
+ * on standard error at exit (or a single JSON object with --stats=json).
+ *
+ * Each thread counts into its own stats_t, which is reached through the
+ * thread local pointer tstats. When --stats isn't given, tstats is NULL
+ * and the STATS_* macros below cost a single well predicted branch.
+ * Threads other than the main thread must call enter_stats_thread()
+ * before they count anything.
+ *
+ * On SIGUSR1, or every N seconds with --progress[=N], the parser prints
+ * how far it got in the current input file, like dd(1) does. The file
+ * size and the start time are taken by begin_progress() when the file
+ * is opened. The event rate is only known if the events are counted,
+ * which --progress turns on.
+ *
+ * A module that keeps counters of its own (eg rollback commits) can
+ * add them to the summary with set_stats_report(). In JSON mode, the
+ * report prints "name":value pairs, each followed by a comma.
+ */
+
+#define STATS_START_TAG  0
+#define STATS_END_TAG    1
+#define STATS_CHARDATA   2
+#define STATS_PIDATA     3
+#define STATS_COMMENT    4
+#define STATS_CDATA      5
+#define STATS_DOCTYPE    6
+#define STATS_DEFAULT    7
+#define STATS_NUMEVENTS  8
+
+typedef struct stats_s {
+  unsigned long int bytesread;
+  unsigned long int reads; /* read syscalls */
+  double input_time; /* seconds blocked in read */
+  double output_time; /* seconds blocked in write */
+  double parse_time; /* seconds in expat, including callbacks */
+  double callback_time; /* seconds in callbacks */
+  unsigned long int events[STATS_NUMEVENTS];
+  unsigned long int selected; /* start tags of selected nodes */
+  unsigned long int byteswritten; /* to stdout */
+  unsigned long int flushes;
+  unsigned long int spills; /* tempcollect buffers written to file */
+  unsigned long int bytesspilled;
+  struct stats_s *next;
+} stats_t;
+
+#define STATS_OPTION  0x7f
+#define STATS_TEXT    1
+#define STATS_JSON    2
+
+#define PROGRESS_OPTION   0x7e
+#define PROGRESS_INTERVAL 5 /* seconds */
+
+#if HAVE_PTHREAD_H && HAVE_LIBPTHREAD && defined(__GNUC__)
+#define STATS_THREAD __thread
+#else
+#define STATS_THREAD
+#endif
+
+#if defined(__GNUC__)
+#define STATS_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define STATS_UNLIKELY(x) (x)
+#endif
+
+extern STATS_THREAD stats_t *tstats;
+
+#define STATS_ADD(field, n) \
+  do { if( STATS_UNLIKELY(tstats != NULL) ) { tstats->field += (n); } } while(0)
+#define STATS_BEGIN(t) \
+  do { if( STATS_UNLIKELY(tstats != NULL) ) { (t) = now_stats(); } } while(0)
+#define STATS_END(field, t) \
+  do { if( STATS_UNLIKELY(tstats != NULL) ) { tstats->field += now_stats() - (t); } } while(0)
+
+typedef void (stats_report_fun)(FILE *out, bool_t json);
+
+bool_t set_stats(const char *optarg);
+void set_stats_report(stats_report_fun *report);
+stats_t *enter_stats_thread();
+double now_stats();
+
+bool_t set_progress(const char *optarg);
+void begin_progress(int fd);
+void print_progress(const char *file, long byteno);
+
+#endif
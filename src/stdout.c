@@ -25,6 +25,7 @@
 #include "entities.h"
 #include "parser.h"
 #include "mem.h"
+#include "stats.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -124,6 +125,8 @@ bool_t flush_stdout() {
     }
     write_file(stdout_fileno, xstdout.buf, xstdout.pos);
     xstdout.byteswritten += xstdout.pos;
+    STATS_ADD(byteswritten, xstdout.pos);
+    STATS_ADD(flushes, 1);
     xstdout.pos = 0;
   }
   return (xstdout.pos == 0);
@@ -169,37 +172,28 @@ bool_t write_stdout(const byte_t *buf, size_t buflen) {
 }
 
 /* squeezes white space, replacing it with single space char.
+   Leading white space is dropped, except that the first char is always
+   kept at the very start of the output. White space directly following
+   the first char is dropped too.
+   Non-space runs are located a word at a time and copied whole.
    Note: All newlines are lost. */
 bool_t squeeze_stdout(const byte_t *buf, size_t buflen) {
-  byte_t *p;
-  bool_t in_space, sq;
-  if( xstdout.buf && (buflen > 0) ) {
-    p = xstdout.buf + xstdout.pos;
-    in_space = (xstdout.pos > 0) ? xml_whitespace(*buf) : FALSE;
-    sq = TRUE;
-    do {
-      while( (xstdout.pos < xstdout.buflen) && (buflen > 0) ) {
-	if( in_space ) {
-	  if( !sq ) {
-	    *p++ = ' ';
-	    xstdout.pos++;
-	    sq = TRUE;
-	  }
-	  buf++;
-	} else {
-	  *p++ = *buf++;
-	  xstdout.pos++;
-	}
-	buflen--;
-	in_space = xml_whitespace(*buf);
-	sq = sq && in_space;
-      }
-      if( xstdout.pos >= xstdout.buflen ) {
-	xstdout.pos = xstdout.buflen;
-	flush_stdout();
-	p = xstdout.buf + xstdout.pos;
+  const char_t *p, *q;
+  const char_t *end = (const char_t *)buf + buflen;
+  if( xstdout.buf && buf && (buflen > 0) ) {
+    p = (const char_t *)buf;
+    if( (xstdout.pos + xstdout.byteswritten == 0) || !xml_whitespace(*p) ) {
+      write_stdout(buf, 1);
+      p++;
+    }
+    for(p = skip_xml_whitespace(p, end); p < end; 
+	p = skip_xml_whitespace(q, end)) {
+      q = find_xml_whitespace(p, end);
+      write_stdout((byte_t *)p, q - p);
+      if( q < end ) {
+	putc_stdout(' ');
       }
-    } while( buflen > 0);
+    }
     return TRUE;
   }
   return FALSE;
@@ -370,3 +364,107 @@ bool_t write_end_tag_stdout(const char_t *name) {
   return TRUE;
 }
 
+/* returns a pointer to n free bytes in the output buffer, or NULL if
+   the buffer is too small. The caller must advance xstdout.pos. */
+static byte_t *reserve_stdout(size_t n) {
+  if( xstdout.buf && (n <= xstdout.buflen) ) {
+    if( xstdout.pos + n > xstdout.buflen ) {
+      flush_stdout();
+    }
+    if( xstdout.pos + n <= xstdout.buflen ) {
+      return xstdout.buf + xstdout.pos;
+    }
+  }
+  return NULL;
+}
+
+#define STDOUT_MAXATTS 16
+
+/* writes indent tabs, the start tag and a newline. The common case
+   is assembled directly in the output buffer, with a single bounds check.
+   Long lines, many attributes or attribute values which need entities
+   go through write_start_tag_stdout() instead. */
+bool_t write_start_tag_line_stdout(int indent, const char_t *name, 
+				   const char_t **att) {
+  size_t len[2 * STDOUT_MAXATTS + 1];
+  size_t n;
+  int i;
+  byte_t *p = NULL;
+
+  if( !name ) {
+    return FALSE;
+  }
+  indent = (indent > 0) ? indent : 0;
+  len[0] = strlen(name);
+  n = indent + len[0] + 3;
+  for(i = 0; att && att[i]; i += 2) {
+    if( i >= 2 * STDOUT_MAXATTS ) {
+      break;
+    }
+    len[i + 1] = strlen(att[i]);
+    len[i + 2] = strlen(att[i + 1]);
+    if( find_next_special(att[i + 1], att[i + 1] + len[i + 2]) < 
+	att[i + 1] + len[i + 2] ) {
+      break;
+    }
+    n += len[i + 1] + len[i + 2] + 4;
+  }
+  if( !att || !att[i] ) {
+    p = reserve_stdout(n);
+  }
+
+  if( !p ) {
+    nputc_stdout('\t', indent);
+    write_start_tag_stdout(name, att, FALSE);
+    return putc_stdout('\n');
+  }
+
+  memset(p, '\t', indent);
+  p += indent;
+  *p++ = '<';
+  memcpy(p, name, len[0]);
+  p += len[0];
+  for(i = 0; att && att[i]; i += 2) {
+    *p++ = ' ';
+    memcpy(p, att[i], len[i + 1]);
+    p += len[i + 1];
+    *p++ = '=';
+    *p++ = '\"';
+    memcpy(p, att[i + 1], len[i + 2]);
+    p += len[i + 2];
+    *p++ = '\"';
+  }
+  *p++ = '>';
+  *p++ = '\n';
+  xstdout.pos += n;
+  return TRUE;
+}
+
+/* writes indent tabs, the end tag and a newline */
+bool_t write_end_tag_line_stdout(int indent, const char_t *name) {
+  size_t len;
+  byte_t *p;
+
+  if( !name ) {
+    return FALSE;
+  }
+  indent = (indent > 0) ? indent : 0;
+  len = strlen(name);
+  p = reserve_stdout(indent + len + 4);
+  if( !p ) {
+    nputc_stdout('\t', indent);
+    write_end_tag_stdout(name);
+    return putc_stdout('\n');
+  }
+
+  memset(p, '\t', indent);
+  p += indent;
+  *p++ = '<';
+  *p++ = '/';
+  memcpy(p, name, len);
+  p += len;
+  *p++ = '>';
+  *p++ = '\n';
+  xstdout.pos += indent + len + 4;
+  return TRUE;
+}
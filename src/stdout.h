@@ -43,6 +43,8 @@ bool_t nprintf_stdout(int size, const char_t *fmt, ...)
 bool_t write_entity_stdout(char_t c);
 bool_t write_start_tag_stdout(const char_t *name, const char_t **att, bool_t slash);
 bool_t write_end_tag_stdout(const char_t *name);
+bool_t write_start_tag_line_stdout(int indent, const char_t *name, const char_t **att);
+bool_t write_end_tag_line_stdout(int indent, const char_t *name);
 
 bool_t write_coded_entities_stdout(const char_t *buf, size_t buflen);
 bool_t write_unescaped_stdout(const char_t *buf, size_t buflen);
@@ -22,19 +22,42 @@
 #include "io.h"
 #include "myerror.h"
 #include "filelist.h"
+#include "mem.h"
 #include "stdparse.h"
+#include "stats.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/fcntl.h>
 #include <string.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 extern const char *inputfile;
 extern volatile flag_t cmd;
 
-result_t std_chardata(void *user, const char_t *buf, size_t buflen) {
-  stdparserinfo_t *pinfo = (stdparserinfo_t *)user;
+/* only a stop or abort request from a delayed chardata call is passed on */
+#define STOP_RESULT(r) ((r) & (PARSER_STOP|PARSER_ABORT))
+
+/* skip.state: with SKIP_EVENTS, the parser still sees the skipped
+   input and its events are only counted. The others are raw scanner 
+   states. */
+#define SKIP_EVENTS  0
+#define SKIP_DONE    1
+#define SKIP_TEXT    2
+#define SKIP_LT      3
+#define SKIP_TAG     4
+#define SKIP_QUOTE   5
+#define SKIP_BANG    6
+#define SKIP_COMMENT 7
+#define SKIP_CDATA   8
+#define SKIP_PI      9
+
+#define SKIPPING(p) \
+  (checkflag((p)->reserved,STDPARSE_RESERVED_SKIP) && ((p)->skip.state > SKIP_DONE))
+
+static result_t fire_chardata(stdparserinfo_t *pinfo, 
+			      const char_t *buf, size_t buflen) {
   result_t r;
   if( pinfo && pinfo->setup.cb.chardata ) { 
     setflag(&pinfo->reserved,STDPARSE_RESERVED_CHARDATA);
@@ -44,7 +67,7 @@ result_t std_chardata(void *user, const char_t *buf, size_t buflen) {
 
     r = 
       (pinfo->sel.active || checkflag(pinfo->setup.flags,STDPARSE_ALLNODES)) ?
-      pinfo->setup.cb.chardata(user, buf, buflen) : PARSER_OK;
+      pinfo->setup.cb.chardata(pinfo, buf, buflen) : PARSER_OK;
 
     pop_xpath(&pinfo->cp);
     activate_tag_stdselect(&pinfo->sel, pinfo->depth, &pinfo->cp, NULL);
@@ -54,16 +77,103 @@ result_t std_chardata(void *user, const char_t *buf, size_t buflen) {
   return PARSER_OK;
 }
 
+/* STDPARSE_COALESCE_CHARDATA: the latest run of adjacent fragments is
+ * kept as a pointer into the parser's buffer, and is only copied when a
+ * fragment from elsewhere (eg an entity) follows, or when the parser
+ * buffer is about to be reused.
+ */
+static bool_t append_text_stdparse(stdparserinfo_t *pinfo, 
+				   const char_t *buf, size_t buflen) {
+  while( pinfo->text.buflen + buflen > pinfo->text.maxbuf ) {
+    if( !grow_mem(&pinfo->text.buf, &pinfo->text.maxbuf, 
+		  sizeof(char_t), 1024) ) {
+      errormsg(E_FATAL, "out of memory.\n");
+    }
+  }
+  memcpy(pinfo->text.buf + pinfo->text.buflen, buf, buflen);
+  pinfo->text.buflen += buflen;
+  return TRUE;
+}
+
+/* call before the parser's buffer changes */
+static bool_t keep_text_stdparse(stdparserinfo_t *pinfo) {
+  if( pinfo->text.viewlen > 0 ) {
+    append_text_stdparse(pinfo, pinfo->text.view, pinfo->text.viewlen);
+    pinfo->text.viewlen = 0;
+  }
+  return TRUE;
+}
+
+/* sends the pending text, call before any other event */
+static result_t flush_text_stdparse(stdparserinfo_t *pinfo) {
+  result_t r = PARSER_OK;
+  if( pinfo->text.buflen > 0 ) {
+    keep_text_stdparse(pinfo);
+    r = fire_chardata(pinfo, pinfo->text.buf, pinfo->text.buflen);
+  } else if( pinfo->text.viewlen > 0 ) {
+    r = fire_chardata(pinfo, pinfo->text.view, pinfo->text.viewlen);
+  }
+  pinfo->text.buflen = 0;
+  pinfo->text.viewlen = 0;
+  return r;
+}
+
+/* call first in every event handler. Also counts down the event
+   batch of next_stdpull(), and suspends the parser when it runs out. */
+static result_t begin_event_stdparse(stdparserinfo_t *pinfo) {
+  result_t r;
+  r = flush_text_stdparse(pinfo);
+  if( (pinfo->batch > 0) && (--pinfo->batch == 0) ) {
+    r |= PARSER_STOP;
+  }
+  return r;
+}
+
+result_t std_chardata(void *user, const char_t *buf, size_t buflen) {
+  stdparserinfo_t *pinfo = (stdparserinfo_t *)user;
+  if( pinfo && checkflag(pinfo->reserved,STDPARSE_RESERVED_SKIP) ) {
+    return PARSER_OK;
+  }
+  if( pinfo && checkflag(pinfo->setup.flags,STDPARSE_COALESCE_CHARDATA) ) {
+    if( (pinfo->text.viewlen > 0) && 
+	(buf == pinfo->text.view + pinfo->text.viewlen) ) {
+      pinfo->text.viewlen += buflen;
+    } else {
+      keep_text_stdparse(pinfo);
+      if( inbuf_parser(pinfo->parser, buf, buflen) ) {
+	pinfo->text.view = buf;
+	pinfo->text.viewlen = buflen;
+      } else {
+	append_text_stdparse(pinfo, buf, buflen);
+      }
+    }
+    if( pinfo->text.buflen + pinfo->text.viewlen >= STDPARSE_COALESCE_MAX ) {
+      return flush_text_stdparse(pinfo);
+    }
+    return PARSER_OK;
+  }
+  if( pinfo && (pinfo->batch > 0) && (--pinfo->batch == 0) ) {
+    return fire_chardata(pinfo, buf, buflen)|PARSER_STOP;
+  }
+  return fire_chardata(pinfo, buf, buflen);
+}
+
 result_t std_start_tag(void *user, const char_t *name, const char_t **att) {
   stdparserinfo_t *pinfo = (stdparserinfo_t *)user;
-  result_t retval;
-  bool_t ok;
+  result_t retval, rt;
+  bool_t ok, active;
   if( pinfo ) { 
+    if( checkflag(pinfo->reserved,STDPARSE_RESERVED_SKIP) ) {
+      pinfo->skip.level++;
+      pinfo->skip.elements++;
+      return PARSER_OK;
+    }
+    rt = begin_event_stdparse(pinfo);
 
     if( pinfo->setup.cb.chardata && 
 	checkflag(pinfo->setup.flags,STDPARSE_ALWAYS_CHARDATA) &&
 	!checkflag(pinfo->reserved,STDPARSE_RESERVED_CHARDATA) ) {
-      std_chardata(user, "", 0);
+      fire_chardata(pinfo, "", 0);
     }
     clearflag(&pinfo->reserved,STDPARSE_RESERVED_CHARDATA);
 
@@ -74,37 +184,67 @@ result_t std_start_tag(void *user, const char_t *name, const char_t **att) {
 
     ok = checkflag(pinfo->setup.flags,STDPARSE_ALLNODES);
 
+    if( pinfo->sel.active ) {
+      STATS_ADD(selected, 1);
+    }
+
     retval = pinfo->setup.cb.start_tag && (ok || pinfo->sel.active)  ?
       pinfo->setup.cb.start_tag(user, name, att) : PARSER_OK;
 
-    if( pinfo->setup.cb.attribute && 
-	(att && *att) && (ok || pinfo->sel.attrib) ) {
+    if( pinfo->setup.cb.attribute && (att && *att) && 
+	ok && (pinfo->sel.atts.natts == 0) ) {
+      /* no xpath mentions attributes, so all of them are shown */
       do {
-	push_attribute_xpath(&pinfo->cp, att[0]);
-	activate_attribute_stdselect(&pinfo->sel, pinfo->depth, &pinfo->cp, att[0]);
+	retval |= pinfo->setup.cb.attribute(user, att[0], att[1]);
+	att += 2;
+      } while( att && *att );
+    } else if( pinfo->setup.cb.attribute && 
+	       (att && *att) && (ok || pinfo->sel.attrib) ) {
+      active = pinfo->sel.active;
+      do {
+	if( wanted_attribute_stdselect(&pinfo->sel, att[0]) ) {
+	  push_attribute_xpath(&pinfo->cp, att[0]);
+	  activate_attribute_stdselect(&pinfo->sel, pinfo->depth, &pinfo->cp, att[0]);
+	  pop_attribute_xpath(&pinfo->cp);
+	} else {
+	  pinfo->sel.active = FALSE;
+	}
 	if( ok || pinfo->sel.active ) {
 	  retval |= pinfo->setup.cb.attribute(user, att[0], att[1]);
 	}
-	pop_attribute_xpath(&pinfo->cp);
 	att += 2;
       } while( att && *att );
-      activate_tag_stdselect(&pinfo->sel, pinfo->depth, &pinfo->cp, NULL);
+      pinfo->sel.active = active;
     }
 
-    return retval;
+    return retval|STOP_RESULT(rt);
   }
   return PARSER_OK;
 }
 
 result_t std_end_tag(void *user, const char_t *name) {
   stdparserinfo_t *pinfo = (stdparserinfo_t *)user;
-  result_t r;
+  result_t r, rt;
+  long begin, end;
   if( pinfo ) { 
+    if( checkflag(pinfo->reserved,STDPARSE_RESERVED_SKIP) ) {
+      if( pinfo->skip.level > 0 ) {
+	pinfo->skip.level--;
+	return PARSER_OK;
+      }
+      clearflag(&pinfo->reserved,STDPARSE_RESERVED_SKIP);
+      if( range_stdparse(pinfo, &begin, &end) ) {
+	pinfo->skip.bytes = begin - pinfo->skip.begin;
+      }
+      /* the contents don't count as chardata */
+      setflag(&pinfo->reserved,STDPARSE_RESERVED_CHARDATA);
+    }
+    rt = begin_event_stdparse(pinfo);
 
     if( pinfo->setup.cb.chardata && 
 	checkflag(pinfo->setup.flags,STDPARSE_ALWAYS_CHARDATA) &&
 	!checkflag(pinfo->reserved,STDPARSE_RESERVED_CHARDATA) ) {
-      std_chardata(user, "", 0);
+      fire_chardata(pinfo, "", 0);
     }
     clearflag(&pinfo->reserved,STDPARSE_RESERVED_CHARDATA);
 
@@ -117,7 +257,7 @@ result_t std_end_tag(void *user, const char_t *name) {
     pop_xpath(&pinfo->cp);
     activate_tag_stdselect(&pinfo->sel, pinfo->depth, &pinfo->cp, NULL);
 
-    return r;
+    return r|STOP_RESULT(rt);
   }
   return PARSER_OK;
 }
@@ -125,84 +265,91 @@ result_t std_end_tag(void *user, const char_t *name) {
 
 result_t std_pidata(void *user, const char_t *target, const char_t *data) {
   stdparserinfo_t *pinfo = (stdparserinfo_t *)user;
-  result_t r;
-  if( pinfo ) { 
+  result_t r, rt;
+  if( pinfo && !checkflag(pinfo->reserved,STDPARSE_RESERVED_SKIP) ) {
+    rt = begin_event_stdparse(pinfo);
     r = pinfo->setup.cb.pidata &&
       (pinfo->sel.active || checkflag(pinfo->setup.flags,STDPARSE_ALLNODES)) ? 
       pinfo->setup.cb.pidata(user, target, data) : PARSER_OK;
-    return r;
+    return r|STOP_RESULT(rt);
   }
   return PARSER_OK;
 }
 
 result_t std_comment(void *user, const char_t *data) {
   stdparserinfo_t *pinfo = (stdparserinfo_t *)user;
-  result_t r;
-  if( pinfo ) { 
+  result_t r, rt;
+  if( pinfo && !checkflag(pinfo->reserved,STDPARSE_RESERVED_SKIP) ) {
+    rt = begin_event_stdparse(pinfo);
     r = pinfo->setup.cb.comment &&
       (pinfo->sel.active || checkflag(pinfo->setup.flags,STDPARSE_ALLNODES)) ? 
       pinfo->setup.cb.comment(user, data) : PARSER_OK;
-    return r;
+    return r|STOP_RESULT(rt);
   }
   return PARSER_OK;
 }
 
 result_t std_start_cdata(void *user) {
   stdparserinfo_t *pinfo = (stdparserinfo_t *)user;
-  result_t r;
-  if( pinfo ) { 
+  result_t r, rt;
+  if( pinfo && !checkflag(pinfo->reserved,STDPARSE_RESERVED_SKIP) ) {
+    rt = begin_event_stdparse(pinfo);
     r = pinfo->setup.cb.start_cdata &&
       (pinfo->sel.active || checkflag(pinfo->setup.flags,STDPARSE_ALLNODES)) ? 
       pinfo->setup.cb.start_cdata(user) : PARSER_OK;
-    return r;
+    return r|STOP_RESULT(rt);
   }
   return PARSER_OK;
 }
 
 result_t std_end_cdata(void *user) {
   stdparserinfo_t *pinfo = (stdparserinfo_t *)user;
-  result_t r;
-  if( pinfo ) { 
+  result_t r, rt;
+  if( pinfo && !checkflag(pinfo->reserved,STDPARSE_RESERVED_SKIP) ) {
+    rt = begin_event_stdparse(pinfo);
     r = pinfo->setup.cb.end_cdata &&
       (pinfo->sel.active || checkflag(pinfo->setup.flags,STDPARSE_ALLNODES)) ? 
       pinfo->setup.cb.end_cdata(user) : PARSER_OK;
-    return r;
+    return r|STOP_RESULT(rt);
   }
   return PARSER_OK;
 }
 
 result_t std_dfault(void *user, const char_t *data, size_t buflen) {
   stdparserinfo_t *pinfo = (stdparserinfo_t *)user;
-  result_t r;
-  if( pinfo ) { 
+  result_t r, rt;
+  if( pinfo && !checkflag(pinfo->reserved,STDPARSE_RESERVED_SKIP) ) {
+    rt = begin_event_stdparse(pinfo);
     r = pinfo->setup.cb.dfault &&
       (pinfo->sel.active || checkflag(pinfo->setup.flags,STDPARSE_ALLNODES)) ? 
       pinfo->setup.cb.dfault(user, data, buflen) : PARSER_OK;
-    return r;
+    return r|STOP_RESULT(rt);
   }
   return PARSER_OK;
 }
 
 result_t std_start_doctypedecl(void *user, const char_t *name, const char_t *sysid, const char_t *pubid, bool_t intsubset) {
   stdparserinfo_t *pinfo = (stdparserinfo_t *)user;
-  result_t r;
+  result_t r, rt;
   if( pinfo ) {
+    rt = begin_event_stdparse(pinfo);
     setflag(&pinfo->reserved,STDPARSE_RESERVED_INTSUBSET);
     r = pinfo->setup.cb.start_doctypedecl ?
       pinfo->setup.cb.start_doctypedecl(user, name, sysid, pubid, intsubset) : PARSER_OK;
-    return r;
+    return r|STOP_RESULT(rt);
   }
   return PARSER_OK;
 }
 
 result_t std_end_doctypedecl(void *user) {
   stdparserinfo_t *pinfo = (stdparserinfo_t *)user;
-  result_t r;
+  result_t r, rt;
   if( pinfo ) {
+    rt = begin_event_stdparse(pinfo);
     clearflag(&pinfo->reserved,STDPARSE_RESERVED_INTSUBSET);
     r = pinfo->setup.cb.end_doctypedecl ?
       pinfo->setup.cb.end_doctypedecl(user) : PARSER_OK;
-    return r;
+    return r|STOP_RESULT(rt);
   }
   return PARSER_OK;
 }
@@ -225,6 +372,8 @@ bool_t reset_stdparserinfo(stdparserinfo_t *pinfo) {
     reset_xpath(&pinfo->cp);
     pinfo->reserved = 0;
     reset_stdselect(&pinfo->sel);
+    pinfo->text.viewlen = 0;
+    pinfo->text.buflen = 0;
     /* don't touch setup structure */
     return TRUE;
   }
@@ -235,6 +384,9 @@ bool_t free_stdparserinfo(stdparserinfo_t *pinfo) {
   if( pinfo ) {
     free_xpath(&pinfo->cp);
     free_stdselect(&pinfo->sel);
+    if( pinfo->text.buf ) {
+      free_mem(&pinfo->text.buf, &pinfo->text.maxbuf);
+    }
     /* zero memory so people don't try to use its (now invalid) contents */
     memset(pinfo, 0, sizeof(stdparserinfo_t));
     return TRUE;
@@ -242,28 +394,33 @@ bool_t free_stdparserinfo(stdparserinfo_t *pinfo) {
   return FALSE;
 }
 
-bool_t stdparse3_create(parser_t *parser, stdparserinfo_t *pinfo) {
+static bool_t setup_stdparse(parser_t *parser, stdparserinfo_t *pinfo) {
   callback_t cb;
+
+  /* force zero memory: prevents bugs when callback_t is extended */
+  memset(&cb, 0, sizeof(callback_t));
+
+  cb.start_tag = std_start_tag; /* always needed */
+  cb.end_tag = std_end_tag; /* always needed */
+
+  cb.chardata = pinfo->setup.cb.chardata ? std_chardata : NULL;
+  cb.pidata = pinfo->setup.cb.pidata ? std_pidata : NULL;
+  cb.comment = pinfo->setup.cb.comment ? std_comment : NULL;
+  cb.start_cdata = pinfo->setup.cb.start_cdata ? std_start_cdata : NULL;
+  cb.end_cdata = pinfo->setup.cb.end_cdata ? std_end_cdata : NULL;
+  cb.start_doctypedecl = pinfo->setup.cb.start_doctypedecl ? std_start_doctypedecl : NULL;
+  cb.end_doctypedecl = pinfo->setup.cb.end_doctypedecl ? std_end_doctypedecl : NULL;
+  cb.entitydecl = pinfo->setup.cb.entitydecl;
+  cb.dfault = pinfo->setup.cb.dfault ? std_dfault : NULL;
+
+  parser->user = pinfo;
+  return setup_parser(parser, &cb);
+}
+
+bool_t stdparse3_create(parser_t *parser, stdparserinfo_t *pinfo) {
   if( pinfo ) {
     if( create_parser(parser, pinfo) ) {
-
-      /* force zero memory: prevents bugs when callback_t is extended */
-      memset(&cb, 0, sizeof(callback_t));
-
-      cb.start_tag = std_start_tag; /* always needed */
-      cb.end_tag = std_end_tag; /* always needed */
-
-      cb.chardata = pinfo->setup.cb.chardata ? std_chardata : NULL;
-      cb.pidata = pinfo->setup.cb.pidata ? std_pidata : NULL;
-      cb.comment = pinfo->setup.cb.comment ? std_comment : NULL;
-      cb.start_cdata = pinfo->setup.cb.start_cdata ? std_start_cdata : NULL;
-      cb.end_cdata = pinfo->setup.cb.end_cdata ? std_end_cdata : NULL;
-      cb.start_doctypedecl = pinfo->setup.cb.start_doctypedecl ? std_start_doctypedecl : NULL;
-      cb.end_doctypedecl = pinfo->setup.cb.end_doctypedecl ? std_end_doctypedecl : NULL;
-      cb.entitydecl = pinfo->setup.cb.entitydecl;
-      cb.dfault = pinfo->setup.cb.dfault ? std_dfault : NULL;
-      
-      return setup_parser(parser, &cb);
+      return setup_stdparse(parser, pinfo);
     }
   }
   return FALSE;
@@ -282,10 +439,377 @@ bool_t stdparse_failed(stdparserinfo_t *pinfo) {
   return (!pinfo || checkflag(pinfo->reserved,STDPARSE_RESERVED_PARSEFAIL));
 }
 
+bool_t tail_stdparse(stdparserinfo_t *pinfo) {
+  if( pinfo && pinfo->setup.tail_fun &&
+      checkflag(pinfo->reserved,STDPARSE_RESERVED_UTF8) ) {
+    setflag(&pinfo->reserved,STDPARSE_RESERVED_TAIL);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t range_stdparse(stdparserinfo_t *pinfo, long *begin, long *end) {
+  return pinfo && range_parser(pinfo->parser, begin, end);
+}
+
+/* raw scan of the contents of a skipped element, which can resume on
+ * the next buffer. Returns the offset in buf of the '<' which starts 
+ * the end tag, -1 if that was the last byte of the previous buffer, 
+ * or buflen if the end tag isn't seen yet.
+ */
+static long scan_skip_stdparse(stdparserinfo_t *pinfo, 
+			       const byte_t *buf, size_t buflen) {
+  const byte_t *p = buf, *e = buf + buflen;
+  int state = pinfo->skip.state;
+  int run = pinfo->skip.run;
+  byte_t c;
+
+  while( p < e ) {
+    c = *p++;
+    switch(state) {
+    case SKIP_TEXT:
+      if( c == '<' ) {
+	state = SKIP_LT;
+      } else if( !(p = memchr(p, '<', e - p)) ) {
+	p = e;
+      }
+      break;
+    case SKIP_LT:
+      run = 0;
+      if( c == '/' ) {
+	if( pinfo->skip.level == 0 ) {
+	  pinfo->skip.state = SKIP_DONE;
+	  return (p - buf) - 2;
+	}
+	pinfo->skip.level--;
+	state = SKIP_TAG;
+      } else if( c == '!' ) {
+	state = SKIP_BANG;
+      } else if( c == '?' ) {
+	state = SKIP_PI;
+      } else {
+	pinfo->skip.level++;
+	pinfo->skip.elements++;
+	state = SKIP_TAG;
+      }
+      break;
+    case SKIP_TAG:
+      if( c == '>' ) {
+	if( run ) { /* empty element */
+	  pinfo->skip.level--;
+	}
+	state = SKIP_TEXT;
+      } else if( (c == '"') || (c == '\'') ) {
+	pinfo->skip.quote = c;
+	state = SKIP_QUOTE;
+      } else {
+	run = (c == '/');
+      }
+      break;
+    case SKIP_QUOTE:
+      if( c == pinfo->skip.quote ) {
+	run = 0;
+	state = SKIP_TAG;
+      }
+      break;
+    case SKIP_BANG:
+      run = 0;
+      state = (c == '-') ? SKIP_COMMENT : (c == '[') ? SKIP_CDATA : SKIP_TAG;
+      break;
+    case SKIP_COMMENT:
+    case SKIP_CDATA:
+      /* ends with --> or ]]> */
+      if( (c == '>') && (run >= 2) ) {
+	state = SKIP_TEXT;
+      } else {
+	run = (c == ((state == SKIP_COMMENT) ? '-' : ']')) ? run + 1 : 0;
+      }
+      break;
+    case SKIP_PI:
+      if( (c == '>') && run ) {
+	state = SKIP_TEXT;
+      } else {
+	run = (c == '?');
+      }
+      break;
+    }
+  }
+  pinfo->skip.state = state;
+  pinfo->skip.run = run;
+  return buflen;
+}
+
+/* the parser sees spaces instead, but the line numbers don't change */
+static void blank_skip_stdparse(byte_t *buf, size_t buflen) {
+  byte_t *e = buf + buflen;
+  for(; buf < e; buf++) {
+    if( *buf != '\n' ) {
+      *buf = ' ';
+    }
+  }
+}
+
+bool_t skip_stdparse(stdparserinfo_t *pinfo) {
+  byte_t *ahead;
+  size_t n;
+  long begin, end, q;
+  if( pinfo && range_stdparse(pinfo, &begin, &end) ) {
+    pinfo->skip.elements = 0;
+    pinfo->skip.bytes = 0;
+    pinfo->skip.begin = end;
+    pinfo->skip.level = 0;
+    pinfo->skip.run = 0;
+
+    ahead = ahead_parser(pinfo->parser, &n);
+    if( !ahead ) {
+      pinfo->skip.state = SKIP_EVENTS;
+    } else if( ahead[-2] == '/' ) {
+      return TRUE; /* empty element, nothing to skip */
+    } else {
+      /* the rest of the current buffer is blanked, and later buffers 
+	 are scanned by next_stdpull() before the parser sees them */
+      pinfo->skip.state = SKIP_TEXT;
+      q = scan_skip_stdparse(pinfo, ahead, n);
+      blank_skip_stdparse(ahead, MIN(n, q));
+    }
+    setflag(&pinfo->reserved,STDPARSE_RESERVED_SKIP);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t skipped_stdparse(stdparserinfo_t *pinfo, long *elements, long *bytes) {
+  if( pinfo && elements && bytes ) {
+    *elements = pinfo->skip.elements;
+    *bytes = pinfo->skip.bytes;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* the parser was aborted at byte offset byteno, buf holds the last
+ * chunk read from strm, and we send everything after byteno */
+static bool_t copy_tail_stdparse(stdparserinfo_t *pinfo, stream_t *strm,
+				 const char *file, const byte_t *buf, 
+				 long byteno) {
+  long off;
+  byte_t *tmp;
+  bool_t ok;
+
+  off = byteno - (strm->bytesread - (long)strm->buflen);
+  if( (off < 0) || (off > (long)strm->buflen) ) {
+    errormsg(E_ERROR, "%s: lost input at byte %ld\n", file, byteno);
+    return FALSE;
+  }
+  ok = pinfo->setup.tail_fun(pinfo, buf + off, strm->buflen - off);
+
+  tmp = (byte_t *)malloc(strm->blksize);
+  if( !tmp ) {
+    errormsg(E_ERROR, "out of memory.\n");
+    return FALSE;
+  }
+  while( ok && !checkflag(cmd,CMD_QUIT) && 
+	 read_stream(strm, tmp, strm->blksize) ) {
+    ok = pinfo->setup.tail_fun(pinfo, tmp, strm->buflen);
+  }
+  free(tmp);
+  return ok;
+}
+
+/* idle parsers, already reset, waiting for the next open_stdpull() */
+static struct {
+  parser_t *list[STDPULL_POOL];
+  int num;
+} pool;
+
+static parser_t *get_parser_stdpull(stdparserinfo_t *pinfo) {
+  parser_t *parser;
+  if( pool.num > 0 ) {
+    parser = pool.list[--pool.num];
+    if( setup_stdparse(parser, pinfo) ) {
+      return parser;
+    }
+    free_parser(parser);
+    free(parser);
+    return NULL;
+  }
+  parser = (parser_t *)malloc(sizeof(parser_t));
+  if( parser && !stdparse3_create(parser, pinfo) ) {
+    free(parser);
+    parser = NULL;
+  }
+  return parser;
+}
+
+static void put_parser_stdpull(parser_t *parser) {
+  if( (pool.num < STDPULL_POOL) && reset_parser(parser) ) {
+    pool.list[pool.num++] = parser;
+  } else {
+    free_parser(parser);
+    free(parser);
+  }
+}
+
+bool_t exit_stdpull(void) {
+  while( pool.num > 0 ) {
+    pool.num--;
+    free_parser(pool.list[pool.num]);
+    free(pool.list[pool.num]);
+  }
+  return TRUE;
+}
+
+bool_t open_stdpull(stdpull_t *sp, stdparserinfo_t *pinfo, const char *file) {
+  if( sp && pinfo && file ) {
+    memset(sp, 0, sizeof(stdpull_t));
+    if( open_file_stream(&sp->strm, file) ) {
+      begin_progress(sp->strm.fd);
+      sp->parser = get_parser_stdpull(pinfo);
+      if( sp->parser ) {
+	sp->pinfo = pinfo;
+	sp->file = file;
+	sp->state = stdpull_nodata;
+	return TRUE;
+      }
+      close_stream(&sp->strm);
+    }
+  }
+  return FALSE;
+}
+
+bool_t close_stdpull(stdpull_t *sp) {
+  if( sp && sp->pinfo ) {
+    if( sp->pinfo->parser == sp->parser ) {
+      sp->pinfo->parser = NULL;
+    }
+    sp->pinfo->batch = 0;
+    put_parser_stdpull(sp->parser);
+    close_stream(&sp->strm);
+    sp->parser = NULL;
+    sp->pinfo = NULL;
+    sp->state = stdpull_done;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* the parser returned early: either suspended by a callback (or the
+   batch count), or finished for good */
+static bool_t halted_stdpull(stdpull_t *sp) {
+  stdparserinfo_t *pinfo = sp->pinfo;
+  parser_t *parser = sp->parser;
+
+  if( suspended_parser(parser) ) {
+    sp->state = stdpull_stopped;
+    return TRUE;
+  }
+  sp->state = stdpull_done;
+  flush_text_stdparse(pinfo);
+
+  if( aborted_parser(parser) &&
+      true_and_clearflag(&pinfo->reserved, STDPARSE_RESERVED_TAIL) ) {
+    copy_tail_stdparse(pinfo, &sp->strm, sp->file, sp->buf, 
+		       parser->cur.byteno);
+  } else if( (pinfo->depth == 0) && (pinfo->maxdepth > 0) ) {
+    /* we're done */
+  } else if( aborted_parser(parser) ) {
+    /* user abort, this is not an error */
+  } else {
+    if( !checkflag(pinfo->setup.flags,STDPARSE_QUIET) ) {
+      errormsg(E_FATAL, 
+	       "%s: %s at line %d, column %d, "
+	       "byte %ld, depth %d\n",
+	       sp->file, error_message_parser(parser),
+	       parser->cur.lineno, parser->cur.colno, 
+	       parser->cur.byteno, pinfo->depth);
+    }
+    setflag(&pinfo->reserved,STDPARSE_RESERVED_PARSEFAIL);
+  }
+  return FALSE;
+}
+
+/* a new block was read while skipping: either the parser never sees
+ * it, or it only sees what follows the skipped element. Returns TRUE 
+ * if the whole block is skipped. The stream is adjusted so that 
+ * copy_tail_stdparse() still works.
+ */
+static bool_t skip_block_stdpull(stdpull_t *sp) {
+  long q;
+  q = scan_skip_stdparse(sp->pinfo, sp->buf, sp->strm.buflen);
+  if( q >= (long)sp->strm.buflen ) {
+    sp->parser->offset += sp->strm.buflen;
+    return TRUE;
+  } else if( q < 0 ) {
+    /* there is room for this, see next_stdpull() */
+    memmove(sp->buf + 1, sp->buf, sp->strm.buflen);
+    sp->buf[0] = '<';
+  } else if( q > 0 ) {
+    memmove(sp->buf, sp->buf + q, sp->strm.buflen - q);
+  }
+  sp->strm.buflen -= q;
+  sp->parser->offset += q;
+  return FALSE;
+}
+
+bool_t next_stdpull(stdpull_t *sp, size_t batch) {
+  stdparserinfo_t *pinfo;
+  parser_t *parser;
+  if( sp && sp->pinfo ) {
+    pinfo = sp->pinfo;
+    parser = sp->parser;
+    pinfo->parser = parser;
+    pinfo->batch = batch;
+    if( !checkflag(sp->flags, STDPULL_DETACHED) ) {
+      inputfile = sp->file;
+    }
+
+    while( !checkflag(cmd,CMD_QUIT) ) {
+      switch(sp->state) {
+      case stdpull_nodata:
+	keep_text_stdparse(pinfo);
+	/* one spare byte for skip_block_stdpull() */
+	sp->buf = getbuf_parser(parser, sp->strm.blksize + 1);
+	if( !sp->buf || !read_stream(&sp->strm, sp->buf, sp->strm.blksize) ) {
+	  flush_text_stdparse(pinfo);
+	  sp->state = stdpull_done;
+	  return FALSE;
+	}
+	if( sp->strm.bytesread == (long)sp->strm.buflen ) {
+	  /* first block, the raw tail can only be copied if it's UTF-8 */
+	  flipflag(&pinfo->reserved, STDPARSE_RESERVED_UTF8,
+		   utf8_prefix_parser(sp->buf, sp->strm.buflen));
+	}
+	if( SKIPPING(pinfo) && skip_block_stdpull(sp) ) {
+	  break;
+	}
+	sp->state = stdpull_ready;
+	break;
+      case stdpull_ready:
+	if( !do_parser(parser, sp->strm.buflen) ) {
+	  return halted_stdpull(sp);
+	}
+	sp->state = stdpull_nodata;
+	break;
+      case stdpull_stopped:
+	restart_parser(parser);
+	if( !audit_parser(parser) ) {
+	  return halted_stdpull(sp);
+	}
+	sp->state = stdpull_nodata;
+	break;
+      case stdpull_done:
+	return FALSE;
+      }
+    }
+    flush_text_stdparse(pinfo);
+    sp->state = stdpull_done;
+  }
+  return FALSE;
+}
+
 bool_t stdparse2(int n, cstringlst_t files, cstringlst_t *xpaths,
 		 stdparserinfo_t *pinfo) {
-  parser_t parser;
-  stream_t strm;
+  stdpull_t sp;
   cstringlst_t xp;
   int f;
 
@@ -293,67 +817,37 @@ bool_t stdparse2(int n, cstringlst_t files, cstringlst_t *xpaths,
 
     if( reset_stdparserinfo(pinfo) ) {
 
-      if( stdparse3_create(&parser, pinfo) ) {
+      for(f = 0; (f < n) && !checkflag(cmd,CMD_QUIT); f++) {
 
-	for(f = 0; (f < n) && !checkflag(cmd,CMD_QUIT); f++) {
+	inputfile = files[f];
+	xp = xpaths ? xpaths[f] : NULL;
+	setup_xpaths_stdselect(&pinfo->sel, xp);
 
-	  inputfile = files[f];
-	  xp = xpaths ? xpaths[f] : NULL;
-	  setup_xpaths_stdselect(&pinfo->sel, xp);
-
-	  if( pinfo->setup.start_file_fun ) {
-	    if( !pinfo->setup.start_file_fun(pinfo, files[f], xp) ) {
-	      continue;
-	    }
+	if( pinfo->setup.start_file_fun ) {
+	  if( !pinfo->setup.start_file_fun(pinfo, files[f], xp) ) {
+	    continue;
 	  }
+	}
 
-	  if( inputfile && open_file_stream(&strm, inputfile) ) {
-
-	    while( !checkflag(cmd,CMD_QUIT) && 
-		   read_stream(&strm, getbuf_parser(&parser, strm.blksize), 
-			       strm.blksize) ) {
-
-	      if( !do_parser(&parser, strm.buflen) ) {
-
-		if( (pinfo->depth == 0) && (pinfo->maxdepth > 0) ) {
-		  /* we're done */
-		  break;
-		} 
-		if( aborted_parser(&parser) ) {
-		  /* user abort, this is not an error */
-		  break;
-		}
-		if( !checkflag(pinfo->setup.flags,STDPARSE_QUIET) ) {
-		  errormsg(E_FATAL, 
-			   "%s: %s at line %d, column %d, "
-			   "byte %ld, depth %d\n",
-			   inputfile, error_message_parser(&parser),
-			   parser.cur.lineno, parser.cur.colno, 
-			   parser.cur.byteno, pinfo->depth);
-		}
-
-		setflag(&pinfo->reserved,STDPARSE_RESERVED_PARSEFAIL);
-		break;
-	      }
-
-	    }
-
-	    close_stream(&strm);
+	if( inputfile && open_stdpull(&sp, pinfo, inputfile) ) {
+	  /* a PARSER_STOP from a callback merely pauses the parser */
+	  while( next_stdpull(&sp, 0) ) {
+	    /* nothing */
 	  }
+	  close_stdpull(&sp);
+	}
 
-	  if( pinfo->setup.end_file_fun ) {
-	    if( !pinfo->setup.end_file_fun(pinfo, files[f], xp) ) {
-	      break;
-	    }
+	if( pinfo->setup.end_file_fun ) {
+	  if( !pinfo->setup.end_file_fun(pinfo, files[f], xp) ) {
+	    break;
 	  }
-
-	  inputfile = NULL;
-	  reset_parser(&parser);
-	  reset_stdparserinfo(pinfo);
 	}
 
-	stdparse3_free(&parser, pinfo);
+	inputfile = NULL;
+	reset_stdparserinfo(pinfo);
       }
+
+      exit_stdpull();
       return TRUE;
     }
   }
@@ -26,6 +26,7 @@
 #endif
 
 #include "parser.h"
+#include "io.h"
 #include "xpath.h"
 #include "stdselect.h"
 
@@ -41,6 +42,14 @@
 #define STDPARSE_MIN1FILE          0x08 /* at least 1 input file needed */
 #define STDPARSE_ALWAYS_CHARDATA   0x10 /* chardata fun even when empty */
 #define STDPARSE_QUIET             0x20 /* if parsing error, no errormsg */
+#define STDPARSE_COALESCE_CHARDATA 0x40 /* one chardata call per text run */
+
+/* With STDPARSE_COALESCE_CHARDATA, the chardata callback is delayed
+   until the next event, and gets the whole text between two events in
+   one call (stdparse2() only). Longer text runs are passed in pieces of 
+   about this size. A PARSER_STOP or PARSER_ABORT from the callback 
+   takes effect after that next event. */
+#define STDPARSE_COALESCE_MAX      65536
 
 
 #define STDPARSE_RESERVED_NEWLINE   0x01
@@ -48,9 +57,13 @@
 #define STDPARSE_RESERVED_CHARDATA  0x04
 #define STDPARSE_RESERVED_INTSUBSET 0x08
 #define STDPARSE_RESERVED_PARSEFAIL 0x10
+#define STDPARSE_RESERVED_TAIL      0x20
+#define STDPARSE_RESERVED_SKIP      0x40
+#define STDPARSE_RESERVED_UTF8      0x80
 
 typedef bool_t (xml_start_file_fun)(void *user, const char_t *file, cstringlst_t xpaths);
 typedef bool_t (xml_end_file_fun)(void *user, const char_t *file, cstringlst_t xpaths);
+typedef bool_t (xml_tail_fun)(void *user, const byte_t *buf, size_t buflen);
 
 /* this structure is used for standard bookkeeping by stdparse.
    When calling stdparse, you should create your own pinfo structure
@@ -79,11 +92,27 @@ typedef struct {
   xpath_t cp; /* current path */
   flag_t reserved; /* not for users */
   stdselect_t sel; /* user selection (XPath) */
+  parser_t *parser; /* not for users, see range_stdparse() */
+  size_t batch; /* not for users, events left, see next_stdpull() */
+  struct {
+    const char_t *view; /* last fragment, still in the parser's buffer */
+    size_t viewlen;
+    char_t *buf; /* earlier fragments */
+    size_t buflen, maxbuf;
+  } text; /* not for users, see STDPARSE_COALESCE_CHARDATA */
+  struct {
+    int state, run; /* raw scanner, see skip_stdparse() */
+    char_t quote;
+    unsigned int level; /* open elements inside the skipped one */
+    long elements; /* descendant elements seen so far */
+    long begin, bytes; /* offset and length of the contents */
+  } skip; /* not for users, see skip_stdparse() */
   struct {
     flag_t flags; /* set some flags, or 0 if no flags wanted */
     callback_t cb; /* fill this with your callbacks */
     xml_start_file_fun *start_file_fun; /* ret false skips file */
     xml_end_file_fun *end_file_fun; /* ret false ends parsing */
+    xml_tail_fun *tail_fun; /* gets the raw input after tail_stdparse() */
   } setup;
 } stdparserinfo_t;
 
@@ -102,11 +131,74 @@ bool_t stdparse(int index, char **argv, stdparserinfo_t *pinfo);
  */
 bool_t stdparse2(int n, cstringlst_t files, cstringlst_t *xpaths,
 		 stdparserinfo_t *pinfo);
-/* stdparse3: create/destroy parser objects used internally by stdparse2 */
+/* stdparse3: create/destroy parser objects used internally by stdpull_t */
 bool_t stdparse3_create(parser_t *parser, stdparserinfo_t *pinfo);
 bool_t stdparse3_free(parser_t *parser, stdparserinfo_t *pinfo);
 
 
 bool_t stdparse_failed(stdparserinfo_t *pinfo);
 
+/* call this from a callback which returns PARSER_ABORT: the rest of the
+ * current file, starting just after the current event, is passed 
+ * unparsed to setup.tail_fun. Use it in end tag callbacks only, since
+ * for empty tags (<a/>) the start tag event also covers the end tag.
+ * Returns FALSE, and the parse goes on, if the file isn't UTF-8.
+ */
+bool_t tail_stdparse(stdparserinfo_t *pinfo);
+
+/* call this from a callback: gets the byte offsets [begin, end) of the
+ * current event in the input file. This is meaningless for chardata
+ * if STDPARSE_COALESCE_CHARDATA is set.
+ */
+bool_t range_stdparse(stdparserinfo_t *pinfo, long *begin, long *end);
+
+/* call this from a start tag callback: the contents of the current
+ * element are passed over by a raw scanner which only counts tags, and
+ * no events are reported until its end tag, which is reported as usual.
+ * The skipped input is not checked for well formedness. In the end tag
+ * callback, skipped_stdparse() gets the number of descendant elements
+ * and the number of bytes between the start and end tags.
+ */
+bool_t skip_stdparse(stdparserinfo_t *pinfo);
+bool_t skipped_stdparse(stdparserinfo_t *pinfo, long *elements, long *bytes);
+
+/* The stdpull_t is the pull style interface underneath stdparse2(): it
+ * parses a single file a little at a time, so that a program can keep
+ * several documents open and interleave them. After open_stdpull(), 
+ * each call to next_stdpull() runs the pinfo callbacks until one of 
+ * them returns PARSER_STOP, or until batch events have been seen 
+ * (0 means no limit), and returns TRUE if it can be called again. 
+ * It returns FALSE at the end of the file, or after a PARSER_ABORT or 
+ * a parse error (see stdparse_failed()). Every stdpull_t needs its 
+ * own stdparserinfo_t, and the xpaths must be set with 
+ * setup_xpaths_stdselect() beforehand.
+ *
+ * Parsers are recycled: close_stdpull() resets the parser and keeps
+ * it for the next open_stdpull(), and exit_stdpull() frees them all.
+ *
+ * Normally next_stdpull() points the global inputfile at its file.
+ * With STDPULL_DETACHED it leaves globals alone, so that it can run
+ * on a worker thread (open and close must still be called from one
+ * thread only, because of the parser pool).
+ */
+#define STDPULL_POOL 16
+
+#define STDPULL_DETACHED 0x01
+
+typedef struct {
+  enum {stdpull_nodata = 0, stdpull_ready, 
+	stdpull_stopped, stdpull_done} state;
+  stdparserinfo_t *pinfo;
+  parser_t *parser;
+  stream_t strm;
+  byte_t *buf; /* last buffer read from strm */
+  const char *file;
+  flag_t flags;
+} stdpull_t;
+
+bool_t open_stdpull(stdpull_t *sp, stdparserinfo_t *pinfo, const char *file);
+bool_t next_stdpull(stdpull_t *sp, size_t batch);
+bool_t close_stdpull(stdpull_t *sp);
+bool_t exit_stdpull(void);
+
 #endif
@@ -47,9 +47,7 @@ bool_t stdprint_start_tag(stdparserinfo_t *sp,
       putc_stdout('\n');
     }
 
-    nputc_stdout('\t', sp->depth - 1);
-    write_start_tag_stdout(name, att, FALSE);
-    putc_stdout('\n');
+    write_start_tag_line_stdout(sp->depth - 1, name, att);
 
     return TRUE;
   }
@@ -63,9 +61,7 @@ bool_t stdprint_end_tag(stdparserinfo_t *sp, const char_t *name) {
       putc_stdout('\n');
     }
 
-    nputc_stdout('\t', sp->depth - 1);
-    write_end_tag_stdout(name);
-    putc_stdout('\n');
+    write_end_tag_line_stdout(sp->depth - 1, name);
 
     return TRUE;
   }
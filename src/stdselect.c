@@ -194,3 +194,7 @@ bool_t activate_attribute_stdselect(stdselect_t *sel, int depth, const xpath_t *
   return FALSE;
 }
 
+/* attributes which no xpath can select need no path work */
+bool_t wanted_attribute_stdselect(const stdselect_t *sel, const char_t *name) {
+  return sel ? wanted_xattributelist(&sel->atts, name) : FALSE;
+}
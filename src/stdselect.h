@@ -55,5 +55,6 @@ bool_t activate_tag_stdselect(stdselect_t *sel, int depth, const xpath_t *xpath,
 bool_t activate_stringval_stdselect(stdselect_t *sel, int depth, const xpath_t *xpath);
 bool_t activate_node_stdselect(stdselect_t *sel, int depth, const xpath_t *xpath);
 bool_t activate_attribute_stdselect(stdselect_t *sel, int depth, const xpath_t *xpath, const char_t *name);
+bool_t wanted_attribute_stdselect(const stdselect_t *sel, const char_t *name);
 
 #endif
@@ -17,29 +17,24 @@
  * 
  * Author:   Laird Breyer <laird@lbreyer.com>
  */
-
 #include "symbols.h"
 #include "mem.h"
 #include "myerror.h"
 
 #include <string.h>
 
-/* used by jumptable */
+/* the jump table maps string hashes to positions in bigs. A zero id
+   marks an empty slot, so hashes are never zero. */
 
 #define FILLEDP(a) ((a)->id)
-#define EQUALP(a,b) ((a)==(b))
-#define SET(a,b) (a = (b))
-
-#define SETMARK(a) ((a)->mark = (unsigned int)1)
-#define UNSETMARK(a) ((a)->mark = (unsigned int)0)
-#define MARKEDP(a) ((a)->mark == (unsigned int)1)
-
 
 bool_t create_jumptable(jumptable_t *jt) {
   if( jt ) {
     jt->num = 0;
-    create_mem(&jt->hash, &jt->maxnum, sizeof(jump_t), 16);
-    return TRUE;
+    if( create_mem(&jt->hash, &jt->maxnum, sizeof(jump_t), 16) ) {
+      memset(jt->hash, 0, jt->maxnum * sizeof(jump_t));
+      return TRUE;
+    }
   }
   return FALSE;
 }
@@ -53,95 +48,49 @@ bool_t free_jumptable(jumptable_t *jt) {
   return FALSE;
 }
 
-jump_t *find_in_jumptable(jumptable_t *jt, size_t id) {
-  register jump_t *i, *loop;
-  /* start at id */
-  i = loop = &jt->hash[id % jt->maxnum];
-
-  while( FILLEDP(i) ) {
-    if( EQUALP(i->id,id) ) {
-      return i; /* found id */
-    } else {
-      i++; /* not found */
-      /* wrap around */
-      i = (i >= &jt->hash[jt->maxnum]) ? jt->hash : i; 
-      if( i == loop ) {
-	return NULL; /* when hash table is full */
-      }
-    }
-  }
-
-  /* empty slot, so not found */
-
-  return i; 
-}
-
-
 bool_t grow_jumptable(jumptable_t *jt) {
-  jump_t *i, *temp_item;
-  size_t oldsize;
-  int c;
+  jump_t *old, *i;
+  size_t oldsize, c;
   if( jt ) {
+    old = jt->hash;
     oldsize = jt->maxnum;
-    if( grow_mem(&jt->hash, &jt->maxnum, sizeof(jump_t), 16) ) {
-
-      memset(&jt->hash[oldsize], 0, (jt->maxnum - oldsize) * sizeof(jump_t));
-      
-      /* now mark every used slot */
-      for(c = 0; c < oldsize; c++) {
-	if( FILLEDP(&jt->hash[c]) ) {
-	  SETMARK(&jt->hash[c]);
-	}
-      }
-
-      /* now relocate each marked slot and clear it */
-      for(c = 0; c < oldsize; c++) {
-	while( MARKEDP(&jt->hash[c]) ) {
-	  /* find where it belongs */
-	  i = &jt->hash[jt->hash[c].id % jt->maxnum];
-	  while( FILLEDP(i) && !MARKEDP(i) ) {
-	    i++;
-	    i = (i > &jt->hash[jt->maxnum]) ? jt->hash : i;
-	  } /* guaranteed to exit since hash is larger than original */
-
-	  /* clear the mark - this must happen after we look for i,
-	   since it should be possible to find i == jt->hash[c] */
-	  UNSETMARK(&jt->hash[c]); 
-
-	  /* now refile */
-	  if( i != &jt->hash[c] ) {
-	    if( MARKEDP(i) ) {
-	      /* swap */
-	      memcpy(temp_item, i, sizeof(jump_t));
-	      memcpy(i, &jt->hash[c], sizeof(jump_t));
-	      memcpy(&jt->hash[c], temp_item, sizeof(jump_t));
-	    } else {
-	      /* copy and clear */
-	      memcpy(i, &jt->hash[c], sizeof(jump_t));
-	      memset(&jt->hash[c], 0, sizeof(jump_t));
-	    }
-	  } 
-	  /* now &jt->hash[c] is marked iff there was a swap */
+    jt->hash = NULL;
+    jt->maxnum = 0;
+    if( !create_mem(&jt->hash, &jt->maxnum, sizeof(jump_t), 2 * oldsize) ) {
+      jt->hash = old;
+      jt->maxnum = oldsize;
+      return FALSE;
+    }
+    memset(jt->hash, 0, jt->maxnum * sizeof(jump_t));
+    for(c = 0; c < oldsize; c++) {
+      if( FILLEDP(&old[c]) ) {
+	i = &jt->hash[old[c].id % jt->maxnum];
+	while( FILLEDP(i) ) {
+	  i = (i + 1 < &jt->hash[jt->maxnum]) ? i + 1 : jt->hash;
 	}
+	*i = old[c];
       }
     }
+    free(old);
+    return TRUE;
   }
   return FALSE;
 }
 
 bool_t insert_jumptable(jumptable_t *jt, unsigned int id, size_t pos) {
   jump_t *i;
-  if( jt ) {
-    if( (100 * jt->num < 95 * jt->maxnum) || grow_jumptable(jt) ) {
-      i = find_in_jumptable(jt, id);
-      if( !FILLEDP(i) ) {
-	i->id = id;
-	i->pos = pos;
-	jt->num++;
-	return TRUE;
+  if( jt && id ) {
+    if( (100 * (jt->num + 1) < 75 * jt->maxnum) || grow_jumptable(jt) ) {
+      i = &jt->hash[id % jt->maxnum];
+      while( FILLEDP(i) ) {
+	i = (i + 1 < &jt->hash[jt->maxnum]) ? i + 1 : jt->hash;
       }
+      i->id = id;
+      i->pos = pos;
+      jt->num++;
+      return TRUE;
     }
-   }
+  }
   return FALSE;
 }
 
@@ -166,20 +115,30 @@ bool_t free_symbols(symbols_t *sb) {
   return FALSE;
 }
 
-symbol_t next_symbols(symbols_t *sb, bool_t generate,
-			    const char_t *begin, const char_t *end) {
-  byte_t *p;
-  if( sb && generate && (begin <= end) ) {
-    p = memccpy(sb->bigs + sb->bigs_len, begin, 0, end - begin);
-    if( p ) { *p++ = 0; }
+static unsigned int hash_symbols(const char_t *begin, size_t len) {
+  return (hash((unsigned char *)begin, len, 0) % 0x7fffffffU) + 1;
+}
 
-    sb->bigs_len = p - sb->bigs;
-    sb->last++;
-    memcpy(p, &sb->last, sizeof(symbol_t));
-    sb->bigs_len += sizeof(symbol_t);
-    return sb->last;
+/* each string is stored null terminated, followed by its symbol value */
+static symbol_t next_symbols(symbols_t *sb, unsigned int h,
+			     const char_t *begin, size_t len) {
+  size_t need = sb->bigs_len + len + 1 + sizeof(symbol_t);
+  while( need > sb->bigmax ) {
+    if( !grow_mem(&sb->bigs, &sb->bigmax, sizeof(byte_t), 64) ) {
+      errormsg(E_WARNING, "out of symbol memory\n");
+      return -1;
+    }
   }
-  return -1;
+  if( !insert_jumptable(&sb->jt, h, sb->bigs_len) ) {
+    errormsg(E_WARNING, "out of symbol memory\n");
+    return -1;
+  }
+  memcpy(sb->bigs + sb->bigs_len, begin, len);
+  sb->bigs[sb->bigs_len + len] = 0;
+  sb->last++;
+  memcpy(sb->bigs + sb->bigs_len + len + 1, &sb->last, sizeof(symbol_t));
+  sb->bigs_len = need;
+  return sb->last;
 }
 
 /* returns -1 on failure, >= 0 is an actual symbol value. String is
@@ -189,72 +148,27 @@ symbol_t next_symbols(symbols_t *sb, bool_t generate,
 symbol_t getvalue_symbols(symbols_t *sb, bool_t generate,
 			  const char_t *begin, const char_t *end) {
   const byte_t *p;
-  bool_t bdone, pdone;
+  const char_t *q;
+  unsigned int h;
+  size_t len;
   jump_t *j;
-
-  if( sb && begin && *begin ) {
-    if( !end ) {
-      end = begin + strlen(begin);
-    }
-    
-    if( (sb->bigs_len + (end - begin) + 1 + sizeof(symbol_t)) > sb->bigmax ) {
-      if( !grow_mem(&sb->bigs, &sb->bigmax, sizeof(byte_t), 16) ) {
-	errormsg(E_WARNING, "out of symbol memory\n");
-	return -1;
+  symbol_t s;
+
+  if( sb && begin && *begin && sb->jt.hash ) {
+    for(q = begin; (!end || (q < end)) && *q; q++);
+    len = q - begin;
+    h = hash_symbols(begin, len);
+    j = &sb->jt.hash[h % sb->jt.maxnum];
+    while( FILLEDP(j) ) {
+      p = sb->bigs + j->pos;
+      if( (j->id == h) && (memcmp(p, begin, len) == 0) && (p[len] == 0) ) {
+	memcpy(&s, p + len + 1, sizeof(symbol_t));
+	return s;
       }
+      j = (j + 1 < &sb->jt.hash[sb->jt.maxnum]) ? j + 1 : sb->jt.hash;
     }
-    
-    if( sb->bigs_len == 0 ) {
-      return next_symbols(sb, generate, begin, end);
-    }
-
-    p = sb->bigs;
-    while( *begin && (begin < end) ) {
-
-      /* skip common prefix */
-      while( (*begin == *p) && *begin && (begin < end) ) {
-	p++;
-	begin++;
-      }
-
-      bdone = ((begin == end) || (*begin == 0));
-      pdone = (*p == 0);
-
-      /* either begin string is empty, or p string is empty, or both */
-      if( bdone && pdone ) {
-
-	/* we found the string */
-	return *((symbol_t *)p);
-
-      } else if( bdone ) { /* a longer p string was inserted first */
-
-	/* follow as many branches as possible */
-	j = find_in_jumptable(&sb->jt, p - sb->bigs);
-	while( j && sb->bigs[j->pos] ) {
-	  p = sb->bigs + j->pos;
-	  j = find_in_jumptable(&sb->jt, p - sb->bigs);
-	}
-
-	if( j && (sb->bigs[j->pos] == 0) ) { /* found the string */
-	  p = sb->bigs + j->pos;
-	  return *((symbol_t *)p);
-	} else { /* there are no further branches at p */
-	  insert_jumptable(&sb->jt, p - sb->bigs, sb->bigs_len);
-	  return next_symbols(sb, generate, begin, end);
-	}	  
-
-      } else { /* 0 != *begin != *p */
-
-	j = find_in_jumptable(&sb->jt, p - sb->bigs);
-	if( !j ) { /* no branch at p, so we append begin */
-	  insert_jumptable(&sb->jt, p - sb->bigs, sb->bigs_len);
-	  return next_symbols(sb, generate, begin, end);
-	}
-
-	/* in here, branch exists */
-	p = sb->bigs + j->pos;
-      }
-      /* and back to while */
+    if( generate ) {
+      return next_symbols(sb, h, begin, len);
     }
   }
   return -1;
@@ -39,9 +39,9 @@ typedef struct {
 
 /* This class builds a list of (immutable) strings which can be
  * searched quickly.  When a string is found, the position in the list
- * identifies it uniquely.  The strings are stored in a trie for fast
- * retrieval. In case the input strings have common prefixes, this is
- * also more memory efficient.
+ * identifies it uniquely.  The strings are found through a hash table
+ * of their positions, and symbol values are handed out in order, 
+ * starting at zero.
  */
 typedef struct {
   byte_t *bigs;
@@ -25,6 +25,7 @@
 #include "stdout.h"
 #include "entities.h"
 #include "io.h"
+#include "stats.h"
 
 #include <string.h>
 #include <sys/types.h>
@@ -317,6 +318,8 @@ bool_t flush_file_tempcollect(tempcollect_t *tc) {
 	}
 	n += w;
       }
+      STATS_ADD(spills, 1);
+      STATS_ADD(bytesspilled, tc->bufpos);
       tc->bufpos = 0;
     }
   }
@@ -28,6 +28,11 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <time.h>
+#include <stdio.h>
+#include <fcntl.h>
+#if defined HAVE_MEMFD_CREATE
+#include <sys/mman.h>
+#endif
 
 extern volatile flag_t cmd;
 
@@ -94,7 +99,8 @@ int open_tempfile(char *template) {
   if( fd != -1 ) {
     busy = 1; /* possible compiler reordering? */
     if( busy ) {
-      add_unique_stringlist(&tempfiles, template, STRINGLIST_STRDUP);
+      /* mkstemp() names are unique, no need to search the list */
+      add_stringlist(&tempfiles, template, STRINGLIST_STRDUP);
     }
     busy = 0;
   }
@@ -114,16 +120,47 @@ bool_t remove_tempfile(const char *template) {
   return r;
 }
 
+/* an anonymous file in memory, which needs no cleanup. The name
+ * can be opened like a regular file, while this process keeps fd open.
+ * Commands we run never see fd, so the name is only good for us.
+ */
+int open_memfd_tempfile(char **name, const char *basename) {
+  int fd = -1;
+#if defined HAVE_MEMFD_CREATE
+  cstring_t cs;
+  char buf[32];
+  fd = memfd_create(basename, MFD_CLOEXEC);
+  if( fd != -1 ) {
+    sprintf(buf, "/proc/self/fd/%d", fd);
+    if( access(buf, R_OK) == 0 ) {
+      create_cstring(&cs, buf, sizeof(buf));
+      *name = p_cstring(&cs);
+    } else {
+      close(fd); /* no /proc */
+      fd = -1;
+    }
+  }
+#endif
+  return fd;
+}
+
 int save_stdin_tempfile(char **tempfile, pid_t *child_pid, const char *progname) {
   int fd;
+  int dupfd;
   pid_t pid;
   stream_t strm;
   byte_t *buf;
   clock_t c;
 
   if( tempfile && child_pid ) {
-    *tempfile = make_template_tempfile(progname);
-    fd = open_tempfile(*tempfile);
+    fd = open_memfd_tempfile(tempfile, progname);
+    if( fd == -1 ) {
+      *tempfile = make_template_tempfile(progname);
+      fd = open_tempfile(*tempfile);
+      if( fd != -1 ) {
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+      }
+    }
     pid = fork();
     if( pid == -1 ) {
       /* failed */
@@ -161,7 +198,11 @@ int save_stdin_tempfile(char **tempfile, pid_t *child_pid, const char *progname)
     }
     /* parent: reads fd and should unlink it */
     *child_pid = pid;
-    return dup(fd);
+    dupfd = dup(fd);
+    if( dupfd != -1 ) {
+      fcntl(dupfd, F_SETFD, FD_CLOEXEC);
+    }
+    return dupfd;
   }
   return -1;
 }
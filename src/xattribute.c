@@ -76,6 +76,8 @@ bool_t compile_xattribute(xattribute_t *xa, const char_t *path) {
 bool_t create_xattributelist(xattributelist_t *xal) {
   if( xal ) {
     xal->num = 0;
+    xal->natts = 0;
+    xal->wild = FALSE;
     return create_mem(&xal->list, &xal->max, sizeof(xattribute_t), 4);
   }
   return FALSE;
@@ -98,12 +100,15 @@ bool_t reset_xattributelist(xattributelist_t *xal) {
       free_xattribute(&xal->list[i]);
     }
     xal->num = 0;
+    xal->natts = 0;
+    xal->wild = FALSE;
     return TRUE;
   }
   return FALSE;
 }
 
 bool_t add_xattributelist(xattributelist_t *xpl, const char_t *xpath) {
+  xattribute_t *xa;
   if( xpl ) {
     if( xpl->num >= xpl->max ) {
       grow_mem(&xpl->list, &xpl->max, sizeof(xattribute_t), 4);
@@ -111,6 +116,11 @@ bool_t add_xattributelist(xattributelist_t *xpl, const char_t *xpath) {
     if( xpl->num < xpl->max ) {
       if( create_xattribute(&xpl->list[xpl->num]) &&
 	  compile_xattribute(&xpl->list[xpl->num], xpath) ) {
+	xa = &xpl->list[xpl->num];
+	if( xa->begin ) {
+	  xpl->natts++;
+	  xpl->wild |= (strncmp(xa->begin, "@*", xa->end - xa->begin) == 0);
+	}
 	xpl->num++;
 	return TRUE;
       }
@@ -155,6 +165,9 @@ bool_t update_xattributelist(xattributelist_t *xal, const char_t **att) {
   int i, j;
   xattribute_t *xa;
   if( xal && att ) {
+    if( xal->natts == 0 ) {
+      return TRUE;
+    }
     for(i = 0; i < xal->num; i++) {
       xa = &xal->list[i];
       if( xa->begin ) {
@@ -171,3 +184,20 @@ bool_t update_xattributelist(xattributelist_t *xal, const char_t **att) {
   return FALSE;
 }
 
+/* true if some path could ever select an attribute with this name.
+ * Everything else can skip the attribute path work entirely.
+ */
+bool_t wanted_xattributelist(const xattributelist_t *xal, const char_t *name) {
+  int i;
+  if( xal && name && (xal->natts > 0) ) {
+    if( xal->wild ) {
+      return TRUE;
+    }
+    for(i = 0; i < xal->num; i++) {
+      if( match_xattribute(&xal->list[i], name) ) {
+	return TRUE;
+      }
+    }
+  }
+  return FALSE;
+}
@@ -42,6 +42,8 @@ typedef struct {
   xattribute_t *list;
   int num;
   size_t max;
+  int natts; /* number of paths with an attribute step */
+  bool_t wild; /* some path ends in @* */
 } xattributelist_t;
 
 bool_t create_xattributelist(xattributelist_t *xal);
@@ -53,5 +55,6 @@ xattribute_t *get_xattributelist(const xattributelist_t *xal, int n);
 bool_t compile_xattributelist(xattributelist_t *xal, cstringlst_t lst);
 bool_t check_xattributelist(const xattributelist_t *xal, const char_t *xpath, const char_t *name);
 bool_t update_xattributelist(xattributelist_t *xal, const char_t **att);
+bool_t wanted_xattributelist(const xattributelist_t *xal, const char_t *name);
 
 #endif
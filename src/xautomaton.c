@@ -0,0 +1,420 @@
+/* 
+ * Copyright (C) 2006 Laird Breyer
+ *  
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA.
+ * 
+ * Author:   Laird Breyer <laird@lbreyer.com>
+ */
+
+#include "common.h"
+#include "mem.h"
+#include "myerror.h"
+#include "xautomaton.h"
+#include "xpath.h"
+#include "entities.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+extern const char_t escc;
+extern const char_t xpath_delims[];
+extern const char_t xpath_specials[];
+
+#define XA_EMPTY  (-1)
+
+bool_t ensure_mem_xautomaton(void *pptr, size_t *nmemb, size_t size, size_t n) {
+  while( *nmemb < n ) {
+    if( !grow_mem(pptr, nmemb, size, MAX(n, 16)) ) {
+      errormsg(E_ERROR, "out of memory for xpath automaton\n");
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+bool_t create_xautomaton(xautomaton_t *xa) {
+  if( xa ) {
+    memset(xa, 0, sizeof(xautomaton_t));
+    xa->dirty = TRUE;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* forget the DFA, but not the patterns */
+bool_t clear_dfa_xautomaton(xautomaton_t *xa) {
+  size_t i;
+  if( xa ) {
+    for(i = 0; i < xa->maxtrans; i++) {
+      if( xa->trans[i].name ) {
+	free(xa->trans[i].name);
+      }
+      xa->trans[i].name = NULL;
+      xa->trans[i].from = XA_EMPTY;
+    }
+    for(i = 0; i < xa->maxdfatab; i++) {
+      xa->dfatab[i] = XA_EMPTY;
+    }
+    xa->ntrans = 0;
+    xa->ndfa = 0;
+    xa->nnfa = 0;
+    xa->ndone = 0;
+    xa->dirty = TRUE;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t reset_xautomaton(xautomaton_t *xa) {
+  if( xa ) {
+    xa->nsteps = 0;
+    xa->npatterns = 0;
+    return clear_dfa_xautomaton(xa);
+  }
+  return FALSE;
+}
+
+bool_t free_xautomaton(xautomaton_t *xa) {
+  if( xa ) {
+    clear_dfa_xautomaton(xa);
+    free_mem(&xa->steps, &xa->maxsteps);
+    free_mem(&xa->patterns, &xa->maxpatterns);
+    free_mem(&xa->dfa, &xa->maxdfa);
+    free_mem(&xa->nfa, &xa->maxnfa);
+    free_mem(&xa->done, &xa->maxdone);
+    free_mem(&xa->dfatab, &xa->maxdfatab);
+    free_mem(&xa->trans, &xa->maxtrans);
+    free_mem(&xa->nxt, &xa->maxnxt);
+    free_mem(&xa->ndn, &xa->maxndn);
+    free_mem(&xa->seen, &xa->maxseen);
+    free_mem(&xa->stack, &xa->maxstack);
+    memset(xa, 0, sizeof(xautomaton_t));
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* compile one step, ie "/name", "//name" or "/ *" followed by optional
+ * attributes and predicates. Returns the end of the step or NULL. */
+const char_t *compile_step_xautomaton(xautomaton_t *xa, const char_t *p) {
+  const char_t *q, *r;
+  xastep_t *st;
+  if( xa && p && (*p == *xpath_delims) ) {
+    if( !ensure_mem_xautomaton(&xa->steps, &xa->maxsteps,
+			       sizeof(xastep_t), xa->nsteps + 1) ) {
+      return NULL;
+    }
+    st = &xa->steps[xa->nsteps];
+    st->flags = 0;
+    st->pattern = xa->npatterns;
+
+    p++;
+    if( *p == *xpath_delims ) {
+      setflag(&st->flags, XASTEP_DESCENDANT);
+      p++;
+    }
+
+    q = skip_unescaped_delimiters(p, NULL, xpath_specials, '\0');
+    if( (q == p) || xml_isdigit(*p) ) {
+      return NULL; /* empty name or node type label */
+    }
+    for(r = p; r < q; r++) {
+      if( (*r == escc) || ((*r == '*') && (q - p > 1)) ) {
+	return NULL; /* escapes and partial names not supported */
+      }
+    }
+    st->name = p;
+    st->len = q - p;
+    if( *p == '*' ) {
+      setflag(&st->flags, XASTEP_ANY);
+    }
+
+    q = skip_attributes_predicates(q, NULL);
+    if( *q && (*q != *xpath_delims) ) {
+      return NULL;
+    }
+
+    xa->nsteps++;
+    return q;
+  }
+  return NULL;
+}
+
+bool_t add_xautomaton(xautomaton_t *xa, const char_t *xpath, int user) {
+  const char_t *p;
+  xapattern_t *pat;
+  size_t first;
+  if( xa && xpath && (*xpath == *xpath_delims) && xpath[1] ) {
+    first = xa->nsteps;
+    for(p = xpath; p && *p; p = compile_step_xautomaton(xa, p));
+    if( !p || (xa->nsteps == first) ||
+	!ensure_mem_xautomaton(&xa->patterns, &xa->maxpatterns,
+			       sizeof(xapattern_t), xa->npatterns + 1) ) {
+      xa->nsteps = first;
+      return FALSE;
+    }
+    pat = &xa->patterns[xa->npatterns++];
+    pat->first = first;
+    pat->num = xa->nsteps - first;
+    pat->user = user;
+    xa->dirty = TRUE;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+int cmp_int_xautomaton(const void *a, const void *b) {
+  return *(const int *)a - *(const int *)b;
+}
+
+unsigned long int hash_dfa_xautomaton(const int *s, size_t ns,
+				      const int *d, size_t nd) {
+  unsigned long int h;
+  h = hash((unsigned char *)s, ns * sizeof(int), nd);
+  return hash((unsigned char *)d, nd * sizeof(int), h);
+}
+
+bool_t equal_dfa_xautomaton(xautomaton_t *xa, const xadfa_t *x,
+			    const int *s, size_t ns, const int *d, size_t nd) {
+  return ( (x->end - x->begin == ns) && (x->dend - x->dbegin == nd) &&
+	   (memcmp(xa->nfa + x->begin, s, ns * sizeof(int)) == 0) &&
+	   (memcmp(xa->done + x->dbegin, d, nd * sizeof(int)) == 0) );
+}
+
+bool_t grow_dfatab_xautomaton(xautomaton_t *xa) {
+  size_t i, j, m;
+  m = (xa->maxdfatab > 0) ? 2 * xa->maxdfatab : 64;
+  free_mem(&xa->dfatab, &xa->maxdfatab);
+  if( !create_mem(&xa->dfatab, &xa->maxdfatab, sizeof(int), m) ) {
+    return FALSE;
+  }
+  for(i = 0; i < xa->maxdfatab; i++) {
+    xa->dfatab[i] = XA_EMPTY;
+  }
+  for(i = 0; i < xa->ndfa; i++) {
+    j = xa->dfa[i].h & (xa->maxdfatab - 1);
+    while( xa->dfatab[j] != XA_EMPTY ) {
+      j = (j + 1) & (xa->maxdfatab - 1);
+    }
+    xa->dfatab[j] = i;
+  }
+  return TRUE;
+}
+
+/* find or create the DFA state with given (sorted) steps and matches */
+int intern_dfa_xautomaton(xautomaton_t *xa, int *s, size_t ns,
+			  int *d, size_t nd) {
+  unsigned long int h;
+  xadfa_t *x;
+  size_t j;
+
+  qsort(s, ns, sizeof(int), cmp_int_xautomaton);
+  qsort(d, nd, sizeof(int), cmp_int_xautomaton);
+  h = hash_dfa_xautomaton(s, ns, d, nd);
+
+  if( (2 * (xa->ndfa + 1) > xa->maxdfatab) &&
+      !grow_dfatab_xautomaton(xa) ) {
+    return XA_EMPTY;
+  }
+
+  j = h & (xa->maxdfatab - 1);
+  while( xa->dfatab[j] != XA_EMPTY ) {
+    x = &xa->dfa[xa->dfatab[j]];
+    if( (x->h == h) && equal_dfa_xautomaton(xa, x, s, ns, d, nd) ) {
+      return xa->dfatab[j];
+    }
+    j = (j + 1) & (xa->maxdfatab - 1);
+  }
+
+  if( !ensure_mem_xautomaton(&xa->dfa, &xa->maxdfa,
+			     sizeof(xadfa_t), xa->ndfa + 1) ||
+      !ensure_mem_xautomaton(&xa->nfa, &xa->maxnfa,
+			     sizeof(int), xa->nnfa + ns) ||
+      !ensure_mem_xautomaton(&xa->done, &xa->maxdone,
+			     sizeof(int), xa->ndone + nd) ) {
+    return XA_EMPTY;
+  }
+
+  x = &xa->dfa[xa->ndfa];
+  x->h = h;
+  x->begin = xa->nnfa;
+  x->end = x->begin + ns;
+  x->dbegin = xa->ndone;
+  x->dend = x->dbegin + nd;
+  memcpy(xa->nfa + x->begin, s, ns * sizeof(int));
+  memcpy(xa->done + x->dbegin, d, nd * sizeof(int));
+  xa->nnfa += ns;
+  xa->ndone += nd;
+
+  xa->dfatab[j] = xa->ndfa;
+  return xa->ndfa++;
+}
+
+/* the initial state contains the first step of every pattern */
+bool_t rebuild_xautomaton(xautomaton_t *xa) {
+  size_t i;
+  if( xa ) {
+    clear_dfa_xautomaton(xa);
+    if( !ensure_mem_xautomaton(&xa->nxt, &xa->maxnxt,
+			       sizeof(int), xa->nsteps + 1) ||
+	!ensure_mem_xautomaton(&xa->ndn, &xa->maxndn,
+			       sizeof(int), xa->npatterns + 1) ||
+	!ensure_mem_xautomaton(&xa->seen, &xa->maxseen,
+			       sizeof(unsigned long int), xa->nsteps + 1) ||
+	!ensure_mem_xautomaton(&xa->stack, &xa->maxstack,
+			       sizeof(int), 16) ) {
+      return FALSE;
+    }
+    memset(xa->seen, 0, xa->maxseen * sizeof(unsigned long int));
+    xa->stamp = 0;
+    for(i = 0; i < xa->npatterns; i++) {
+      xa->nxt[i] = xa->patterns[i].first;
+    }
+    xa->stack[0] = intern_dfa_xautomaton(xa, xa->nxt, xa->npatterns,
+					 xa->ndn, 0);
+    xa->dirty = (xa->stack[0] == XA_EMPTY);
+    return !xa->dirty;
+  }
+  return FALSE;
+}
+
+bool_t match_step_xautomaton(const xastep_t *st, const char_t *name, size_t len) {
+  return checkflag(st->flags, XASTEP_ANY) ||
+    ((st->len == len) && (strncmp(st->name, name, len) == 0));
+}
+
+/* compute the DFA state reached from state "from" after opening
+ * a tag called name. This is only done once for each transition. */
+int step_xautomaton(xautomaton_t *xa, int from, const char_t *name, size_t len) {
+  const xapattern_t *pat;
+  const xastep_t *st;
+  size_t ns, nd;
+  int i, s, begin, end;
+
+  ns = nd = 0;
+  xa->stamp++;
+  begin = xa->dfa[from].begin;
+  end = xa->dfa[from].end;
+  for(i = begin; i < end; i++) {
+    s = xa->nfa[i];
+    st = &xa->steps[s];
+    if( checkflag(st->flags, XASTEP_DESCENDANT) &&
+	(xa->seen[s] != xa->stamp) ) {
+      xa->seen[s] = xa->stamp;
+      xa->nxt[ns++] = s;
+    }
+    if( match_step_xautomaton(st, name, len) ) {
+      pat = &xa->patterns[st->pattern];
+      if( s + 1 == pat->first + pat->num ) {
+	xa->ndn[nd++] = pat->user;
+      } else if( xa->seen[s + 1] != xa->stamp ) {
+	xa->seen[s + 1] = xa->stamp;
+	xa->nxt[ns++] = s + 1;
+      }
+    }
+  }
+  return intern_dfa_xautomaton(xa, xa->nxt, ns, xa->ndn, nd);
+}
+
+bool_t grow_trans_xautomaton(xautomaton_t *xa) {
+  xatrans_t *old;
+  size_t i, j, m, oldmax;
+  old = xa->trans;
+  oldmax = xa->maxtrans;
+  m = (oldmax > 0) ? 2 * oldmax : 64;
+  if( !create_mem(&xa->trans, &xa->maxtrans, sizeof(xatrans_t), m) ) {
+    xa->trans = old;
+    xa->maxtrans = oldmax;
+    return FALSE;
+  }
+  for(i = 0; i < xa->maxtrans; i++) {
+    xa->trans[i].from = XA_EMPTY;
+    xa->trans[i].name = NULL;
+  }
+  for(i = 0; i < oldmax; i++) {
+    if( old[i].from != XA_EMPTY ) {
+      j = old[i].h & (xa->maxtrans - 1);
+      while( xa->trans[j].from != XA_EMPTY ) {
+	j = (j + 1) & (xa->maxtrans - 1);
+      }
+      xa->trans[j] = old[i];
+    }
+  }
+  if( old ) {
+    free(old);
+  }
+  return TRUE;
+}
+
+bool_t push_tag_xautomaton(xautomaton_t *xa, unsigned int depth, const char_t *name) {
+  unsigned long int h;
+  xatrans_t *t;
+  size_t j, len;
+  int from, to;
+  if( xa && name && (depth > 0) ) {
+    if( xa->dirty && !rebuild_xautomaton(xa) ) {
+      return FALSE;
+    }
+    if( !ensure_mem_xautomaton(&xa->stack, &xa->maxstack,
+			       sizeof(int), depth + 1) ) {
+      return FALSE;
+    }
+
+    from = xa->stack[depth - 1];
+    len = strlen(name);
+    h = hash((unsigned char *)name, len, from);
+
+    if( (2 * (xa->ntrans + 1) > xa->maxtrans) &&
+	!grow_trans_xautomaton(xa) ) {
+      return FALSE;
+    }
+    j = h & (xa->maxtrans - 1);
+    while( xa->trans[j].from != XA_EMPTY ) {
+      t = &xa->trans[j];
+      if( (t->h == h) && (t->from == from) && (strcmp(t->name, name) == 0) ) {
+	xa->stack[depth] = t->to;
+	return TRUE;
+      }
+      j = (j + 1) & (xa->maxtrans - 1);
+    }
+
+    to = step_xautomaton(xa, from, name, len);
+    if( to == XA_EMPTY ) {
+      return FALSE;
+    }
+    t = &xa->trans[j];
+    t->from = from;
+    t->to = to;
+    t->h = h;
+    t->name = dup_string(name, name + len);
+    xa->ntrans++;
+
+    xa->stack[depth] = to;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t get_done_xautomaton(xautomaton_t *xa, unsigned int depth,
+			   const int **begin, const int **end) {
+  const xadfa_t *x;
+  if( xa && begin && end && !xa->dirty && (depth < xa->maxstack) ) {
+    x = &xa->dfa[xa->stack[depth]];
+    *begin = xa->done + x->dbegin;
+    *end = xa->done + x->dend;
+    return TRUE;
+  }
+  return FALSE;
+}
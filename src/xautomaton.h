@@ -0,0 +1,117 @@
+/* 
+ * Copyright (C) 2006 Laird Breyer
+ *  
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA.
+ * 
+ * Author:   Laird Breyer <laird@lbreyer.com>
+ */
+
+#ifndef XAUTOMATON_H
+#define XAUTOMATON_H
+
+#include "common.h"
+
+/* An xautomaton_t matches many xpath patterns at once against the
+ * current path of a document, one tag at a time.
+ *
+ * Each pattern is compiled into a list of steps (tag names, '*' or
+ * '//name'). Attributes and predicates are ignored, just like
+ * match_no_att_no_pred_xpath(), so the caller must still check those.
+ * The automaton is a lazily built DFA: every (state, tagname) transition
+ * is computed once from the underlying pattern steps, and then cached.
+ * The caller keeps one DFA state per depth, so closing a tag is free, and
+ * opening a tag costs a single hash lookup once the document structure
+ * has been seen.
+ *
+ * Patterns which cannot be compiled (relative paths, escaped characters,
+ * partial names like "na*", etc.) are rejected, and must be matched
+ * the old fashioned way.
+ */
+
+#define XASTEP_ANY         0x01 /* matches any tag name */
+#define XASTEP_DESCENDANT  0x02 /* preceded by // */
+
+typedef struct {
+  const char_t *name; /* not null terminated */
+  size_t len;
+  flag_t flags;
+  int pattern;
+} xastep_t;
+
+typedef struct {
+  int first; /* index of first step */
+  int num; /* number of steps */
+  int user; /* reported when the pattern matches */
+} xapattern_t;
+
+typedef struct {
+  int begin, end; /* active steps are nfa[begin..end) */
+  int dbegin, dend; /* matched user ids are done[dbegin..dend) */
+  unsigned long int h;
+} xadfa_t;
+
+typedef struct {
+  int from, to;
+  char_t *name;
+  unsigned long int h;
+} xatrans_t;
+
+typedef struct {
+  xastep_t *steps;
+  size_t nsteps, maxsteps;
+  xapattern_t *patterns;
+  size_t npatterns, maxpatterns;
+
+  /* lazily built DFA */
+  xadfa_t *dfa;
+  size_t ndfa, maxdfa;
+  int *nfa;
+  size_t nnfa, maxnfa;
+  int *done;
+  size_t ndone, maxdone;
+  int *dfatab; /* open addressing, indices into dfa */
+  size_t maxdfatab;
+  xatrans_t *trans; /* open addressing */
+  size_t ntrans, maxtrans;
+
+  /* scratch space */
+  int *nxt;
+  size_t maxnxt;
+  int *ndn;
+  size_t maxndn;
+  unsigned long int *seen;
+  size_t maxseen;
+  unsigned long int stamp;
+
+  /* one DFA state per depth */
+  int *stack;
+  size_t maxstack;
+  bool_t dirty;
+} xautomaton_t;
+
+bool_t create_xautomaton(xautomaton_t *xa);
+bool_t free_xautomaton(xautomaton_t *xa);
+bool_t reset_xautomaton(xautomaton_t *xa);
+
+/* returns FALSE if the pattern cannot be compiled */
+bool_t add_xautomaton(xautomaton_t *xa, const char_t *xpath, int user);
+
+/* call after the tag at depth (>= 1) is opened */
+bool_t push_tag_xautomaton(xautomaton_t *xa, unsigned int depth, const char_t *name);
+/* user ids of the patterns which exactly match the path up to depth */
+bool_t get_done_xautomaton(xautomaton_t *xa, unsigned int depth,
+			   const int **begin, const int **end);
+
+#endif
@@ -20,11 +20,16 @@
 
 #include "common.h"
 #include "stdparse.h"
-#include "tempvar.h"
 #include "io.h"
+#include "myerror.h"
+#include "stdout.h"
+#include "mem.h"
+#include "mysignal.h"
 #include "awkvm.h"
+#include "stats.h"
 
 #include <string.h>
+#include <ctype.h>
 #include <getopt.h>
 
 /* for option processing */
@@ -36,34 +41,182 @@ extern char *inputfile;
 extern long inputline;
 
 extern volatile flag_t cmd;
+extern const char_t xpath_delims[];
 
 #include <stdio.h>
 
+/* Each record is an XML node: the outermost nodes selected by the
+ * XPATHs, or the children of the root element if there are none. The
+ * record's text is collected as the document streams by, and the
+ * program is run once the node is closed, so memory use only depends
+ * on the size of a single record.
+ */
 typedef struct {
   stdparserinfo_t std; /* must be first */
   flag_t flags;
 
   awkvm_t vm;
-
-  cstringlst_t files;
-  cstringlst_t *xpaths;
-  int n;
-
+  cstringlst_t assignments;
+  int nassignments;
+
+  unsigned int recdepth; /* 0 until the first selected node */
+  unsigned int depth; /* of the current record, 0 if none */
+  char_t *text;
+  size_t textlen, maxtext;
+  char_t *path;
+  size_t maxpath;
+  char_t *attbuf; /* name\0value\0name\0value\0... */
+  size_t attlen, maxattbuf;
+  const char_t **att;
+  size_t maxatt;
 } parserinfo_awk_t;
 
 #define AWK_VERSION    0x01
 #define AWK_HELP       0x02
-#define AWK_DEBUG      0x03
-#define AWK_SCRIPT     0x04
+
+#define AWK_SCRIPT     0x01
 
 #define AWK_USAGE \
 "Usage: xml-awk [OPTION]... SCRIPT [[FILE]... [:XPATH]...]...\n" \
+"Run the awk SCRIPT once for each selected node in the FILE(s).\n" \
 "\n" \
-"\n" \
+"  -f PROGFILE    read the script from PROGFILE\n" \
+"  -F FS          set the field separator FS\n" \
+"  -v VAR=VALUE   assign VALUE to VAR before the script starts\n" \
+"      --stats[=json]  print resource statistics on exit\n" \
+"      --progress[=N]  report progress on stderr every N seconds\n" \
 "      --help     display this help and exit\n" \
 "      --version  display version information and exit\n"
 
+static bool_t append_text(char_t **buf, size_t *len, size_t *max,
+			  const char_t *s, size_t n) {
+  while( *len + n + 1 > *max ) {
+    if( !grow_mem(buf, max, sizeof(char_t), 256) ) {
+      errormsg(E_FATAL, "out of memory.\n");
+    }
+  }
+  memcpy(*buf + *len, s, n);
+  *len += n;
+  (*buf)[*len] = '\0';
+  return TRUE;
+}
+
+/* text in different elements is kept apart, so that fields can be split */
+static void separate_text(parserinfo_awk_t *pinfo) {
+  if( (pinfo->textlen > 0) && 
+      !isspace((unsigned char)pinfo->text[pinfo->textlen - 1]) ) {
+    append_text(&pinfo->text, &pinfo->textlen, &pinfo->maxtext, " ", 1);
+  }
+}
+
+static void open_record(parserinfo_awk_t *pinfo, const char_t **att) {
+  const char_t *path;
+  size_t n = 0;
+  pinfo->depth = pinfo->std.depth;
+  pinfo->textlen = 0;
+  pinfo->attlen = 0;
+  path = string_xpath(&pinfo->std.cp);
+  append_text(&pinfo->path, &n, &pinfo->maxpath, path, strlen(path));
+  for( ; att && att[0]; att += 2) {
+    append_text(&pinfo->attbuf, &pinfo->attlen, &pinfo->maxattbuf, 
+		att[0], strlen(att[0]) + 1);
+    append_text(&pinfo->attbuf, &pinfo->attlen, &pinfo->maxattbuf, 
+		att[1], strlen(att[1]) + 1);
+  }
+}
+
+static bool_t close_record(parserinfo_awk_t *pinfo) {
+  static char_t empty[] = "";
+  const char_t *p, *end;
+  char_t *b, *e;
+  size_t n = 0;
+
+  for(p = pinfo->attbuf, end = p + pinfo->attlen; p < end; 
+      p += strlen(p) + 1) {
+    if( n + 1 >= pinfo->maxatt ) {
+      if( !grow_mem(&pinfo->att, &pinfo->maxatt, sizeof(char_t *), 8) ) {
+	errormsg(E_FATAL, "out of memory.\n");
+      }
+    }
+    pinfo->att[n++] = p;
+  }
+  if( pinfo->att ) {
+    pinfo->att[n] = NULL;
+  }
+
+  b = pinfo->text;
+  e = b + pinfo->textlen;
+  if( b ) {
+    while( (b < e) && isspace((unsigned char)*b) ) {
+      b++;
+    }
+    while( (e > b) && isspace((unsigned char)e[-1]) ) {
+      e--;
+    }
+    *e = '\0';
+  } else {
+    b = e = empty;
+  }
+  pinfo->depth = 0;
+  return record_awkvm(&pinfo->vm, b, e - b, pinfo->path, 
+		      (n > 0) ? pinfo->att : NULL);
+}
+
+result_t start_tag(void *user, const char_t *name, const char_t **att) {
+  parserinfo_awk_t *pinfo = (parserinfo_awk_t *)user;
+  if( pinfo ) {
+    if( pinfo->depth > 0 ) {
+      separate_text(pinfo);
+    } else if( pinfo->std.depth >= pinfo->recdepth ) {
+      if( (pinfo->recdepth == 0) || (pinfo->std.depth == pinfo->recdepth) ) {
+	open_record(pinfo, att);
+      }
+    }
+  }
+  return PARSER_OK;
+}
+
+result_t end_tag(void *user, const char_t *name) {
+  parserinfo_awk_t *pinfo = (parserinfo_awk_t *)user;
+  if( pinfo && (pinfo->depth > 0) ) {
+    if( pinfo->std.depth == pinfo->depth ) {
+      if( !close_record(pinfo) || checkflag(cmd,CMD_QUIT) ) {
+	return PARSER_ABORT;
+      }
+    } else {
+      separate_text(pinfo);
+    }
+  }
+  return PARSER_OK;
+}
+
+result_t chardata(void *user, const char_t *buf, size_t buflen) {
+  parserinfo_awk_t *pinfo = (parserinfo_awk_t *)user;
+  if( pinfo && (pinfo->depth > 0) ) {
+    append_text(&pinfo->text, &pinfo->textlen, &pinfo->maxtext, buf, buflen);
+  }
+  return PARSER_OK;
+}
 
+bool_t start_file_fun(void *user, const char_t *file, const char_t **xpaths) {
+  parserinfo_awk_t *pinfo = (parserinfo_awk_t *)user;
+  if( pinfo ) {
+    pinfo->depth = 0;
+    /* filelist.c passes xpath_delims when no xpaths were given */
+    pinfo->recdepth = 
+      (xpaths && xpaths[0] && (xpaths[0] != xpath_delims)) ? 0 : 2;
+    return file_awkvm(&pinfo->vm, file);
+  }
+  return FALSE;
+}
+
+bool_t end_file_fun(void *user, const char_t *file, const char_t **xpaths) {
+  parserinfo_awk_t *pinfo = (parserinfo_awk_t *)user;
+  if( pinfo ) {
+    return !checkflag(pinfo->vm.flags,AWKVM_EXIT) && !checkflag(cmd,CMD_QUIT);
+  }
+  return FALSE;
+}
 
 bool_t create_parserinfo_awk(parserinfo_awk_t *pinfo) {
   bool_t ok = TRUE;
@@ -72,10 +225,14 @@ bool_t create_parserinfo_awk(parserinfo_awk_t *pinfo) {
     memset(pinfo, 0, sizeof(parserinfo_awk_t));
     ok &= create_stdparserinfo(&pinfo->std);
 
+    pinfo->std.setup.flags = STDPARSE_MIN1FILE|STDPARSE_COALESCE_CHARDATA;
+    pinfo->std.setup.cb.start_tag = start_tag;
+    pinfo->std.setup.cb.end_tag = end_tag;
+    pinfo->std.setup.cb.chardata = chardata;
+    pinfo->std.setup.start_file_fun = start_file_fun;
+    pinfo->std.setup.end_file_fun = end_file_fun;
     pinfo->flags = 0;
 
-    pinfo->std.setup.flags = 0;
-
     ok &= create_awkvm(&pinfo->vm);
 
     return ok;
@@ -87,16 +244,23 @@ bool_t free_parserinfo_awk(parserinfo_awk_t *pinfo) {
   if( pinfo ) {
     free_stdparserinfo(&pinfo->std);
     free_awkvm(&pinfo->vm);
+    free_mem(&pinfo->text, &pinfo->maxtext);
+    free_mem(&pinfo->path, &pinfo->maxpath);
+    free_mem(&pinfo->attbuf, &pinfo->maxattbuf);
+    free_mem(&pinfo->att, &pinfo->maxatt);
+    if( pinfo->assignments ) {
+      free(pinfo->assignments);
+    }
   }
   return FALSE;
 }
 
-
 bool_t compile_string_script(parserinfo_awk_t *pinfo, const char_t *filename,
 			  const char_t *begin, const char_t *end) {
   if( pinfo && begin && end ) {
     inputfile = (char *)filename;
-    inputline = 0;
+    inputline = 1;
+    setflag(&pinfo->flags, AWK_SCRIPT);
     return parse_string_awkvm(&pinfo->vm, begin, end);
   }
   return FALSE;
@@ -106,13 +270,32 @@ bool_t compile_file_script(parserinfo_awk_t *pinfo, const char *file) {
   bool_t retval = FALSE;
   if( pinfo && file ) {
     inputfile = (char *)file;
-    inputline = 0;
+    inputline = 1;
+    setflag(&pinfo->flags, AWK_SCRIPT);
     retval = parse_file_awkvm(&pinfo->vm, file);
   }
   return retval;
 }
 
+/* assignments must wait until the program is compiled */
+static void add_assignment(parserinfo_awk_t *pinfo, char *assignment) {
+  cstringlst_t a;
+  if( !strchr(assignment, '=') ) {
+    errormsg(E_FATAL, "bad assignment %s, expected VAR=VALUE\n", assignment);
+  }
+  a = (cstringlst_t)realloc((void *)pinfo->assignments, 
+			    (pinfo->nassignments + 2) * sizeof(char *));
+  if( !a ) {
+    errormsg(E_FATAL, "out of memory.\n");
+  }
+  a[pinfo->nassignments++] = assignment;
+  a[pinfo->nassignments] = NULL;
+  pinfo->assignments = a;
+}
+
 void set_option_awk(int op, char *optarg, parserinfo_awk_t *pinfo) {
+  static char fs[] = "FS=";
+  char *a;
   switch(op) {
   case AWK_VERSION:
     puts("xml-awk" COPYBLURB);
@@ -122,9 +305,29 @@ void set_option_awk(int op, char *optarg, parserinfo_awk_t *pinfo) {
     puts(AWK_USAGE);
     exit(EXIT_SUCCESS);
     break;
+  case STATS_OPTION:
+    set_stats(optarg);
+    break;
+  case PROGRESS_OPTION:
+    set_progress(optarg);
+    break;
   case 'f':
     compile_file_script(pinfo, optarg);
     break;
+  case 'v':
+    add_assignment(pinfo, optarg);
+    break;
+  case 'F':
+    a = (char *)malloc(strlen(fs) + strlen(optarg) + 1);
+    if( !a ) {
+      errormsg(E_FATAL, "out of memory.\n");
+    }
+    strcpy(a, fs);
+    strcat(a, (strcmp(optarg, "t") == 0) ? "\t" : optarg);
+    add_assignment(pinfo, a);
+    break;
+  default:
+    break;
   }
 }
 
@@ -132,10 +335,14 @@ int main(int argc, char **argv) {
   signed char op;
   parserinfo_awk_t pinfo;
   char_t *script = NULL;
+  int exitcode = EXIT_SUCCESS;
+  int i;
 
   struct option longopts[] = {
     { "version", 0, NULL, AWK_VERSION },
     { "help", 0, NULL, AWK_HELP },
+    { "stats", 2, NULL, STATS_OPTION },
+    { "progress", 2, NULL, PROGRESS_OPTION },
     { 0 }
   };
 
@@ -145,7 +352,7 @@ int main(int argc, char **argv) {
 
   if( create_parserinfo_awk(&pinfo) ) {
 
-    while( (op = getopt_long(argc, argv, "f:",
+    while( (op = getopt_long(argc, argv, "f:F:v:",
 			     longopts, NULL)) > -1 ) {
       set_option_awk(op, optarg, &pinfo);
     }
@@ -159,16 +366,29 @@ int main(int argc, char **argv) {
       compile_string_script(&pinfo, "ARGV", script, script + strlen(script));
       optind++;
     }
+    compile_awkvm(&pinfo.vm);
+    for(i = 0; i < pinfo.nassignments; i++) {
+      assign_awkvm(&pinfo.vm, pinfo.assignments[i]);
+    }
+    inputfile = "";
+    inputline = 0;
 
+    init_signal_handling(SIGNALS_DEFAULT);
     init_file_handling();
 
-    stdparse(MAXFILES, argv + optind, (stdparserinfo_t *)&pinfo);
+    open_stdout();
+    if( begin_awkvm(&pinfo.vm) && needinput_awkvm(&pinfo.vm) ) {
+      stdparse(MAXFILES, argv + optind, (stdparserinfo_t *)&pinfo);
+    }
+    end_awkvm(&pinfo.vm);
+    close_stdout();
 
     exit_file_handling();
+    exit_signal_handling();
 
+    exitcode = pinfo.vm.exitcode;
     free_parserinfo_awk(&pinfo);
   }
 
-
-  return EXIT_SUCCESS;
+  return exitcode;
 }
@@ -27,6 +27,7 @@
 #include "filelist.h"
 #include "mysignal.h"
 #include "mem.h"
+#include "stats.h"
 
 #include <string.h>
 #include <getopt.h>
@@ -83,6 +84,8 @@ typedef struct {
 "Concatenate the XML contents of FILE(s), or standard input,\n" \
 "into a single well formed XML document on standard output.\n" \
 "\n" \
+"      --stats[=json]  print resource statistics on exit\n" \
+"      --progress[=N]  report progress on stderr every N seconds\n" \
 "      --help     display this help and exit\n" \
 "      --version  display version information and exit\n"
 
@@ -96,6 +99,12 @@ void set_option_cat(int op, char *optarg) {
     puts(CAT_USAGE);
     exit(EXIT_SUCCESS);
     break;
+  case STATS_OPTION:
+    set_stats(optarg);
+    break;
+  case PROGRESS_OPTION:
+    set_progress(optarg);
+    break;
   }
 }
 
@@ -276,6 +285,8 @@ int main(int argc, char **argv) {
   struct option longopts[] = {
     { "version", 0, NULL, CAT_VERSION },
     { "help", 0, NULL, CAT_HELP },
+    { "stats", 2, NULL, STATS_OPTION },
+    { "progress", 2, NULL, PROGRESS_OPTION },
     { 0 }
   };
 
@@ -318,6 +329,8 @@ int main(int argc, char **argv) {
 
 	if( inputfile && open_file_stream(&strm, inputfile) ) {
 
+	  begin_progress(strm.fd);
+
 	  pinfo.xdf = xna;
 	  pinfo.ctype = plaintext;
 	  while( !checkflag(cmd,CMD_QUIT) && 
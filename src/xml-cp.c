@@ -30,8 +30,10 @@
 #include "tempcollect.h"
 #include "filelist.h"
 #include "rcm.h"
+#include "rollback.h"
 #include "tempfile.h"
 #include "mysignal.h"
+#include "stats.h"
 
 #include <string.h>
 #include <getopt.h>
@@ -59,6 +61,8 @@ typedef struct {
   rcm_t rcm;
   tempcollect_t sav;
   flag_t flags;
+  int targets;
+  int jobs;
 } parserinfo_cp_t;
 
 #define CP_VERSION    0x01
@@ -68,12 +72,21 @@ typedef struct {
 #define CP_REPLACE    0x05
 #define CP_APPEND     0x06
 #define CP_MULTI      0x07
+#define CP_DURABLE    0x08
+#define CP_STATS      0x09
+#define CP_TARGETS    0x0a
+#define CP_JOBS       'j'
 #define CP_USAGE \
 "Usage: xml-cp [OPTION]... [[FILE]... [:XPATH]...]... TARGET [:XPATH]...\n" \
 "Reformat each node in FILE(s), or standard input.\n" \
 "\n" \
 "      --help     display this help and exit\n" \
-"      --version  display version information and exit\n"
+"      --version  display version information and exit\n" \
+"      --durability=LEVEL  with --write-files, none, batch or strict\n" \
+"      --stats[=json]  print file commit and resource statistics on exit\n" \
+"      --progress[=N]  report progress on stderr every N seconds\n" \
+"      --targets=N  the last N files are targets (needs --write-files)\n" \
+"  -j, --jobs=N   update N targets at a time\n"
 
 #define CP_FLAG_TARGET   0x01
 
@@ -91,6 +104,30 @@ void set_option_cp(int op, char *optarg, parserinfo_cp_t *pinfo) {
   case CP_FILES:
     setflag(&pinfo->rcm.flags, RCM_WRITE_FILES);
     break;
+  case CP_DURABLE:
+    if( !set_durability_with_rollback(optarg) ) {
+      errormsg(E_FATAL, "unknown durability %s (try --help).\n", optarg);
+    }
+    break;
+  case CP_STATS:
+    set_stats(optarg);
+    set_stats_report(print_stats_with_rollback);
+    break;
+  case PROGRESS_OPTION:
+    set_progress(optarg);
+    break;
+  case CP_TARGETS:
+    pinfo->targets = atoi(optarg);
+    if( pinfo->targets < 1 ) {
+      errormsg(E_FATAL, "bad number of targets %s\n", optarg);
+    }
+    break;
+  case CP_JOBS:
+    pinfo->jobs = atoi(optarg);
+    if( pinfo->jobs < 1 ) {
+      errormsg(E_FATAL, "bad number of jobs %s\n", optarg);
+    }
+    break;
   case CP_PREPEND:
     setflag(&pinfo->rcm.flags, RCM_CP_PREPEND);
     break;
@@ -144,6 +181,12 @@ result_t end_tag(void *user, const char_t *name) {
 
       cp_end_tag_rcm(&pinfo->rcm, &pinfo->std, name);
 
+      if( checkflag(pinfo->rcm.flags,RCM_CP_TAIL) &&
+	  tail_stdparse(&pinfo->std) ) {
+	/* copy the rest of the target without parsing it */
+	return PARSER_ABORT;
+      }
+
       if( (pinfo->std.depth == 1) &&
 	  !checkflag(pinfo->rcm.flags,RCM_CP_OKINSERT) ) {
 	if( !checkflag(pinfo->rcm.flags,RCM_CP_MULTI) ) {
@@ -201,6 +244,10 @@ result_t dfault(void *user, const char_t *data, size_t buflen) {
 }
 
 
+bool_t tail_fun(void *user, const byte_t *buf, size_t buflen) {
+  return write_stdout(buf, buflen);
+}
+
 bool_t create_parserinfo_cp(parserinfo_cp_t *pinfo) {
 
   bool_t ok = TRUE;
@@ -218,7 +265,11 @@ bool_t create_parserinfo_cp(parserinfo_cp_t *pinfo) {
       pinfo->std.setup.cb.chardata = chardata;
       pinfo->std.setup.cb.dfault = dfault;
 
+      pinfo->std.setup.tail_fun = tail_fun;
+
       pinfo->flags = 0;
+      pinfo->targets = 1;
+      pinfo->jobs = 1;
 
     }
     return ok;
@@ -281,6 +332,7 @@ int main(int argc, char **argv) {
   signed char op;
   parserinfo_cp_t pinfo;
   filelist_t fl;
+  bool_t ok = TRUE;
 
   struct option longopts[] = {
     { "version", 0, NULL, CP_VERSION },
@@ -290,6 +342,11 @@ int main(int argc, char **argv) {
     { "replace", 0, NULL, CP_REPLACE },
     { "append", 0, NULL, CP_APPEND },
     { "multi", 0, NULL, CP_MULTI },
+    { "durability", 1, NULL, CP_DURABLE },
+    { "stats", 2, NULL, CP_STATS },
+    { "progress", 2, NULL, PROGRESS_OPTION },
+    { "targets", 1, NULL, CP_TARGETS },
+    { "jobs", 1, NULL, CP_JOBS },
     { 0 }
   };
 
@@ -299,7 +356,7 @@ int main(int argc, char **argv) {
 
   if( create_parserinfo_cp(&pinfo) ) {
 
-    while( (op = getopt_long(argc, argv, "",
+    while( (op = getopt_long(argc, argv, "j:",
 			     longopts, NULL)) > -1 ) {
       set_option_cp(op, optarg, &pinfo);
     }
@@ -315,27 +372,40 @@ int main(int argc, char **argv) {
       pinfo.xpaths = getxpaths_filelist(&fl);
       pinfo.n = getsize_filelist(&fl);
     
-      if( pinfo.n < 2 ) { 
+      if( pinfo.n < pinfo.targets + 1 ) { 
 	errormsg(E_FATAL, "no target specified (try --help).\n");
       }
+      if( (pinfo.targets > 1) && 
+	  !checkflag(pinfo.rcm.flags, RCM_WRITE_FILES) ) {
+	errormsg(E_FATAL, "too many targets (try --write-files).\n");
+      }
 
       init_signal_handling(SIGNALS_DEFAULT);
       init_file_handling();
       init_tempfile_handling();
+      init_rollback_handling();
 
-      if( stdparse2(pinfo.n - 1, pinfo.files, pinfo.xpaths, &pinfo.std) ) {
+      if( stdparse2(pinfo.n - pinfo.targets, pinfo.files, pinfo.xpaths, 
+		    &pinfo.std) ) {
 
 	if( reinit_parserinfo_cp(&pinfo) ) {
 	  /* output always to stdout */
 	  setflag(&pinfo.rcm.flags, RCM_CP_OUTPUT);
 
-	  stdparse2(1, &pinfo.files[pinfo.n - 1], 
-		    &pinfo.xpaths[pinfo.n - 1], &pinfo.std);
+	  if( !checkflag(pinfo.rcm.flags, RCM_CP_PAYLOAD) ) {
+	    /* workers can't share the tempfile of a huge insert */
+	    pinfo.jobs = 1;
+	  }
+	  ok = parallel_stdparse2_rcm(pinfo.jobs, pinfo.targets,
+				      &pinfo.files[pinfo.n - pinfo.targets], 
+				      &pinfo.xpaths[pinfo.n - pinfo.targets],
+				      &pinfo.std);
 
 	}
 
       }
 
+      exit_rollback_handling();
       exit_tempfile_handling();
       exit_file_handling();      
       exit_signal_handling();
@@ -346,5 +416,5 @@ int main(int argc, char **argv) {
     free_parserinfo_cp(&pinfo);
   }
 
-  return EXIT_SUCCESS;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
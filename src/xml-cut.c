@@ -28,9 +28,10 @@
 #include "stdparse.h"
 #include "stdprint.h"
 #include "entities.h"
-#include "tempcollect.h"
+#include "cstring.h"
 #include "interval.h"
 #include "mysignal.h"
+#include "stats.h"
 
 #include <string.h>
 #include <getopt.h>
@@ -48,11 +49,29 @@ extern volatile flag_t cmd;
 #include <stdio.h>
 #include <ctype.h>
 
+typedef struct {
+  int fno;
+  bool_t field_lock;
+  char_t delim;
+  intervalmgr_t *im;
+} fields_fun_t;
+
+typedef struct {
+  int cno;
+  bool_t has_output;
+  intervalmgr_t *im;
+} chars_fun_t;
+
+/* the field and char tokenizers are run on each chardata fragment as 
+   it arrives, and their state is reset at each tag */
 typedef struct {
   stdparserinfo_t std; /* must be first so we can cast correctly */
   flag_t flags;
   intervalmgr_t im;
-  tempcollect_t stringval;
+  fields_fun_t ff;
+  chars_fun_t cf;
+  cstring_t coded; /* current fragment, with coded entities */
+  bool_t cdata; /* inside a CDATA section, where nothing is coded */
 } parserinfo_cut_t;
 
 #define CUT_VERSION    0x01
@@ -61,6 +80,8 @@ typedef struct {
 "Usage: xml-cut OPTION... [[FILE] [:XPATH]...]\n" \
 "Print selected parts of nodes from FILE, or standard input.\n" \
 "\n" \
+"      --stats[=json]  print resource statistics on exit\n" \
+"      --progress[=N]  report progress on stderr every N seconds\n" \
 "      --help     display this help and exit\n" \
 "      --version  display version information and exit\n"
 
@@ -122,6 +143,12 @@ void set_option_cut(int op, char *optarg, parserinfo_cut_t *pinfo) {
     puts(CUT_USAGE);
     exit(EXIT_SUCCESS);
     break;
+  case STATS_OPTION:
+    set_stats(optarg);
+    break;
+  case PROGRESS_OPTION:
+    set_progress(optarg);
+    break;
   case 'c':
     setflag(&pinfo->flags,CUT_FLAG_CHAR);
     read_interval_spec(optarg, &pinfo->im);
@@ -137,13 +164,6 @@ void set_option_cut(int op, char *optarg, parserinfo_cut_t *pinfo) {
   }
 }
 
-typedef struct {
-  int fno;
-  bool_t field_lock;
-  char_t delim;
-  intervalmgr_t *im;
-} fields_fun_t;
-
 
 /* print all spaces, and only selected field numbers, on each line in turn */
 bool_t fields_fun(void *user, byte_t *buf, size_t buflen) {
@@ -182,20 +202,6 @@ bool_t fields_fun(void *user, byte_t *buf, size_t buflen) {
   return FALSE;
 }
 
-bool_t print_fields_stdout(parserinfo_cut_t *pinfo) {
-  fields_fun_t ff;
-  tempcollect_adapter_t ad;
-  ff.fno = 0;
-  ff.field_lock = FALSE;
-  ff.delim = ' ';
-  ff.im = &pinfo->im;
-  ad.fun = fields_fun;
-  ad.user = &ff;
-
-  write_adapter_tempcollect(&pinfo->stringval, &ad);
-  return TRUE;
-}
-
 /* THIS IS AN ALTERNATIVE FIELDS_FUN WHICH PRINTS DELIM BETWEEN FIELDS */
 
 /* typedef struct { */
@@ -256,73 +262,82 @@ bool_t print_fields_stdout(parserinfo_cut_t *pinfo) {
 /* } */
 
 
-typedef struct {
-  int cno;
-  bool_t has_output;
-  intervalmgr_t *im;
-} chars_fun_t;
-
+/* jumps over the unselected chars of each line, and copies the 
+   selected ones in runs */
 bool_t chars_fun(void *user, byte_t *buf, size_t buflen) {
   chars_fun_t *cft = (chars_fun_t *)user;
+  byte_t *p, *q, *nl;
+  size_t n;
+  int a, b;
   if( cft ) {
-    while( buflen-- > 0 ) {
-      if( *buf == '\n' ) {
-      	putc_stdout(*buf);
+    p = buf;
+    q = buf + buflen;
+    while( p < q ) {
+      nl = (byte_t *)memchr(p, '\n', q - p);
+      if( !nl ) {
+	nl = q;
+      }
+      while( (p < nl) && next_intervalmgr(cft->im, cft->cno, &a, &b) ) {
+	if( a > cft->cno ) {
+	  n = MIN((size_t)(a - cft->cno), (size_t)(nl - p));
+	  p += n;
+	  cft->cno += n;
+	}
+	if( p < nl ) {
+	  n = MIN((size_t)(b - cft->cno) + 1, (size_t)(nl - p));
+	  write_stdout(p, n);
+	  cft->has_output = TRUE;
+	  p += n;
+	  cft->cno += n;
+	}
+      }
+      cft->cno += (nl - p);
+      p = nl;
+      if( p < q ) {
+      	putc_stdout('\n');
       	cft->has_output = TRUE;
       	cft->cno = 1;
-      } else if( memberof_intervalmgr(cft->im, cft->cno++) ) {
-      	putc_stdout(*buf);
-      	cft->has_output = TRUE;
+	p++;
       }
-      buf++;
     }
     return TRUE;
   }
   return FALSE;
 }
 
-/* print only selected chars on each line of pinfo->im */
-bool_t print_chars_stdout(parserinfo_cut_t *pinfo) {
-  chars_fun_t cf;
-  tempcollect_adapter_t ad;
-  cf.cno = 1;
-  cf.has_output = FALSE;
-  cf.im = &pinfo->im;
-  ad.fun = chars_fun;
-  ad.user = &cf;
-
-  write_adapter_tempcollect(&pinfo->stringval, &ad);
-  return cf.has_output;
-}
-
-
-result_t flush_stringval_stdout(parserinfo_cut_t *pinfo) {
+result_t reset_tokens_cut(parserinfo_cut_t *pinfo) {
   if( pinfo ) {
-    if( checkflag(pinfo->flags,CUT_FLAG_FIELD) ) {
-
-      if( !is_empty_tempcollect(&pinfo->stringval) ) {
-
-	if( !print_fields_stdout(pinfo) ) {
-	  /* write_stdout_tempcollect(&pinfo->stringval); /\* safety *\/ */
-	}
-	reset_tempcollect(&pinfo->stringval);
-      }
-
-    } else if( checkflag(pinfo->flags,CUT_FLAG_CHAR) ) {
-
-      if( !is_empty_tempcollect(&pinfo->stringval) ) {
-	if( !print_chars_stdout(pinfo) ) {
-	  /* write_stdout_tempcollect(&pinfo->stringval); */
-	}
-	reset_tempcollect(&pinfo->stringval);
-      }
-
-    }
+    pinfo->ff.fno = 0;
+    pinfo->ff.field_lock = FALSE;
+    pinfo->cf.cno = 1;
     return TRUE;
   }
   return FALSE;
 }
 
+/* passes a fragment of a string value to the tokenizer, 
+   with its entities coded unless it belongs to a CDATA section */
+bool_t tokenize_cut(parserinfo_cut_t *pinfo, const char_t *buf, size_t buflen) {
+  const char_t *q;
+  q = pinfo->cdata ? NULL : find_next_special(buf, buf + buflen);
+  if( q && (q < buf + buflen) ) {
+    q = write_coded_entities_cstring(&pinfo->coded, 
+				     truncate_cstring(&pinfo->coded, 0), 
+				     buf, buflen);
+    if( !q ) {
+      return FALSE;
+    }
+    buf = begin_cstring(&pinfo->coded);
+    buflen = q - buf;
+  }
+  if( checkflag(pinfo->flags,CUT_FLAG_FIELD) ) {
+    return fields_fun(&pinfo->ff, (byte_t *)buf, buflen);
+  } else if( checkflag(pinfo->flags,CUT_FLAG_CHAR) ) {
+    return chars_fun(&pinfo->cf, (byte_t *)buf, buflen);
+  }
+  return TRUE;
+}
+
 result_t start_tag(void *user, const char_t *name, const char_t **att) {
   parserinfo_cut_t *pinfo = (parserinfo_cut_t *)user;
   if( pinfo ) { 
@@ -332,7 +347,7 @@ result_t start_tag(void *user, const char_t *name, const char_t **att) {
 	write_start_tag_stdout(name, att, FALSE);
       }
     } else {
-      flush_stringval_stdout(pinfo);
+      reset_tokens_cut(pinfo);
       write_start_tag_stdout(name, att, FALSE);
     }
 
@@ -349,7 +364,7 @@ result_t end_tag(void *user, const char_t *name) {
 	write_end_tag_stdout(name);
       }
     } else {
-      flush_stringval_stdout(pinfo);
+      reset_tokens_cut(pinfo);
       write_end_tag_stdout(name);
     }      
 
@@ -361,22 +376,42 @@ result_t chardata(void *user, const char_t *buf, size_t buflen) {
   parserinfo_cut_t *pinfo = (parserinfo_cut_t *)user;
   if( pinfo ) { 
 
-  /* stringval is needed to save the string value of the node,
-     as we cannot decide if we want to print it until we've
-     seen it in its entirety */
 
     if( checkflag(pinfo->flags,CUT_FLAG_TAG) ) {
-      if( memberof_intervalmgr(&pinfo->im, pinfo->std.depth + 1) ) {
+      if( !memberof_intervalmgr(&pinfo->im, pinfo->std.depth + 1) ) {
+	/* not shown */
+      } else if( pinfo->cdata ) {
+	write_stdout((byte_t *)buf, buflen);
+      } else {
 	write_coded_entities_stdout(buf, buflen);
       }
     } else { 
-      write_coded_entities_tempcollect(&pinfo->stringval, buf, buflen);
+      tokenize_cut(pinfo, buf, buflen);
     }
 
   }
   return PARSER_OK;
 }
 
+/* the CDATA markers are always printed, like the default data */
+result_t start_cdata(void *user) {
+  parserinfo_cut_t *pinfo = (parserinfo_cut_t *)user;
+  if( pinfo ) { 
+    puts_stdout("<![CDATA[");
+    pinfo->cdata = TRUE;
+  }
+  return PARSER_OK;
+}
+
+result_t end_cdata(void *user) {
+  parserinfo_cut_t *pinfo = (parserinfo_cut_t *)user;
+  if( pinfo ) { 
+    puts_stdout("]]>");
+    pinfo->cdata = FALSE;
+  }
+  return PARSER_OK;
+}
+
 result_t dfault(void *user, const char_t *data, size_t buflen) {
   parserinfo_cut_t *pinfo = (parserinfo_cut_t *)user;
   if( pinfo ) { 
@@ -392,16 +427,21 @@ bool_t create_parserinfo_cut(parserinfo_cut_t *pinfo) {
     memset(pinfo, 0, sizeof(parserinfo_cut_t));
     ok &= create_stdparserinfo(&pinfo->std);
 
-    pinfo->std.setup.flags = STDPARSE_EQ1FILE;
+    pinfo->std.setup.flags = STDPARSE_EQ1FILE|STDPARSE_COALESCE_CHARDATA;
     pinfo->std.setup.cb.start_tag = start_tag;
     pinfo->std.setup.cb.end_tag = end_tag;
     pinfo->std.setup.cb.chardata = chardata;
+    pinfo->std.setup.cb.start_cdata = start_cdata;
+    pinfo->std.setup.cb.end_cdata = end_cdata;
     pinfo->std.setup.cb.dfault = dfault;
     pinfo->flags = 0;
 
     ok &= create_intervalmgr(&pinfo->im);
-    ok &= create_tempcollect(&pinfo->stringval, "stringval", 
-			     MINVARSIZE, MAXVARSIZE);
+    ok &= (create_cstring(&pinfo->coded, "", 1024) != NULL);
+    pinfo->ff.delim = ' ';
+    pinfo->ff.im = &pinfo->im;
+    pinfo->cf.im = &pinfo->im;
+    reset_tokens_cut(pinfo);
     return ok;
   }
   return FALSE;
@@ -410,7 +450,7 @@ bool_t create_parserinfo_cut(parserinfo_cut_t *pinfo) {
 bool_t free_parserinfo_cut(parserinfo_cut_t *pinfo) {
   free_stdparserinfo(&pinfo->std);
   free_intervalmgr(&pinfo->im);
-  free_tempcollect(&pinfo->stringval);
+  free_cstring(&pinfo->coded);
   return TRUE;
 }
 
@@ -452,6 +492,8 @@ int main(int argc, char **argv) {
   struct option longopts[] = {
     { "version", 0, NULL, CUT_VERSION },
     { "help", 0, NULL, CUT_HELP },
+    { "stats", 2, NULL, STATS_OPTION },
+    { "progress", 2, NULL, PROGRESS_OPTION },
     { 0 }
   };
 
@@ -29,6 +29,7 @@
 #include "stdout.h"
 #include "echo.h"
 #include "tempvar.h"
+#include "stats.h"
 
 #include <string.h>
 #include <getopt.h>
@@ -64,6 +65,7 @@ typedef struct {
 "Echo an XML document to standard output.\n" \
 "\n" \
 "  -e            enable interpretation of control information\n" \
+"      --stats[=json]  print resource statistics on exit\n" \
 "      --help    display this help and exit\n" \
 "      --version display version information and exit\n"
 
@@ -99,6 +101,9 @@ int set_option(int op, char *optarg) {
     puts(ECHO_USAGE1);
     exit(EXIT_SUCCESS);
     break;
+  case STATS_OPTION:
+    set_stats(optarg);
+    break;
   case ECHO_XPATHSEP:
     redefine_xpath_specials(optarg);
     break;
@@ -147,6 +152,7 @@ int main(int argc, char **argv) {
     { "version", 0, NULL, ECHO_VERSION },
     { "help", 0, NULL, ECHO_HELP },
     { "path-separator", 1, NULL, ECHO_XPATHSEP },
+    { "stats", 2, NULL, STATS_OPTION },
     { 0 }
   };
 
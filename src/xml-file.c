@@ -27,9 +27,21 @@
 #include "stdparse.h"
 #include "entities.h"
 #include "mysignal.h"
+#include "filelist.h"
+#include "mem.h"
+#include "stats.h"
 
 #include <string.h>
+#include <ctype.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#if HAVE_PTHREAD_H && HAVE_LIBPTHREAD
+#include <pthread.h>
+#define FILE_WITH_THREADS 1
+#endif
 
 /* for option processing */
 extern char *optarg;
@@ -52,38 +64,71 @@ typedef struct {
   char_t *tag;
 } features_t;
 
+typedef enum { m_nothing = 0, m_doctype, m_sysid, m_pubid, m_tag } mtype_t;
+typedef enum { m_done, m_and, m_or } mnext_t;
+typedef struct {
+  mtype_t mtype;
+  mnext_t next;
+  const char_t *mvalue;
+  const char_t *ident;
+} magic_t;
+
+/* The rules of the magic files given with --magic come first, then the
+ * builtin rules, and the first rule which matches wins. Each rule is
+ * hashed by its type and (case insensitive) value, so identifying a
+ * file costs one lookup per feature, whatever the number of rules.
+ */
+typedef struct {
+  magic_t *rules;
+  size_t numrules, maxrules;
+  int *tab; /* rule index + 1, or 0 if empty */
+  size_t maxtab;
+  char **owned; /* contents of the magic files */
+  size_t numowned, maxowned;
+} magicdb_t;
+
+/* each file is sniffed by reading just enough to see the root tag */
 typedef struct {
-  stdparserinfo_t std; /* must be first so we can cast correctly */
   features_t feats;
+  bool_t failed;
+  bool_t done;
+} sniff_t;
+
+typedef struct {
+  magicdb_t db;
+  cstringlst_t files;
+  sniff_t *sniffs;
+  size_t numfiles;
+  size_t next;
   flag_t flags;
-  int numfiles;
+  int jobs;
   int llf;
+#if FILE_WITH_THREADS
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+#endif
 } parserinfo_file_t;
 
 #define FILE_VERSION    0x01
 #define FILE_HELP       0x02
 #define FILE_SHOW       0x03
+#define FILE_MAGIC      'm'
+#define FILE_JOBS       'j'
 #define FILE_USAGE \
 "Usage: xml-file [OPTION]... FILE [FILE]...\n" \
 "Determine type of FILE(s).\n" \
 "\n" \
-"      --help     display this help and exit\n" \
-"      --version  display version information and exit\n"
+"  -m, --magic=MFILE  use the rules in MFILE before the builtin ones\n" \
+"  -j, --jobs=N       examine N files at a time\n" \
+"      --stats[=json]  print resource statistics on exit\n" \
+"      --help         display this help and exit\n" \
+"      --version      display version information and exit\n"
 
 #define FILE_FLAG_SHOW 0x01
 
-typedef enum { m_nothing = 0, m_doctype, m_sysid, m_pubid, m_tag } mtype_t;
-typedef enum { m_done, m_and, m_or } mnext_t;
-typedef struct {
-  mtype_t mtype;
-  mnext_t next;
-  const char_t *mvalue;
-  const char_t *ident;
-} magic_t;
+#define FILE_HEADER    4096
 
-/* list of possible document types, scanned from top to bottom until
-   first match. Eventually, this will have to be made efficient, and
-   read/written from/to an external magic file, eg magic(5) */ 
+/* builtin list of possible document types, see also --magic */ 
 static const magic_t magic[] = {
   { m_doctype, m_done, "html", "HTML text document" },
   { m_tag, m_done, "html", "HTML text fragment" },
@@ -96,25 +141,170 @@ static const magic_t magic[] = {
   { 0 }
 };
 
-bool_t cmp_magic(features_t *f, const magic_t *m) {
-  if( f && m ) {
-    switch(m->mtype) {
-    case m_nothing:
+bool_t add_magic(magicdb_t *db, const magic_t *m) {
+  if( db && m ) {
+    if( (db->numrules >= db->maxrules) &&
+	!grow_mem(&db->rules, &db->maxrules, sizeof(magic_t), 16) ) {
       return FALSE;
-    case m_doctype: 
-      return (f->doctype && (strcasecmp(f->doctype, m->mvalue) == 0));
-    case m_sysid:
-      return (f->sysid && (strcasecmp(f->sysid, m->mvalue) == 0));
-    case m_pubid:
-      return (f->pubid && (strcasecmp(f->pubid, m->mvalue) == 0));
-    case m_tag:
-      return (f->tag && (strcasecmp(f->tag, m->mvalue) == 0));
     }
+    db->rules[db->numrules++] = *m;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* magic file lines have the form: TYPE VALUE DESCRIPTION,
+   where VALUE can be double quoted if it contains spaces */
+bool_t load_magic(magicdb_t *db, const char *file) {
+  FILE *f;
+  char *buf = NULL, *p, *q, *e;
+  size_t n, max = 0;
+  magic_t m;
+  int line;
+  f = fopen(file, "r");
+  if( !f ) {
+    errormsg(E_FATAL, "cannot open magic file %s\n", file);
+  }
+  n = 0;
+  do {
+    if( !grow_mem(&buf, &max, sizeof(char), 4096) ) {
+      errormsg(E_FATAL, "out of memory.\n");
+    }
+    n += fread(buf + n, 1, max - n - 1, f);
+  } while( n == max - 1 );
+  fclose(f);
+  buf[n] = '\0';
+
+  if( (db->numowned >= db->maxowned) &&
+      !grow_mem(&db->owned, &db->maxowned, sizeof(char *), 4) ) {
+    errormsg(E_FATAL, "out of memory.\n");
+  }
+  db->owned[db->numowned++] = buf;
+
+  for(p = buf, line = 1; *p; p = e, line++) {
+    e = strchr(p, '\n');
+    e = e ? (*e = '\0', e + 1) : p + strlen(p);
+    p += strspn(p, " \t\r");
+    if( !*p || (*p == '#') ) {
+      continue;
+    }
+    memset(&m, 0, sizeof(magic_t));
+    q = p + strcspn(p, " \t\r");
+    if( (q - p == 7) && (strncmp(p, "doctype", 7) == 0) ) {
+      m.mtype = m_doctype;
+    } else if( (q - p == 5) && (strncmp(p, "sysid", 5) == 0) ) {
+      m.mtype = m_sysid;
+    } else if( (q - p == 5) && (strncmp(p, "pubid", 5) == 0) ) {
+      m.mtype = m_pubid;
+    } else if( (q - p == 3) && (strncmp(p, "tag", 3) == 0) ) {
+      m.mtype = m_tag;
+    }
+    p = q + strspn(q, " \t\r");
+    if( *p == '"' ) {
+      q = strchr(++p, '"');
+    } else {
+      q = p + strcspn(p, " \t\r");
+    }
+    if( (m.mtype == m_nothing) || !q || (q == p) || !*q ) {
+      errormsg(E_FATAL, "%s:%d: bad magic rule\n", file, line);
+    }
+    *q++ = '\0';
+    m.mvalue = p;
+    m.ident = q + strspn(q, " \t");
+    for(q = (char *)m.ident + strlen(m.ident); 
+	(q > m.ident) && isspace(q[-1]); q--) {
+      q[-1] = '\0';
+    }
+    if( !*m.ident ) {
+      errormsg(E_FATAL, "%s:%d: bad magic rule\n", file, line);
+    }
+    if( !add_magic(db, &m) ) {
+      errormsg(E_FATAL, "out of memory.\n");
+    }
+  }
+  return TRUE;
+}
+
+static unsigned long hash_magic(mtype_t mtype, const char_t *s) {
+  unsigned char low[64];
+  unsigned long h = mtype;
+  size_t k;
+  do {
+    for(k = 0; (k < sizeof(low)) && s[k]; k++) {
+      low[k] = tolower((unsigned char)s[k]);
+    }
+    h = hash(low, k, h);
+    s += k;
+  } while( *s );
+  return h;
+}
+
+/* rules with the same type and value as an earlier rule never match */
+bool_t compile_magic(magicdb_t *db) {
+  const magic_t *m;
+  size_t i, j;
+  for(m = magic; m->mtype != m_nothing; m++) {
+    if( !add_magic(db, m) ) {
+      return FALSE;
+    }
+  }
+  for(db->maxtab = 16; db->maxtab < 2 * db->numrules; db->maxtab *= 2);
+  db->tab = (int *)calloc(db->maxtab, sizeof(int));
+  if( !db->tab ) {
+    return FALSE;
+  }
+  for(i = 0; i < db->numrules; i++) {
+    j = hash_magic(db->rules[i].mtype, db->rules[i].mvalue) & (db->maxtab - 1);
+    while( db->tab[j] && 
+	   ((db->rules[db->tab[j] - 1].mtype != db->rules[i].mtype) ||
+	    (strcasecmp(db->rules[db->tab[j] - 1].mvalue, 
+			db->rules[i].mvalue) != 0)) ) {
+      j = (j + 1) & (db->maxtab - 1);
+    }
+    if( !db->tab[j] ) {
+      db->tab[j] = i + 1;
+    }
+  }
+  return TRUE;
+}
+
+/* index of the matching rule, or numrules if none */
+size_t find_magic(const magicdb_t *db, mtype_t mtype, const char_t *value) {
+  size_t j;
+  if( db && db->tab && value ) {
+    j = hash_magic(mtype, value) & (db->maxtab - 1);
+    while( db->tab[j] ) {
+      if( (db->rules[db->tab[j] - 1].mtype == mtype) &&
+	  (strcasecmp(db->rules[db->tab[j] - 1].mvalue, value) == 0) ) {
+	return db->tab[j] - 1;
+      }
+      j = (j + 1) & (db->maxtab - 1);
+    }
+  }
+  return db ? db->numrules : 0;
+}
+
+bool_t free_magic(magicdb_t *db) {
+  if( db ) {
+    while( db->numowned > 0 ) {
+      free(db->owned[--db->numowned]);
+    }
+    if( db->owned ) {
+      free_mem(&db->owned, &db->maxowned);
+    }
+    if( db->rules ) {
+      free_mem(&db->rules, &db->maxrules);
+    }
+    if( db->tab ) {
+      free(db->tab);
+      db->tab = NULL;
+    }
+    return TRUE;
   }
   return FALSE;
 }
 
-void set_option_file(int op, char *optarg) {
+void set_option_file(int op, char *optarg, parserinfo_file_t *pinfo) {
   switch(op) {
   case FILE_VERSION:
     puts("xml-file" COPYBLURB);
@@ -124,33 +314,42 @@ void set_option_file(int op, char *optarg) {
     puts(FILE_USAGE);
     exit(EXIT_SUCCESS);
     break;
+  case STATS_OPTION:
+    set_stats(optarg);
+    break;
   case FILE_SHOW:
     u_options |= FILE_FLAG_SHOW;
     break;
+  case FILE_MAGIC:
+    load_magic(&pinfo->db, optarg);
+    break;
+  case FILE_JOBS:
+    pinfo->jobs = atoi(optarg);
+    if( pinfo->jobs < 1 ) {
+      errormsg(E_FATAL, "bad number of jobs %s\n", optarg);
+    }
+#if !FILE_WITH_THREADS
+    errormsg(E_WARNING, "compiled without thread support, ignoring --jobs\n");
+    pinfo->jobs = 1;
+#endif
+    break;
   }
 }
 
 result_t start_doctypedecl(void *user, const char_t *name, const char_t *sysid, const char_t *pubid, bool_t intsub) {
- parserinfo_file_t *pinfo = (parserinfo_file_t *)user;
-  if( pinfo ) { 
-    pinfo->feats.doctype = name ? strdup(name) : NULL;
-    pinfo->feats.sysid = sysid ? strdup(sysid) : NULL;
-    pinfo->feats.pubid = pubid ? strdup(pubid) : NULL;
-  }
-  return PARSER_OK;
-}
-
-result_t end_doctypedecl(void *user) {
-parserinfo_file_t *pinfo = (parserinfo_file_t *)user;
-  if( pinfo ) { 
+  sniff_t *s = (sniff_t *)user;
+  if( s ) { 
+    s->feats.doctype = name ? strdup(name) : NULL;
+    s->feats.sysid = sysid ? strdup(sysid) : NULL;
+    s->feats.pubid = pubid ? strdup(pubid) : NULL;
   }
   return PARSER_OK;
 }
 
 result_t start_tag(void *user, const char_t *name, const char_t **att) {
-  parserinfo_file_t *pinfo = (parserinfo_file_t *)user;
-  if( pinfo ) { 
-    pinfo->feats.tag = name ? strdup(name) : NULL;
+  sniff_t *s = (sniff_t *)user;
+  if( s ) { 
+    s->feats.tag = name ? strdup(name) : NULL;
   }
   return PARSER_ABORT; /* we only look at a single tag */
 }
@@ -183,84 +382,236 @@ void reset_features(features_t *feats, const char_t *file) {
   }
 }
 
-const char_t *ident_string(features_t *feats) {
-  const magic_t *m;
-  for(m = magic; m->mtype != m_nothing; m++) {
-    if( cmp_magic(feats, m) ) {
-      return m->ident;
-    }
-  }
-  return "XML text";
+const char_t *ident_string(const magicdb_t *db, features_t *feats) {
+  size_t i, j;
+  i = find_magic(db, m_doctype, feats->doctype);
+  j = find_magic(db, m_sysid, feats->sysid);
+  i = MIN(i, j);
+  j = find_magic(db, m_pubid, feats->pubid);
+  i = MIN(i, j);
+  j = find_magic(db, m_tag, feats->tag);
+  i = MIN(i, j);
+  return (i < db->numrules) ? db->rules[i].ident : "XML text";
 }
 
 /* mimic file(1) with keywords "text", "data" */
-void identify_from_features(parserinfo_file_t *pinfo) {
+void identify_from_features(parserinfo_file_t *pinfo, sniff_t *s) {
   const char_t *id = "unrecognized data";
-  if( !stdparse_failed(&pinfo->std) ) {
-    id = ident_string(&pinfo->feats);
+  if( !s->failed ) {
+    id = ident_string(&pinfo->db, &s->feats);
   }
-  puts_stdout(pinfo->feats.file);
+  puts_stdout(s->feats.file);
   putc_stdout(':');
-  nputc_stdout(' ', pinfo->llf + 1 - strlen(pinfo->feats.file));
+  nputc_stdout(' ', pinfo->llf + 1 - strlen(s->feats.file));
   puts_stdout(id);
   putc_stdout('\n');
   flush_stdout();
 }
 
-void show_features(parserinfo_file_t *pinfo) {
-  if( pinfo ) {
-    puts_stdout("[file] "); puts_stdout(pinfo->feats.file);
-    puts_stdout("[doctype] "); puts_stdout(pinfo->feats.doctype);
-    puts_stdout("[sysid] "); puts_stdout(pinfo->feats.sysid);
-    puts_stdout("[pubid] "); puts_stdout(pinfo->feats.pubid);
-    puts_stdout("[tag] "); puts_stdout(pinfo->feats.tag);
+void show_features(sniff_t *s) {
+  if( s ) {
+    puts_stdout("[file] "); puts_stdout(s->feats.file);
+    puts_stdout("[doctype] "); puts_stdout(s->feats.doctype);
+    puts_stdout("[sysid] "); puts_stdout(s->feats.sysid);
+    puts_stdout("[pubid] "); puts_stdout(s->feats.pubid);
+    puts_stdout("[tag] "); puts_stdout(s->feats.tag);
   }
 }
 
-bool_t start_file_fun(void *user, const char_t *file, const char_t **xpaths) {
-  parserinfo_file_t *pinfo = (parserinfo_file_t *)user;
-  if( pinfo ) {
-    reset_features(&pinfo->feats, file);
+/* reads the file in small pieces until the parser has seen the root tag,
+   which is usually within the first piece */
+bool_t sniff_file(parser_t *parser, sniff_t *s, const char *file) {
+  struct stat st;
+  byte_t *buf;
+  off_t off = 0;
+  ssize_t n;
+  int fd;
+
+  reset_features(&s->feats, file);
+  s->failed = TRUE;
+
+  fd = (strcmp(file, "stdin") == 0) ? 
+    STDIN_FILENO : open(file, O_RDONLY|O_BINARY);
+  if( fd == -1 ) {
+    errormsg(E_ERROR, "cannot open %s\n", file);
+    return FALSE;
   }
-  return TRUE;
+  if( (fstat(fd, &st) == 0) && S_ISDIR(st.st_mode) ) {
+    errormsg(E_ERROR, "cannot open directory %s\n", file);
+  } else if( reset_parser(parser) ) {
+    parser->user = s;
+    s->failed = FALSE;
+    while( !checkflag(cmd,CMD_QUIT) ) {
+      buf = getbuf_parser(parser, FILE_HEADER);
+      if( !buf ) {
+	break;
+      }
+      n = (fd == STDIN_FILENO) ? 
+	read(fd, buf, FILE_HEADER) : pread(fd, buf, FILE_HEADER, off);
+      if( n <= 0 ) {
+	break;
+      }
+      STATS_ADD(reads, 1);
+      STATS_ADD(bytesread, n);
+      off += n;
+      if( !do_parser(parser, n) ) {
+	s->failed = !aborted_parser(parser);
+	break;
+      }
+    }
+  }
+  if( fd != STDIN_FILENO ) {
+    close(fd);
+  }
+  return !s->failed;
 }
 
-bool_t end_file_fun(void *user, const char_t *file, const char_t **xpaths) {
-  parserinfo_file_t *pinfo = (parserinfo_file_t *)user;
-  if( pinfo ) {
+bool_t create_sniffer(parser_t *parser) {
+  callback_t cb;
+  if( create_parser(parser, NULL) ) {
+    memset(&cb, 0, sizeof(callback_t));
+    cb.start_tag = start_tag;
+    cb.start_doctypedecl = start_doctypedecl;
+    return setup_parser(parser, &cb);
+  }
+  return FALSE;
+}
+
+#if FILE_WITH_THREADS
+void *run_sniffer(void *arg) {
+  parserinfo_file_t *pinfo = (parserinfo_file_t *)arg;
+  parser_t parser;
+  sniff_t *s;
+  bool_t ok;
+  enter_stats_thread();
+  ok = create_sniffer(&parser);
+  while( ok ) {
+    pthread_mutex_lock(&pinfo->lock);
+    s = (pinfo->next < pinfo->numfiles) && !checkflag(cmd,CMD_QUIT) ?
+      &pinfo->sniffs[pinfo->next++] : NULL;
+    if( !s ) {
+      /* wake up the main thread if it waits for an abandoned file */
+      pthread_cond_broadcast(&pinfo->cond);
+    }
+    pthread_mutex_unlock(&pinfo->lock);
+    if( !s ) {
+      break;
+    }
+    sniff_file(&parser, s, pinfo->files[s - pinfo->sniffs]);
+    pthread_mutex_lock(&pinfo->lock);
+    s->done = TRUE;
+    pthread_cond_broadcast(&pinfo->cond);
+    pthread_mutex_unlock(&pinfo->lock);
+  }
+  if( ok ) {
+    free_parser(&parser);
+  }
+  return NULL;
+}
+#endif
+
+/* waits until file i is sniffed, or sniffs it if there are no threads */
+sniff_t *wait_sniffer(parserinfo_file_t *pinfo, parser_t *parser,
+		      size_t i, bool_t threads) {
+  sniff_t *s = &pinfo->sniffs[i];
+#if FILE_WITH_THREADS
+  if( threads ) {
+    pthread_mutex_lock(&pinfo->lock);
+    while( !s->done && !(checkflag(cmd,CMD_QUIT) && (i >= pinfo->next)) ) {
+      pthread_cond_wait(&pinfo->cond, &pinfo->lock);
+    }
+    pthread_mutex_unlock(&pinfo->lock);
+    return s->done ? s : NULL;
+  }
+#endif
+  sniff_file(parser, s, pinfo->files[i]);
+  s->done = TRUE;
+  return s;
+}
+
+bool_t sniff_files(parserinfo_file_t *pinfo, int argc, char **argv) {
+  filelist_t fl;
+  parser_t parser;
+  sniff_t *s;
+  size_t i;
+  int t = 0;
+#if FILE_WITH_THREADS
+  pthread_t *threads = NULL;
+#endif
+
+  if( !create_filelist(&fl, argc, argv, FILELIST_MIN1) ) {
+    return FALSE;
+  }
+  if( hasxpaths_filelist(&fl) ) {
+    errormsg(E_FATAL, "command does not accept XPATH after filename(s)\n");
+  }
+  pinfo->files = getfiles_filelist(&fl);
+  pinfo->numfiles = getsize_filelist(&fl);
+  pinfo->sniffs = (sniff_t *)calloc(pinfo->numfiles + 1, sizeof(sniff_t));
+  if( !pinfo->sniffs || !create_sniffer(&parser) ) {
+    errormsg(E_FATAL, "out of memory.\n");
+  }
+
+#if FILE_WITH_THREADS
+  if( (pinfo->jobs > 1) && (pinfo->numfiles > 1) ) {
+    pthread_mutex_init(&pinfo->lock, NULL);
+    pthread_cond_init(&pinfo->cond, NULL);
+    threads = malloc(pinfo->jobs * sizeof(pthread_t));
+    for(t = 0; threads && (t < pinfo->jobs); t++) {
+      if( pthread_create(&threads[t], NULL, run_sniffer, pinfo) != 0 ) {
+	break;
+      }
+    }
+    if( t == 0 ) {
+      errormsg(E_WARNING, "cannot create threads, working sequentially\n");
+    }
+  }
+#endif
+
+  for(i = 0; (i < pinfo->numfiles) && !checkflag(cmd,CMD_QUIT); i++) {
+    inputfile = (char *)pinfo->files[i];
+    s = wait_sniffer(pinfo, &parser, i, (t > 0));
+    if( !s ) {
+      break;
+    }
     if( checkflag(u_options, FILE_FLAG_SHOW) ) {
-      show_features(pinfo);
+      show_features(s);
     }
-    identify_from_features(pinfo);
+    identify_from_features(pinfo, s);
+  }
+
+#if FILE_WITH_THREADS
+  if( threads ) {
+    while( t-- > 0 ) {
+      pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    pthread_cond_destroy(&pinfo->cond);
+    pthread_mutex_destroy(&pinfo->lock);
+  }
+#endif
+
+  for(i = 0; i < pinfo->numfiles; i++) {
+    free_features(&pinfo->sniffs[i].feats);
   }
+  free(pinfo->sniffs);
+  pinfo->sniffs = NULL;
+  free_parser(&parser);
+  free_filelist(&fl);
   return TRUE;
 }
 
 bool_t create_parserinfo_file(parserinfo_file_t *pinfo) {
-  bool_t ok = TRUE;
   if( pinfo ) {
-
     memset(pinfo, 0, sizeof(parserinfo_file_t));
-    ok &= create_stdparserinfo(&pinfo->std);
-    ok &= create_features(&pinfo->feats);
-
-    pinfo->std.setup.flags = 
-      STDPARSE_MIN1FILE|STDPARSE_NOXPATHS|STDPARSE_QUIET;
-    pinfo->std.setup.cb.start_tag = start_tag;
-    pinfo->std.setup.cb.start_doctypedecl = start_doctypedecl;
-    pinfo->std.setup.cb.end_doctypedecl = end_doctypedecl;
-
-    pinfo->std.setup.start_file_fun = start_file_fun;
-    pinfo->std.setup.end_file_fun = end_file_fun;
-
-    return ok;
+    pinfo->jobs = 1;
+    return TRUE;
   }
   return FALSE;
 }
 
 bool_t free_parserinfo_file(parserinfo_file_t *pinfo) {
-  free_features(&pinfo->feats);
-  free_stdparserinfo(&pinfo->std);
+  free_magic(&pinfo->db);
   return TRUE;
 }
 
@@ -280,6 +631,9 @@ int main(int argc, char **argv) {
     { "version", 0, NULL, FILE_VERSION },
     { "help", 0, NULL, FILE_HELP },
     { "show-everything", 0, NULL, FILE_SHOW },
+    { "magic", 1, NULL, FILE_MAGIC },
+    { "jobs", 1, NULL, FILE_JOBS },
+    { "stats", 2, NULL, STATS_OPTION },
     { 0 }
   };
 
@@ -289,9 +643,9 @@ int main(int argc, char **argv) {
 
   if( create_parserinfo_file(&pinfo) ) {
 
-    while( (op = getopt_long(argc, argv, "",
+    while( (op = getopt_long(argc, argv, "m:j:",
 			     longopts, NULL)) > -1 ) {
-      set_option_file(op, optarg);
+      set_option_file(op, optarg, &pinfo);
     }
 
     if( !argv[optind] ) {
@@ -299,6 +653,10 @@ int main(int argc, char **argv) {
       exit(EXIT_SUCCESS);
     }
 
+    if( !compile_magic(&pinfo.db) ) {
+      errormsg(E_FATAL, "out of memory.\n");
+    }
+
     pinfo.llf = length_longest_filename(argv + optind);
 
     init_signal_handling(SIGNALS_DEFAULT);
@@ -306,7 +664,7 @@ int main(int argc, char **argv) {
 
     open_stdout();
 
-    stdparse(MAXFILES, argv + optind, (stdparserinfo_t *)&pinfo);
+    sniff_files(&pinfo, MAXFILES, argv + optind);
 
     close_stdout();
 
@@ -32,6 +32,8 @@
 #include "cstring.h"
 #include "tempfile.h"
 #include "mysignal.h"
+#include "procpool.h"
+#include "stats.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -60,7 +62,7 @@ typedef enum {
   NAME, PATH,
   PRINT, EXEC, EXECNODE,
   /* argument-like IDs must follow ARG value, needed by parse_expressions() */
-  ARG=100, SUBP, SUBA, SUBF, SEMIC
+  ARG=100, SUBP, SUBA, SUBF, SEMIC, PLUS
 } expid_t;
 
 typedef struct { 
@@ -70,6 +72,10 @@ typedef struct {
     int integer;
   } arg;
   cstring_t tmp;
+  /* for -exec ... {} + */
+  stringlist_t batch;
+  stringlist_t files;
+  size_t batchlen;
 } exp_t;
 
 typedef struct {
@@ -92,6 +98,8 @@ bool_t free_explist(explist_t *el) {
     if( el->list ) {
       for(i = 0; i < el->num; i++) {
 	free_cstring(&el->list[i].tmp);
+	free_stringlist(&el->list[i].batch);
+	free_stringlist(&el->list[i].files);
       }
       free_mem(&el->list, &el->max);
     }
@@ -239,11 +247,34 @@ findnode_t *find_xmlstop_findnodelist(findnodelist_t *fnl, int depth) {
   return NULL;
 }
 
+void remove_files_tempfile(stringlist_t *files) {
+  int i;
+  for(i = 0; i < files->num; i++) {
+    remove_tempfile(files->list[i]);
+  }
+  reset_stringlist(files);
+}
+
+/* forget the finished commands, and remove their temporary files */
+void finish_jobs_find(procpool_t *pp) {
+  stringlist_t *files;
+  proc_t p;
+  while( get_done_procpool(pp, &p) ) {
+    files = (stringlist_t *)p.user;
+    if( files ) {
+      remove_files_tempfile(files);
+      free_stringlist(files);
+      free(files);
+    }
+  }
+}
+
 typedef struct {
   stdparserinfo_t std; /* must be first so we can cast correctly */
   flag_t flags;
 
   findnodelist_t nodes;
+  procpool_t jobs; /* for -P */
   explist_t expressions;
   tempcollect_t sav;
   int savd;
@@ -257,6 +288,8 @@ typedef struct {
 "Usage: xml-find [[FILE]... [:XPATH]...]... [EXPRESSION]\n" \
 "Search for XML nodes in an FILE, or standard input, and evaluate\n" \
 "EXPRESSION on each.\n" \
+"      --stats[=json]  print resource statistics on exit\n" \
+"      --progress[=N]  report progress on stderr every N seconds\n" \
 "      --help     display this help and exit\n" \
 "      --version  display version information and exit\n"
 
@@ -267,6 +300,9 @@ typedef struct {
 #define FIND_FLAG_SAVEXML      0x10
 #define FIND_FLAG_HAS_ACTION   0x20
 
+#define FIND_BATCH_ARGS        1024 /* max nodes per -exec ... {} + */
+#define FIND_BATCH_BYTES       (64 * 1024)
+
 void set_option_find(int op, char *optarg) {
   switch(op) {
   case FIND_VERSION:
@@ -277,6 +313,12 @@ void set_option_find(int op, char *optarg) {
     puts(FIND_USAGE);
     exit(EXIT_SUCCESS);
     break;
+  case STATS_OPTION:
+    set_stats(optarg);
+    break;
+  case PROGRESS_OPTION:
+    set_progress(optarg);
+    break;
   }
 }
 
@@ -339,9 +381,20 @@ bool_t parse_expressions(parserinfo_find_t *pinfo, char **argv) {
 	} else if( strcmp(*argv,"-execnode") == 0 ) {
 	  e->id = EXECNODE;
 	  setflag(&pinfo->flags,FIND_FLAG_HAS_ACTION);
+	  setflag(&pinfo->flags,FIND_FLAG_SAVEXML); /* for stdin */
 	} else if( strcmp(*argv,"-exec") == 0 ) {
 	  e->id = EXEC;
 	  setflag(&pinfo->flags,FIND_FLAG_HAS_ACTION);
+	} else if( strcmp(*argv,"-P") == 0 ) {
+	  e->id = NOP;
+	  argv++;
+	  if( argv && *argv && (atoi(*argv) > 0) ) {
+	    pinfo->jobs.maxprocs = atoi(*argv);
+	    e = add_explist(&pinfo->expressions);
+	    e->id = NOP; /* keep argument counts correct */
+	  } else {
+	    errormsg(E_FATAL, "-P needs a positive number of processes.\n");
+	  }
 	} else if( strcmp(*argv,"-name") == 0 ) {
 	  e->id = NAME;
 	  argv++;
@@ -395,6 +448,12 @@ bool_t parse_expressions(parserinfo_find_t *pinfo, char **argv) {
 	      } else if( strcmp(*argv,";") == 0 ) {
 		e->id = SEMIC;
 		break;
+	      } else if( (strcmp(*argv,"+") == 0) &&
+			 ((e - 1)->id == SUBP || (e - 1)->id == SUBF) ) {
+		e->id = PLUS; /* batch many nodes per command */
+		create_stringlist(&get_explist(&pinfo->expressions, i)->batch);
+		create_stringlist(&get_explist(&pinfo->expressions, i)->files);
+		break;
 	      } else {
 		e->id = ARG;
 		e->arg.string = *argv;
@@ -403,11 +462,19 @@ bool_t parse_expressions(parserinfo_find_t *pinfo, char **argv) {
 	    }	    
 	    argv++;
 	  }
-	  if( !e || (e->id != SEMIC) ) {
+	  if( !e || ((e->id != SEMIC) && (e->id != PLUS)) ) {
 	    errormsg(E_FATAL, "exec command must end with semicolon ';'.\n");
 	  }
 	  f = get_explist(&pinfo->expressions, i);
 	  f->arg.integer = pinfo->expressions.num - 1;
+	  if( e->id == PLUS ) {
+	    for(f = f + 2; f < e - 1; f++) {
+	      if( (f->id != ARG) || strstr(f->arg.string, "{}") ||
+		  strstr(f->arg.string, "{@}") || strstr(f->arg.string, "{-}") ) {
+		errormsg(E_FATAL, "only the last argument can be {} with '+'.\n");
+	      }
+	    }
+	  }
 	}
       }
       return parse_expressions(pinfo, ++argv);
@@ -529,33 +596,57 @@ bool_t write_xml_tempfile_fun(void *user, byte_t *buf, size_t buflen) {
   return FALSE;
 }
 
-bool_t write_xml_tempfile(tempcollect_t *sav, char *tmplate,
-			  int start, int stop, const char_t *path) {
+bool_t write_xml_fd(tempcollect_t *sav, int fd,
+		   int start, int stop, const char_t *path) {
   write_xml_tempfile_fun_t wxtf;
   tempcollect_adapter_t ad;
 
-  if( sav && (start <= stop) ) {
-    wxtf.fd = open_tempfile(tmplate);
-    if( wxtf.fd != -1 ) {
-
-      if( write_file(wxtf.fd, (byte_t *)get_headwrap(), 
-		     strlen(get_headwrap())) ) {
-	write_path_file(wxtf.fd, path, TRUE);
-	wxtf.tc = sav;
-	wxtf.pos = 0;
-	wxtf.start = start;
-	wxtf.stop = stop;
-	ad.fun = write_xml_tempfile_fun;
-	ad.user = &wxtf;
-	write_adapter_tempcollect(sav, &ad);
-	write_path_file(wxtf.fd, path, FALSE);
-      }
+  if( sav && (start <= stop) && (fd != -1) ) {
+    if( write_file(fd, (byte_t *)get_headwrap(), 
+		   strlen(get_headwrap())) ) {
+      write_path_file(fd, path, TRUE);
+      wxtf.fd = fd;
+      wxtf.tc = sav;
+      wxtf.pos = 0;
+      wxtf.start = start;
+      wxtf.stop = stop;
+      ad.fun = write_xml_tempfile_fun;
+      ad.user = &wxtf;
+      write_adapter_tempcollect(sav, &ad);
+      write_path_file(fd, path, FALSE);
+    }
+    return TRUE;
+  }
+  return FALSE;
+}
 
-      close(wxtf.fd);
-      return TRUE;
+bool_t write_xml_tempfile(tempcollect_t *sav, char *tmplate,
+			  int start, int stop, const char_t *path) {
+  bool_t ok = FALSE;
+  int fd;
+  if( sav && (start <= stop) ) {
+    fd = open_tempfile(tmplate);
+    if( fd != -1 ) {
+      ok = write_xml_fd(sav, fd, start, stop, path);
+      close(fd);
     }
   }
-  
+  return ok;
+}
+
+/* the child may exit without reading everything, that's not an error */
+bool_t write_xml_pipe(findnode_t *node, tempcollect_t *sav, int fd) {
+  struct sigaction ign, old;
+  bool_t ok;
+  if( node && sav && (fd != -1) ) {
+    memset(&ign, 0, sizeof(struct sigaction));
+    ign.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ign, &old);
+    ok = write_xml_fd(sav, fd, node->xml.start, node->xml.stop, "");
+    close(fd);
+    sigaction(SIGPIPE, &old, NULL);
+    return ok;
+  }
   return FALSE;
 }
 
@@ -608,6 +699,8 @@ char *subst_curl(cstring_t *cs, const char_t *template, findnode_t *node, bool_t
     } else if( strncmp(b, "-}", 2) == 0 ) {
       c = puts_cstring(cs, c, p_cstring(&node->xml.file));
       b += 2;
+    } else {
+      c = puts_cstring(cs, c, "{"); /* not special */
     }
 
     template = b;
@@ -618,17 +711,159 @@ char *subst_curl(cstring_t *cs, const char_t *template, findnode_t *node, bool_t
   return p_cstring(cs);
 }
 
+/* runs a command, and removes the temporary files when it's done. In
+ * parallel mode, the command keeps running in the background and the
+ * result is always TRUE. With -execnode, the node is written to the
+ * command's standard input.
+ */
+bool_t run_exec(procpool_t *pp, const char **argv, findnode_t *node,
+		tempcollect_t *sav, stringlist_t *files, bool_t relative) {
+  stringlist_t *own;
+  pid_t pid;
+  int fd;
+  bool_t ok;
+
+  if( pp && argv && argv[0] ) {
+    if( pp->maxprocs <= 1 ) {
+      if( relative ) {
+	pid = spawn_cmdline(argv[0], argv, &fd);
+	ok = (pid != -1);
+	if( ok ) {
+	  write_xml_pipe(node, sav, fd);
+	  ok = wait_cmdline(pid, argv[0]);
+	}
+      } else {
+	ok = exec_cmdline(argv[0], argv);
+      }
+      if( files ) {
+	remove_files_tempfile(files);
+      }
+      return ok;
+    }
+
+    /* the files must outlive the node, and the batch */
+    own = NULL;
+    if( (files && (files->num > 0)) || (node && CSTRINGP(node->xml.file)) ) {
+      own = (stringlist_t *)malloc(sizeof(stringlist_t));
+      if( !own ) {
+	errormsg(E_FATAL, "out of memory\n");
+      }
+      memset(own, 0, sizeof(stringlist_t));
+      if( files ) {
+	*own = *files;
+	memset(files, 0, sizeof(stringlist_t));
+      } else {
+	add_stringlist(own, p_cstring(&node->xml.file), STRINGLIST_STRDUP);
+      }
+    }
+
+    pid = run_procpool(pp, argv[0], argv, relative ? &fd : NULL, own);
+    /* argv may point to the file name, so only forget it now */
+    if( !files && node && CSTRINGP(node->xml.file) ) {
+      free_cstring(&node->xml.file);
+    }
+    if( pid == -1 ) {
+      if( own ) {
+	remove_files_tempfile(own);
+	free_stringlist(own);
+	free(own);
+      }
+    } else if( relative ) {
+      write_xml_pipe(node, sav, fd);
+    }
+    finish_jobs_find(pp);
+    return (pid != -1);
+  }
+  return FALSE;
+}
+
+/* runs the accumulated -exec ... {} + command in el[n] */
+bool_t flush_batch_exec(explist_t *el, int n, procpool_t *pp,
+			stringlist_t *tmp) {
+  exp_t *x, *f;
+  int i;
+  bool_t ok = TRUE;
+  if( el && pp && tmp ) {
+    x = get_explist(el, n);
+    if( x && (x->batch.num > 0) ) {
+      reset_stringlist(tmp);
+      /* all but the last argument {} are constant */
+      for(i = n + 1; i < x->arg.integer - 1; i++) {
+	f = get_explist(el, i);
+	add_stringlist(tmp, f->arg.string, STRINGLIST_DONTFREE);
+      }
+      for(i = 0; i < x->batch.num; i++) {
+	add_stringlist(tmp, x->batch.list[i], STRINGLIST_DONTFREE);
+      }
+      ok = run_exec(pp, argv_stringlist(tmp), NULL, NULL, &x->files, FALSE);
+      reset_stringlist(&x->batch);
+      x->batchlen = 0;
+    }
+  }
+  return ok;
+}
+
+bool_t flush_all_batch_exec(explist_t *el, procpool_t *pp,
+			    stringlist_t *tmp) {
+  exp_t *e;
+  int n;
+  bool_t ok = TRUE;
+  if( el ) {
+    for(n = 0; n < el->num; n++) {
+      e = get_explist(el, n);
+      if( (e->id == EXEC) || (e->id == EXECNODE) ) {
+	ok &= flush_batch_exec(el, n, pp, tmp);
+      }
+    }
+  }
+  return ok;
+}
+
+/* remember the node for later, the command is run once enough nodes
+ * have accumulated. Always TRUE, like find(1). 
+ */
+bool_t batch_exec(explist_t *el, findnode_t *node, tempcollect_t *sav,
+		  int n, procpool_t *pp, stringlist_t *tmp, 
+		  bool_t relative) {
+  exp_t *x, *f;
+  const char *a;
+  if( el && node ) {
+    x = get_explist(el, n);
+    f = get_explist(el, x->arg.integer - 1);
+    if( f->id == SUBF ) {
+      a = create_xml_tempfile(node, sav, relative);
+      x->batchlen += strlen(a) + 1;
+      add_stringlist(&x->batch, a, STRINGLIST_STRDUP);
+      /* now the batch owns the file */
+      add_stringlist(&x->files, a, STRINGLIST_STRDUP);
+      free_cstring(&node->xml.file);
+    } else {
+      a = relative ? p_cstring(&node->basename) : p_cstring(&node->path);
+      x->batchlen += strlen(a) + 1;
+      add_stringlist(&x->batch, a, STRINGLIST_STRDUP);
+    }
+    if( (x->batch.num >= FIND_BATCH_ARGS) || 
+	(x->batchlen >= FIND_BATCH_BYTES) ) {
+      flush_batch_exec(el, n, pp, tmp);
+    }
+    return TRUE;
+  }
+  return FALSE;
+}
+
 bool_t action_exec(explist_t *el, findnode_t *node, tempcollect_t *sav,
-		   int nstart, int nstop, stringlist_t *tmp, 
-		   bool_t relative) {
-  const char *filename, *a;
+		   int nstart, int nstop, procpool_t *pp,
+		   stringlist_t *tmp, bool_t relative) {
+  const char *a;
   char *p;
   exp_t *f;
   int n;
   if( el && node && tmp ) {
+    if( get_explist(el, nstop)->id == PLUS ) {
+      return batch_exec(el, node, sav, nstart - 1, pp, tmp, relative);
+    }
     reset_stringlist(tmp);
     f = get_explist(el, nstart);    
-    filename = f->arg.string;  
     /* zeroth arg is filename */
     add_stringlist(tmp, f->arg.string, STRINGLIST_DONTFREE);
     for(n = nstart + 1; n < nstop; n++) {
@@ -664,13 +899,13 @@ bool_t action_exec(explist_t *el, findnode_t *node, tempcollect_t *sav,
       }
 
     }
-    return exec_cmdline(filename, argv_stringlist(tmp));
+    return run_exec(pp, argv_stringlist(tmp), node, sav, NULL, relative);
   }
   return FALSE;
 }
 
 bool_t eval_expressions(explist_t *el, findnode_t *node, tempcollect_t *sav,
-			int n, int nstop, stringlist_t *tmp) {
+			int n, int nstop, procpool_t *pp, stringlist_t *tmp) {
   exp_t *e;
   bool_t ok = TRUE;
   /* printf("eval_expressions %d %d\n", n, nstop); */
@@ -682,7 +917,7 @@ bool_t eval_expressions(explist_t *el, findnode_t *node, tempcollect_t *sav,
 	break;
       }
       if( e->id == OPEN ) {
-	ok &= eval_expressions(el, node, sav, n + 1, e->arg.integer, tmp);
+	ok &= eval_expressions(el, node, sav, n + 1, e->arg.integer, pp, tmp);
 	n = e->arg.integer;
       } else if( e->id == CLOSE ) {
 	n++;
@@ -699,21 +934,21 @@ bool_t eval_expressions(explist_t *el, findnode_t *node, tempcollect_t *sav,
 	/* implicit */
 	n++;
       } else if( e->id == OR ) {
-	ok = (ok || eval_expressions(el, node, sav, n + 1, nstop, tmp));
+	ok = (ok || eval_expressions(el, node, sav, n + 1, nstop, pp, tmp));
 	n = nstop;
       } else if( e->id == NOT ) {
-	ok &= !eval_expressions(el, node, sav, n + 1, e->arg.integer, tmp);
+	ok &= !eval_expressions(el, node, sav, n + 1, e->arg.integer, pp, tmp);
 	n = e->arg.integer;
       } else if( e->id == PRINT ) {
 	ok &= action_print(node);
 	n++;
       } else if( e->id == EXEC ) {
-	ok &= action_exec(el, node, sav, n + 1, e->arg.integer, tmp, FALSE);
+	ok &= action_exec(el, node, sav, n + 1, e->arg.integer, pp, tmp, FALSE);
 	n = e->arg.integer;
       } else if( e->id == EXECNODE ) {
-	ok &= action_exec(el, node, sav, n + 1, e->arg.integer, tmp, TRUE);
+	ok &= action_exec(el, node, sav, n + 1, e->arg.integer, pp, tmp, TRUE);
 	n = e->arg.integer;
-      } else if( e->id == SEMIC ) {
+      } else if( (e->id == SEMIC) || (e->id == PLUS) ) {
 	n++;
       } else if( e->id == NAME ) {
 	ok &= globmatch(begin_cstring(&node->basename), 
@@ -739,13 +974,14 @@ bool_t eval_expressions(explist_t *el, findnode_t *node, tempcollect_t *sav,
 }
 
 bool_t process_available_nodes(findnodelist_t *fnl, explist_t *el, 
-			       tempcollect_t *sav, stringlist_t *tmp) {
+			       tempcollect_t *sav, procpool_t *pp,
+			       stringlist_t *tmp) {
   int i;
   findnode_t *f;
   if( fnl && el && sav ) {
     for(i = 0; i < fnl->num; i++) {
       f = get_findnodelist(fnl, i);
-      eval_expressions(el, f, sav, 0, el->num, tmp);
+      eval_expressions(el, f, sav, 0, el->num, pp, tmp);
     }
     reset_findnodelist(fnl);
     reset_tempcollect(sav);
@@ -799,7 +1035,7 @@ result_t start_tag(void *user, const char_t *name, const char_t **att) {
 
     if( !checkflag(pinfo->flags,FIND_FLAG_DELAYNODES) ) {
       process_available_nodes(&pinfo->nodes, &pinfo->expressions, 
-			      &pinfo->sav, &pinfo->tmp);
+			      &pinfo->sav, &pinfo->jobs, &pinfo->tmp);
     }
 
     pinfo->savd++;
@@ -822,7 +1058,7 @@ result_t end_tag(void *user, const char_t *name) {
 
     if( pinfo->savd <= 0 ) {
       process_available_nodes(&pinfo->nodes, &pinfo->expressions, 
-			      &pinfo->sav, &pinfo->tmp);
+			      &pinfo->sav, &pinfo->jobs, &pinfo->tmp);
     }
   }
   return PARSER_OK|PARSER_DEFAULT;
@@ -860,6 +1096,7 @@ bool_t create_parserinfo_find(parserinfo_find_t *pinfo) {
     /* pinfo->std.setup.cb.attribute = attribute; */
 
     ok &= create_findnodelist(&pinfo->nodes);
+    ok &= create_procpool(&pinfo->jobs, 1);
     ok &= create_tempcollect(&pinfo->sav, "sav", MINVARSIZE, MAXVARSIZE);
     ok &= create_explist(&pinfo->expressions);
     ok &= create_stringlist(&pinfo->tmp);
@@ -871,6 +1108,7 @@ bool_t create_parserinfo_find(parserinfo_find_t *pinfo) {
 bool_t free_parserinfo_find(parserinfo_find_t *pinfo) {
   free_stdparserinfo(&pinfo->std);
   free_findnodelist(&pinfo->nodes);
+  free_procpool(&pinfo->jobs);
   free_tempcollect(&pinfo->sav);
   free_explist(&pinfo->expressions);
   free_stringlist(&pinfo->tmp);
@@ -885,6 +1123,8 @@ int main(int argc, char **argv) {
   struct option longopts[] = {
     { "version", 0, NULL, FIND_VERSION },
     { "help", 0, NULL, FIND_HELP },
+    { "stats", 2, NULL, STATS_OPTION },
+    { "progress", 2, NULL, PROGRESS_OPTION },
     { 0 }
   };
 
@@ -901,16 +1141,22 @@ int main(int argc, char **argv) {
       set_option_find(op, optarg);
     }
 
-    init_signal_handling(SIGNALS_NOCHLD); /* for exec_cmdline */
+    parse_expressions(&pinfo, argv + fe);
+
+    /* exec_cmdline waits for its child, parallel jobs use CMD_CHLD */
+    init_signal_handling((pinfo.jobs.maxprocs > 1) ? 
+			 SIGNALS_DEFAULT : SIGNALS_NOCHLD);
     init_file_handling();
     init_tempfile_handling();
 
-    parse_expressions(&pinfo, argv + fe);
-
     open_stdout();
 
     stdparse(fe - 1, argv + optind, (stdparserinfo_t *)&pinfo);
 
+    flush_all_batch_exec(&pinfo.expressions, &pinfo.jobs, &pinfo.tmp);
+    reap_procpool(&pinfo.jobs, 1);
+    finish_jobs_find(&pinfo.jobs);
+
     close_stdout();
 
     exit_tempfile_handling();
@@ -32,6 +32,8 @@
 #include "stringlist.h"
 #include "mem.h"
 #include "htfilter.h"
+#include "intern.h"
+#include "stats.h"
 
 #include <string.h>
 #include <getopt.h>
@@ -158,6 +160,7 @@ typedef struct {
 "Aggressively fix tags and entities in FILE or standard input,\n" \
 "printing a well formed XML document on standard output.\n" \
 "\n" \
+"      --stats[=json]  print resource statistics on exit\n" \
 "      --help    display this help and exit\n" \
 "      --version display version information and exit\n"
 
@@ -176,6 +179,9 @@ int set_option(int op, char *optarg) {
     puts(FIXTAGS_USAGE0);
     exit(EXIT_SUCCESS);
     break;
+  case STATS_OPTION:
+    set_stats(optarg);
+    break;
   case FIXTAGS_WRAP:
     setflag(&u_options,FIXTAGS_FLAG_WRAP);
     break;
@@ -1738,6 +1744,7 @@ int main(int argc, char **argv) {
     { "root-wrap", 0, NULL, FIXTAGS_WRAP },
     { "html", 0, NULL, FIXTAGS_HTML },
     { "xml", 0, NULL, FIXTAGS_XML },
+    { "stats", 2, NULL, STATS_OPTION },
     { 0 }
   };
 
@@ -1772,6 +1779,7 @@ int main(int argc, char **argv) {
     exit_signal_handling();
 
     free_fixtagsinfo(&ftinfo);
+    exit_intern();
   }
   return exit_value;
 }
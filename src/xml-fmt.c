@@ -28,6 +28,7 @@
 #include "entities.h"
 #include "stdprint.h"
 #include "mysignal.h"
+#include "stats.h"
 
 #include <string.h>
 #include <getopt.h>
@@ -55,6 +56,8 @@ typedef struct {
 "Usage: xml-fmt [OPTION]... [FILE]\n" \
 "Reformat each node in FILE(s), or standard input.\n" \
 "\n" \
+"      --stats[=json]  print resource statistics on exit\n" \
+"      --progress[=N]  report progress on stderr every N seconds\n" \
 "      --help     display this help and exit\n" \
 "      --version  display version information and exit\n"
 
@@ -68,6 +71,12 @@ void set_option_fmt(int op, char *optarg) {
     puts(FMT_USAGE);
     exit(EXIT_SUCCESS);
     break;
+  case STATS_OPTION:
+    set_stats(optarg);
+    break;
+  case PROGRESS_OPTION:
+    set_progress(optarg);
+    break;
   }
 }
 
@@ -181,6 +190,8 @@ int main(int argc, char **argv) {
   struct option longopts[] = {
     { "version", 0, NULL, FMT_VERSION },
     { "help", 0, NULL, FMT_HELP },
+    { "stats", 2, NULL, STATS_OPTION },
+    { "progress", 2, NULL, PROGRESS_OPTION },
     { 0 }
   };
 
@@ -30,6 +30,7 @@
 #include "stringlist.h"
 #include "entities.h"
 #include "mysignal.h"
+#include "stats.h"
 
 #include <string.h>
 #include <getopt.h>
@@ -116,6 +117,8 @@ typedef struct {
 "Usage: xml-grep [OPTION] PATTERN [[FILE]... [:XPATH]...]...\n" \
 "Print those XML nodes matching PATTERN in given FILE(s), or standard input.\n" \
 "\n" \
+"      --stats[=json]  print resource statistics on exit\n" \
+"      --progress[=N]  report progress on stderr every N seconds\n" \
 "      --help     display this help and exit\n" \
 "      --version  display version information and exit\n"
 
@@ -143,6 +146,12 @@ void set_option_grep(int op, char *optarg, stringlist_t *patterns) {
     puts(GREP_USAGE);
     exit(EXIT_SUCCESS);
     break;
+  case STATS_OPTION:
+    set_stats(optarg);
+    break;
+  case PROGRESS_OPTION:
+    set_progress(optarg);
+    break;
   case 'v':
   case GREP_INVERT:
     setflag(&u_options, GREP_FLAG_INVERT);
@@ -629,6 +638,8 @@ int main(int argc, char **argv) {
     { "extended-regexp", 0, NULL, GREP_EXTEND },
     { "subtree", 0, NULL, GREP_SUBTREE },
     { "attributes", 0, NULL, GREP_ATTRIBUTES },
+    { "stats", 2, NULL, STATS_OPTION },
+    { "progress", 2, NULL, PROGRESS_OPTION },
     { 0 }
   };
 
@@ -29,6 +29,7 @@
 #include "stdprint.h"
 #include "mem.h"
 #include "mysignal.h"
+#include "stats.h"
 
 #include <string.h>
 #include <getopt.h>
@@ -42,14 +43,16 @@ extern char *inputfile;
 extern long inputline;
 
 extern volatile flag_t cmd;
+extern const char_t xpath_delims[];
 
 #include <stdio.h>
 
 typedef struct {
   stdparserinfo_t std; /* must be first so we can cast correctly */
   flag_t flags;
-  long int maxc, maxl, maxt;
+  long int maxc, maxl, maxt, maxb;
   long int c, l, t;
+  bool_t done; /* the open tags were closed, nothing more is printed */
 } parserinfo_head_t;
 
 #define HEAD_VERSION    0x01
@@ -57,16 +60,24 @@ typedef struct {
 #define HEAD_CHARS      0x03
 #define HEAD_LINES      0x04
 #define HEAD_TAGS       0x05
+#define HEAD_BYTES      0x06
 #define HEAD_USAGE \
 "Usage: xml-head [OPTION]... [FILE]\n" \
 "Reformat each node in FILE(s), or standard input.\n" \
 "\n" \
+"  -c, --chars=N  print at most N characters of each line of text\n" \
+"  -n, --lines=N  print at most N lines of text in each node\n" \
+"  -t, --tags=N   print at most N tags\n" \
+"      --bytes=N  stop reading the input after N bytes\n" \
+"      --stats[=json]  print resource statistics on exit\n" \
+"      --progress[=N]  report progress on stderr every N seconds\n" \
 "      --help     display this help and exit\n" \
 "      --version  display version information and exit\n"
 
 #define HEAD_FLAG_CHARS 0x01
 #define HEAD_FLAG_LINES 0x02
 #define HEAD_FLAG_TAGS  0x04
+#define HEAD_FLAG_BYTES 0x08
 
 void set_option_head(int op, char *optarg, parserinfo_head_t *pinfo) {
   switch(op) {
@@ -78,6 +89,12 @@ void set_option_head(int op, char *optarg, parserinfo_head_t *pinfo) {
     puts(HEAD_USAGE);
     exit(EXIT_SUCCESS);
     break;
+  case STATS_OPTION:
+    set_stats(optarg);
+    break;
+  case PROGRESS_OPTION:
+    set_progress(optarg);
+    break;
   case 'c':
   case HEAD_CHARS:
     setflag(&pinfo->flags, HEAD_FLAG_CHARS);
@@ -86,7 +103,7 @@ void set_option_head(int op, char *optarg, parserinfo_head_t *pinfo) {
     break;
   case 'n':
   case HEAD_LINES:
-    setflag(&pinfo->flags, HEAD_FLAG_CHARS);
+    setflag(&pinfo->flags, HEAD_FLAG_LINES);
     pinfo->maxl = atol(optarg);
     break;
   case 't':
@@ -94,6 +111,10 @@ void set_option_head(int op, char *optarg, parserinfo_head_t *pinfo) {
     setflag(&pinfo->flags, HEAD_FLAG_TAGS);
     pinfo->maxt = atol(optarg) + 1;
     break;
+  case HEAD_BYTES:
+    setflag(&pinfo->flags, HEAD_FLAG_BYTES);
+    pinfo->maxb = atol(optarg);
+    break;
   default:
     break;
   }
@@ -116,9 +137,56 @@ long int set_obsolete_option(char *firstarg) {
   return n;
 }
 
+/* close the open tags, innermost first, reading the current path in
+ * place. If skip is set, the innermost tag was never printed.
+ * Labels that aren't tag names (eg chardata) are ignored.
+ */
+bool_t unwind_path(stdparserinfo_t *sp, bool_t skip) {
+  const char_t *begin, *p, *q;
+  if( sp ) {
+    begin = string_xpath(&sp->cp);
+    for(p = q = begin + strlen(begin); p > begin; q = p) {
+      while( (--p > begin) && (*p != *xpath_delims) ) { }
+      if( (q > p + 1) && !xml_isdigit(p[1]) ) {
+	if( !skip ) {
+	  puts_stdout("</");
+	  write_stdout((byte_t *)p + 1, q - p - 1);
+	  puts_stdout(">\n");
+	}
+	skip = FALSE;
+      }
+    }
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* closes the open tags, and makes the callbacks ignore the events
+   which expat still delivers after the abort, such as the end tag of
+   an empty element */
+result_t stop_head(parserinfo_head_t *pinfo, bool_t skip) {
+  unwind_path(&pinfo->std, skip);
+  pinfo->done = TRUE;
+  return PARSER_ABORT;
+}
+
+/* true if the current event starts beyond the input byte budget.
+   Once this happens, nothing more can be printed. The budget only
+   applies after the root start tag, so the output is always a
+   complete document, even if N ends in the prolog. */
+bool_t past_bytes(parserinfo_head_t *pinfo) {
+  long int b, e;
+  return checkflag(pinfo->flags,HEAD_FLAG_BYTES) && (pinfo->t > 0) &&
+    range_stdparse(&pinfo->std, &b, &e) && (b >= pinfo->maxb);
+}
+
 result_t start_tag(void *user, const char_t *name, const char_t **att) {
   parserinfo_head_t *pinfo = (parserinfo_head_t *)user;
-  if( pinfo ) { 
+  if( pinfo && !pinfo->done ) { 
+    if( past_bytes(pinfo) ) {
+      return stop_head(pinfo, TRUE);
+    }
+
     if( pinfo->std.depth > 0 ) {
       pinfo->c = 0;
       pinfo->l = 0;
@@ -127,7 +195,8 @@ result_t start_tag(void *user, const char_t *name, const char_t **att) {
 
     if( checkflag(pinfo->flags,HEAD_FLAG_TAGS) ) {
       if( (pinfo->maxt > -1) && (pinfo->t > pinfo->maxt) ) {
-	return PARSER_OK;
+	/* no tag can follow, so stop reading now */
+	return stop_head(pinfo, TRUE);
       }
     }
 
@@ -136,36 +205,20 @@ result_t start_tag(void *user, const char_t *name, const char_t **att) {
   return PARSER_OK;
 }
 
-bool_t unwind_path(stdparserinfo_t *sp) {
-  xpath_t path;
-  const char_t *name;
-  if( sp ) {
-    if( create_xpath(&path) ) {
-      copy_xpath(&path, &sp->cp);
-      do {
-	name = get_last_xpath(&path);
-	if( name && *name ) {
-	  write_end_tag_stdout(name);
-	  putc_stdout('\n');
-	}
-      } while( pop_xpath(&path) );
-    }
-    return TRUE;
-  }
-  return FALSE;
-}
-
 result_t end_tag(void *user, const char_t *name) {
   parserinfo_head_t *pinfo = (parserinfo_head_t *)user;
-  if( pinfo ) { 
+  if( pinfo && !pinfo->done ) { 
+    if( past_bytes(pinfo) ) {
+      return stop_head(pinfo, FALSE);
+    }
+
     pinfo->c = 0;
     pinfo->l = 0;
     pinfo->t++;
 
     if( checkflag(pinfo->flags,HEAD_FLAG_TAGS) ) {
       if( (pinfo->maxt > -1) && (pinfo->t > pinfo->maxt) ) {
-	unwind_path(&pinfo->std);
-	return PARSER_ABORT;
+	return stop_head(pinfo, FALSE);
       }
     }
 
@@ -209,7 +262,10 @@ bool_t print_chardata(const char_t *buf, size_t buflen,
 
 result_t chardata(void *user, const char_t *buf, size_t buflen) {
   parserinfo_head_t *pinfo = (parserinfo_head_t *)user;
-  if( pinfo ) { 
+  if( pinfo && !pinfo->done ) { 
+    if( past_bytes(pinfo) ) {
+      return stop_head(pinfo, FALSE);
+    }
     if( pinfo->std.depth == 0 ) {
 	write_coded_entities_stdout(buf, buflen);
     } else {
@@ -226,7 +282,10 @@ result_t chardata(void *user, const char_t *buf, size_t buflen) {
 
 result_t dfault(void *user, const char_t *data, size_t buflen) {
   parserinfo_head_t *pinfo = (parserinfo_head_t *)user;
-  if( pinfo ) { 
+  if( pinfo && !pinfo->done ) { 
+    if( past_bytes(pinfo) ) {
+      return stop_head(pinfo, FALSE);
+    }
     stdprint_dfault(&pinfo->std, data, buflen);
   }
   return PARSER_OK;
@@ -254,6 +313,7 @@ bool_t create_parserinfo_head(parserinfo_head_t *pinfo) {
     pinfo->maxc = -1;
     pinfo->maxl = -1;
     pinfo->maxt = -1;
+    pinfo->maxb = -1;
 
     return ok;
   }
@@ -272,8 +332,12 @@ int main(int argc, char **argv) {
   struct option longopts[] = {
     { "version", 0, NULL, HEAD_VERSION },
     { "help", 0, NULL, HEAD_HELP },
-    { "chars", 0, NULL, HEAD_CHARS },
-    { "tags", 0, NULL, HEAD_TAGS },
+    { "chars", 1, NULL, HEAD_CHARS },
+    { "lines", 1, NULL, HEAD_LINES },
+    { "tags", 1, NULL, HEAD_TAGS },
+    { "bytes", 1, NULL, HEAD_BYTES },
+    { "stats", 2, NULL, STATS_OPTION },
+    { "progress", 2, NULL, PROGRESS_OPTION },
     { 0 }
   };
 
@@ -295,7 +359,8 @@ int main(int argc, char **argv) {
     }
 
     if( !checkflag(pinfo.flags, 
-		   HEAD_FLAG_TAGS|HEAD_FLAG_LINES|HEAD_FLAG_CHARS) ) {
+		   HEAD_FLAG_TAGS|HEAD_FLAG_LINES|HEAD_FLAG_CHARS|
+		   HEAD_FLAG_BYTES) ) {
       setflag(&pinfo.flags, HEAD_FLAG_TAGS);
       pinfo.maxt = 10;
     }
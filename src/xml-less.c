@@ -27,6 +27,7 @@
 #include "io.h"
 #include "tempfile.h"
 #include "mysignal.h"
+#include "stats.h"
 
 #include <stdio.h>
 #include <getopt.h>
@@ -46,7 +47,9 @@ int u_options = 0;
 #define LESS_HELP       0x02
 #define LESS_USAGE \
 "Usage: xml-less [OPTION]... FILE\n" \
-"Interactively display the XML document contained in FILE on the terminal.\n"
+"Interactively display the XML document contained in FILE on the terminal.\n" \
+"\n" \
+"      --stats[=json]  print resource statistics on exit\n"
 
 void set_option(int op, char *optarg) {
   switch(op) {
@@ -57,6 +60,9 @@ void set_option(int op, char *optarg) {
   case LESS_HELP:
     puts(LESS_USAGE);
     break;
+  case STATS_OPTION:
+    set_stats(optarg);
+    break;
   }
 }
 
@@ -70,6 +76,7 @@ int main(int argc, char **argv) {
   struct option longopts[] = {
     { "version", 0, NULL, LESS_VERSION },
     { "help", 0, NULL, LESS_HELP },
+    { "stats", 2, NULL, STATS_OPTION },
     { 0 }
   };
 
@@ -28,6 +28,7 @@
 #include "stdout.h"
 #include "stdparse.h"
 #include "mysignal.h"
+#include "stats.h"
 
 #include <string.h>
 #include <getopt.h>
@@ -56,14 +57,20 @@ typedef struct {
 #define LS_VERSION     0x01
 #define LS_HELP        0x02
 #define LS_ATTRIBUTES  0x03
+#define LS_SIZE        0x04
 #define LS_USAGE \
 "Usage: xml-ls [OPTION]... [[FILE]... [:XPATH]...]...\n" \
 "List structural information about the FILE(s), or standard input.\n" \
 "\n" \
-"      --help     display this help and exit\n" \
-"      --version  display version information and exit\n"
+"  -a, --attributes  show the attributes\n" \
+"  -s, --size        show the number of elements and bytes inside leaves\n" \
+"      --stats[=json]  print resource statistics on exit\n" \
+"      --progress[=N]  report progress on stderr every N seconds\n" \
+"      --help        display this help and exit\n" \
+"      --version     display version information and exit\n"
 
 #define LS_FLAG_ATTRIBUTES 0x01
+#define LS_FLAG_SIZE       0x02
 
 void set_option_ls(int op, char *optarg, parserinfo_ls_t *pinfo) {
   switch(op) {
@@ -75,10 +82,20 @@ void set_option_ls(int op, char *optarg, parserinfo_ls_t *pinfo) {
     puts(LS_USAGE);
     exit(EXIT_SUCCESS);
     break;
+  case STATS_OPTION:
+    set_stats(optarg);
+    break;
+  case PROGRESS_OPTION:
+    set_progress(optarg);
+    break;
   case 'a':
   case LS_ATTRIBUTES:
     setflag(&pinfo->flags,LS_FLAG_ATTRIBUTES);
     break;
+  case 's':
+  case LS_SIZE:
+    setflag(&pinfo->flags,LS_FLAG_SIZE);
+    break;
   }
 }
 
@@ -123,6 +140,11 @@ result_t start_tag(void *user, const char_t *name, const char_t **att) {
       /* also include the node position in original document */
 /*       nprintf_stdout(32, " pos=\"%d\"/>", pinfo->npos); */
       puts_stdout( (d < pinfo->pd) ? ">" : "/>");
+
+      /* nothing below a leaf is printed, so don't parse it */
+      if( d == pinfo->pd ) {
+	skip_stdparse(&pinfo->std);
+      }
     }
   }
   return PARSER_OK;
@@ -131,6 +153,7 @@ result_t start_tag(void *user, const char_t *name, const char_t **att) {
 result_t end_tag(void *user, const char_t *name) {
   parserinfo_ls_t *pinfo = (parserinfo_ls_t *)user;
   unsigned int d;
+  long elements, bytes;
   if( pinfo ) { 
     pinfo->contin = FALSE;
     d = pinfo->std.depth - pinfo->std.sel.mindepth;
@@ -140,6 +163,10 @@ result_t end_tag(void *user, const char_t *name) {
       puts_stdout("</");
       puts_stdout(name);
       putc_stdout('>');
+    } else if( (d == pinfo->pd) && checkflag(pinfo->flags,LS_FLAG_SIZE) &&
+	       skipped_stdparse(&pinfo->std, &elements, &bytes) ) {
+      nprintf_stdout(64, " <!-- %ld elements, %ld bytes -->", 
+		     elements, bytes);
     }
   }
   return PARSER_OK;
@@ -203,6 +230,9 @@ int main(int argc, char **argv) {
     { "version", 0, NULL, LS_VERSION },
     { "help", 0, NULL, LS_HELP },
     { "attributes", 0, NULL, LS_ATTRIBUTES },
+    { "size", 0, NULL, LS_SIZE },
+    { "stats", 2, NULL, STATS_OPTION },
+    { "progress", 2, NULL, PROGRESS_OPTION },
     { 0 }
   };
 
@@ -212,7 +242,7 @@ int main(int argc, char **argv) {
 
   if( create_parserinfo_ls(&pinfo) ) {
 
-    while( (op = getopt_long(argc, argv, "a",
+    while( (op = getopt_long(argc, argv, "as",
 			     longopts, NULL)) > -1 ) {
       set_option_ls(op, optarg, &pinfo);
     }
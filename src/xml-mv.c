@@ -33,6 +33,7 @@
 #include "rollback.h"
 #include "tempfile.h"
 #include "mysignal.h"
+#include "stats.h"
 
 #include <string.h>
 #include <getopt.h>
@@ -77,12 +78,19 @@ typedef struct {
 #define MV_PREPEND    0x04
 #define MV_REPLACE    0x05
 #define MV_APPEND     0x06
+#define MV_DURABLE    0x07
+#define MV_STATS      0x08
+#define MV_SPLICE     0x09
 #define MV_USAGE \
 "Usage: xml-mv [OPTION]... [[FILE]... [:XPATH]...]...\n" \
 "Reformat each node in FILE(s), or standard input.\n" \
 "\n" \
 "      --help     display this help and exit\n" \
-"      --version  display version information and exit\n"
+"      --version  display version information and exit\n" \
+"      --durability=LEVEL  with --write-files, none, batch or strict\n" \
+"      --stats[=json]  print file commit and resource statistics on exit\n" \
+"      --progress[=N]  report progress on stderr every N seconds\n" \
+"      --splice   with --write-files, only cut out the moved bytes\n"
 
 #define MV_FLAG_TARGET       0x01
 #define MV_FLAG_SEEN_STDOUT  0x02
@@ -102,6 +110,21 @@ void set_option_mv(int op, char *optarg, parserinfo_mv_t *pinfo) {
   case MV_FILES:
     setflag(&pinfo->rcm.flags, RCM_WRITE_FILES);
     break;
+  case MV_DURABLE:
+    if( !set_durability_with_rollback(optarg) ) {
+      errormsg(E_FATAL, "unknown durability %s (try --help).\n", optarg);
+    }
+    break;
+  case MV_STATS:
+    set_stats(optarg);
+    set_stats_report(print_stats_with_rollback);
+    break;
+  case PROGRESS_OPTION:
+    set_progress(optarg);
+    break;
+  case MV_SPLICE:
+    setflag(&pinfo->rcm.flags, RCM_RM_SPLICE);
+    break;
   case MV_PREPEND:
     setflag(&pinfo->rcm.flags, RCM_CP_PREPEND);
     break;
@@ -388,6 +411,10 @@ int main(int argc, char **argv) {
     { "prepend", 0, NULL, MV_PREPEND },
     { "replace", 0, NULL, MV_REPLACE },
     { "append", 0, NULL, MV_APPEND },
+    { "durability", 1, NULL, MV_DURABLE },
+    { "stats", 2, NULL, MV_STATS },
+    { "progress", 2, NULL, PROGRESS_OPTION },
+    { "splice", 0, NULL, MV_SPLICE },
     { 0 }
   };
 
@@ -33,10 +33,16 @@
 #include "tempfile.h"
 #include "mysignal.h"
 #include "objstack.h"
+#include "stats.h"
 
 #include <string.h>
 #include <getopt.h>
 
+#if HAVE_PTHREAD_H && HAVE_LIBPTHREAD
+#include <pthread.h>
+#define PASTE_WITH_THREADS 1
+#endif
+
 /* for option processing */
 extern char *optarg;
 extern int optind, opterr, optopt;
@@ -58,15 +64,38 @@ typedef struct {
 } fx_t;
 
 #define NODEREADER_TEMPORARY 0x01
+#define NODEREADER_DONE      0x02
+
+#if PASTE_WITH_THREADS
+/* With --threads, each nodereader_t parses on its own thread, and 
+ * hands every completed node to the main thread through a bounded
+ * queue. Slots are swapped rather than copied, so a tempcollect_t
+ * only ever belongs to one thread at a time.
+ */
+#define NODEQUEUE_SIZE 8
+
+typedef struct {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  tempcollect_t slot[NODEQUEUE_SIZE];
+  tempcollect_t out; /* owned by the main thread */
+  int head, num;
+  bool_t last; /* the final node has been queued */
+  bool_t stop; /* the main thread has given up */
+  bool_t running;
+} nodequeue_t;
+#endif
 
 typedef struct {
   stdparserinfo_t std; /* must be first */
-  enum {nr_nodata = 0, nr_ready, nr_stopped, nr_dead, nr_endofile} state;
-  stream_t strm;
-  parser_t parser;
+  stdpull_t pull;
   tempcollect_t sav;
   const char *xp[2];
   flag_t flags;
+#if PASTE_WITH_THREADS
+  nodequeue_t queue;
+#endif
 } nodereader_t;
 
 result_t start_tag(void *user, const char_t *name, const char_t **att) {
@@ -133,10 +162,16 @@ result_t dfault(void *user, const char_t *data, size_t buflen) {
 }
 
 
+#if PASTE_WITH_THREADS
+bool_t stop_nodequeue(nodereader_t *nr);
+#endif
+
 bool_t free_nodereader(nodereader_t *nr) {
   if( nr ) {
-    stdparse3_free(&nr->parser, &nr->std);
-    close_stream(&nr->strm);
+#if PASTE_WITH_THREADS
+    stop_nodequeue(nr);
+#endif
+    close_stdpull(&nr->pull);
     if( checkflag(nr->flags, NODEREADER_TEMPORARY) ) {
       remove_tempfile(nr->sav.name);
     }
@@ -152,7 +187,6 @@ bool_t create_nodereader(nodereader_t *nr, const char *filename, const char *xpa
     memset(nr, 0, sizeof(nodereader_t)); /* important */
     ok &= create_stdparserinfo(&nr->std);
     ok &= create_tempcollect(&nr->sav, filename, MINVARSIZE, MAXVARSIZE);
-    ok &= open_file_stream(&nr->strm, filename);
     if( ok ) {
 
       nr->std.setup.flags = STDPARSE_ALLNODES|STDPARSE_ALWAYS_CHARDATA;
@@ -161,7 +195,7 @@ bool_t create_nodereader(nodereader_t *nr, const char *filename, const char *xpa
       nr->std.setup.cb.chardata = chardata;
       nr->std.setup.cb.dfault = dfault;
 
-      ok &= stdparse3_create(&nr->parser, &nr->std);
+      ok &= open_stdpull(&nr->pull, &nr->std, filename);
       
       nr->xp[0] = xpath;
       ok &= setup_xpaths_stdselect(&nr->std.sel, nr->xp);
@@ -178,7 +212,114 @@ bool_t create_nodereader(nodereader_t *nr, const char *filename, const char *xpa
 }
 
 
-#define MAX_NR 16 /* max number of simultaneously open files */
+/* returns TRUE when stopped and there is more data to process */
+bool_t read_nodes(nodereader_t *nr) {
+  return nr && next_stdpull(&nr->pull, 0);
+}
+
+#if PASTE_WITH_THREADS
+/* worker side: swap the completed node in tc for an empty slot,
+   waiting while the queue is full. Returns FALSE if we must give up. */
+static bool_t push_nodequeue(nodequeue_t *q, tempcollect_t *tc, bool_t last) {
+  tempcollect_t tmp;
+  bool_t ok;
+  int i;
+  pthread_mutex_lock(&q->lock);
+  while( (q->num >= NODEQUEUE_SIZE) && !q->stop ) {
+    pthread_cond_wait(&q->cond, &q->lock);
+  }
+  ok = !q->stop;
+  if( ok ) {
+    i = (q->head + q->num) % NODEQUEUE_SIZE;
+    tmp = q->slot[i];
+    q->slot[i] = *tc;
+    *tc = tmp;
+    q->num++;
+    q->last = last;
+    pthread_cond_broadcast(&q->cond);
+  }
+  pthread_mutex_unlock(&q->lock);
+  return ok;
+}
+
+/* main side: the next node is left in q->out, which must be
+   reset after use. Like read_nodes(), returns TRUE if there is more. */
+static bool_t pop_nodequeue(nodequeue_t *q) {
+  tempcollect_t tmp;
+  bool_t more;
+  pthread_mutex_lock(&q->lock);
+  while( (q->num == 0) && !q->last ) {
+    pthread_cond_wait(&q->cond, &q->lock);
+  }
+  if( q->num > 0 ) {
+    tmp = q->out;
+    q->out = q->slot[q->head];
+    q->slot[q->head] = tmp;
+    q->head = (q->head + 1) % NODEQUEUE_SIZE;
+    q->num--;
+    pthread_cond_broadcast(&q->cond);
+  }
+  more = !(q->last && (q->num == 0));
+  pthread_mutex_unlock(&q->lock);
+  return more;
+}
+
+static void *run_nodereader(void *user) {
+  nodereader_t *nr = (nodereader_t *)user;
+  bool_t more;
+  enter_stats_thread();
+  do {
+    more = read_nodes(nr);
+  } while( push_nodequeue(&nr->queue, &nr->sav, !more) && more );
+  return NULL;
+}
+
+bool_t start_nodequeue(nodereader_t *nr) {
+  nodequeue_t *q;
+  int i;
+  if( nr ) {
+    q = &nr->queue;
+    memset(q, 0, sizeof(nodequeue_t));
+    for(i = 0; i < NODEQUEUE_SIZE; i++) {
+      create_tempcollect(&q->slot[i], nr->sav.name, MINVARSIZE, MAXVARSIZE);
+    }
+    create_tempcollect(&q->out, nr->sav.name, MINVARSIZE, MAXVARSIZE);
+    setflag(&nr->pull.flags, STDPULL_DETACHED);
+    q->running = TRUE;
+    if( (pthread_mutex_init(&q->lock, NULL) != 0) ||
+	(pthread_cond_init(&q->cond, NULL) != 0) ||
+	(pthread_create(&q->thread, NULL, run_nodereader, nr) != 0) ) {
+      errormsg(E_FATAL, "cannot start a thread for %s\n", nr->pull.file);
+    }
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t stop_nodequeue(nodereader_t *nr) {
+  nodequeue_t *q;
+  int i;
+  if( nr && nr->queue.running ) {
+    q = &nr->queue;
+    pthread_mutex_lock(&q->lock);
+    q->stop = TRUE;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+    pthread_join(q->thread, NULL);
+    pthread_cond_destroy(&q->cond);
+    pthread_mutex_destroy(&q->lock);
+    for(i = 0; i < NODEQUEUE_SIZE; i++) {
+      free_tempcollect(&q->slot[i]);
+    }
+    free_tempcollect(&q->out);
+    q->running = FALSE;
+    return TRUE;
+  }
+  return FALSE;
+}
+#endif
+
+#define MAX_NR 64 /* max number of simultaneously open files */
 typedef struct {
   nodereader_t list[MAX_NR];
   int num;
@@ -228,18 +369,24 @@ typedef struct {
   nodereader_list_t nrl;
   enum {tab_start = 0, tab_end} tab;
 
+  flag_t flags;
 } parserinfo_paste_t;
 
 #define PASTE_VERSION    0x01
 #define PASTE_HELP       0x02
+#define PASTE_THREADS    0x03
 #define PASTE_USAGE \
 "Usage: xml-paste [OPTION]... [[FILE]... [:XPATH]...]...\n" \
 "Merge selected nodes of FILE(s) sequentially.\n" \
 "\n" \
+"      --threads  parse each input on its own thread\n" \
+"      --stats[=json]  print resource statistics on exit\n" \
+"      --progress[=N]  report progress on stderr every N seconds\n" \
 "      --help     display this help and exit\n" \
 "      --version  display version information and exit\n"
 
 #define PASTE_FLAG_TARGET   0x01
+#define PASTE_FLAG_THREADS  0x02
 
 
 void set_option_paste(int op, char *optarg, parserinfo_paste_t *pinfo) {
@@ -252,6 +399,19 @@ void set_option_paste(int op, char *optarg, parserinfo_paste_t *pinfo) {
     puts(PASTE_USAGE);
     exit(EXIT_SUCCESS);
     break;
+  case STATS_OPTION:
+    set_stats(optarg);
+    break;
+  case PROGRESS_OPTION:
+    set_progress(optarg);
+    break;
+  case PASTE_THREADS:
+#if PASTE_WITH_THREADS
+    setflag(&pinfo->flags, PASTE_FLAG_THREADS);
+#else
+    errormsg(E_WARNING, "compiled without thread support, ignoring --threads\n");
+#endif
+    break;
   }
 }
 
@@ -309,57 +469,24 @@ bool_t prepare_files(parserinfo_paste_t *pinfo) {
   return FALSE;
 }
 
-/* returns TRUE when stopped and there is more data to process */
-bool_t read_nodes(nodereader_t *nr) {
-  if( nr ) {
-    parser_t *parser = &nr->parser;
-    stream_t *strm = &nr->strm;
-
-    while( !checkflag(cmd,CMD_QUIT) ) {
-      switch(nr->state) {
-      case nr_nodata:
-	nr->state = read_stream(strm, getbuf_parser(parser, strm->blksize), 
-				strm->blksize) ? nr_ready : nr_endofile;
-	break;
-      case nr_ready:
-	if( do_parser(parser, strm->buflen) ) {
-	  nr->state = nr_nodata;
-	} else {
-	  stdparserinfo_t *std = &nr->std;
-	  if( (std->depth == 0) && (std->maxdepth > 0) ) {
-	    nr->state = nr_endofile;
-	    return FALSE;
-	  } 
-	  if( suspended_parser(parser) ) {
-	    nr->state = nr_stopped;
-	    return TRUE;
-	  }
-	  nr->state = nr_dead;
-	  errormsg(E_FATAL, 
-		   "%s: %s at line %d, column %d, "
-		   "byte %ld, depth %d\n",
-		   nr->sav.name, error_message_parser(parser),
-		   parser->cur.lineno, parser->cur.colno, 
-		   parser->cur.byteno, std->depth);
-	}
-	break;
-      case nr_stopped:
-	restart_parser(parser);
-	nr->state = nr_ready;
-	break;
-      case nr_dead:
-      case nr_endofile:
-	return FALSE;
-      }
-    }    
-    nr->state = nr_endofile;
+/* the next node of nr is left in *tc, which must be reset after use.
+   Returns TRUE when stopped and there is more data to process. */
+bool_t fetch_nodes(parserinfo_paste_t *pinfo, nodereader_t *nr, 
+		   tempcollect_t **tc) {
+#if PASTE_WITH_THREADS
+  if( checkflag(pinfo->flags, PASTE_FLAG_THREADS) ) {
+    *tc = &nr->queue.out;
+    return pop_nodequeue(&nr->queue);
   }
-  return FALSE;
+#endif
+  *tc = &nr->sav;
+  return read_nodes(nr);
 }
 
 bool_t paste_nodes(parserinfo_paste_t *pinfo, char *filename) {
-  flag_t active = 0;
-  int i, fd = -1;
+  int i, live, fd = -1;
+  nodereader_t *nr;
+  tempcollect_t *tc;
   if( pinfo ) {
 
     if( strcmp(filename, "stdout") != 0 ) {
@@ -375,25 +502,34 @@ bool_t paste_nodes(parserinfo_paste_t *pinfo, char *filename) {
     puts_stdout(get_open_root());
     putc_stdout('\n');
 
-    active = (1 << pinfo->nrl.num) - 1;
-    while( active ) {
+#if PASTE_WITH_THREADS
+    if( checkflag(pinfo->flags, PASTE_FLAG_THREADS) ) {
+      for(i = 0; i < pinfo->nrl.num; i++) {
+	start_nodequeue(&pinfo->nrl.list[i]);
+      }
+    }
+#endif
+
+    live = pinfo->nrl.num;
+    while( (live > 0) && !checkflag(cmd,CMD_QUIT) ) {
 
       pinfo->tab = tab_start; /* lazy print <tab> */
 
       for(i = 0; !checkflag(cmd,CMD_QUIT) && (i < pinfo->nrl.num); i++) {
-	if( active & (1<<i) ) {
-	  nodereader_t *nr = &pinfo->nrl.list[i];
-	  if( !read_nodes(nr) ) {
+	nr = &pinfo->nrl.list[i];
+	if( !checkflag(nr->flags, NODEREADER_DONE) ) {
+	  if( !fetch_nodes(pinfo, nr, &tc) ) {
 	    /* we're done with this file */
-	    active &= ~(1<<i);
+	    setflag(&nr->flags, NODEREADER_DONE);
+	    live--;
 	  }
-	  if( !is_empty_tempcollect(&nr->sav) ) {
+	  if( !is_empty_tempcollect(tc) ) {
 	    if( pinfo->tab == tab_start ) {
 	      write_start_tag_stdout(tabname, NULL, FALSE);
 	      pinfo->tab = tab_end;
 	    }
-	    write_stdout_tempcollect(&nr->sav);
-	    reset_tempcollect(&nr->sav);
+	    write_stdout_tempcollect(tc);
+	    reset_tempcollect(tc);
 	  }
 	}
       }
@@ -404,6 +540,12 @@ bool_t paste_nodes(parserinfo_paste_t *pinfo, char *filename) {
       }
     }
 
+#if PASTE_WITH_THREADS
+    for(i = 0; i < pinfo->nrl.num; i++) {
+      stop_nodequeue(&pinfo->nrl.list[i]);
+    }
+#endif
+
     puts_stdout(get_close_root());
     puts_stdout(get_footwrap());
     close_stdout();
@@ -422,11 +564,14 @@ int main(int argc, char **argv) {
   filelist_t fl;
   int f;
   fx_t fxn;
-  flag_t flags;
+  char *tmpname;
 
   struct option longopts[] = {
     { "version", 0, NULL, PASTE_VERSION },
     { "help", 0, NULL, PASTE_HELP },
+    { "threads", 0, NULL, PASTE_THREADS },
+    { "stats", 2, NULL, STATS_OPTION },
+    { "progress", 2, NULL, PROGRESS_OPTION },
     { 0 }
   };
 
@@ -459,18 +604,19 @@ int main(int argc, char **argv) {
 	    errormsg(E_FATAL, "unexpected stack corruption\n");
 	    break;
 	  }
-	  flags = (f >= pinfo.n) ? NODEREADER_TEMPORARY : 0;
-	  if( !add_nodereader_list(&pinfo.nrl, 
-				   fxn.filename, fxn.xpath, flags) ) {
-	    fxn.filename = make_template_tempfile(progname);
-	    fxn.xpath = tabpath;
-	    if( !push_objstack(&pinfo.fxstack, (byte_t *)&fxn, sizeof(fx_t)) ) {
-	      errormsg(E_FATAL, "stack push failure");
-	    }
-	    paste_nodes(&pinfo, (char *)fxn.filename); /* allow overwrite */
+	  if( pinfo.nrl.num >= MAX_NR ) {
+	    /* too many open files: paste them into a temporary file,
+	       which takes their place at the front, so the columns
+	       keep the order of the command line */
+	    tmpname = make_template_tempfile(progname);
+	    paste_nodes(&pinfo, tmpname); /* allow overwrite */
 	    reset_nodereader_list(&pinfo.nrl);
-	    f--; /* retry this path */
+	    if( !add_nodereader_list(&pinfo.nrl, tmpname, tabpath, 
+				     NODEREADER_TEMPORARY) ) {
+	      errormsg(E_FATAL, "cannot read temporary file %s\n", tmpname);
+	    }
 	  }
+	  add_nodereader_list(&pinfo.nrl, fxn.filename, fxn.xpath, 0);
 	}
 	paste_nodes(&pinfo, "stdout");
 
@@ -484,6 +630,7 @@ int main(int argc, char **argv) {
     }
 
     free_parserinfo_paste(&pinfo);
+    exit_stdpull();
   }
 
   return EXIT_SUCCESS;
@@ -27,6 +27,7 @@
 #include "xmatch.h"
 #include "xpredicate.h"
 #include "xattribute.h"
+#include "xautomaton.h"
 #include "tempcollect.h"
 #include "stringlist.h"
 #include "format.h"
@@ -36,6 +37,7 @@
 #include "tempvar.h"
 #include "cstring.h"
 #include "mysignal.h"
+#include "stats.h"
 
 extern const char_t xpath_magic[];
 
@@ -63,6 +65,7 @@ typedef struct {
   char_t fmt_type;
   char_t val_type;
   unsigned int mindepth;
+  unsigned long int stamp;
 } argstatus_t;
 
 typedef struct {
@@ -70,11 +73,22 @@ typedef struct {
   size_t count;
   size_t max;
   size_t mark;
+  /* indices of the active collectors, so we don't scan them all */
+  int *live;
+  int *next;
+  size_t nlive;
+  size_t nnext;
+  size_t maxlive;
+  unsigned long int stamp;
 } printf_args_t;
 
 bool_t create_printf_args(printf_args_t *pargs) {
   pargs->count = 0;
-  return create_mem(&pargs->status, &pargs->max, sizeof(argstatus_t), 16);      
+  pargs->nlive = 0;
+  pargs->stamp = 0;
+  return create_mem(&pargs->status, &pargs->max, sizeof(argstatus_t), 16) &&
+    create_mem(&pargs->live, &pargs->maxlive, sizeof(int), 16) &&
+    create_mem(&pargs->next, &pargs->maxlive, sizeof(int), 16);
 }
 
 void add_printf_args(printf_args_t *pargs, tempcollect_t *tc, const char_t *fmt) {
@@ -90,6 +104,7 @@ void add_printf_args(printf_args_t *pargs, tempcollect_t *tc, const char_t *fmt)
       as->active = FALSE;
       as->newline = FALSE;
       as->fmt = fmt;
+      as->stamp = 0;
 
       for(; fmt[0] && fmt[1]; fmt++);
       as->fmt_type = *fmt;
@@ -100,33 +115,28 @@ void add_printf_args(printf_args_t *pargs, tempcollect_t *tc, const char_t *fmt)
   }
 }
 
-bool_t find_printf_args(printf_args_t *pargs, const char_t *path, int *n) {
-  size_t i;
-  const char_t *p;
-  char_t *q;
-
-  if( pargs && path && n) {
-    for(i = pargs->mark; i < pargs->count; i++) {
-      p = pargs->status[i].tc->name;
-      q = strchr(p, *xpath_magic);
-      if( q ) {
-	q++;
-	if( strcmp(path, q) == 0) {
-	  *n = i;
-	  return TRUE;
-	}
-      }
-    }
-  }
-  return FALSE;
-}
-
-
 bool_t free_printf_args(printf_args_t *pargs) {
+  size_t m = pargs->maxlive;
   pargs->count = 0;
+  pargs->nlive = 0;
+  free_mem(&pargs->next, &m);
+  free_mem(&pargs->live, &pargs->maxlive);
   return free_mem(&pargs->status, &pargs->max);
 }
 
+/* make room for all the collectors in the live lists */
+bool_t grow_live_printf_args(printf_args_t *pargs) {
+  size_t m;
+  while( pargs->maxlive < pargs->count ) {
+    m = pargs->maxlive;
+    if( !grow_mem(&pargs->live, &pargs->maxlive, sizeof(int), 16) ||
+        !grow_mem(&pargs->next, &m, sizeof(int), 16) ) {
+      errormsg(E_FATAL, "out of memory\n");
+    }
+  }
+  return TRUE;
+}
+
 bool_t check_printf_args(printf_args_t *args) {
   size_t i;
   bool_t ok = TRUE;
@@ -157,6 +167,9 @@ typedef struct {
   xmatcher_t xm;
   xpredicatelist_t xp;
   xattributelist_t xa;
+  xautomaton_t xt; /* matches all xpaths of the current file at once */
+  int *fallback; /* xpaths which xt cannot handle */
+  size_t nfallback, maxfallback;
   tempvar_t tv; /* for text values */
   tempvar_t av; /* for attribute values */
 
@@ -164,19 +177,26 @@ typedef struct {
   stringlist_t fmt;
   charbuf_t pcs;
   printf_args_t args;
+  const char_t *record; /* print FORMAT whenever this node closes */
+  int recorddepth; /* depth of the open record node, or 0 */
 } parserinfo_printf_t;
 
 #define PRINTF_FLAG_ACTIVE   0x01
 #define PRINTF_FLAG_CHARDATA 0x02
+#define PRINTF_FLAG_RECORD   0x04
 
 #define PRINTF_VERSION       0x01
 #define PRINTF_HELP          0x02
+#define PRINTF_RECORD        0x03
 #define PRINTF_USAGE0 \
 "Usage: xml-printf [OPTION]... FORMAT [[FILE]... [:XPATH]...]...\n" \
 "Print the text value(s) of XPATH(s) according to FORMAT.\n" \
 "\n" \
+"      --stats[=json]  print resource statistics on exit\n" \
+"      --progress[=N]  report progress on stderr every N seconds\n" \
 "      --help     display this help and exit\n" \
 "      --version  display version information and exit\n" \
+"      --record=XPATH  print FORMAT each time a node XPATH closes\n" \
 "This command prints the string FORMAT only, but FORMAT can contain\n" \
 "C printf style formatting instructions which specify how subsequent\n" \
 "arguments are converted for output.\n"
@@ -190,7 +210,7 @@ typedef struct {
 "to SOURCE, or if omitted, relative to the XML document in standard input.\n" \
 "Only the text value of each XPATH is substituted.\n"
 
-void set_option_printf(int op, char *optarg) {
+void set_option_printf(int op, char *optarg, parserinfo_printf_t *pinfo) {
   switch(op) {
   case PRINTF_VERSION:
     puts("xml-printf" COPYBLURB);
@@ -201,6 +221,16 @@ void set_option_printf(int op, char *optarg) {
     puts(PRINTF_USAGE1);
     exit(EXIT_SUCCESS);
     break;
+  case STATS_OPTION:
+    set_stats(optarg);
+    break;
+  case PROGRESS_OPTION:
+    set_progress(optarg);
+    break;
+  case PRINTF_RECORD:
+    setflag(&pinfo->flags, PRINTF_FLAG_RECORD);
+    pinfo->record = (*optarg == *xpath_magic) ? optarg + 1 : optarg;
+    break;
   }
 }
 
@@ -306,10 +336,24 @@ void assign_file_collectors(parserinfo_printf_t *pinfo, const char *inputfile) {
 	}
       }
     }
-    /* now prepare */
+    /* now prepare. The collectors may have moved if the list grew */
+    for(w = 0; w < pinfo->args.count; w++) {
+      pinfo->args.status[w].tc = get_tclist(&pinfo->collectors, w);
+    }
+    reset_xautomaton(&pinfo->xt);
+    pinfo->nfallback = 0;
     for(w = pinfo->args.mark; w < pinfo->args.count; w++) {
       pinfo->args.status[w].active = FALSE;
+      if( !add_xautomaton(&pinfo->xt, pinfo->xm.xpath[w], w) ) {
+	if( (pinfo->nfallback >= pinfo->maxfallback) &&
+	    !grow_mem(&pinfo->fallback, &pinfo->maxfallback, sizeof(int), 16) ) {
+	  errormsg(E_FATAL, "out of memory\n");
+	}
+	pinfo->fallback[pinfo->nfallback++] = w;
+      }
     }
+    pinfo->args.nlive = 0;
+    grow_live_printf_args(&pinfo->args);
   }
 }
 
@@ -338,58 +382,107 @@ bool_t activate_collector(argstatus_t *as, parserinfo_printf_t *pinfo, bool_t ac
   return FALSE;
 }
 
+/* activates collector z unless it was already activated this round */
+void touch_collector(parserinfo_printf_t *pinfo, int z, char_t val_type) {
+  printf_args_t *pargs = &pinfo->args;
+  argstatus_t *as = &pargs->status[z];
+  if( as->stamp != pargs->stamp ) {
+    as->stamp = pargs->stamp;
+    activate_collector(as, pinfo, TRUE, val_type);
+    pargs->next[pargs->nnext++] = z;
+  }
+}
+
 /* activate/deactivate all collectors of interest.  
  * 
  * If attrib != NULL, then we take care to not activate/deactivate
  * chardata collectors, only attribute value collectors.
  * If attrib == NULL, then activation/deactivation applies to all 
  * types of collectors.
+ *
+ * The xpaths are matched by the automaton, which gives the collectors
+ * matching the current path at each depth, so only the collectors
+ * which are (or were) live are ever looked at. Xpaths the automaton
+ * cannot handle are matched one by one as before.
  */
 bool_t activate_collectors(parserinfo_printf_t *pinfo, const char_t *attrib) {
-  int w, z, m;
+  printf_args_t *pargs = &pinfo->args;
+  const int *b, *e;
+  int *swap;
+  int z, m;
+  size_t i;
+  unsigned int d;
   const xattribute_t *xa;
   const char_t *path;
-  bool_t v, tmatch, amatch, active = FALSE;
+  bool_t inside;
 
   if( pinfo ) {
-    for(z = pinfo->args.mark; z < pinfo->args.count; z++) {
-      path = string_xpath(&pinfo->std.cp);
-      m = match_no_att_no_pred_xpath(pinfo->xm.xpath[z], NULL, path);
-      v = valid_xpredicate(&pinfo->xp.list[z]);
-      xa = get_xattributelist(&pinfo->xa, z);
-      tmatch = (!attrib && !xa->begin && 
-		((m == 0) || (m == -1)) && v);
-      amatch = (attrib && xa->begin && xa->precheck && 
-		(m == 0) && v && match_xattribute(xa, attrib));
-
-      if( attrib && xa->begin ) { 
-	if( amatch ) {
-	  /* this collector must be activated */
-	  if( find_printf_args(&pinfo->args, 
-			       get_xmatcher(&pinfo->xm, z), &w) ) {
-	    activate_collector(&pinfo->args.status[w], pinfo, TRUE, 'a');
-	    active = TRUE;
+    pargs->stamp++;
+    pargs->nnext = 0;
+
+    /* outside of a record, every collector is deactivated below */
+    inside = !checkflag(pinfo->flags,PRINTF_FLAG_RECORD) || 
+      (pinfo->recorddepth > 0);
+
+    /* text collectors match at any depth, attributes only at the top */
+    for(d = attrib ? pinfo->std.depth : 1; 
+	inside && (d <= pinfo->std.depth); d++) {
+      if( get_done_xautomaton(&pinfo->xt, d, &b, &e) ) {
+	for(; b < e; b++) {
+	  z = *b;
+	  xa = get_xattributelist(&pinfo->xa, z);
+	  if( !valid_xpredicate(&pinfo->xp.list[z]) ) {
+	    continue;
+	  } else if( !attrib && !xa->begin ) {
+	    touch_collector(pinfo, z, 't');
+	  } else if( attrib && xa->begin && xa->precheck &&
+		     match_xattribute(xa, attrib) ) {
+	    touch_collector(pinfo, z, 'a');
 	  }
-	} else {
-	  /* this collector must be deactivated */
-	  activate_collector(&pinfo->args.status[z], pinfo, FALSE, 'a');
 	}
-      } else if( !attrib ) { 
-	if( tmatch ) {
-	  /* this collector must be activated */
-	  if( find_printf_args(&pinfo->args, 
-			       get_xmatcher(&pinfo->xm, z), &w) ) {
-	    activate_collector(&pinfo->args.status[w], pinfo, TRUE, 't');
-	    active = TRUE;
-	  }
+      }
+    }
+
+    if( inside && (pinfo->nfallback > 0) ) {
+      path = string_xpath(&pinfo->std.cp);
+      for(i = 0; i < pinfo->nfallback; i++) {
+	z = pinfo->fallback[i];
+	m = match_no_att_no_pred_xpath(pinfo->xm.xpath[z], NULL, path);
+	xa = get_xattributelist(&pinfo->xa, z);
+	if( !valid_xpredicate(&pinfo->xp.list[z]) ) {
+	  continue;
+	} else if( !attrib && !xa->begin && ((m == 0) || (m == -1)) ) {
+	  touch_collector(pinfo, z, 't');
+	} else if( attrib && xa->begin && xa->precheck && (m == 0) &&
+		   match_xattribute(xa, attrib) ) {
+	  touch_collector(pinfo, z, 'a');
+	}
+      }
+    }
+
+    m = pargs->nnext;
+    for(i = 0; i < pargs->nlive; i++) {
+      z = pargs->live[i];
+      if( pargs->status[z].stamp != pargs->stamp ) {
+	xa = get_xattributelist(&pinfo->xa, z);
+	if( attrib && !xa->begin ) {
+	  /* chardata collectors are left alone */
+	  pargs->next[pargs->nnext++] = z;
 	} else {
 	  /* this collector must be deactivated */
-	  activate_collector(&pinfo->args.status[z], pinfo, FALSE, 't');
+	  activate_collector(&pargs->status[z], pinfo, FALSE, 'a');
 	}
       }
     }
+
+    swap = pargs->live;
+    pargs->live = pargs->next;
+    pargs->next = swap;
+    pargs->nlive = pargs->nnext;
+
+    return (m > 0);
   }
-  return active;
+  return FALSE;
 }
 
 bool_t write_active_collectors(printf_args_t *pargs, tempvar_t *tv) {
@@ -402,8 +495,8 @@ bool_t write_active_collectors(printf_args_t *pargs, tempvar_t *tv) {
 
   if( pargs && tv && !is_empty_tempvar(tv) ) {
 
-    for(i = pargs->mark; i < pargs->count; i++) {
-      argstatus_t *as = &pargs->status[i];
+    for(i = 0; i < pargs->nlive; i++) {
+      argstatus_t *as = &pargs->status[pargs->live[i]];
       if( as->active && (as->val_type == *tv->tc.name) ) {
 	if( as->newline ) {
 	  /* printf("NEWLINE\n"); */
@@ -446,7 +539,11 @@ tempcollect_t *find_collector(parserinfo_printf_t *pinfo, int i) {
   if( pinfo ) {
     name = get_stringlist(&pinfo->cids, i);
     if( name ) {
-      tc = find_byname_tclist(&pinfo->collectors, name);
+      /* usually, the i-th collector is the one we want */
+      tc = get_tclist(&pinfo->collectors, i);
+      if( !tc || (strcmp(tc->name, name) != 0) ) {
+	tc = find_byname_tclist(&pinfo->collectors, name);
+      }
       if( !tc ) {
 	errormsg(E_FATAL, "cannot find data for %s\n", name);
       }
@@ -455,11 +552,87 @@ tempcollect_t *find_collector(parserinfo_printf_t *pinfo, int i) {
   return tc;
 }
 
+bool_t write_printf_collectors(parserinfo_printf_t *pinfo, bool_t reuse) {
+  size_t i;
+  const char_t *p, *q;
+  tempcollect_t *tc;
+  if( pinfo ) {
+    i = 0; 
+    do {
+      p = pinfo->format;
+      q = strpbrk(p, "%\\");
+      while( q ) {
+	write_stdout((byte_t *)p, q - p);
+	p = q + 1;
+	if( *q == '%' ) {
+	  q++;
+	  if( *q == '%' ) {
+	    putc_stdout('%');
+	  } else {
+	    tc = find_collector(pinfo, i);
+	    if( tc ) {
+	      write_stdout_tempcollect(tc);
+	    }
+	    p = skip_unescaped_delimiters(p, NULL, "sdfgu", '\0');
+	    i++;
+	  }
+	} else if( *q == '\\' ) {
+	  putc_stdout(convert_backslash(q));
+	}
+	p++;
+	q = strpbrk(p, "%\\");
+      }
+      puts_stdout(p);
+    } while( reuse && (i < pinfo->cids.num) );
+
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t write_printf_format(parserinfo_printf_t *pinfo, bool_t reuse) {
+  if( pinfo && check_printf_args(&pinfo->args) ) {
+    return write_printf_collectors(pinfo, reuse);
+  }
+  return FALSE;
+}
+
+/* In record mode, the collectors only ever hold the text of the
+ * current record, as nothing is collected outside of a record node.
+ * When the record closes, the collectors are printed and emptied,
+ * ready for the next record. A missing argument is not an error, it
+ * is simply printed as an empty string.
+ */
+bool_t flush_record_printf(parserinfo_printf_t *pinfo) {
+  argstatus_t *as;
+  size_t i;
+  bool_t ok;
+  if( pinfo ) {
+    write_active_collectors(&pinfo->args, &pinfo->tv);
+    ok = write_printf_collectors(pinfo, TRUE);
+    for(i = pinfo->args.mark; i < pinfo->args.count; i++) {
+      as = &pinfo->args.status[i];
+      reset_tempcollect(as->tc);
+      as->exists = FALSE;
+      as->newline = FALSE;
+    }
+    return ok;
+  }
+  return FALSE;
+}
+
 result_t start_tag(void *user, const char_t *name, const char_t **att) {
   parserinfo_printf_t *pinfo = (parserinfo_printf_t *)user;
   if( pinfo ) {
     update_xpredicatelist(&pinfo->xp, string_xpath(&pinfo->std.cp), att);
     update_xattributelist(&pinfo->xa, att);
+    push_tag_xautomaton(&pinfo->xt, pinfo->std.depth, name);
+    if( checkflag(pinfo->flags,PRINTF_FLAG_RECORD) && 
+	(pinfo->recorddepth == 0) &&
+	(match_no_att_no_pred_xpath(pinfo->record, NULL, 
+				    string_xpath(&pinfo->std.cp)) == 0) ) {
+      pinfo->recorddepth = pinfo->std.depth;
+    }
 
     clearflag(&pinfo->flags,PRINTF_FLAG_CHARDATA);
     write_active_collectors(&pinfo->args, &pinfo->tv);
@@ -476,6 +649,14 @@ result_t end_tag(void *user, const char_t *name) {
     write_active_collectors(&pinfo->args, &pinfo->tv);
     flipflag(&pinfo->flags, PRINTF_FLAG_ACTIVE, 
 	     activate_collectors(pinfo, NULL));
+    if( checkflag(pinfo->flags,PRINTF_FLAG_RECORD) &&
+	(match_no_att_no_pred_xpath(pinfo->record, NULL, 
+				    string_xpath(&pinfo->std.cp)) == 0) ) {
+      flush_record_printf(pinfo);
+      if( pinfo->recorddepth == pinfo->std.depth ) {
+	pinfo->recorddepth = 0;
+      }
+    }
   }
   return PARSER_OK;
 }
@@ -551,46 +732,6 @@ bool_t check_printf_format(parserinfo_printf_t *pinfo) {
   return FALSE;
 }
 
-bool_t write_printf_format(parserinfo_printf_t *pinfo, bool_t reuse) {
-  size_t i;
-  const char_t *p, *q;
-  tempcollect_t *tc;
-  if( pinfo ) {
-    if( check_printf_args(&pinfo->args) ) {
-      i = 0; 
-      do {
-	p = pinfo->format;
-	q = strpbrk(p, "%\\");
-	while( q ) {
-	  write_stdout((byte_t *)p, q - p);
-	  p = q + 1;
-	  if( *q == '%' ) {
-	    q++;
-	    if( *q == '%' ) {
-	      putc_stdout('%');
-	    } else {
-	      tc = find_collector(pinfo, i);
-	      if( tc ) {
-		write_stdout_tempcollect(tc);
-	      }
-	      p = skip_unescaped_delimiters(p, NULL, "sdfgu", '\0');
-	      i++;
-	    }
-	  } else if( *q == '\\' ) {
-	    putc_stdout(convert_backslash(q));
-	  }
-	  p++;
-	  q = strpbrk(p, "%\\");
-	}
-	puts_stdout(p);
-      } while( reuse && (i < pinfo->cids.num) );
-
-      return TRUE;
-    }
-  }
-  return FALSE;
-}
-
 bool_t create_parserinfo_printf(parserinfo_printf_t *pinfo) {
   bool_t ok = TRUE;
   if( pinfo ) {
@@ -610,6 +751,7 @@ bool_t create_parserinfo_printf(parserinfo_printf_t *pinfo) {
     ok &= create_xmatcher(&pinfo->xm);
     ok &= create_xpredicatelist(&pinfo->xp);
     ok &= create_xattributelist(&pinfo->xa);
+    ok &= create_xautomaton(&pinfo->xt);
     ok &= create_tempvar(&pinfo->tv, "t", MINVARSIZE, MAXVARSIZE);
     ok &= create_tempvar(&pinfo->av, "a", MINVARSIZE, MAXVARSIZE);
     ok &= create_tclist(&pinfo->collectors);
@@ -629,6 +771,8 @@ bool_t free_parserinfo_printf(parserinfo_printf_t *pinfo) {
     free_xmatcher(&pinfo->xm);
     free_xpredicatelist(&pinfo->xp);
     free_xattributelist(&pinfo->xa);
+    free_xautomaton(&pinfo->xt);
+    free_mem(&pinfo->fallback, &pinfo->maxfallback);
     free_tempvar(&pinfo->tv);
     free_tempvar(&pinfo->av);
     free_tclist(&pinfo->collectors);
@@ -647,6 +791,9 @@ int main(int argc, char **argv) {
   struct option longopts[] = {
     { "version", 0, NULL, PRINTF_VERSION },
     { "help", 0, NULL, PRINTF_HELP },
+    { "record", 1, NULL, PRINTF_RECORD },
+    { "stats", 2, NULL, STATS_OPTION },
+    { "progress", 2, NULL, PROGRESS_OPTION },
     { 0 }
   };
 
@@ -656,15 +803,20 @@ int main(int argc, char **argv) {
   inputfile = "";
   inputline = 0;
   
-  while( (op = getopt_long(argc, argv, "",
-			   longopts, NULL)) > -1 ) {
-    set_option_printf(op, optarg);
-  }
+  if( create_parserinfo_printf(&pinfo) ) {
 
-  init_signal_handling(SIGNALS_DEFAULT); 
-  init_file_handling();
+    while( (op = getopt_long(argc, argv, "",
+			     longopts, NULL)) > -1 ) {
+      set_option_printf(op, optarg, &pinfo);
+    }
 
-  if( create_parserinfo_printf(&pinfo) ) {
+    init_signal_handling(SIGNALS_DEFAULT); 
+    init_file_handling();
+
+    if( !argv[optind] ) {
+      puts(PRINTF_USAGE0);
+      exit(EXIT_FAILURE);
+    }
 
     if( !read_format(&pinfo, argv[optind++]) ) {
       errormsg(E_FATAL, "bad format string.\n");
@@ -683,11 +835,19 @@ int main(int argc, char **argv) {
       if( make_cids(&pinfo) ) {
 
 	unique_files(&pinfo);
+	if( checkflag(pinfo.flags,PRINTF_FLAG_RECORD) && 
+	    (pinfo.ufiles.num > 1) ) {
+	  errormsg(E_FATAL, "--record accepts only a single input file\n");
+	}
+
 	open_stdout();
 	if( stdparse2(pinfo.ufiles.num, pinfo.ufiles.list, 
 		      NULL /* no stdselect */, &pinfo.std) ) {
 
-	  if( write_printf_format(&pinfo, TRUE) ) {
+	  if( checkflag(pinfo.flags,PRINTF_FLAG_RECORD) ) {
+	    /* everything was printed while parsing */
+	    exit_value = EXIT_SUCCESS;
+	  } else if( write_printf_format(&pinfo, TRUE) ) {
 	    exit_value = EXIT_SUCCESS;
 	  }
 
@@ -697,10 +857,10 @@ int main(int argc, char **argv) {
       free_filelist(&fl);
     }
     free_parserinfo_printf(&pinfo);
-  }
 
-  exit_file_handling();
-  exit_signal_handling();
+    exit_file_handling();
+    exit_signal_handling();
+  }
 
   return exit_value;
 }
@@ -32,6 +32,7 @@
 #include "filelist.h"
 #include "tempfile.h"
 #include "mysignal.h"
+#include "stats.h"
 
 #include <string.h>
 #include <getopt.h>
@@ -57,17 +58,28 @@ typedef struct {
 
   rcm_t rcm;
   flag_t flags;
+  int jobs;
 } parserinfo_rm_t;
 
 #define RM_VERSION    0x01
 #define RM_HELP       0x02
 #define RM_FILES      0x03
+#define RM_JOBS       0x04
+#define RM_DURABLE    0x05
+#define RM_STATS      0x06
+#define RM_SPLICE     0x07
 #define RM_USAGE \
 "Usage: xml-rm [OPTION]... [[FILE]... [:XPATH]...]...\n" \
 "Remove nodes and print to standard output.\n" \
 "\n" \
 "      --help     display this help and exit\n" \
-"      --version  display version information and exit\n"
+"      --version  display version information and exit\n" \
+"      --write-files  modify the files in place\n" \
+"      --jobs=N   with --write-files, process N files at a time\n" \
+"      --splice   with --write-files, only cut out the removed bytes\n" \
+"      --durability=LEVEL  with --write-files, none, batch or strict\n" \
+"      --stats[=json]  print file commit and resource statistics on exit\n" \
+"      --progress[=N]  report progress on stderr every N seconds\n"
 
 #define RM_FLAG_SEEN_STDOUT  0x01
 #define RM_FLAG_WARN_STDOUT  0x01
@@ -86,6 +98,27 @@ void set_option_rm(int op, char *optarg, parserinfo_rm_t *pinfo) {
   case RM_FILES:
     setflag(&pinfo->rcm.flags, RCM_WRITE_FILES);
     break;
+  case RM_DURABLE:
+    if( !set_durability_with_rollback(optarg) ) {
+      errormsg(E_FATAL, "unknown durability %s (try --help).\n", optarg);
+    }
+    break;
+  case RM_STATS:
+    set_stats(optarg);
+    set_stats_report(print_stats_with_rollback);
+    break;
+  case PROGRESS_OPTION:
+    set_progress(optarg);
+    break;
+  case RM_SPLICE:
+    setflag(&pinfo->rcm.flags, RCM_RM_SPLICE);
+    break;
+  case RM_JOBS:
+    pinfo->jobs = atoi(optarg);
+    if( pinfo->jobs < 1 ) {
+      errormsg(E_FATAL, "bad number of jobs %s\n", optarg);
+    }
+    break;
   }
   }
 }
@@ -176,6 +209,7 @@ bool_t create_parserinfo_rm(parserinfo_rm_t *pinfo) {
     pinfo->std.setup.end_file_fun = end_file_fun;
 
     pinfo->flags = 0;
+    pinfo->jobs = 1;
 
     return ok;
   }
@@ -197,11 +231,17 @@ int main(int argc, char **argv) {
   signed char op;
   parserinfo_rm_t pinfo;
   filelist_t fl;
+  bool_t ok = TRUE;
 
   struct option longopts[] = {
     { "version", 0, NULL, RM_VERSION },
     { "help", 0, NULL, RM_HELP },
     { "write-files", 0, NULL, RM_FILES },
+    { "jobs", 1, NULL, RM_JOBS },
+    { "durability", 1, NULL, RM_DURABLE },
+    { "stats", 2, NULL, RM_STATS },
+    { "progress", 2, NULL, PROGRESS_OPTION },
+    { "splice", 0, NULL, RM_SPLICE },
     { 0 }
   };
 
@@ -244,8 +284,13 @@ int main(int argc, char **argv) {
       init_tempfile_handling();
       init_rollback_handling();
 
-      stdparse2(pinfo.n, pinfo.files, pinfo.xpaths,
-		(stdparserinfo_t *)&pinfo);
+      if( checkflag(pinfo.rcm.flags, RCM_WRITE_FILES) ) {
+	ok = parallel_stdparse2_rcm(pinfo.jobs, pinfo.n, pinfo.files, pinfo.xpaths,
+			       (stdparserinfo_t *)&pinfo);
+      } else {
+	stdparse2(pinfo.n, pinfo.files, pinfo.xpaths,
+		  (stdparserinfo_t *)&pinfo);
+      }
 
       exit_rollback_handling();
       exit_tempfile_handling();
@@ -260,5 +305,5 @@ int main(int argc, char **argv) {
 
 
 
-  return EXIT_SUCCESS;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -34,6 +34,7 @@
 #include "filelist.h"
 #include "stringlist.h"
 #include "mysignal.h"
+#include "stats.h"
 
 #include <string.h>
 #include <getopt.h>
@@ -76,6 +77,7 @@ typedef struct {
 #define SEDVM_FLAG_JOIN        0x08
 #define SEDVM_FLAG_OKSUB       0x10
 #define SEDVM_FLAG_NOAUTOEXEC  0x20
+#define SEDVM_FLAG_DIRTY       0x40 /* pattern space differs from leaf */
 
 bool_t create_sedvm(sedvm_t *vm) {
   bool_t ok = TRUE;
@@ -138,6 +140,8 @@ typedef struct {
 "Usage: xml-sed [OPTION]... SCRIPT [[FILE] [:XPATH]...]\n" \
 "For each leaf node in FILE or STDIN, perform basic text and XML transformations in SCRIPT.\n" \
 "\n" \
+"      --stats[=json]  print resource statistics on exit\n" \
+"      --progress[=N]  report progress on stderr every N seconds\n" \
 "      --help     display this help and exit\n" \
 "      --version  display version information and exit\n"
 
@@ -484,6 +488,31 @@ bool_t echo_relative(echo_t *echo, tempvar_t *output,
   return FALSE;
 }
 
+/* An unmodified leaf need not be unechoed and then parsed again
+   by echo_relative(). We already know its path, and the leafparser
+   has kept its chardata as XML, so we synchronize the echo_t path
+   directly and copy the chardata verbatim. This is only equivalent
+   if the echo_t isn't in some special state set by the script. */
+bool_t can_echo_verbatim(echo_t *echo) {
+  return echo && (echo->indentdepth == ECHO_INDENTNONE) &&
+    !checkflag(echo->flags, ECHO_FLAG_CDATA|ECHO_FLAG_COMMENT);
+}
+
+bool_t echo_verbatim(echo_t *echo, const xpath_t *path, tempcollect_t *raw,
+		     xpath_t *tmp) {
+  bool_t ok = TRUE;
+  if( echo && path && raw && tmp ) {
+    copy_xpath(tmp, &echo->xpath);
+    retarget_xpath(tmp, path);
+    ok &= open_relpath_stdout_echo(echo, tmp);
+    if( !is_empty_tempcollect(raw) ) {
+      ok &= write_stdout_tempcollect(raw);
+    }
+    return ok;
+  }
+  return FALSE;
+}
+
 int goto_label(sedvm_t *vm, const char_t *label) {
   int i = 0;
   sedcmd_t *c;
@@ -568,7 +597,7 @@ bool_t exec_sedvm(sedvm_t *vm, echo_t *output, tempvar_t *tmpvar,
 	pos = 0; 
 	while( exec_substitution(c, &pos, &vm->patternsp, tmpvar) ) { 
 	  swap_tempvar(tmpvar, &vm->patternsp);
-	  setflag(&vm->flags, SEDVM_FLAG_OKSUB);
+	  setflag(&vm->flags, SEDVM_FLAG_OKSUB|SEDVM_FLAG_DIRTY);
 	  if( !checkflag(c->flags, SED_FLAG_SUBSTITUTE_ALL) ) {
 	    break;
 	  }
@@ -577,7 +606,7 @@ bool_t exec_sedvm(sedvm_t *vm, echo_t *output, tempvar_t *tmpvar,
       case TRANSLITERATE:
 	if( exec_transliteration(c, &vm->patternsp, tmpvar) ) {
 	  swap_tempvar(tmpvar, &vm->patternsp);
-	  setflag(&vm->flags, SEDVM_FLAG_OKSUB);
+	  setflag(&vm->flags, SEDVM_FLAG_OKSUB|SEDVM_FLAG_DIRTY);
 	}
 	break;
       case TEST:
@@ -590,6 +619,7 @@ bool_t exec_sedvm(sedvm_t *vm, echo_t *output, tempvar_t *tmpvar,
 	return TRUE;
       case DELP:
 	reset_tempvar(&vm->patternsp);
+	setflag(&vm->flags, SEDVM_FLAG_DIRTY);
 	vm->ic = vm->commands.num; /* finish this cycle */
 	break;
       case PRINTP:
@@ -600,6 +630,7 @@ bool_t exec_sedvm(sedvm_t *vm, echo_t *output, tempvar_t *tmpvar,
 	break;
       case REPLACE:
 	reset_tempvar(&vm->patternsp);
+	setflag(&vm->flags, SEDVM_FLAG_DIRTY);
 	if( (line->typ != lt_last) && (c->address.id == INTERVAL) && 
 	    ( (line->no + 1) < c->address.args.range.line2 ) ) {
 	  /* don't change the ic, so on next cycle we start here */
@@ -629,13 +660,16 @@ bool_t exec_sedvm(sedvm_t *vm, echo_t *output, tempvar_t *tmpvar,
 	/* fall through */
       case PASTEHA:
 	puts_tempvar(&vm->patternsp, string_tempvar(&vm->holdsp));
+	setflag(&vm->flags, SEDVM_FLAG_DIRTY);
 	break;
       case SWAPH:
 	swap_tempvar(&vm->patternsp, &vm->holdsp);
+	setflag(&vm->flags, SEDVM_FLAG_DIRTY);
 	break;
       case NEXT:
 	ok &= echo_relative(output, &vm->patternsp, &output->tmpath, &vm->tmpath);
 	reset_tempvar(&vm->patternsp);
+	setflag(&vm->flags, SEDVM_FLAG_DIRTY);
 	vm->ic++;
 	setflag(&vm->flags, SEDVM_FLAG_NOAUTOEXEC);
 	return TRUE;
@@ -644,6 +678,7 @@ bool_t exec_sedvm(sedvm_t *vm, echo_t *output, tempvar_t *tmpvar,
 	break;
       case READF:
 	ok &= read_from_file_tempvar(&vm->patternsp, p_cstring(&c->args.file.name));
+	setflag(&vm->flags, SEDVM_FLAG_DIRTY);
 	break;
       case WRITEF:
 	ok &= write_to_file_tempvar(&vm->patternsp, p_cstring(&c->args.file.name),
@@ -656,6 +691,7 @@ bool_t exec_sedvm(sedvm_t *vm, echo_t *output, tempvar_t *tmpvar,
 	return TRUE;
       case DELJ:
 	del_echo_chunk(&vm->patternsp);
+	setflag(&vm->flags, SEDVM_FLAG_DIRTY);
 	break;
       case PRINTJ:
 	print_echo_chunk(vm, output, &vm->patternsp);
@@ -676,8 +712,12 @@ bool_t exec_sedvm(sedvm_t *vm, echo_t *output, tempvar_t *tmpvar,
   return FALSE;
 }
 
+/* if path and raw are not NULL, and the script didn't touch the pattern
+ * space, then the leaf is copied verbatim instead of echoed. 
+ */
 bool_t autoexec_sedvm(sedvm_t *vm, echo_t *output, tempvar_t *tmpvar,
-		      lineinfo_t *line) {
+		      lineinfo_t *line, const xpath_t *path, 
+		      tempcollect_t *raw) {
   bool_t ok = TRUE;
   int i;
   if( vm ) {
@@ -700,7 +740,10 @@ bool_t autoexec_sedvm(sedvm_t *vm, echo_t *output, tempvar_t *tmpvar,
       ok &= echo_relative(output, tmpvar, &output->tmpath, &vm->tmpath);
     }
 
-    if( !is_empty_tempvar(&vm->patternsp) ) {
+    if( path && raw && checkflag(vm->flags, SEDVM_FLAG_AUTOPRINT) &&
+	!checkflag(vm->flags, SEDVM_FLAG_DIRTY) && can_echo_verbatim(output) ) {
+      ok &= echo_verbatim(output, path, raw, &vm->tmpath);
+    } else if( !is_empty_tempvar(&vm->patternsp) ) {
       ok &= echo_relative(output, &vm->patternsp, &output->tmpath, &vm->tmpath);
     }
 
@@ -744,9 +787,11 @@ result_t do_leaf_node(void *user, unecho_t *ue) {
       if( !puts_tempvar(&pinfo->vm.patternsp, string_tempvar(&ue->sv)) ) {
 	errormsg(E_FATAL, "out of pattern space.\n");
       }
+      setflag(&pinfo->vm.flags, SEDVM_FLAG_DIRTY);
     } else {
       /* fast copy ue into patternsp */
       swap_tempvar(&pinfo->vm.patternsp, &ue->sv);
+      clearflag(&pinfo->vm.flags, SEDVM_FLAG_DIRTY);
     }
     /* use now obsolete ue as a temporary */
     tmp = &ue->sv;
@@ -763,7 +808,8 @@ result_t do_leaf_node(void *user, unecho_t *ue) {
 	list_pattern_stdout_sedvm(&pinfo->vm, &pinfo->lfp.line);
       }
 
-      autoexec_sedvm(&pinfo->vm, &pinfo->echo, tmp, &pinfo->lfp.line);
+      autoexec_sedvm(&pinfo->vm, &pinfo->echo, tmp, &pinfo->lfp.line,
+		     &pinfo->lfp.cp, &pinfo->lfp.raw);
 
     }
 
@@ -810,6 +856,7 @@ bool_t create_parserinfo_sed(parserinfo_sed_t *pinfo) {
     setflag(&pinfo->lfp.setup.flags,LFP_ABSOLUTE_PATH);
     setflag(&pinfo->lfp.setup.flags,LFP_ALWAYS_CHARDATA);
     setflag(&pinfo->lfp.setup.flags,LFP_ATTRIBUTES);
+    setflag(&pinfo->lfp.setup.flags,LFP_RAW_CHARDATA);
     clearflag(&pinfo->lfp.setup.flags,LFP_SKIP_EMPTY);
     
     setflag(&pinfo->lfp.setup.flags,LFP_PRE_OPEN);
@@ -864,6 +911,12 @@ void set_option_sed(int op, char *optarg, parserinfo_sed_t *pinfo) {
     puts(SED_USAGE);
     exit(EXIT_SUCCESS);
     break;
+  case STATS_OPTION:
+    set_stats(optarg);
+    break;
+  case PROGRESS_OPTION:
+    set_progress(optarg);
+    break;
   case SED_DEBUG:
     setflag(&pinfo->flags, SED_FLAG_DEBUG);
     break;
@@ -893,6 +946,8 @@ int main(int argc, char **argv) {
     { "help", 0, NULL, SED_HELP },
     { "unecho", 0, NULL, SED_DEBUG },
     { "non-empty", 0, NULL, SED_NONEMPTY },
+    { "stats", 2, NULL, STATS_OPTION },
+    { "progress", 2, NULL, PROGRESS_OPTION },
     { 0 }
   };
 
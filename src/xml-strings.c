@@ -26,6 +26,7 @@
 #include "stdout.h"
 #include "stdparse.h"
 #include "mysignal.h"
+#include "stats.h"
 
 #include <string.h>
 #include <getopt.h>
@@ -54,6 +55,8 @@ typedef struct {
 "Usage: xml-strings [OPTION]... [[FILE]... [:XPATH]...]...\n" \
 "Display textual strings in FILE(s), or standard input.\n" \
 "\n" \
+"      --stats[=json]  print resource statistics on exit\n" \
+"      --progress[=N]  report progress on stderr every N seconds\n" \
 "      --help     display this help and exit\n" \
 "      --version  display version information and exit\n"
 
@@ -71,6 +74,12 @@ void set_option_strings(int op, char *optarg, parserinfo_strings_t *pinfo) {
     puts(STRINGS_USAGE);
     exit(EXIT_SUCCESS);
     break;
+  case STATS_OPTION:
+    set_stats(optarg);
+    break;
+  case PROGRESS_OPTION:
+    set_progress(optarg);
+    break;
   case STRINGS_VERBATIM:
     clearflag(&pinfo->flags,STRINGS_FLAG_SQUEEZE);
     break;
@@ -164,6 +173,8 @@ int main(int argc, char **argv) {
     { "version", 0, NULL, STRINGS_VERSION },
     { "help", 0, NULL, STRINGS_HELP },
     { "no-squeeze", 0, NULL, STRINGS_VERBATIM },
+    { "stats", 2, NULL, STATS_OPTION },
+    { "progress", 2, NULL, PROGRESS_OPTION },
     { 0 }
   };
 
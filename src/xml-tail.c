@@ -0,0 +1,855 @@
+/*
+ * Copyright (C) 2009 Laird Breyer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * Author:   Laird Breyer <laird@lbreyer.com>
+ */
+
+#include "common.h"
+#include "fbparser.h"
+#include "cursor.h"
+#include "xpath.h"
+#include "io.h"
+#include "myerror.h"
+#include "stdout.h"
+#include "entities.h"
+#include "tempfile.h"
+#include "mysignal.h"
+#include "mem.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/wait.h>
+
+/* for option processing */
+extern char *optarg;
+extern int optind, opterr, optopt;
+
+extern char *progname;
+extern char *inputfile;
+extern long inputline;
+
+extern volatile flag_t cmd;
+
+typedef enum { m_none, m_start, m_end, m_empty, m_other } markup_t;
+
+/* stacked in place of the missing end tag of an element open at EOF */
+#define TAIL_OPENTAG(x) (-(x) - 2)
+#define TAIL_MAXOPEN    64
+
+/* The last records are found by scanning the file backwards from
+ * EOF, one block at a time, without running the XML parser. Then the
+ * prolog, the ancestors of the first record (a cursor) and the span
+ * of records are reparsed and printed verbatim. If the reparse does
+ * not agree with the backward scan, we fall back on a full forward
+ * parse to locate the records.
+ */
+typedef struct {
+  fbparser_t fbp;
+  flag_t flags;
+  long int maxn;    /* number of records to print */
+  int depth;        /* depth of the records, the root is at depth 0 */
+  int interval;     /* seconds between polls when following */
+  /* block cache for the backward scan */
+  off_t boff;
+  byte_t *bbegin, *bend;
+  /* where the records are */
+  char_t *rootname;
+  off_t rootoff;
+  off_t *anc;       /* ancestor start tags, depth entries */
+  off_t *ends;      /* end tags crossed by the backward scan */
+  size_t nends, maxends;
+  off_t opens[TAIL_MAXOPEN]; /* elements open at EOF, innermost first */
+  int nopen;
+  int low;          /* depth of the outermost ancestor found so far */
+  cursor_t cursor;  /* ancestors, then the first record */
+  off_t first;      /* start tag of the first record */
+  off_t span;       /* first byte printed after the ancestors */
+  off_t last;       /* end of the last record */
+  long int count;   /* number of records found */
+  /* forward parse fallback */
+  off_t *canc;
+  off_t *ring;
+  long int cur;
+  bool_t endrec;
+  /* reparsing */
+  position_t pos;
+  long int seen;
+  xpath_t path;     /* open tags */
+} parserinfo_tail_t;
+
+#define TAIL_VERSION    0x01
+#define TAIL_HELP       0x02
+#define TAIL_RECORDS    0x03
+#define TAIL_DEPTH      0x04
+#define TAIL_FOLLOW     0x05
+#define TAIL_SLEEP      0x06
+#define TAIL_USAGE \
+"Usage: xml-tail [OPTION]... [FILE]\n" \
+"Print the last records in FILE, or standard input.\n" \
+"\n" \
+"  -n, --records=N         print the last N records (default 10)\n" \
+"  -d, --depth=D           records are elements at depth D (default 1)\n" \
+"  -f, --follow            print new records as the file grows\n" \
+"  -s, --sleep-interval=S  with -f, check the file every S seconds\n" \
+"      --stats[=json]  print resource statistics on exit\n" \
+"      --help              display this help and exit\n" \
+"      --version           display version information and exit\n"
+
+#define TAIL_FLAG_FOLLOW 0x01
+
+void set_option_tail(int op, char *optarg, parserinfo_tail_t *pinfo) {
+  switch(op) {
+  case TAIL_VERSION:
+    puts("xml-tail" COPYBLURB);
+    exit(EXIT_SUCCESS);
+    break;
+  case TAIL_HELP:
+    puts(TAIL_USAGE);
+    exit(EXIT_SUCCESS);
+    break;
+  case STATS_OPTION:
+    set_stats(optarg);
+    break;
+  case 'n':
+  case TAIL_RECORDS:
+    pinfo->maxn = atol(optarg);
+    break;
+  case 'd':
+  case TAIL_DEPTH:
+    pinfo->depth = MAX(atoi(optarg), 0);
+    break;
+  case 'f':
+  case TAIL_FOLLOW:
+    setflag(&pinfo->flags, TAIL_FLAG_FOLLOW);
+    break;
+  case 's':
+  case TAIL_SLEEP:
+    pinfo->interval = MAX(atoi(optarg), 1);
+    break;
+  default:
+    break;
+  }
+}
+
+long int set_obsolete_option(char *firstarg) {
+  long int n = -1;
+  if( firstarg && (*firstarg == '-') ) {
+    firstarg++;
+    if( *firstarg ) {
+      n = atol(firstarg);
+      while( *firstarg && xml_isdigit(*firstarg) ) {
+	firstarg++;
+      }
+      if( *firstarg != '\0' ) {
+	n = -1;
+      }
+    }
+  }
+  return n;
+}
+
+/* byte at offset off, or -1. Only the current block is remembered here,
+ * the blockmanager caches the others.
+ */
+int getc_tail(parserinfo_tail_t *pinfo, off_t off) {
+  fbreader_t *fbr = &pinfo->fbp.reader;
+  if( (off < pinfo->boff) ||
+      (off >= pinfo->boff + (pinfo->bend - pinfo->bbegin)) ) {
+    pinfo->boff = off - (off % fbr->blksize);
+    if( !read_fileblockreader(fbr, pinfo->boff,
+			      &pinfo->bbegin, &pinfo->bend) ) {
+      pinfo->boff = 0;
+      pinfo->bbegin = pinfo->bend = NULL;
+      return -1;
+    }
+    if( off >= pinfo->boff + (pinfo->bend - pinfo->bbegin) ) {
+      return -1;
+    }
+  }
+  return pinfo->bbegin[off - pinfo->boff];
+}
+
+/* other reads can recycle the cached block */
+void forget_tail(parserinfo_tail_t *pinfo) {
+  pinfo->boff = 0;
+  pinfo->bbegin = pinfo->bend = NULL;
+}
+
+bool_t match_tail(parserinfo_tail_t *pinfo, off_t off, const char *s) {
+  if( off < 0 ) {
+    return FALSE;
+  }
+  for(; *s; s++, off++) {
+    if( getc_tail(pinfo, off) != (byte_t)*s ) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/* a comment, CDATA section or PI ending just before off. Its opening
+ * delimiter is searched backwards, so that a '<' inside is skipped.
+ */
+bool_t skip_back_tail(parserinfo_tail_t *pinfo, off_t off,
+		      const char *open, off_t *begin) {
+  off_t p;
+  for(p = off - strlen(open); p >= 0; p--) {
+    if( (getc_tail(pinfo, p) == '<') && match_tail(pinfo, p, open) ) {
+      *begin = p;
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/* identify the markup starting at '<', and find its end. Attribute
+ * values are skipped, since they can contain '>'.
+ */
+markup_t classify_tail(parserinfo_tail_t *pinfo, off_t off, off_t *end) {
+  int c, q = 0, prev = 0;
+  markup_t m;
+  c = getc_tail(pinfo, off + 1);
+  m = (c == '/') ? m_end : ((c == '!') || (c == '?')) ? m_other : m_start;
+  for(off++; (c = getc_tail(pinfo, off)) != -1; off++) {
+    if( q ) {
+      q = (c == q) ? 0 : q;
+    } else if( (m == m_start) && ((c == '"') || (c == '\'')) ) {
+      q = c;
+    } else if( c == '>' ) {
+      *end = off + 1;
+      return ((m == m_start) && (prev == '/')) ? m_empty : m;
+    }
+    prev = c;
+  }
+  return m_none;
+}
+
+/* find the markup preceding off, scanning backwards. Text cannot
+ * contain '<', so outside of comments, CDATA sections and PIs the
+ * nearest '<' starts the markup. Those three are recognized by
+ * their terminator and skipped whole.
+ */
+markup_t prev_markup_tail(parserinfo_tail_t *pinfo, off_t off,
+			  off_t *begin, off_t *end) {
+  off_t p;
+  int c;
+  for(p = off - 1; p >= 0; p--) {
+    c = getc_tail(pinfo, p);
+    if( c == '>' ) {
+      /* text may contain "-->" or "?>", so only trust the
+	 terminator if the opening delimiter exists */
+      *end = p + 1;
+      if( (match_tail(pinfo, p - 2, "]]>") &&
+	   skip_back_tail(pinfo, p - 2, "<![CDATA[", begin)) ||
+	  (match_tail(pinfo, p - 2, "-->") &&
+	   skip_back_tail(pinfo, p - 2, "<!--", begin)) ||
+	  (match_tail(pinfo, p - 1, "?>") &&
+	   skip_back_tail(pinfo, p - 1, "<?", begin)) ) {
+	return m_other;
+      }
+    } else if( c == '<' ) {
+      *begin = p;
+      return classify_tail(pinfo, p, end);
+    } else if( c == -1 ) {
+      break;
+    }
+  }
+  return m_none;
+}
+
+bool_t is_root_end_tail(parserinfo_tail_t *pinfo, off_t off) {
+  const char_t *s;
+  int c;
+  for(s = pinfo->rootname, off += 2; *s; s++, off++) {
+    if( getc_tail(pinfo, off) != (byte_t)*s ) {
+      return FALSE;
+    }
+  }
+  c = getc_tail(pinfo, off);
+  return (c == '>') || ((c != -1) && xml_whitespace(c));
+}
+
+/* TRUE if the root end tag is missing, as in a log which is still
+ * being written.
+ */
+bool_t unfinished_tail(parserinfo_tail_t *pinfo) {
+  off_t p, b = -1, e;
+  markup_t m;
+  p = pinfo->fbp.reader.size;
+  do {
+    m = prev_markup_tail(pinfo, p, &b, &e);
+    p = b;
+  } while( m == m_other );
+  return (m != m_none) && (b != pinfo->rootoff) &&
+    !((m == m_end) && is_root_end_tail(pinfo, b));
+}
+
+bool_t push_end_tail(parserinfo_tail_t *pinfo, off_t e) {
+  if( pinfo->nends >= pinfo->maxends ) {
+    if( !grow_mem(&pinfo->ends, &pinfo->maxends, sizeof(off_t), 16) ) {
+      return FALSE;
+    }
+  }
+  pinfo->ends[pinfo->nends++] = e;
+  return TRUE;
+}
+
+/* true if the start tag at b matches the stacked end tag e. An element
+ * which is still open at EOF has no end tag, and is matched by its own
+ * start tag only.
+ */
+bool_t same_name_tail(parserinfo_tail_t *pinfo, off_t b, off_t e) {
+  int c, d;
+  if( e < 0 ) {
+    return (b == TAIL_OPENTAG(e));
+  }
+  for(b++, e += 2; ; b++, e++) {
+    c = getc_tail(pinfo, b);
+    d = getc_tail(pinfo, e);
+    if( (c == -1) || !xml_namechar(c) ) {
+      return (d == -1) || !xml_namechar(d);
+    } else if( c != d ) {
+      return FALSE;
+    }
+  }
+}
+
+/* in an unfinished document, some elements have no end tag, and
+ * the depth at EOF is unknown. They are found by matching start and
+ * end tags backwards all the way to the root. This reads the whole
+ * file, but is still much cheaper than parsing it.
+ */
+bool_t find_open_tail(parserinfo_tail_t *pinfo) {
+  off_t p, b = -1, e = -1;
+  markup_t m;
+
+  pinfo->nends = 0;
+  p = pinfo->fbp.reader.size;
+  while( (m = prev_markup_tail(pinfo, p, &b, &e)) != m_none ) {
+    p = b;
+    if( m == m_end ) {
+      push_end_tail(pinfo, b);
+    } else if( m == m_start ) {
+      if( (pinfo->nends > 0) &&
+	  same_name_tail(pinfo, b, pinfo->ends[pinfo->nends - 1]) ) {
+	pinfo->nends--;
+      } else if( pinfo->nopen < TAIL_MAXOPEN ) {
+	pinfo->opens[pinfo->nopen++] = b;
+      } else {
+	return FALSE;
+      }
+      if( b == pinfo->rootoff ) {
+	break;
+      }
+    }
+  }
+  return (pinfo->nends == 0) && (pinfo->nopen > 0) &&
+    (pinfo->opens[pinfo->nopen - 1] == pinfo->rootoff);
+}
+
+/* walk backwards from EOF, stacking end tags, until maxn records are
+ * seen or we leave the parent of the last record. Then keep going to
+ * find each ancestor's start tag. The root is already known from
+ * find_root_tail().
+ */
+bool_t scan_records_tail(parserinfo_tail_t *pinfo) {
+  off_t p, b = -1, e = -1;
+  markup_t m;
+  int i;
+
+  pinfo->nends = 0;
+  for(i = pinfo->nopen - 1; i >= 0; i--) {
+    push_end_tail(pinfo, TAIL_OPENTAG(pinfo->opens[i]));
+  }
+
+  pinfo->count = 0;
+  pinfo->low = pinfo->depth;
+  p = pinfo->fbp.reader.size;
+  while( (pinfo->count < pinfo->maxn) && (pinfo->low == pinfo->depth) &&
+	 ((m = prev_markup_tail(pinfo, p, &b, &e)) != m_none) ) {
+    p = b;
+    if( m == m_end ) {
+      push_end_tail(pinfo, b);
+      if( (pinfo->nends == pinfo->depth + 1) && (pinfo->count == 0) ) {
+	pinfo->last = e;
+      }
+    } else if( m == m_start ) {
+      if( (pinfo->nends == 0) ||
+	  !same_name_tail(pinfo, b, pinfo->ends[pinfo->nends - 1]) ) {
+	return FALSE;
+      }
+      pinfo->nends--;
+      if( (pinfo->nends == pinfo->depth) &&
+	  (pinfo->ends[pinfo->nends] >= 0) ) {
+	/* an unfinished element is not a record */
+	pinfo->first = b;
+	pinfo->count++;
+      } else if( (pinfo->nends < pinfo->depth) && (pinfo->count > 0) ) {
+	pinfo->anc[pinfo->nends] = b;
+	pinfo->low = pinfo->nends;
+      }
+    } else if( (m == m_empty) && (pinfo->nends == pinfo->depth) ) {
+      if( pinfo->count == 0 ) {
+	pinfo->last = e;
+      }
+      pinfo->first = b;
+      pinfo->count++;
+    }
+  }
+
+  while( (pinfo->count > 0) && (pinfo->low > 1) ) {
+    m = prev_markup_tail(pinfo, p, &b, &e);
+    p = b;
+    if( m == m_none ) {
+      return FALSE;
+    } else if( m == m_end ) {
+      push_end_tail(pinfo, b);
+    } else if( m == m_start ) {
+      if( (pinfo->nends == 0) ||
+	  !same_name_tail(pinfo, b, pinfo->ends[pinfo->nends - 1]) ) {
+	return FALSE;
+      }
+      if( --pinfo->nends < pinfo->low ) {
+	pinfo->anc[pinfo->nends] = b;
+	pinfo->low = pinfo->nends;
+      }
+    }
+  }
+  return TRUE;
+}
+
+bool_t backward_scan_tail(parserinfo_tail_t *pinfo) {
+  bool_t ok;
+  off_t p;
+
+  forget_tail(pinfo);
+  pinfo->nopen = 0;
+  ok = (!unfinished_tail(pinfo) || find_open_tail(pinfo)) &&
+    scan_records_tail(pinfo);
+
+  if( ok && (pinfo->count > 0) ) {
+    if( pinfo->depth > 0 ) {
+      pinfo->anc[0] = pinfo->rootoff;
+      /* print the indentation of the first record */
+      for(p = pinfo->first;
+	  (p > 0) && xml_whitespace(getc_tail(pinfo, p - 1)); p--);
+      pinfo->span =
+	((p < pinfo->first) && (getc_tail(pinfo, p - 1) == '>')) ?
+	p : pinfo->first;
+    } else {
+      pinfo->span = pinfo->first;
+    }
+  }
+  forget_tail(pinfo);
+  return ok;
+}
+
+void start_tag_root(fbparserinfo_t *fbpi, const char_t *name,
+		    const char_t **att, void *user) {
+  parserinfo_tail_t *pinfo = (parserinfo_tail_t *)user;
+  if( pinfo && !pinfo->rootname ) {
+    pinfo->rootoff = fbpi->offset;
+    pinfo->rootname = strdup(name);
+  }
+}
+
+/* the root start tag is near the beginning, so a forward parse is cheap */
+bool_t find_root_tail(parserinfo_tail_t *pinfo) {
+  fbcallback_t callbacks;
+  position_t pos;
+
+  memset(&callbacks, 0, sizeof(fbcallback_t));
+  callbacks.start_tag = start_tag_root;
+  callbacks.user = pinfo;
+
+  reset_parser(&pinfo->fbp.parser);
+  reset_parserinfo_fileblockparser(&pinfo->fbp.info);
+  setup_fileblockparser(&pinfo->fbp, &callbacks);
+  pos.offset = 0;
+  pos.nodecount = 0;
+  while( !pinfo->rootname && parse_next_fileblockparser(&pinfo->fbp, &pos) );
+  return (pinfo->rootname != NULL);
+}
+
+void start_tag_forward(fbparserinfo_t *fbpi, const char_t *name,
+		       const char_t **att, void *user) {
+  parserinfo_tail_t *pinfo = (parserinfo_tail_t *)user;
+  if( pinfo ) {
+    if( fbpi->depth < pinfo->depth ) {
+      pinfo->canc[fbpi->depth] = fbpi->offset;
+      if( fbpi->depth + 1 == pinfo->depth ) {
+	pinfo->cur = 0;
+      }
+    } else if( fbpi->depth == pinfo->depth ) {
+      pinfo->ring[pinfo->cur % pinfo->maxn] = fbpi->offset;
+      pinfo->cur++;
+    }
+  }
+}
+
+void end_tag_forward(fbparserinfo_t *fbpi, const char_t *name, void *user) {
+  parserinfo_tail_t *pinfo = (parserinfo_tail_t *)user;
+  if( pinfo && (fbpi->depth == pinfo->depth + 1) ) {
+    pinfo->endrec = TRUE;
+  }
+}
+
+/* slow but sure: parse the whole file, remembering the last maxn
+ * record offsets in a ring.
+ */
+bool_t forward_scan_tail(parserinfo_tail_t *pinfo) {
+  fbcallback_t callbacks;
+  position_t pos;
+
+  memset(&callbacks, 0, sizeof(fbcallback_t));
+  callbacks.start_tag = start_tag_forward;
+  callbacks.end_tag = end_tag_forward;
+  callbacks.user = pinfo;
+
+  reset_parser(&pinfo->fbp.parser);
+  reset_parserinfo_fileblockparser(&pinfo->fbp.info);
+  setup_fileblockparser(&pinfo->fbp, &callbacks);
+  pinfo->cur = 0;
+  pinfo->endrec = FALSE;
+  pinfo->count = 0;
+  pos.offset = 0;
+  pos.nodecount = 0;
+  while( parse_next_fileblockparser(&pinfo->fbp, &pos) ) {
+    if( pinfo->endrec ) {
+      pinfo->endrec = FALSE;
+      pinfo->last = pos.offset;
+      pinfo->count = MIN(pinfo->cur, pinfo->maxn);
+      pinfo->first = pinfo->ring[(pinfo->cur - pinfo->count) % pinfo->maxn];
+      pinfo->span = pinfo->first;
+      memcpy(pinfo->anc, pinfo->canc, sizeof(off_t) * pinfo->depth);
+    }
+  }
+  return (pos.status == ps_ok);
+}
+
+void start_tag_replay(fbparserinfo_t *fbpi, const char_t *name,
+		      const char_t **att, void *user) {
+  parserinfo_tail_t *pinfo = (parserinfo_tail_t *)user;
+  if( pinfo ) {
+    if( fbpi->depth == pinfo->depth ) {
+      pinfo->seen++;
+    }
+    push_tag_xpath(&pinfo->path, name);
+  }
+}
+
+void end_tag_replay(fbparserinfo_t *fbpi, const char_t *name, void *user) {
+  parserinfo_tail_t *pinfo = (parserinfo_tail_t *)user;
+  if( pinfo ) {
+    pop_xpath(&pinfo->path);
+  }
+}
+
+bool_t write_range_tail(parserinfo_tail_t *pinfo, off_t from, off_t to) {
+  byte_t *begin, *end;
+  while( (from < to) &&
+	 read_fileblockreader(&pinfo->fbp.reader, from, &begin, &end) &&
+	 (begin < end) ) {
+    if( end - begin > to - from ) {
+      end = begin + (to - from);
+    }
+    write_stdout(begin, end - begin);
+    from += end - begin;
+  }
+  return (from >= to);
+}
+
+bool_t next_tail(parserinfo_tail_t *pinfo, bool_t print) {
+  off_t from = pinfo->pos.offset;
+  if( parse_next_fileblockparser(&pinfo->fbp, &pinfo->pos) ) {
+    return !print || write_range_tail(pinfo, from, pinfo->pos.offset);
+  }
+  return FALSE;
+}
+
+/* reparse the prolog, the ancestors in the cursor, and the records.
+ * Returns TRUE if this agrees with the scan.
+ */
+bool_t replay_tail(parserinfo_tail_t *pinfo, bool_t print) {
+  fbcallback_t callbacks;
+  size_t i, top;
+
+  memset(&callbacks, 0, sizeof(fbcallback_t));
+  callbacks.start_tag = start_tag_replay;
+  callbacks.end_tag = end_tag_replay;
+  callbacks.user = pinfo;
+
+  reset_parser(&pinfo->fbp.parser);
+  reset_parserinfo_fileblockparser(&pinfo->fbp.info);
+  setup_fileblockparser(&pinfo->fbp, &callbacks);
+  reset_xpath(&pinfo->path);
+  pinfo->seen = 0;
+
+  top = get_length_cursor(&pinfo->cursor);
+  pinfo->pos.offset = 0;
+  pinfo->pos.nodecount = 0;
+  /* the prolog holds the encoding and entity declarations */
+  while( pinfo->pos.offset < get_depth_offset_cursor(&pinfo->cursor, 0) ) {
+    if( !next_tail(pinfo, print) ) {
+      return FALSE;
+    }
+  }
+
+  for(i = 0; i + 1 < top; i++) {
+    pinfo->pos.offset = get_depth_offset_cursor(&pinfo->cursor, i);
+    if( !next_tail(pinfo, print) ) {
+      return FALSE;
+    }
+    if( print && ((i + 2 < top) || (pinfo->span == pinfo->first)) ) {
+      putc_stdout('\n');
+    }
+  }
+
+  pinfo->pos.offset = pinfo->span;
+  while( pinfo->pos.offset < pinfo->last ) {
+    if( !next_tail(pinfo, print) ) {
+      return FALSE;
+    }
+  }
+
+  return (pinfo->pos.offset == pinfo->last) &&
+    (pinfo->seen == pinfo->count) &&
+    (pinfo->fbp.info.depth == top - 1);
+}
+
+bool_t build_cursor_tail(parserinfo_tail_t *pinfo) {
+  int i;
+  reset_cursor(&pinfo->cursor);
+  for(i = 0; i < pinfo->depth; i++) {
+    bump_cursor(&pinfo->cursor, i, pinfo->anc[i], 0);
+  }
+  bump_cursor(&pinfo->cursor, pinfo->depth, pinfo->first, 0);
+  /* push_cursor() drops offsets which don't increase */
+  return (get_length_cursor(&pinfo->cursor) == pinfo->depth + 1);
+}
+
+bool_t locate_tail(parserinfo_tail_t *pinfo) {
+  if( !find_root_tail(pinfo) ) {
+    return FALSE;
+  }
+  if( backward_scan_tail(pinfo) ) {
+    if( (pinfo->count == 0) ||
+	(build_cursor_tail(pinfo) && replay_tail(pinfo, FALSE)) ) {
+      return TRUE;
+    }
+  }
+  if( forward_scan_tail(pinfo) ) {
+    if( (pinfo->count == 0) ||
+	(build_cursor_tail(pinfo) && replay_tail(pinfo, FALSE)) ) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+bool_t close_tag_tail(xpath_t *xp, tagtype_t t,
+		      const char_t *begin, const char_t *end, void *user) {
+  puts_stdout("</");
+  write_stdout((byte_t *)begin, end - begin);
+  puts_stdout(">\n");
+  return TRUE;
+}
+
+/* keep parsing as the file grows. Partial nodes are printed as soon
+ * as they are seen, like tail -f prints partial lines.
+ */
+bool_t follow_tail(parserinfo_tail_t *pinfo) {
+  off_t from;
+  bool_t ok;
+  while( !checkflag(cmd,CMD_QUIT) ) {
+    while( pinfo->pos.offset < pinfo->fbp.reader.size ) {
+      from = pinfo->pos.offset;
+      ok = parse_next_fileblockparser(&pinfo->fbp, &pinfo->pos);
+      if( pinfo->pos.status == ps_error ) {
+	errormsg(E_ERROR, "%s: %s at byte %ld\n", inputfile,
+		 error_message_parser(&pinfo->fbp.parser), (long)from);
+	return FALSE;
+      }
+      write_range_tail(pinfo, from, pinfo->pos.offset);
+      if( !ok ) {
+	break;
+      }
+    }
+    flush_stdout();
+    if( !refresh_fileblockparser(&pinfo->fbp) ) {
+      sleep(pinfo->interval);
+    }
+    process_pending_signal();
+  }
+  return TRUE;
+}
+
+bool_t tail(parserinfo_tail_t *pinfo) {
+  if( !locate_tail(pinfo) ) {
+    if( !checkflag(pinfo->flags,TAIL_FLAG_FOLLOW) ) {
+      errormsg(E_ERROR, "%s: cannot locate the last records\n", inputfile);
+      return FALSE;
+    }
+    pinfo->count = 0; /* maybe there is no root yet */
+  }
+  if( pinfo->count > 0 ) {
+    replay_tail(pinfo, TRUE);
+  } else if( checkflag(pinfo->flags,TAIL_FLAG_FOLLOW) ) {
+    /* nothing yet, so print everything as it comes */
+    reset_cursor(&pinfo->cursor);
+    pinfo->span = pinfo->last = 0;
+    replay_tail(pinfo, TRUE);
+  } else {
+    return TRUE;
+  }
+  if( checkflag(pinfo->flags,TAIL_FLAG_FOLLOW) ) {
+    follow_tail(pinfo);
+  }
+  if( length_xpath(&pinfo->path) > 0 ) {
+    if( !checkflag(pinfo->flags,TAIL_FLAG_FOLLOW) ) {
+      putc_stdout('\n');
+    }
+    close_xpath(&pinfo->path, close_tag_tail, NULL);
+  }
+  return TRUE;
+}
+
+bool_t create_parserinfo_tail(parserinfo_tail_t *pinfo) {
+  bool_t ok = TRUE;
+  if( pinfo ) {
+    memset(pinfo, 0, sizeof(parserinfo_tail_t));
+    ok &= create_cursor(&pinfo->cursor);
+    ok &= create_xpath(&pinfo->path);
+    ok &= create_mem(&pinfo->ends, &pinfo->maxends, sizeof(off_t), 16);
+    pinfo->nends = 0;
+    pinfo->flags = 0;
+    pinfo->maxn = 10;
+    pinfo->depth = 1;
+    pinfo->interval = 1;
+    pinfo->rootname = NULL;
+    forget_tail(pinfo);
+    return ok;
+  }
+  return FALSE;
+}
+
+bool_t free_parserinfo_tail(parserinfo_tail_t *pinfo) {
+  if( pinfo ) {
+    free_cursor(&pinfo->cursor);
+    free_xpath(&pinfo->path);
+    if( pinfo->rootname ) { free(pinfo->rootname); }
+    if( pinfo->anc ) { free(pinfo->anc); }
+    if( pinfo->canc ) { free(pinfo->canc); }
+    if( pinfo->ring ) { free(pinfo->ring); }
+    free_mem(&pinfo->ends, &pinfo->maxends);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+int main(int argc, char **argv) {
+  signed char op;
+  parserinfo_tail_t pinfo;
+  int fd = -1;
+  pid_t pid;
+  int exitcode = EXIT_FAILURE;
+  struct option longopts[] = {
+    { "version", 0, NULL, TAIL_VERSION },
+    { "help", 0, NULL, TAIL_HELP },
+    { "records", 1, NULL, TAIL_RECORDS },
+    { "depth", 1, NULL, TAIL_DEPTH },
+    { "follow", 0, NULL, TAIL_FOLLOW },
+    { "sleep-interval", 1, NULL, TAIL_SLEEP },
+    { "stats", 2, NULL, STATS_OPTION },
+    { 0 }
+  };
+
+  progname = "xml-tail";
+  inputfile = "";
+  inputline = 0;
+
+  if( create_parserinfo_tail(&pinfo) ) {
+
+    if( (argc > 1) && ((pinfo.maxn = set_obsolete_option(argv[1])) >= 0) ) {
+      argv[1] = "-z"; /* dummy */
+    } else {
+      pinfo.maxn = 10;
+    }
+
+    while( (op = getopt_long(argc, argv, "n:d:fs:z",
+			     longopts, NULL)) > -1 ) {
+      set_option_tail(op, optarg, &pinfo);
+    }
+
+    init_signal_handling(SIGNALS_DEFAULT);
+    init_file_handling();
+    init_tempfile_handling();
+    open_stdout();
+
+    /* depth + 1 entries, so that depth 0 allocates something */
+    pinfo.anc = malloc(sizeof(off_t) * (pinfo.depth + 1));
+    pinfo.canc = malloc(sizeof(off_t) * (pinfo.depth + 1));
+    pinfo.ring = malloc(sizeof(off_t) * MAX(pinfo.maxn, 1));
+    if( !pinfo.anc || !pinfo.canc || !pinfo.ring ) {
+      errormsg(E_FATAL, "out of memory\n");
+    }
+
+    inputfile = (optind < argc) ? argv[optind] : NULL;
+    if( !inputfile || (strcmp("stdin",inputfile) == 0) ||
+	(strcmp("-",inputfile) == 0) ) {
+      fd = save_stdin_tempfile(&inputfile, &pid, progname);
+      if( fd == -1 ) {
+	free(inputfile);
+	inputfile = NULL;
+      } else {
+	/* like tail(1), don't follow a pipe. The backward scan needs
+	   all of it */
+	clearflag(&pinfo.flags, TAIL_FLAG_FOLLOW);
+	waitpid(pid, NULL, 0);
+      }
+    }
+
+    if( pinfo.maxn <= 0 ) {
+      exitcode = EXIT_SUCCESS;
+    } else if( inputfile &&
+	       open_fileblockparser(&pinfo.fbp, inputfile, 32) ) {
+      if( tail(&pinfo) ) {
+	exitcode = EXIT_SUCCESS;
+      }
+      close_fileblockparser(&pinfo.fbp);
+    }
+
+    /* cleanup stdin reader and tempfile */
+    if( fd != -1 ) {
+      close(fd);
+      remove_tempfile(inputfile);
+      free(inputfile);
+    }
+
+    close_stdout();
+    exit_tempfile_handling();
+    exit_file_handling();
+    exit_signal_handling();
+
+    free_parserinfo_tail(&pinfo);
+  }
+
+  return exitcode;
+}
@@ -29,6 +29,7 @@
 #include "unecho.h"
 #include "filelist.h"
 #include "mysignal.h"
+#include "stats.h"
 
 #include <string.h>
 #include <getopt.h>
@@ -66,6 +67,8 @@ typedef struct {
 "Usage: xml-unecho [OPTION]... [[FILE] [:XPATH]...]\n" \
 "For each leaf node in FILE or STDIN, print a corresponding xml-echo line.\n" \
 "\n" \
+"      --stats[=json]  print resource statistics on exit\n" \
+"      --progress[=N]  report progress on stderr every N seconds\n" \
 "      --help     display this help and exit\n" \
 "      --version  display version information and exit\n"
 
@@ -81,6 +84,12 @@ void set_option_unecho(int op, char *optarg) {
     puts(UNECHO_USAGE);
     exit(EXIT_SUCCESS);
     break;
+  case STATS_OPTION:
+    set_stats(optarg);
+    break;
+  case PROGRESS_OPTION:
+    set_progress(optarg);
+    break;
   case UNECHO_XPATHSEP:
     redefine_xpath_specials(optarg);
     break;
@@ -157,6 +166,8 @@ int main(int argc, char **argv) {
     { "help", 0, NULL, UNECHO_HELP },
     { "xpath-separator", 1, NULL, UNECHO_XPATHSEP },
     { "xml-sed", 0, NULL, UNECHO_XMLSED },
+    { "stats", 2, NULL, STATS_OPTION },
+    { "progress", 2, NULL, PROGRESS_OPTION },
     { 0 }
   };
 
@@ -27,9 +27,21 @@
 #include "stdparse.h"
 #include "entities.h"
 #include "mysignal.h"
+#include "filelist.h"
+#include "rawscan.h"
+#include "mem.h"
+#include "stats.h"
 
 #include <string.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#if HAVE_PTHREAD_H && HAVE_LIBPTHREAD
+#include <pthread.h>
+#define WC_WITH_THREADS 1
+#endif
 
 /* for option processing */
 extern char *optarg;
@@ -44,30 +56,104 @@ extern volatile flag_t cmd;
 #include <stdio.h>
 
 typedef struct {
-  int tags;
-  int depth;
-  int height;
+  long tags;
+  long depth;
+  long height;
+  long attributes;
+  long texts;
+  long comments;
+  long bytes;
+  long chars;
+  long *hist; /* elements at each depth */
+  size_t histlen;
 } statistics_t;
 
+/* With --fast, each file is cut into chunks which are scanned by
+ * rawscan_t, on separate threads with --jobs. A chunk boundary is
+ * moved just past a '>' after its nominal offset, which is almost
+ * always the end of some markup. The main thread puts the 
+ * chunks of a file back together in order, and rescans a chunk
+ * itself in the rare case that the boundary was inside markup.
+ * Only input which looks like UTF-8 (or ASCII) can be scanned, so
+ * the first chunk of each file checks the BOM and XML declaration,
+ * and other files (eg UTF-16) are parsed in full instead.
+ */
+typedef struct {
+  int file;
+  off_t begin, end; /* nominal range, or begin < 0 for the whole stream */
+  off_t start, stop; /* actual range */
+  rawscan_t rs;
+  bool_t plain; /* first chunk of the file looks like UTF-8 */
+  bool_t done;
+} chunk_t;
+
+typedef struct {
+  cstringlst_t files;
+  chunk_t *chunks;
+  size_t numchunks;
+  size_t next;
+#if WC_WITH_THREADS
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+#endif
+} chunklist_t;
+
 typedef struct {
   stdparserinfo_t std; /* must be first so we can cast correctly */
   flag_t flags;
   statistics_t file;
   statistics_t summary;
   int numfiles;
+  int jobs;
+  bool_t pending; /* nonblank text since the last tag */
+  bool_t broken;
 } parserinfo_wc_t;
 
 #define WC_VERSION    0x01
 #define WC_HELP       0x02
+#define WC_COMMENTS   0x03
+#define WC_FAST       0x04
+#define WC_CHECK      0x05
+#define WC_ATTRIBUTES 'a'
+#define WC_TEXTS      't'
+#define WC_BYTES      'c'
+#define WC_CHARS      'm'
+#define WC_HISTOGRAM  'H'
+#define WC_JOBS       'j'
 #define WC_USAGE \
 "Usage: xml-wc [OPTION]... [[FILE]... [:XPATH]...]...\n" \
 "Prints statistics (height,depth,tags) for each FILE(s), and\n" \
 "a total line if more than one FILE is specified.\n" \
 "\n" \
-"      --help     display this help and exit\n" \
-"      --version  display version information and exit\n"
-
-void set_option_wc(int op, char *optarg) {
+"  -a, --attributes  also print the number of attributes\n" \
+"  -t, --texts       also print the number of nonblank text nodes\n" \
+"      --comments    also print the number of comments\n" \
+"  -c, --bytes       also print the number of text bytes\n" \
+"  -m, --chars       also print the number of text characters\n" \
+"  -H, --histogram   print the number of elements at each depth\n" \
+"      --fast        count without parsing, assumes well formed input\n" \
+"      --check       with --fast, report obviously broken input\n" \
+"  -j, --jobs=N      with --fast, scan N files or chunks at a time\n" \
+"      --stats[=json]  print resource statistics on exit\n" \
+"      --progress[=N]  report progress on stderr every N seconds\n" \
+"      --help        display this help and exit\n" \
+"      --version     display version information and exit\n"
+
+#define WC_FLAG_ATTRIBUTES 0x01
+#define WC_FLAG_TEXTS      0x02
+#define WC_FLAG_COMMENTS   0x04
+#define WC_FLAG_BYTES      0x08
+#define WC_FLAG_CHARS      0x10
+#define WC_FLAG_HISTOGRAM  0x20
+#define WC_FLAG_FAST       0x40
+#define WC_FLAG_CHECK      0x80
+
+#define WC_FLAG_CHARDATA   (WC_FLAG_TEXTS|WC_FLAG_BYTES|WC_FLAG_CHARS)
+
+#define WC_BLOCK      262144
+#define WC_CHUNK      (4L * 1048576)
+
+void set_option_wc(int op, char *optarg, parserinfo_wc_t *pinfo) {
   switch(op) {
   case WC_VERSION:
     puts("xml-wc" COPYBLURB);
@@ -77,52 +163,204 @@ void set_option_wc(int op, char *optarg) {
     puts(WC_USAGE);
     exit(EXIT_SUCCESS);
     break;
+  case STATS_OPTION:
+    set_stats(optarg);
+    break;
+  case PROGRESS_OPTION:
+    set_progress(optarg);
+    break;
+  case WC_ATTRIBUTES:
+    setflag(&pinfo->flags, WC_FLAG_ATTRIBUTES);
+    break;
+  case WC_TEXTS:
+    setflag(&pinfo->flags, WC_FLAG_TEXTS);
+    break;
+  case WC_COMMENTS:
+    setflag(&pinfo->flags, WC_FLAG_COMMENTS);
+    break;
+  case WC_BYTES:
+    setflag(&pinfo->flags, WC_FLAG_BYTES);
+    break;
+  case WC_CHARS:
+    setflag(&pinfo->flags, WC_FLAG_CHARS);
+    break;
+  case WC_HISTOGRAM:
+    setflag(&pinfo->flags, WC_FLAG_HISTOGRAM);
+    break;
+  case WC_FAST:
+    setflag(&pinfo->flags, WC_FLAG_FAST);
+    break;
+  case WC_CHECK:
+    setflag(&pinfo->flags, WC_FLAG_CHECK);
+    break;
+  case WC_JOBS:
+    pinfo->jobs = atoi(optarg);
+    if( pinfo->jobs < 1 ) {
+      errormsg(E_FATAL, "bad number of jobs %s\n", optarg);
+    }
+#if !WC_WITH_THREADS
+    errormsg(E_WARNING, "compiled without thread support, ignoring --jobs\n");
+    pinfo->jobs = 1;
+#endif
+    break;
+  }
+}
+
+bool_t count_depth_statistics(statistics_t *s, int depth, long n) {
+  size_t old;
+  if( s && (depth >= 0) ) {
+    while( (size_t)depth >= s->histlen ) {
+      old = s->histlen;
+      if( !grow_mem(&s->hist, &s->histlen, sizeof(long), 16) ) {
+	errormsg(E_FATAL, "out of memory.\n");
+      }
+      memset(s->hist + old, 0, (s->histlen - old) * sizeof(long));
+    }
+    s->hist[depth] += n;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+void close_text_wc(parserinfo_wc_t *pinfo) {
+  if( pinfo->pending ) {
+    pinfo->file.texts++;
+    pinfo->pending = FALSE;
   }
 }
 
 result_t start_tag(void *user, const char_t *name, const char_t **att) {
   parserinfo_wc_t *pinfo = (parserinfo_wc_t *)user;
   if( pinfo ) { 
+    close_text_wc(pinfo);
     pinfo->file.tags++;
     pinfo->file.height += (pinfo->std.depth == 2) ? 1 : 0;
+    while( att && *att ) {
+      pinfo->file.attributes++;
+      att += 2;
+    }
+    if( checkflag(pinfo->flags, WC_FLAG_HISTOGRAM) ) {
+      count_depth_statistics(&pinfo->file, pinfo->std.depth, 1);
+    }
+  }
+  return PARSER_OK;
+}
+
+result_t end_tag(void *user, const char_t *name) {
+  parserinfo_wc_t *pinfo = (parserinfo_wc_t *)user;
+  if( pinfo ) { 
+    close_text_wc(pinfo);
+  }
+  return PARSER_OK;
+}
 
+result_t chardata(void *user, const char_t *buf, size_t buflen) {
+  parserinfo_wc_t *pinfo = (parserinfo_wc_t *)user;
+  const char_t *p, *e;
+  if( pinfo && (pinfo->std.depth > 0) ) {
+    pinfo->file.bytes += buflen;
+    pinfo->file.chars += buflen;
+    for(p = buf, e = buf + buflen; p < e; p++) {
+      pinfo->file.chars -= ((*p & 0xc0) == 0x80);
+    }
+    if( skip_xml_whitespace(buf, buf + buflen) < buf + buflen ) {
+      pinfo->pending = TRUE;
+    }
   }
   return PARSER_OK;
 }
 
+result_t comment(void *user, const char_t *data) {
+  parserinfo_wc_t *pinfo = (parserinfo_wc_t *)user;
+  if( pinfo && (pinfo->std.depth > 0) ) {
+    pinfo->file.comments++;
+  }
+  return PARSER_OK;
+}
 
 bool_t reset_statistics(parserinfo_wc_t *pinfo) {
   if( pinfo ) {
     pinfo->file.height = 0;
     pinfo->file.depth = 0;
     pinfo->file.tags = 0;
+    pinfo->file.attributes = 0;
+    pinfo->file.texts = 0;
+    pinfo->file.comments = 0;
+    pinfo->file.bytes = 0;
+    pinfo->file.chars = 0;
+    if( pinfo->file.hist ) {
+      memset(pinfo->file.hist, 0, pinfo->file.histlen * sizeof(long));
+    }
+    pinfo->pending = FALSE;
     pinfo->numfiles++;
     return TRUE;
   }
   return FALSE;
 }
 
+void print_statistics(parserinfo_wc_t *pinfo, statistics_t *s) {
+  nprintf_stdout(80, "%7ld %7ld %7ld", s->height, s->depth, s->tags);
+  if( checkflag(pinfo->flags, WC_FLAG_ATTRIBUTES) ) {
+    nprintf_stdout(20, " %7ld", s->attributes);
+  }
+  if( checkflag(pinfo->flags, WC_FLAG_TEXTS) ) {
+    nprintf_stdout(20, " %7ld", s->texts);
+  }
+  if( checkflag(pinfo->flags, WC_FLAG_COMMENTS) ) {
+    nprintf_stdout(20, " %7ld", s->comments);
+  }
+  if( checkflag(pinfo->flags, WC_FLAG_BYTES) ) {
+    nprintf_stdout(20, " %7ld", s->bytes);
+  }
+  if( checkflag(pinfo->flags, WC_FLAG_CHARS) ) {
+    nprintf_stdout(20, " %7ld", s->chars);
+  }
+}
+
+/* one line per depth, under the depth and tags columns */
+void print_histogram(parserinfo_wc_t *pinfo, statistics_t *s) {
+  size_t d;
+  if( checkflag(pinfo->flags, WC_FLAG_HISTOGRAM) ) {
+    for(d = 1; d < s->histlen; d++) {
+      if( s->hist[d] > 0 ) {
+	nprintf_stdout(40, "%7s %7d %7ld\n", "", (int)d, s->hist[d]);
+      }
+    }
+  }
+}
+
 bool_t file_statistics(parserinfo_wc_t *pinfo, 
 		       const char_t *filename,
 		       const char_t **xpaths) {
+  size_t d;
   if( pinfo ) {
-    pinfo->file.depth = pinfo->std.maxdepth;
+    if( !checkflag(pinfo->flags, WC_FLAG_FAST) ) {
+      pinfo->file.depth = pinfo->std.maxdepth;
+    }
     
     pinfo->summary.tags += pinfo->file.tags;
     pinfo->summary.depth = MAX(pinfo->summary.depth,pinfo->file.depth);
     pinfo->summary.height += pinfo->file.height;
+    pinfo->summary.attributes += pinfo->file.attributes;
+    pinfo->summary.texts += pinfo->file.texts;
+    pinfo->summary.comments += pinfo->file.comments;
+    pinfo->summary.bytes += pinfo->file.bytes;
+    pinfo->summary.chars += pinfo->file.chars;
+    for(d = 0; d < pinfo->file.histlen; d++) {
+      if( pinfo->file.hist[d] > 0 ) {
+	count_depth_statistics(&pinfo->summary, d, pinfo->file.hist[d]);
+      }
+    }
 
-    nprintf_stdout(80, "%7d %7d %7d %s",
-		   pinfo->file.height,
-		   pinfo->file.depth,
-		   pinfo->file.tags,
-		   filename);
-    while( *xpaths ) {
+    print_statistics(pinfo, &pinfo->file);
+    nprintf_stdout(20 + strlen(filename), " %s", filename);
+    while( xpaths && *xpaths ) {
       puts_stdout(" :");
       puts_stdout(*xpaths);
       xpaths++;
     }
     putc_stdout('\n');
+    print_histogram(pinfo, &pinfo->file);
 
     return TRUE;
   }
@@ -132,10 +370,9 @@ bool_t file_statistics(parserinfo_wc_t *pinfo,
 bool_t summary_statistics(parserinfo_wc_t *pinfo) {
   if( pinfo ) {
     if( pinfo->numfiles > 1) {
-      nprintf_stdout(80, "%7d %7d %7d total\n",
-		     pinfo->summary.height,
-		     pinfo->summary.depth,
-		     pinfo->summary.tags);
+      print_statistics(pinfo, &pinfo->summary);
+      puts_stdout(" total\n");
+      print_histogram(pinfo, &pinfo->summary);
     }
     return TRUE;
   }
@@ -158,6 +395,386 @@ bool_t end_file_fun(void *user, const char_t *file, const char_t **xpaths) {
   return TRUE;
 }
 
+/* returns the offset just past the first '>' at or after off which
+   is followed by '<' or a newline, as tags usually are */
+off_t cut_chunk(int fd, off_t off, off_t size, byte_t *buf) {
+  ssize_t n;
+  byte_t *p, *q;
+  if( off <= 0 ) {
+    return 0;
+  }
+  while( off < size ) {
+    n = pread(fd, buf, MIN(WC_BLOCK, size - off), off);
+    if( n <= 0 ) {
+      break;
+    }
+    for(p = buf; (q = memchr(p, '>', buf + n - p)); p = q + 1) {
+      if( (q + 1 == buf + n) || (q[1] == '<') || (q[1] == '\n') ) {
+	return off + (q - buf) + 1;
+      }
+    }
+    off += n;
+  }
+  return size;
+}
+
+bool_t scan_range(rawscan_t *rs, int fd, off_t start, off_t stop,
+		  byte_t *buf) {
+  ssize_t n;
+  while( (start < stop) && !checkflag(cmd,CMD_QUIT) ) {
+    n = pread(fd, buf, MIN(WC_BLOCK, stop - start), start);
+    if( n <= 0 ) {
+      return FALSE;
+    }
+    STATS_ADD(reads, 1);
+    STATS_ADD(bytesread, n);
+    scan_rawscan(rs, buf, n);
+    start += n;
+  }
+  return TRUE;
+}
+
+bool_t scan_chunk(chunk_t *c, const char *file, byte_t *buf) {
+  stream_t strm;
+  struct stat st;
+  ssize_t n = 0;
+  off_t total = 0;
+  bool_t ok = FALSE;
+  c->plain = TRUE;
+  if( c->begin < 0 ) {
+    if( open_file_stream(&strm, file) ) {
+      ok = TRUE;
+      while( !checkflag(cmd,CMD_QUIT) && 
+	     ((n = read(strm.fd, buf, WC_BLOCK)) > 0) ) {
+	STATS_ADD(reads, 1);
+	STATS_ADD(bytesread, n);
+	if( (total == 0) && !(c->plain = utf8_prefix_parser(buf, n)) ) {
+	  break;
+	}
+	total += n;
+	scan_rawscan(&c->rs, buf, n);
+      }
+      if( n < 0 ) {
+	errormsg(E_ERROR, "cannot read %s\n", file);
+	ok = FALSE;
+      }
+      close_stream(&strm);
+    }
+  } else {
+    c->start = c->stop = c->begin;
+    strm.fd = open(file, O_RDONLY|O_BINARY);
+    if( strm.fd == -1 ) {
+      errormsg(E_ERROR, "cannot open %s\n", file);
+    } else {
+      if( fstat(strm.fd, &st) == 0 ) {
+	c->start = cut_chunk(strm.fd, c->begin, st.st_size, buf);
+	c->stop = cut_chunk(strm.fd, c->end, st.st_size, buf);
+	if( c->begin == 0 ) {
+	  n = pread(strm.fd, buf, MIN(WC_BLOCK, st.st_size), 0);
+	  c->plain = (n > 0) && utf8_prefix_parser(buf, n);
+	}
+	ok = c->plain ? 
+	  scan_range(&c->rs, strm.fd, c->start, c->stop, buf) : TRUE;
+      }
+      close(strm.fd);
+    }
+  }
+  return ok;
+}
+
+/* the earlier chunks ended inside markup, so continue from there */
+bool_t rescan_chunk(rawscan_t *rs, chunk_t *c, const char *file, 
+		    byte_t *buf) {
+  bool_t ok = FALSE;
+  int fd;
+  fd = open(file, O_RDONLY|O_BINARY);
+  if( fd != -1 ) {
+    ok = scan_range(rs, fd, c->start, c->stop, buf);
+    close(fd);
+  }
+  return ok;
+}
+
+bool_t create_chunklist(chunklist_t *cl, cstringlst_t files, int n, 
+			int jobs) {
+  struct stat st;
+  off_t size, off;
+  size_t max;
+  int f;
+  if( cl && files ) {
+    memset(cl, 0, sizeof(chunklist_t));
+    cl->files = files;
+    if( !create_mem(&cl->chunks, &max, sizeof(chunk_t), MAX(n, 1)) ) {
+      return FALSE;
+    }
+    for(f = 0; f < n; f++) {
+      size = ( (jobs > 1) && (strcmp(files[f], "stdin") != 0) &&
+	       (stat(files[f], &st) == 0) && S_ISREG(st.st_mode) ) ? 
+	st.st_size : 0;
+      off = 0;
+      do {
+	if( cl->numchunks >= max ) {
+	  if( !grow_mem(&cl->chunks, &max, sizeof(chunk_t), 16) ) {
+	    return FALSE;
+	  }
+	}
+	memset(&cl->chunks[cl->numchunks], 0, sizeof(chunk_t));
+	cl->chunks[cl->numchunks].file = f;
+	if( size > 2 * WC_CHUNK ) {
+	  cl->chunks[cl->numchunks].begin = off;
+	  off += MAX(WC_CHUNK, size / jobs);
+	  off = (size - off < WC_CHUNK) ? size : off;
+	  cl->chunks[cl->numchunks].end = off;
+	} else {
+	  cl->chunks[cl->numchunks].begin = -1;
+	  off = size;
+	}
+	cl->numchunks++;
+      } while( off < size );
+    }
+#if WC_WITH_THREADS
+    pthread_mutex_init(&cl->lock, NULL);
+    pthread_cond_init(&cl->cond, NULL);
+#endif
+    return TRUE;
+  }
+  return FALSE;
+}
+
+bool_t free_chunklist(chunklist_t *cl) {
+  if( cl ) {
+#if WC_WITH_THREADS
+    pthread_cond_destroy(&cl->cond);
+    pthread_mutex_destroy(&cl->lock);
+#endif
+    if( cl->chunks ) {
+      free(cl->chunks);
+      cl->chunks = NULL;
+    }
+    return TRUE;
+  }
+  return FALSE;
+}
+
+#if WC_WITH_THREADS
+void *run_chunklist(void *arg) {
+  chunklist_t *cl = (chunklist_t *)arg;
+  chunk_t *c;
+  byte_t *buf;
+  enter_stats_thread();
+  buf = malloc(WC_BLOCK);
+  while( buf ) {
+    pthread_mutex_lock(&cl->lock);
+    c = (cl->next < cl->numchunks) && !checkflag(cmd,CMD_QUIT) ? 
+      &cl->chunks[cl->next++] : NULL;
+    if( !c ) {
+      /* wake up the main thread if it waits for an abandoned chunk */
+      pthread_cond_broadcast(&cl->cond);
+    }
+    pthread_mutex_unlock(&cl->lock);
+    if( !c ) {
+      break;
+    }
+    create_rawscan(&c->rs);
+    scan_chunk(c, cl->files[c->file], buf);
+    pthread_mutex_lock(&cl->lock);
+    c->done = TRUE;
+    pthread_cond_broadcast(&cl->cond);
+    pthread_mutex_unlock(&cl->lock);
+  }
+  if( buf ) {
+    free(buf);
+  }
+  return NULL;
+}
+#endif
+
+/* waits until chunk i is ready, or scans it if there are no threads */
+chunk_t *wait_chunklist(chunklist_t *cl, size_t i, bool_t threads,
+			byte_t *buf) {
+  chunk_t *c = &cl->chunks[i];
+#if WC_WITH_THREADS
+  if( threads ) {
+    pthread_mutex_lock(&cl->lock);
+    while( !c->done && !(checkflag(cmd,CMD_QUIT) && (i >= cl->next)) ) {
+      pthread_cond_wait(&cl->cond, &cl->lock);
+    }
+    pthread_mutex_unlock(&cl->lock);
+    return c->done ? c : NULL;
+  }
+#endif
+  create_rawscan(&c->rs);
+  scan_chunk(c, cl->files[c->file], buf);
+  c->done = TRUE;
+  return c;
+}
+
+/* rawscan can't count this file, so parse it like without --fast */
+bool_t parse_wc(parserinfo_wc_t *pinfo, cstringlst_t files, 
+	      cstringlst_t *xpaths, int f) {
+  bool_t ok;
+  if( strcmp(files[f], "stdin") == 0 ) {
+    errormsg(E_ERROR, 
+	     "stdin: --fast needs UTF-8 or ASCII input, try without --fast\n");
+    pinfo->broken = TRUE;
+    return FALSE;
+  }
+  clearflag(&pinfo->flags, WC_FLAG_FAST);
+  ok = stdparse2(1, files + f, xpaths ? xpaths + f : NULL, &pinfo->std);
+  setflag(&pinfo->flags, WC_FLAG_FAST);
+  return ok;
+}
+
+void check_rawscan(parserinfo_wc_t *pinfo, rawscan_t *rs, const char *file) {
+  const rawlevel_t *l;
+  const char *what = NULL;
+  l = level_rawscan(rs, 0);
+  if( unfinished_rawscan(rs) ) {
+    what = "unterminated markup at end of input";
+  } else if( rs->mindepth < 0 ) {
+    what = "end tag without start tag";
+  } else if( rs->depth > 0 ) {
+    what = "unclosed element(s) at end of input";
+  } else if( !level_rawscan(rs, 1) || (level_rawscan(rs, 1)->elements != 1) ) {
+    what = "not exactly one root element";
+  } else if( (l && (l->texts > 0)) || pending_rawscan(rs) ) {
+    what = "text outside the root element";
+  }
+  if( what ) {
+    errormsg(E_WARNING, "%s: %s\n", file, what);
+    pinfo->broken = TRUE;
+  }
+}
+
+void rawscan_statistics(parserinfo_wc_t *pinfo, rawscan_t *rs) {
+  const rawlevel_t *l;
+  int d;
+  pinfo->file.depth = MAX(rs->maxdepth, 0);
+  for(d = 1; (l = level_rawscan(rs, d)); d++) {
+    pinfo->file.tags += l->elements;
+    pinfo->file.height += (d == 2) ? l->elements : 0;
+    pinfo->file.attributes += l->attributes;
+    pinfo->file.texts += l->texts;
+    pinfo->file.comments += l->comments;
+    pinfo->file.bytes += l->bytes;
+    pinfo->file.chars += l->chars;
+    if( checkflag(pinfo->flags, WC_FLAG_HISTOGRAM) && (l->elements > 0) ) {
+      count_depth_statistics(&pinfo->file, d, l->elements);
+    }
+  }
+}
+
+bool_t fast_wc(parserinfo_wc_t *pinfo, int argc, char **argv) {
+  filelist_t fl;
+  chunklist_t cl;
+  cstringlst_t files;
+  cstringlst_t *xpaths;
+  rawscan_t acc;
+  chunk_t *c;
+  byte_t *buf;
+  size_t i;
+  int n, f, t, jobs;
+  bool_t ok = TRUE;
+  bool_t parsed = FALSE; /* file f was parsed in full */
+#if WC_WITH_THREADS
+  pthread_t *threads = NULL;
+#endif
+
+  if( !create_filelist(&fl, argc, argv, FILELIST_MIN1) ) {
+    return FALSE;
+  }
+  if( hasxpaths_filelist(&fl) ) {
+    errormsg(E_FATAL, "--fast does not accept XPATH after filename(s)\n");
+  }
+  files = getfiles_filelist(&fl);
+  xpaths = getxpaths_filelist(&fl);
+  n = getsize_filelist(&fl);
+  jobs = MAX(pinfo->jobs, 1);
+
+  buf = malloc(WC_BLOCK);
+  if( !buf || !create_rawscan(&acc) || 
+      !create_chunklist(&cl, files, n, jobs) ) {
+    errormsg(E_FATAL, "out of memory.\n");
+  }
+
+  t = 0;
+#if WC_WITH_THREADS
+  if( jobs > 1 ) {
+    threads = malloc(jobs * sizeof(pthread_t));
+    for(t = 0; threads && (t < jobs); t++) {
+      if( pthread_create(&threads[t], NULL, run_chunklist, &cl) != 0 ) {
+	break;
+      }
+    }
+    if( t == 0 ) {
+      errormsg(E_WARNING, "cannot create threads, scanning sequentially\n");
+    }
+  }
+#endif
+
+  f = -1;
+  for(i = 0; (i < cl.numchunks) && !checkflag(cmd,CMD_QUIT); i++) {
+    c = wait_chunklist(&cl, i, (t > 0), buf);
+    if( !c ) {
+      break;
+    }
+    if( c->file != f ) {
+      if( (f >= 0) && !parsed ) {
+	rawscan_statistics(pinfo, &acc);
+	file_statistics(pinfo, files[f], xpaths ? xpaths[f] : NULL);
+      }
+      f = c->file;
+      inputfile = (char *)files[f];
+      parsed = !c->plain;
+      if( parsed ) {
+	ok &= parse_wc(pinfo, files, xpaths, f);
+      } else {
+	reset_statistics(pinfo);
+	reset_rawscan(&acc);
+	reduce_rawscan(&acc, &c->rs);
+      }
+    } else if( parsed ) {
+      /* the later chunks of a parsed file are ignored */
+    } else if( resumable_rawscan(&acc) ) {
+      reduce_rawscan(&acc, &c->rs);
+    } else {
+      ok &= rescan_chunk(&acc, c, files[f], buf);
+    }
+    free_rawscan(&c->rs);
+    if( (f >= 0) && !parsed && ((i + 1 == cl.numchunks) || 
+				(cl.chunks[i + 1].file != f)) ) {
+      if( checkflag(pinfo->flags, WC_FLAG_CHECK) ) {
+	check_rawscan(pinfo, &acc, files[f]);
+      }
+    }
+  }
+  if( (f >= 0) && !parsed ) {
+    rawscan_statistics(pinfo, &acc);
+    file_statistics(pinfo, files[f], xpaths ? xpaths[f] : NULL);
+  }
+
+#if WC_WITH_THREADS
+  if( threads ) {
+    while( t-- > 0 ) {
+      pthread_join(threads[t], NULL);
+    }
+    free(threads);
+  }
+  /* chunks which were scanned but never reduced */
+  for(; i < cl.numchunks; i++) {
+    if( cl.chunks[i].done ) {
+      free_rawscan(&cl.chunks[i].rs);
+    }
+  }
+#endif
+
+  free_chunklist(&cl);
+  free_rawscan(&acc);
+  free(buf);
+  free_filelist(&fl);
+  return ok;
+}
+
 bool_t create_parserinfo_wc(parserinfo_wc_t *pinfo) {
   bool_t ok = TRUE;
   if( pinfo ) {
@@ -171,6 +788,8 @@ bool_t create_parserinfo_wc(parserinfo_wc_t *pinfo) {
     pinfo->std.setup.start_file_fun = start_file_fun;
     pinfo->std.setup.end_file_fun = end_file_fun;
 
+    pinfo->jobs = 1;
+
     return ok;
   }
   return FALSE;
@@ -178,6 +797,12 @@ bool_t create_parserinfo_wc(parserinfo_wc_t *pinfo) {
 
 bool_t free_parserinfo_wc(parserinfo_wc_t *pinfo) {
   free_stdparserinfo(&pinfo->std);
+  if( pinfo->file.hist ) {
+    free_mem(&pinfo->file.hist, &pinfo->file.histlen);
+  }
+  if( pinfo->summary.hist ) {
+    free_mem(&pinfo->summary.hist, &pinfo->summary.histlen);
+  }
   return TRUE;
 }
 
@@ -188,6 +813,17 @@ int main(int argc, char **argv) {
   struct option longopts[] = {
     { "version", 0, NULL, WC_VERSION },
     { "help", 0, NULL, WC_HELP },
+    { "attributes", 0, NULL, WC_ATTRIBUTES },
+    { "texts", 0, NULL, WC_TEXTS },
+    { "comments", 0, NULL, WC_COMMENTS },
+    { "bytes", 0, NULL, WC_BYTES },
+    { "chars", 0, NULL, WC_CHARS },
+    { "histogram", 0, NULL, WC_HISTOGRAM },
+    { "fast", 0, NULL, WC_FAST },
+    { "check", 0, NULL, WC_CHECK },
+    { "jobs", 1, NULL, WC_JOBS },
+    { "stats", 2, NULL, STATS_OPTION },
+    { "progress", 2, NULL, PROGRESS_OPTION },
     { 0 }
   };
 
@@ -197,9 +833,22 @@ int main(int argc, char **argv) {
 
   if( create_parserinfo_wc(&pinfo) ) {
 
-    while( (op = getopt_long(argc, argv, "",
+    while( (op = getopt_long(argc, argv, "actmHj:",
 			     longopts, NULL)) > -1 ) {
-      set_option_wc(op, optarg);
+      set_option_wc(op, optarg, &pinfo);
+    }
+
+    if( !checkflag(pinfo.flags, WC_FLAG_FAST) && (pinfo.jobs > 1) ) {
+      errormsg(E_WARNING, "--jobs needs --fast, ignored\n");
+    }
+    /* --fast needs these too if it must parse a file in full */
+    if( checkflag(pinfo.flags, WC_FLAG_CHARDATA) ) {
+      setflag(&pinfo.std.setup.flags, STDPARSE_COALESCE_CHARDATA);
+      pinfo.std.setup.cb.chardata = chardata;
+      pinfo.std.setup.cb.end_tag = end_tag;
+    }
+    if( checkflag(pinfo.flags, WC_FLAG_COMMENTS) ) {
+      pinfo.std.setup.cb.comment = comment;
     }
 
     init_signal_handling(SIGNALS_DEFAULT);
@@ -207,7 +856,11 @@ int main(int argc, char **argv) {
 
     open_stdout();
 
-    stdparse(MAXFILES, argv + optind, (stdparserinfo_t *)&pinfo);
+    if( checkflag(pinfo.flags, WC_FLAG_FAST) ) {
+      fast_wc(&pinfo, MAXFILES, argv + optind);
+    } else {
+      stdparse(MAXFILES, argv + optind, (stdparserinfo_t *)&pinfo);
+    }
 
     summary_statistics(&pinfo);
 
@@ -218,5 +871,5 @@ int main(int argc, char **argv) {
 
     free_parserinfo_wc(&pinfo);
   }
-  return EXIT_SUCCESS;
+  return pinfo.broken ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -109,6 +109,7 @@ bool_t close_xpath(xpath_t *xp, iterator_xpath_fun *f, void *user);
 int cmp_no_attributes_xpath(const char_t *p1, const char_t *p2);
 int match_no_att_no_pred_xpath(const char_t *patbegin, const char_t *patend, 
 			       const char_t *xpath);
+const char_t *skip_attributes_predicates(const char_t *begin, const char_t *end);
 bool_t equal_no_attributes_xpath(const xpath_t *xp1, const xpath_t *xp2);
 bool_t equal_xpath(const xpath_t *xp1, const xpath_t *xp2);
 
@@ -118,6 +118,7 @@ bool_t compile_xpredicate(xpredicate_t *xp, const char_t *path) {
 bool_t create_xpredicatelist(xpredicatelist_t *xpl) {
   if( xpl ) {
     xpl->num = 0;
+    xpl->npreds = 0;
     return create_mem(&xpl->list, &xpl->max, sizeof(xpredicate_t), 4);
   }
   return FALSE;
@@ -140,6 +141,7 @@ bool_t reset_xpredicatelist(xpredicatelist_t *xpl) {
       free_xpredicate(&xpl->list[i]);
     }
     xpl->num = 0;
+    xpl->npreds = 0;
     return TRUE;
   }
   return FALSE;
@@ -153,6 +155,7 @@ bool_t add_xpredicatelist(xpredicatelist_t *xpl, const char_t *xpath) {
     if( xpl->num < xpl->max ) {
       if( create_xpredicate(&xpl->list[xpl->num]) &&
 	  compile_xpredicate(&xpl->list[xpl->num], xpath) ) {
+	xpl->npreds += xpl->list[xpl->num].num;
 	xpl->num++;
 	return TRUE;
       }
@@ -184,6 +187,9 @@ bool_t update_xpredicatelist(xpredicatelist_t *xpl, const char_t *xpath, const c
   int i, j, k;
   xpredicate_t *xp;
   if( xpl && xpath ) {
+    if( xpl->npreds == 0 ) {
+      return TRUE; /* nothing to count */
+    }
     for(i = 0; i < xpl->num; i++) {
       xp = &xpl->list[i];
       for(j = 0; j < xp->num; j++) {
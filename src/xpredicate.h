@@ -58,6 +58,7 @@ typedef struct {
   xpredicate_t *list;
   int num;
   size_t max;
+  int npreds; /* total number of predicates in all paths */
 } xpredicatelist_t;
 
 bool_t create_xpredicatelist(xpredicatelist_t *xpl);